@@ -17,10 +17,26 @@
 ******************************************************************************/
 
 #include "tinyxml2.h"
+#include "ImportQueue.h"
+#include "OFXConversion.h"
+#include "TextDocument.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
 #include <ctype.h>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <malloc.h>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <regex>
 #include <set>
 #include <shobjidl.h> 
@@ -28,6 +44,8 @@
 #include <stdlib.h>
 #include <string>
 #include <tchar.h>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <windows.h>
 #include <winhttp.h>
@@ -44,12 +62,38 @@
 #define ID_CONFIG_CHANGE_IMPORT_HANDLER_LOCATION 8
 #define ID_CONFIG_DEDUPE_MEMO 9
 #define ID_CONFIG_TRIM_LINES 10
+#define ID_ACTIONS_CONVERT_LARGE_FILE 11
+#define ID_CONFIG_MEMORY_CAP_16MB 12
+#define ID_CONFIG_MEMORY_CAP_64MB 13
+#define ID_CONFIG_MEMORY_CAP_256MB 14
+#define ID_ACTIONS_VALIDATE_OFX 15
+#define ID_CONFIG_NORMALIZE_AMOUNTS_DATES 16
+#define ID_CONFIG_SORT_AND_DEDUPE 17
+#define ID_ACTIONS_SHOW_REPORT 18
+#define ID_CONFIG_MEASURE_ALLOCATIONS 19
+#define ID_ACTIONS_SHOW_IMPORT_QUEUE 20
+#define ID_ACTIONS_SAVE_SPLIT_BY_ACCOUNT 21
+#define ID_ACTIONS_CONVERT_CSV_FILE 22
+#define ID_ACTIONS_CONVERT_QIF_FILE 23
+#define ID_ACTIONS_EXPORT_TRANSACTIONS 24
+#define ID_CONFIG_SAVE_INDEX 25
+#define ID_CONFIG_COMPARE_WITH_INPUT 26
+#define ID_ACTIONS_SAVE_DIFFERENCES 27
+#define ID_VIEW_NEXT_PAGE 28
+#define ID_VIEW_PREVIOUS_PAGE 29
+#define ID_VIEW_FIRST_PAGE 30
+#define ID_VIEW_LAST_PAGE 31
+#define ID_CONFIG_CLEAN_UP_PAYEES 32
 
 #define IDC_MAIN_EDIT 101
 #define IDC_OFX_EDIT 102
 #define IDC_BUTTON_OPEN 103
 #define IDC_BUTTON_CONVERT_AND_IMPORT 104
 
+// Posted by the import queue's worker when an import finishes.
+// wParam is the import's id.
+#define WM_IMPORT_FINISHED (WM_APP + 1)
+
 
 // Global variables
 std::wstring VERSION_ID = L"4";
@@ -67,652 +111,355 @@ L"GDPR Privacy Notice: This program does not collect any financial data. "
 "The only data it collects is related to usage: We want to identify how "
 "many people use this program. In order to do that, this program 'pings' a "
 "webserver upon starting. This program does not send any financial data!";
-// For the headers, spacing matters! I've observed some files not getting 
-// accepted because of spacing before and after an '='! Very strange, but
-// this is Windows so it shouldn't be surprising.
-const std::string XML_HEADER =
-"<?xml version=\"1.0\" encoding=\"utf-8\" ?>";
-const std::string XML_OFX_HEADER =
-"<?OFX OFXHEADER=\"200\" VERSION=\"202\" SECURITY=\"NONE\" "
-"OLDFILEUID=\"NONE\" NEWFILEUID=\"NONE\" ?>";
-// Allowed child elements under <STMTTRN> fields. Everything else gets deleted.
-// Remember that order matters for this whitelist array and for Money!!!
-const std::vector<std::string> STMTTRN_WHITELIST{ "TRNTYPE", "DTPOSTED", 
-    "DTUSER", "TRNAMT", "FITID", "CHECKNUM", "NAME", "CCACCTTO", "MEMO", };
-// Where to find the <BANKTRANLIST> for a Message Set Type 
-std::map<std::string, std::vector<std::string>> TYPE_TO_BANKTRANLIST_MAP = {
-    {"CREDITCARDMSGSRSV1",
-        {"OFX", "CREDITCARDMSGSRSV1", "CCSTMTTRNRS", "CCSTMTRS", "BANKTRANLIST"}},
-    {"BANKMSGSRSV1",
-        {"OFX", "BANKMSGSRSV1",       "STMTTRNRS",   "STMTRS",   "BANKTRANLIST"}},
-};
-bool dedupeMemoField = true;
-bool trimLines = true;
-
-// Attempt to fix the imbalanced input into well-formatted XML.
-std::string FixXML(const std::string& input) {
-    // A lot of banks really mangle their XML and this is the #1 problem
-    // with preparing a file for MS Money. By now, we've detected XML mis-match
-    // issues. Let's try to fix it by guessing where matching tags could go...
-    // * Most commonly, it occurs when an element does not have a closing tag
-    //   after a value. E.g. '<status><value>1</status>' is missing a 
-    //   '</value>'.
-    //
-    // MS Money doesn't require perfect XML to work, but getting it perfect 
-    // will help us. MS Money trips up on extra fields. Once we have valid XML,
-    // we can use standard XML APIs to remove problematic fields. Determining 
-    // which fields are problematic is an educated guess.
-
-    std::string fixedXML;  // Will contain our final result.
-    std::string tag;  // *Anything* in brackets: <.*> 
-    std::string value;  // Anything not inside brackets
-    bool processTag = false;
-    std::vector<std::string> tagStack;
-
-    // To determine where to add tags, we tokenize XML tags and values.
-    // Upon encountering a closing bracket ('>'), our fixing logic kicks in.
-    // We use a stack to determine if there is an imbalance, and if to fix.
-    for (const char& c : input) {
-        if (c == '>') {
-            tag += c;
-
-            if (tag.find("</") == 0) {
-                // Closing tag (e.g. </item>). Make sure we match with the top
-                // of the tag stack
-                if (tagStack.size() == 0) {
-                    // This XML is so bad we can't fix it.
-                    // Give up. The user will get a message
-                    // later when this XML fails to parse.
-                    fixedXML = "No XML tag to match closing tag with. "
-                        "Giving up. XML:\n" + fixedXML;
-                    return fixedXML;
-                }
-                std::string tagRawValue = tag.substr(2, tag.length() - 3);
-                std::string topOfStack = tagStack.back();
-                tagStack.pop_back();
-                std::string topOfStackRawValue = topOfStack.substr(
-                    1,
-                    topOfStack.length() - 2);
-                while (topOfStackRawValue != tagRawValue) {
-                    if (tagStack.size() == 0) {
-                        // This XML is so bad we can't fix it.
-                        // Give up. The user will get a message
-                        // later when this XML fails to parse.
-                        fixedXML = "Ran into issues trying to fix this XML:\n"
-                            + fixedXML;
-                        return fixedXML;
-                    }
-                    fixedXML += value + "</" + topOfStackRawValue + ">";
-                    value = "";
-                    topOfStack = tagStack.back();
-                    topOfStackRawValue = topOfStack.substr(1,
-                        topOfStack.length() - 2);
-                    tagStack.pop_back();
-                }
-                fixedXML += value + tag;
-                value = tag = "";
-            }
-            else if (tag.find("/>") == tag.length() - 2 || tag.find("<?")==0) {
-                // Self contained tag. Write it out directly. Nothing to 
-                // balance here.
-                fixedXML += value + tag;
-                value = tag = "";
-            }
-            else {
-                // This is an opening tag, e.g. <tag>
-                if (value.length() > 0) {
-                    // We have a value. This value is associated with the item 
-                    // at the top of the stack. Since we didn't encounter a 
-                    // closing element, this must be imbalanced, and we 
-                    // manually add the closing element after the value.
-                    if (tagStack.size() == 0) {
-                        // This XML is so bad we can't fix it.
-                        // Give up. The user will get a message
-                        // later when this XML fails to parse.
-                        fixedXML =
-                            "No XML tag to match value with. Giving up. XML:\n"
-                            + fixedXML;
-                        return fixedXML;
-                    }
-                    std::string topOfStack = tagStack.back();
-                    tagStack.pop_back();
-                    std::string prevTagRawValue = topOfStack.substr(1,
-                        topOfStack.length() - 2);
-                    fixedXML += value + "</" + prevTagRawValue + ">" + tag;
-                }
-                else {
-                    // No value already present, so we just write out the 
-                    // element.
-                    fixedXML += tag;
-                }
-                tagStack.push_back(tag);
-                value = tag = "";
-            }
+// The Config menu's settings. Only the UI thread touches these.
+ConversionOptions settings;
+// Statistics about the last conversion, for the curious
+std::string lastConversionReport;
+// Add allocation counts per conversion stage to the report
+bool measureAllocations = false;
+// Save a transaction index (see OFXIndex) next to large file conversions
+bool saveTransactionIndex = false;
+// Compare the output with the input after converting (see StructuralDiff)
+bool compareWithInput = false;
+// What changed in each transaction in the last conversion, if compared
+std::string lastConversionDifferences;
+// Where the text in the input window came from, for reports
+std::string inputName = "input window";
+// The memory cap of the bounded-memory mode (see BoundedConverter)
+size_t boundedMemoryCap = 64 * 1024 * 1024;
+
+// Every allocation is counted here for AllocationStats (see
+// OFXConversion.h). The tests don't replace these, so they measure nothing.
+// Nobody is measuring most of the time, so look at the global counter
+// before the thread_local.
+inline bool MeasuringAllocations() {
+    return AllocationStatsThreads().load(std::memory_order_relaxed) != 0 &&
+        ActiveAllocationStats() != NULL;
+}
 
-            // We've processed a tag. If we encounter a character later, it 
-            // belongs to a value and not an XML tag.
-            processTag = false;
-        }
-        else if (c == '<') {
-            // We are going to process an XML element
-            assert(tag.length() == 0);
-            tag += c;
-            processTag = true;
-            // If we have a value waiting, let's trim extra whitespace off
-            if (value.length() > 1) {
-                value.erase(value.find_last_not_of(" ") + 1);
-            }
-        }
-        else if (processTag) {
-            // Continue processing this character as an XML element
-            tag += c;
-        }
-        else {
-            // We are processing a value, not an XML element
-            if (value.length() == 0 && (isspace(c))) {
-                // Ignore leading (left-side) whitespace
-                continue;
-            }
-            if (c == '\r' || c == '\n') {
-                // Ignore new lines in values
-                continue;
-            }
-            value += c;
-        }
-    }
-
-    // If there is anything in the tagStack, close it out
-    for (int i = tagStack.size() - 1; i >= 0; --i) {
-        std::string topOfStack = tagStack.back();
-        tagStack.pop_back();
-        std::string tagRawValue = topOfStack.substr(1,
-            topOfStack.length() - 2);
-        fixedXML += "</" + tagRawValue + ">";
-    }
-    return fixedXML;
-}
-
-// Remove any extra STMTTRN child elements. Order elements correctly.
-void PruneSTMTTRN(tinyxml2::XMLElement* banktranlist) {
-    // We need to prune extra elements because they can cause MS Money to 
-    // reject the file. This increases our chances of success. They also
-    // need to be in the correct order.
-
-    // The <STMTTRN> is where all the magic and trouble happens.
-    // Extra elements under it will choke MS Money. Also, so will
-    // out-of-order elements!
-    // Let's remove any extra elements that don't match a whitelist AND
-    // put it in order.
-    /*
-        Here's an example of a sanitized STMTTRN:
-        <STMTTRN>
-          <TRNTYPE>CHECK</TRNTYPE>
-          <DTPOSTED>20190101120000.000[0:GMT]</DTPOSTED>
-          <TRNAMT>-1.00</TRNAMT>
-          <FITID>0123456789ABCDEF</FITID>
-          <CHECKNUM>100</CHECKNUM>
-          <NAME>CHECK# 100 CHECK WITHDRAWAL</NAME>
-          <MEMO>CHECK# 100 CHECK WITHDRAWAL</MEMO>
-        </STMTTRN>
-    */
-    // * I've observed STMTRN elements as children under the following:
-    //   * <OFX><CREDITCARDMSGSRSV1><CCSTMTTRNRS><CCSTMTRS><BANKTRANLIST>
-    //   * <OFX><BANKMSGSRSV1><STMTTRNRS><STMTRS><BANKTRANLIST>
-    //   * Are there others that I should care about?
-    tinyxml2::XMLElement* stmttrn = banktranlist->FirstChildElement("STMTTRN");
-    while (stmttrn) {  // For every STMTTRN element
-        tinyxml2::XMLElement* current_stmttrn = stmttrn;
-        // Get pointer to next element first, since doing it at the end
-        // (after all our modifications) means NextSiblingElement is NULL.
-        stmttrn = stmttrn->NextSiblingElement("STMTTRN");
-        tinyxml2::XMLElement* ordered_stmttrn = 
-            banktranlist->GetDocument()->NewElement("STMTTRN");
-
-        // Cleanup: De-dupe (aka Delete) MEMO field if it is identical to NAME
-        if (dedupeMemoField) {
-            // If <NAME> == <MEMO>, then delete MEMO field.
-            // Personally, I hate when this gets duplicated. Waste of space!
-            tinyxml2::XMLElement* name = 
-                current_stmttrn->FirstChildElement("NAME");
-            tinyxml2::XMLElement* memo = 
-                current_stmttrn->FirstChildElement("MEMO");
-            if (name && memo && name->GetText() && memo->GetText() &&
-                (strcmp(name->GetText(), memo->GetText()) == 0)) {
-                current_stmttrn->DeleteChild(memo);
-            }
+void* operator new(size_t size) {
+    void* memory;
+    while ((memory = malloc(size > 0 ? size : 1)) == NULL) {
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
         }
+        handler();
+    }
+    if (MeasuringAllocations()) {
+        ActiveAllocationStats()->Allocated(ActiveAllocationStage(),
+            _msize(memory));
+    }
+    return memory;
+}
 
-        for (unsigned int i = 0; i < STMTTRN_WHITELIST.size(); ++i) {
-            // Go through the whitelist, which is in correct order, and build
-            // a new STMTTRN element in that order
-            tinyxml2::XMLElement* child =
-                current_stmttrn->FirstChildElement(
-                    STMTTRN_WHITELIST[i].c_str());
+void* operator new[](size_t size) {
+    return operator new(size);
+}
 
-            // If Child is an empty value, skip it
-            if (child && child->GetText() == NULL) {
-                continue;
-            }
+void operator delete(void* memory) noexcept {
+    if (memory && MeasuringAllocations()) {
+        ActiveAllocationStats()->Freed(ActiveAllocationStage(),
+            _msize(memory));
+    }
+    free(memory);
+}
 
-            // Special Case 1: If no <NAME>, check if <PAYEE> and use that. 
-            // But, delete <PAYEE> if both elements are present.
-            if (STMTTRN_WHITELIST[i] == "NAME") {
-                tinyxml2::XMLElement* payee = 
-                    current_stmttrn->FirstChildElement("PAYEE");
-                if (!child) {
-                    // No <NAME>, so use PAYEE if it is present
-                    if (payee) {
-                        ordered_stmttrn->InsertEndChild(payee);
-                    }
-                    else {
-                        // Didn't find NAME or PAYEE. No problem, not required!
-                    }
-                }
-                else {
-                    // Since <NAME> exists, make sure PAYEE does not.
-                    if (payee) {
-                        banktranlist->GetDocument()->DeleteNode(payee);
-                    }
-                    ordered_stmttrn->InsertEndChild(child);
-                }
-                continue;
-            }
-            // Special Case 2: If no <CCACCTTO>, check <BANKACCTTO>.
-            // But, delete <BANKACCTTO> if both present.
-            if (STMTTRN_WHITELIST[i] == "CCACCTTO") {
-                tinyxml2::XMLElement* bankacctto =
-                    current_stmttrn->FirstChildElement("BANKACCTTO");
-                if (!child) {
-                    // No <CCACCTTO>, so use BANKACCTTO if present
-                    if (bankacctto) {
-                        ordered_stmttrn->InsertEndChild(bankacctto);
-                    }
-                    else {
-                        // Did not find CCACCT or BANKACCTTO.
-                        // No problem, it's not required anyways
-                    }
-                }
-                else {
-                    // Since <CCACCTTO> exists, make sure BANKACCTTO does not.
-                    // Presence of both will cause issues.
-                    if (bankacctto) {
-                        banktranlist->GetDocument()->DeleteNode(bankacctto);
-                    }
-                    ordered_stmttrn->InsertEndChild(child);
-                }
-                continue;
-            }
+void operator delete[](void* memory) noexcept {
+    operator delete(memory);
+}
 
-            if (child) {
-                ordered_stmttrn->InsertEndChild(child);
-            }
-        }
+// The compiler calls these when it knows the size. _msize() is what the
+// counts use either way, so the size isn't needed.
+void operator delete(void* memory, size_t) noexcept {
+    operator delete(memory);
+}
 
-        // I want to preserve the order of the STMTTRN element, so leave it in
-        // place and replace the children with the in-order children. 
-        // Otherwise, I could have just inserted ordered_stmttrn.
-        current_stmttrn->DeleteChildren();
-        tinyxml2::XMLNode* child = ordered_stmttrn->FirstChild();
-        while (child) {
-            current_stmttrn->InsertEndChild(child);
-            child = ordered_stmttrn->FirstChild();
-        }
-        banktranlist->GetDocument()->DeleteNode(ordered_stmttrn);
-    }
-}
-
-// Is the XML balanced correctly with proper opening and closing tags?
-bool isXMLBalanced(const std::string& xml) {
-    // TinyXML2 does not always appear to be correct when determining if
-    // the XML is valid and balanced. Thus, this is used to make that 
-    // determination. 
-    // We use a stack to determine if the XML is balanced. It's very
-    // similar to the previous FixXML() method.
-    // Since our XML input files don't have attribute values, the code is a 
-    // little simpler. If the XML ever gets attributes, then 
-    // expect this code to break.
-    bool isBalanced = true;
-    std::string tag;  // *Anything* in brackets: <.*> 
-    std::string value;  // Anything not inside brackets
-    bool processTag = false;
-    std::vector<std::string> tagStack;
-
-    for (const char& c : xml) {
-        if (c == '>') {
-            tag += c;
-            if (tag.find("</") == 0) {
-                // Closing tag (e.g. </item>)
-                if (tagStack.size() == 0) {
-                    // No opening tag to match this closing tag. Unbalanced.
-                    return false;
-                }
-                std::string tagRawValue = tag.substr(2, tag.length() - 3);
-                std::string topOfStack = tagStack.back();
-                tagStack.pop_back();
-                std::string topOfStackRawValue = topOfStack.substr(
-                    1,
-                    topOfStack.length() - 2);
-                if (topOfStackRawValue != tagRawValue) {
-                    // The top of the stack does not match this closing tag. 
-                    // Therefore, XML is unbalanced.
-                    return false;
-                }
-                value = tag = "";  // tags match. close out tag and value vars.
-            }
-            else if (tag.find("/>") == tag.length() - 2 || tag.find("<?")==0) {
-                // Self contained tag. Nothing to balance here.
-                value = tag = "";
-                processTag = false;
-                continue;
-            }
-            else {
-                // This is the end of an opening tag, e.g. <tag>
-                if (value.length() > 0) {
-                    // We have a previous value that wasn't closed out with a 
-                    // closing tag. Therefore, the xml is unbalanced.
-                    return false;
-                }
-                tagStack.push_back(tag);
-                value = tag = "";
-            }
+void operator delete[](void* memory, size_t) noexcept {
+    operator delete(memory);
+}
 
-            // We've processed a tag. If we encounter a character later, it 
-            // belongs to a value and not an XML tag.
-            processTag = false;
-        }
-        else if (c == '<') {
-            // We are going to process an XML element
-            assert(tag.length() == 0);
-            tag += c;
-            processTag = true;
-        }
-        else if (processTag) {
-            // Continue processing this character as an XML element
-            tag += c;
-        }
-        else {
-            if (value.length() == 0 && (isspace(c))) {
-                // Ignore leading (left-side) whitespace
-                continue;
-            }
-            if (c == '\r' || c == '\n') {
-                // Ignore new lines in values
-                continue;
-            }
-            value += c;
-        }
-    }
+// Allocations of every measured conversion since the program started
+AllocationStats sessionAllocations;
+
+// A page is this many lines, or less if they are long...
+const size_t PAGE_LINES = 5000;
+// ...because it's at most this many bytes. Even as wide characters that's
+// well under the EDIT controls' limit (see WM_CREATE), so there's room to
+// type.
+const size_t PAGE_BYTES = 512 * 1024;
+
+// One of the two text panes. Its EDIT control only ever has one page of
+// the document in it, so a 50 MB file opens as quickly as a small one. Hand
+// edits to the page are put back into the document (SyncPage()) before the
+// document is read or another page is shown.
+struct EditorPane {
+    explicit EditorPane(int controlId, const wchar_t* name)
+        : controlId(controlId), name(name) {}
+
+    int controlId;
+    const wchar_t* name;  // For the title bar
+    TextDocument document;
+    bool utf8 = true;  // Shown as UTF-8, or else as ANSI
+    // The part of the document that's in the control
+    size_t pageStart = 0;
+    size_t pageLength = 0;
+};
+EditorPane inputPane(IDC_MAIN_EDIT, L"Input");
+EditorPane outputPane(IDC_OFX_EDIT, L"OFX");
 
-    if (tagStack.size() > 0) {
-        return false;
-    }
-    return true;
+bool IsUTF8(const std::string& text) {
+    return text.empty() || MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS,
+        text.data(), static_cast<int>(text.length()), NULL, 0) != 0;
 }
 
-void SetOfxWindowDebugText(HWND hWnd, const std::string& xml) {
-    HWND hOfxEdit = GetDlgItem(hWnd, IDC_OFX_EDIT);
-    std::string text =
-        "This text is invalid and only for debugging purposes!"
-        "\r\n\r\n" + xml;
-    SetWindowTextA(hOfxEdit, text.c_str());
+bool IsUTF8Continuation(char c) {
+    return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
 }
 
-// Convert whatever is in the Input window (should be QFX XML) to 
-// a MS Money-acceptable OFX format.
-bool ConvertInputToOFX(HWND hWnd) {
-    // Polish the input text before converting into OFX-happy XML.
-    std::string polishedText;
-
-    // First, get the input from the main window and shove into a ANSI string
-    HWND hEdit = GetDlgItem(hWnd, IDC_MAIN_EDIT);
-    std::string inputText;
-    int len = GetWindowTextLength(hEdit) + 1;
-    std::vector<wchar_t> buf(len);
-    GetWindowText(hEdit, &buf[0], len);
-    std::wstring wide = &buf[0];
-    std::string s(wide.begin(), wide.end());
-
-    // Remove anything before <OFX> - it's junk to Money or headers that can
-    // be replaced. Some banks, i.e. Wells Fargo, jam everything into one line.
-    // std::regex's search and match have memory issues with long lines, so
-    // that's why this logic is very simple - to avoid using that library.
-    std::istringstream ss(s);
-    std::string line;
-    // First, look for the start of <OFX>
-    while (std::getline(ss, line)) {
-        std::size_t start = line.find("<OFX>");
-        if (start != std::string::npos) {
-            polishedText += line.substr(start, std::string::npos);
-            break;
+// Where the page starting at start ends
+size_t PageEnd(const TextDocument& document, size_t start) {
+    size_t end = document.OffsetOfLine(
+        document.LineOfOffset(start) + PAGE_LINES);
+    if (end - start > PAGE_BYTES) {
+        // Long lines. Cut between characters, and not inside a "\r\n".
+        end = start + PAGE_BYTES;
+        while (end > start + 1 && (IsUTF8Continuation(document.At(end)) ||
+            (document.At(end) == '\n' && document.At(end - 1) == '\r'))) {
+            --end;
         }
     }
-    // Now append the rest
-    while (std::getline(ss, line)) {
-        if (trimLines) {
-            // Some banks include a ton of space and new lines.
-            // Let's trim the excess space on both sides of the line.
-            // Left-trim the spaces of the line.
-            int i = 0;
-            while (std::isspace(line[i])) {
-                ++i;
-            }
-            line = line.substr(i);
-
-            // Right-trim the line.
-            int charsToRTrim = 0;
-            for (int i = line.length() - 1; i > 0; --i) {
-                if (std::isspace(line[i])) {
-                    ++charsToRTrim;
-                }
-                else {
-                    break;
-                }
-            }
-            if (charsToRTrim > 0) {
-                line = line.substr(0, line.length() - charsToRTrim);
-            }
-        }
+    return end;
+}
 
-        // If the line ends with ">", don't add a new line.
-        if (line.length() > 1 && line[line.length() - 1] == '>') {
-            polishedText += line;
-        }
-        else {
-            //New-line just helps me debug later. XML Parser does all
-            //the nice formatting.
-            polishedText += line + "\n";
+// Where the page that ends at end starts
+size_t PreviousPageStart(const TextDocument& document, size_t end) {
+    size_t line = document.LineOfOffset(end);
+    if (document.OffsetOfLine(line) < end) {
+        ++line;  // The page ends inside a line, which counts too
+    }
+    size_t start = document.OffsetOfLine(
+        line > PAGE_LINES ? line - PAGE_LINES : 0);
+    if (end - start > PAGE_BYTES) {
+        start = end - PAGE_BYTES;
+        while (start < end - 1 && (IsUTF8Continuation(document.At(start)) ||
+            (document.At(start) == '\n' && document.At(start - 1) == '\r'))) {
+            ++start;
         }
     }
+    return start;
+}
 
-    // Add OFX XML-style headers. Version may be wrong, but Money doesn't care.
-    polishedText = XML_HEADER + "\n" + XML_OFX_HEADER + "\n" + polishedText;
-
-    // Convert text to an XML object
-    tinyxml2::XMLDocument doc;
-    const char* inxml = polishedText.c_str();
-    doc.Parse(inxml);
-
-    // Check if the elements are balanced. TinyXML is not always 100% correct
-    // (sometimes give success / code 0 for broken XML. So we also check again.
-    if (doc.ErrorID() == 14 ||
-        (doc.ErrorID() == 0 && !isXMLBalanced(polishedText))) {
-        // Mis-matched brackets. Let's attempt to fix it, 
-        // but inform the user first.
-        std::string msg;
-        if (doc.ErrorID() == 14) {
-            msg = "Input XML does not have matching brackets according to the "
-                "XML Parser. Will attempt to fix it!\n\n"
-                "XML Parser Error Message: ";
-            msg += doc.ErrorStr();
-        }
-        else {
-            msg = "Input XML appears to be unbalanced. Will try to fix it!";
-        }
-        MessageBoxA(NULL,
-            msg.c_str(),
-            "FYI: XML is unbalanced",
-            MB_OK | MB_ICONWARNING);
-        std::string fixedXML = FixXML(polishedText);
-        inxml = fixedXML.c_str();
-        doc.Parse(inxml);
-        if (doc.ErrorID() != 0) {
-            std::string msg = "Could not fix the XML. This XML either needs "
-                "to be fixed at the source, or this program needs extra "
-                "modifications to handle the XML.\n\nParser error message: ";
-            msg += std::to_string(doc.ErrorID()) + ":\n";
-            msg += doc.ErrorStr();
-            MessageBoxA(NULL,
-                msg.c_str(),
-                "Error Parsing XML Again",
-                MB_OK | MB_ICONSTOP);
-            SetOfxWindowDebugText(hWnd, inxml);
-            return false;
+// Say which lines are showing in the title bar, when there's more than one
+// page
+void UpdatePageTitle(HWND hWnd) {
+    std::wstring title = szTitle;
+    for (const EditorPane* pane : { &inputPane, &outputPane }) {
+        const TextDocument& document = pane->document;
+        if (pane->pageStart == 0 && pane->pageLength == document.Length()) {
+            continue;
         }
+        size_t first = document.LineOfOffset(pane->pageStart) + 1;
+        size_t last = document.LineOfOffset(
+            pane->pageStart + std::max<size_t>(pane->pageLength, 1) - 1) + 1;
+        title += std::wstring(L" - ") + pane->name + L" lines " +
+            std::to_wstring(first) + L"-" + std::to_wstring(last) + L" of " +
+            std::to_wstring(document.LineCount());
     }
-    else if (doc.ErrorID() != 0) {
-        std::string msg =
-            "Parser Error when processing XML. Cannot continue: ";
-        msg += std::to_string(doc.ErrorID()) + ":\n";
-        msg += doc.ErrorStr();
-        MessageBoxA(NULL,
-            msg.c_str(),
-            "Error Parsing XML",
-            MB_OK | MB_ICONERROR);
-        SetOfxWindowDebugText(hWnd, inxml);
-        return false;
+    SetWindowText(hWnd, title.c_str());
+}
+
+// Put the page of pane's document starting at start into its control
+void ShowPage(HWND hWnd, EditorPane& pane, size_t start) {
+    size_t end = PageEnd(pane.document, start);
+    std::string page;
+    pane.document.Read(start, end - start, page);
+    pane.pageStart = start;
+    pane.pageLength = end - start;
+
+    std::wstring wide;
+    UINT codePage = pane.utf8 ? CP_UTF8 : CP_ACP;
+    int count = MultiByteToWideChar(codePage, 0, page.data(),
+        static_cast<int>(page.length()), NULL, 0);
+    if (count > 0) {
+        wide.resize(count);
+        MultiByteToWideChar(codePage, 0, page.data(),
+            static_cast<int>(page.length()), &wide[0], count);
     }
+    HWND hEdit = GetDlgItem(hWnd, pane.controlId);
+    SetWindowText(hEdit, wide.c_str());
+    SendMessage(hEdit, EM_SETMODIFY, FALSE, 0);
+    UpdatePageTitle(hWnd);
+}
 
-    // Determine if this is a CreditCard statement or a Bank statement.
-    tinyxml2::XMLElement* ofxRoot = doc.FirstChildElement("OFX");
-    if (!ofxRoot) {
-        MessageBoxA(NULL,
-            "OFX is missing <OFX> element at the root. Cannot parse.",
-            "Error Parsing XML",
-            MB_OK);
-        SetOfxWindowDebugText(hWnd, inxml);
-        return false;
+// Start pane over with text and show its first page
+void LoadPane(HWND hWnd, EditorPane& pane, std::string text) {
+    pane.utf8 = IsUTF8(text);
+    pane.document.Load(std::move(text));
+    ShowPage(hWnd, pane, 0);
+}
+
+// If the page in pane's control was edited, put it back into the document
+void SyncPage(HWND hWnd, EditorPane& pane) {
+    HWND hEdit = GetDlgItem(hWnd, pane.controlId);
+    if (!SendMessage(hEdit, EM_GETMODIFY, 0, 0)) {
+        return;
     }
-    tinyxml2::XMLHandle docHandle(&doc);
-
-    // Determine what "types" this statement contains. Some include both
-    // Credit Card and Bank statements, or have both with 1 empty. It's crazy.
-    // Currently, only CreditCard and Bank statements are supported,
-    // since they are the only 2 types which I see have a BANKTRANLIST child.
-    // There are other types, but I couldn't see if they have BANKTRANLIST
-    // children. For a list of other types, see: 
-    // https://schemas.liquid-technologies.com/OFX/2.1.1/?page=ofxresponse.html
-    std::vector<std::string> statementTypes = { };
-    if (docHandle.FirstChildElement("OFX").
-        FirstChildElement("CREDITCARDMSGSRSV1").ToElement()) {
-        // We have a Credit Card Statement
-        statementTypes.push_back("CREDITCARDMSGSRSV1");
-    }
-    if (docHandle.FirstChildElement("OFX").
-        FirstChildElement("BANKMSGSRSV1").ToElement()) {
-        // We have a Bank Statement
-        statementTypes.push_back("BANKMSGSRSV1");
-    }
-    if (docHandle.FirstChildElement("OFX").
-        FirstChildElement("INVSTMTMSGSRSV1").ToElement()) {
-        // We have a Bank Statement
-        statementTypes.push_back("INVSTMTMSGSRSV1");
-    }
-
-    if (statementTypes.size() == 0) {
-        // Error: Found zero statements
-        MessageBoxA(NULL,
-            "OFX is missing valid elements under the <OFX> root (like "
-            "<CREDITCARDMSGSRSV1> or <BANKMSGSRSV1>). Cannot parse.",
-            "Error Parsing XML",
-            MB_OK);
-        SetOfxWindowDebugText(hWnd, inxml);
-        return false;
+    int len = GetWindowTextLength(hEdit) + 1;
+    std::vector<wchar_t> buf(len);
+    GetWindowText(hEdit, &buf[0], len);
+    std::string page;
+    UINT codePage = pane.utf8 ? CP_UTF8 : CP_ACP;
+    int count = WideCharToMultiByte(codePage, 0, &buf[0], len - 1, NULL, 0,
+        NULL, NULL);
+    if (count > 0) {
+        page.resize(count);
+        WideCharToMultiByte(codePage, 0, &buf[0], len - 1, &page[0], count,
+            NULL, NULL);
     }
+    pane.document.Replace(pane.pageStart, pane.pageLength, page);
+    pane.pageLength = page.length();
+    SendMessage(hEdit, EM_SETMODIFY, FALSE, 0);
+}
 
-    // Using the Statement Type as a key name, we lookup its expected 
-    // <BANKTRANLIST> path from a map data structure.
-    for (std::string& type : statementTypes) {
-        if (type == "INVSTMTMSGSRSV1") {
-            // Nothing to do yet for this type. Just pretty print the XML
-            // and add headers.
-            continue;
-        }
-        std::vector<std::string> pathToBanktranlist =
-            TYPE_TO_BANKTRANLIST_MAP[type];
-        if (pathToBanktranlist.size() == 0) {
-            MessageBoxA(NULL,
-                "Cannot find TYPE_TO_BANKTRANLIST_MAP mapping; Code error! "
-                "Stopping!",
-                "Fatal Error",
-                MB_OK | MB_ICONSTOP);
-            SetOfxWindowDebugText(hWnd, inxml);
-            continue;
+// Show another page of the pane that has the keyboard focus (the input pane
+// if neither has it)
+void TurnPage(HWND hWnd, int command) {
+    EditorPane& pane = GetFocus() == GetDlgItem(hWnd, IDC_OFX_EDIT) ?
+        outputPane : inputPane;
+    SyncPage(hWnd, pane);
+    const TextDocument& document = pane.document;
+    size_t start = pane.pageStart;
+    switch (command) {
+    case ID_VIEW_NEXT_PAGE:
+        if (pane.pageStart + pane.pageLength < document.Length()) {
+            start = pane.pageStart + pane.pageLength;
         }
+        break;
+    case ID_VIEW_PREVIOUS_PAGE:
+        start = PreviousPageStart(document, pane.pageStart);
+        break;
+    case ID_VIEW_FIRST_PAGE:
+        start = 0;
+        break;
+    case ID_VIEW_LAST_PAGE:
+        start = PreviousPageStart(document, document.Length());
+        break;
+    }
+    if (start != pane.pageStart) {
+        ShowPage(hWnd, pane, start);
+    }
+}
 
-        // Now that we have an expected <BANKTRANLIST> path, see if the item
-        // exists at that path.
-        tinyxml2::XMLHandle banktranlistHandle(&doc);
-        bool hasError = false;
-        for (size_t i = 0; i < pathToBanktranlist.size(); ++i) {
-            banktranlistHandle = banktranlistHandle.FirstChildElement(
-                pathToBanktranlist[i].c_str());
-            if (!banktranlistHandle.ToElement()) {
-                // Possible Problem: Could not find element in expected path...
-                // Let user know right now and stop processing for this type.
-                hasError = true;
-                std::string fullPath;
-                for (size_t j = 0; j < pathToBanktranlist.size(); ++j) {
-                    fullPath += "<" + pathToBanktranlist[j] + ">";
-                }
-                std::string errorMsg = "Not modifiying " + type + " because "
-                    "we encountered problems locating this element: " +
-                    pathToBanktranlist[i] + " in the path " + fullPath +
-                    ". We were expecting it to be present. This might be a "
-                    "problem (or not, if it was purposely left out): inspect "
-                    "the output to make sure you are okay with results.";
-                MessageBoxA(NULL,
-                    errorMsg.c_str(),
-                    "FYI: Possible Error",
-                    MB_OK | MB_ICONINFORMATION);
-                break;
-            }
-        }
+void SetOfxWindowDebugText(HWND hWnd, const std::string& xml) {
+    std::string text =
+        "This text is invalid and only for debugging purposes!"
+        "\r\n\r\n" + xml;
+    LoadPane(hWnd, outputPane, std::move(text));
+}
 
-        // We got the <BANKTRANLIST> element. Now, prune unnecessary elements.
-        if (!hasError) {
-            tinyxml2::XMLElement* banktranlist =
-                banktranlistHandle.ToElement();
-            PruneSTMTTRN(banktranlist);
+// Convert whatever is in the Input window (should be QFX XML) to 
+// a MS Money-acceptable OFX format.
+bool ConvertInputToOFX(HWND hWnd) {
+    // Convert the input pane's document, with any hand edits. Unless it
+    // was edited, that's the file as it was read, without a copy.
+    SyncPage(hWnd, inputPane);
+    const std::string& s = inputPane.document.Contents();
+
+    static ConversionBuffers buffers;  // Only the UI thread converts here
+    ConversionContext context(settings);
+    AllocationStats allocations;
+    if (measureAllocations) {
+        context.allocations = &allocations;
+    }
+    std::ostringstream differences;
+    if (compareWithInput) {
+        context.differences = &differences;
+    }
+    std::string output;
+    bool success = ConvertQFXToOFX(s, context, buffers, output);
+    if (success) {
+        LoadPane(hWnd, outputPane, std::move(output));
+        lastConversionReport = context.diagnostics.report;
+        lastConversionDifferences = differences.str();
+        if (measureAllocations) {
+            sessionAllocations.Add(allocations);
+            lastConversionReport += "\r\nAllocations per stage (JSON):\r\n" +
+                allocations.ToJSON(inputName) + "\r\n\r\nAll measured "
+                "conversions so far:\r\n" +
+                sessionAllocations.ToJSON("all") + "\r\n";
         }
     }
-
-    // Pretty Print XML
-    tinyxml2::XMLPrinter printer;
-    doc.Print(&printer);
-    const char* prettyXml = printer.CStr();
-
-    // We want the editor to display text nicely. In Windows land,
-    // we need to add carriage returns before the newlines...
-    std::string normalizedString;
-    const char* p = &prettyXml[0];
-    while (*p != '\0') {
-        if (*p == '\n') {
-            normalizedString += "\r\n";
+    else {
+        SetOfxWindowDebugText(hWnd, output);
+    }
+    for (const ConversionMessage& message : context.diagnostics.messages) {
+        UINT icon = MB_ICONINFORMATION;
+        if (message.severity == ConversionMessage::MESSAGE_WARNING) {
+            icon = MB_ICONWARNING;
         }
-        else {
-            normalizedString += *p;
+        else if (message.severity == ConversionMessage::MESSAGE_ERROR) {
+            icon = MB_ICONERROR;
         }
-        ++p;
+        MessageBoxA(NULL,
+            message.text.c_str(),
+            message.title.c_str(),
+            MB_OK | icon);
     }
-    HWND hOfxEdit = GetDlgItem(hWnd, IDC_OFX_EDIT);
+    return success;
+}
 
-    if (s == normalizedString) {
-        MessageBoxA(NULL,
-            "FYI: Nothing changed after attempting to convert!",
+// Check whatever is in the OFX window (possibly hand-edited) for problems
+// that will make Money reject it.
+void ValidateOFXWindow(HWND hWnd) {
+    SyncPage(hWnd, outputPane);
+    MoneyValidator validator;
+    outputPane.document.ForEachPiece([&validator](const char* data,
+        size_t length) {
+        validator.Feed(data, length);
+    });
+    validator.Finish();
+    if (validator.DiagnosticCount() == 0) {
+        MessageBoxA(hWnd,
+            "No problems found.",
             "FYI",
             MB_OK | MB_ICONINFORMATION);
+        return;
+    }
+    std::string msg = std::to_string(validator.DiagnosticCount()) +
+        " possible problems found:\n\n" +
+        FormatValidationDiagnostics(validator.Diagnostics(),
+            validator.DiagnosticCount(), 25);
+    MessageBoxA(hWnd,
+        msg.c_str(),
+        "FYI: Possible Problems For Money",
+        MB_OK | MB_ICONWARNING);
+}
+
+// The payee rules file goes next to the program. Without one, the
+// conversion uses DEFAULT_PAYEE_RULES.
+const wchar_t PAYEE_RULES_FILE_NAME[] = L"ConvertToOFX-payees.txt";
+
+// Turn payee cleanup on. The rules are compiled again each time, so edits to
+// the file are picked up. If the file has a mistake in it, tell the user and
+// leave cleanup off.
+bool LoadPayeeRules(HWND hWnd) {
+    wchar_t exePath[MAX_PATH];
+    DWORD length = GetModuleFileName(NULL, exePath, MAX_PATH);
+    std::wstring path(exePath, length);
+    path = path.substr(0, path.find_last_of(L"\\/") + 1) +
+        PAYEE_RULES_FILE_NAME;
+    std::ifstream file(path.c_str());
+    std::istringstream defaults(DEFAULT_PAYEE_RULES);
+    std::shared_ptr<PayeeRules> rules = std::make_shared<PayeeRules>();
+    std::string error;
+    if (!rules->Compile(file ? static_cast<std::istream&>(file) : defaults,
+        error)) {
+        MessageBoxA(hWnd, error.c_str(), "Error Reading Payee Rules",
+            MB_OK | MB_ICONERROR);
+        return false;
     }
-    SetWindowTextA(hOfxEdit, normalizedString.c_str());
+    settings.payeeRules = rules;
     return true;
 }
 
@@ -722,6 +469,7 @@ void CreateMainMenu(HWND hWnd) {
     HMENU hFileSubMenu = CreatePopupMenu();
     HMENU hActionsSubMenu = CreatePopupMenu();
     HMENU hConfigSubMenu = CreatePopupMenu();
+    HMENU hViewSubMenu = CreatePopupMenu();
     HMENU hHelpSubMenu = CreatePopupMenu();
     
     AppendMenu(hMenu, MF_STRING | MF_POPUP,
@@ -730,6 +478,8 @@ void CreateMainMenu(HWND hWnd) {
         (UINT)hActionsSubMenu, _T("OFX &Actions"));
     AppendMenu(hMenu, MF_STRING | MF_POPUP,
         (UINT)hConfigSubMenu, _T("Confi&g"));
+    AppendMenu(hMenu, MF_STRING | MF_POPUP,
+        (UINT)hViewSubMenu, _T("&View"));
     AppendMenu(hMenu, MF_STRING | MF_POPUP,
         (UINT)hHelpSubMenu, _T("&Help"));
 
@@ -742,8 +492,26 @@ void CreateMainMenu(HWND hWnd) {
         _T("&Convert To OFX\tALT+C"));
     AppendMenu(hActionsSubMenu, MF_STRING, ID_ACTIONS_SAVE_OFX,
         _T("&Save OFX As...\tALT+S"));
+    AppendMenu(hActionsSubMenu, MF_STRING, ID_ACTIONS_SAVE_SPLIT_BY_ACCOUNT,
+        _T("Save OFX As One File Per &Account..."));
     AppendMenu(hActionsSubMenu, MF_STRING, ID_ACTIONS_SEND_TO_MONEY,
         _T("Send OFX To Money &Import Handler\tALT+I"));
+    AppendMenu(hActionsSubMenu, MF_STRING, ID_ACTIONS_VALIDATE_OFX,
+        _T("Chec&k OFX For Money Compatibility"));
+    AppendMenu(hActionsSubMenu, MF_STRING, ID_ACTIONS_SHOW_REPORT,
+        _T("Show Last Conversion &Report"));
+    AppendMenu(hActionsSubMenu, MF_STRING, ID_ACTIONS_SAVE_DIFFERENCES,
+        _T("Save Last Conversion's &Differences..."));
+    AppendMenu(hActionsSubMenu, MF_STRING, ID_ACTIONS_SHOW_IMPORT_QUEUE,
+        _T("Show Import &Queue"));
+    AppendMenu(hActionsSubMenu, MF_STRING, ID_ACTIONS_CONVERT_LARGE_FILE,
+        _T("Convert &Large File With Bounded Memory..."));
+    AppendMenu(hActionsSubMenu, MF_STRING, ID_ACTIONS_CONVERT_CSV_FILE,
+        _T("Convert CSV &File To OFX..."));
+    AppendMenu(hActionsSubMenu, MF_STRING, ID_ACTIONS_CONVERT_QIF_FILE,
+        _T("Convert Q&IF File To OFX..."));
+    AppendMenu(hActionsSubMenu, MF_STRING, ID_ACTIONS_EXPORT_TRANSACTIONS,
+        _T("&Export Transactions As CSV Or JSON..."));
 
     AppendMenu(hConfigSubMenu,
         MF_STRING,
@@ -757,6 +525,53 @@ void CreateMainMenu(HWND hWnd) {
         MF_STRING,
         ID_CONFIG_TRIM_LINES,
         _T("&Trim the left and right sides of each line"));
+    AppendMenu(hConfigSubMenu,
+        MF_STRING,
+        ID_CONFIG_NORMALIZE_AMOUNTS_DATES,
+        _T("&Rewrite amounts and dates in Money's preferred format"));
+    AppendMenu(hConfigSubMenu,
+        MF_STRING,
+        ID_CONFIG_SORT_AND_DEDUPE,
+        _T("&Sort transactions by date and remove duplicate FITIDs"));
+    AppendMenu(hConfigSubMenu,
+        MF_STRING,
+        ID_CONFIG_CLEAN_UP_PAYEES,
+        _T("Clean &up payee names and memos (see README)"));
+    AppendMenu(hConfigSubMenu,
+        MF_STRING,
+        ID_CONFIG_MEASURE_ALLOCATIONS,
+        _T("&Measure memory use per conversion stage (see report)"));
+    AppendMenu(hConfigSubMenu,
+        MF_STRING,
+        ID_CONFIG_SAVE_INDEX,
+        _T("Save a transaction &index with large files (FILE.ofx.idx)"));
+    AppendMenu(hConfigSubMenu,
+        MF_STRING,
+        ID_CONFIG_COMPARE_WITH_INPUT,
+        _T("Com&pare the output with the input (see report)"));
+    AppendMenu(hConfigSubMenu, MF_SEPARATOR, 0, NULL);
+    AppendMenu(hConfigSubMenu,
+        MF_STRING,
+        ID_CONFIG_MEMORY_CAP_16MB,
+        _T("Large File Memory Cap: 16 MB"));
+    AppendMenu(hConfigSubMenu,
+        MF_STRING,
+        ID_CONFIG_MEMORY_CAP_64MB,
+        _T("Large File Memory Cap: 64 MB"));
+    AppendMenu(hConfigSubMenu,
+        MF_STRING,
+        ID_CONFIG_MEMORY_CAP_256MB,
+        _T("Large File Memory Cap: 256 MB"));
+
+    // Big files are shown a page at a time, in whichever pane has the focus
+    AppendMenu(hViewSubMenu, MF_STRING, ID_VIEW_NEXT_PAGE,
+        _T("&Next Page\tALT+PGDN"));
+    AppendMenu(hViewSubMenu, MF_STRING, ID_VIEW_PREVIOUS_PAGE,
+        _T("&Previous Page\tALT+PGUP"));
+    AppendMenu(hViewSubMenu, MF_STRING, ID_VIEW_FIRST_PAGE,
+        _T("&First Page\tALT+HOME"));
+    AppendMenu(hViewSubMenu, MF_STRING, ID_VIEW_LAST_PAGE,
+        _T("&Last Page\tALT+END"));
 
     AppendMenu(hHelpSubMenu, MF_STRING, ID_HELP_ONLINE,
         _T("On-Line &Documentation"));
@@ -765,12 +580,20 @@ void CreateMainMenu(HWND hWnd) {
     AppendMenu(hHelpSubMenu, MF_STRING, ID_HELP_ABOUT,
         _T("&About"));
 
-    if (dedupeMemoField) {
+    if (settings.dedupeMemoField) {
         CheckMenuItem(hConfigSubMenu, ID_CONFIG_DEDUPE_MEMO, MF_CHECKED);
     }
-    if (trimLines) {
+    if (settings.trimLines) {
         CheckMenuItem(hConfigSubMenu, ID_CONFIG_TRIM_LINES, MF_CHECKED);
     }
+    if (settings.normalizeAmountsAndDates) {
+        CheckMenuItem(hConfigSubMenu, ID_CONFIG_NORMALIZE_AMOUNTS_DATES,
+            MF_CHECKED);
+    }
+    if (settings.sortAndDedupeTransactions) {
+        CheckMenuItem(hConfigSubMenu, ID_CONFIG_SORT_AND_DEDUPE, MF_CHECKED);
+    }
+    CheckMenuItem(hConfigSubMenu, ID_CONFIG_MEMORY_CAP_64MB, MF_CHECKED);
     SetMenu(hWnd, hMenu);
 }
 
@@ -782,42 +605,17 @@ void LoadFile(const PWSTR filename, HWND hWnd) {
         DWORD dwFileSize = GetFileSize(hFile, NULL);
         if (dwFileSize != 0xFFFFFFFF) {
             DWORD dwRead;
-            LPBYTE fileByteArray = new BYTE[dwFileSize];
-
-            if (ReadFile(hFile, fileByteArray, dwFileSize, &dwRead, NULL)) {
-                // If the file is UTF-8 or Unicode, we need to convert it to
-                // Wide Characters. I can't get it working with Unicode yet.
-                std::string fileTxt(reinterpret_cast<const char*>(
-                    fileByteArray),
-                    dwRead);
-                int num_chars = MultiByteToWideChar(CP_UTF8,
-                    MB_ERR_INVALID_CHARS, fileTxt.c_str(), fileTxt.length(),
-                    NULL, 0);
-                std::wstring fileTxtWideChars;
-                HWND hEdit = GetDlgItem(hWnd, IDC_MAIN_EDIT);
-                if (num_chars) {
-                    fileTxtWideChars.resize(num_chars);
-                    if (MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS,
-                        fileTxt.c_str(), fileTxt.length(),
-                        &fileTxtWideChars[0], num_chars)) {
-                        SetWindowText(hEdit, fileTxtWideChars.c_str());
-                    }
-                    else {
-                        MessageBox(NULL,
-                            L"Error reading characters in file. "
-                            "Maybe there is an invalid character?",
-                            L"Error",
-                            MB_OK | MB_ICONERROR);
-                    }
-                }
-                else {
-                    if (!SetWindowTextA(hEdit, fileTxt.c_str())) {
-                        MessageBox(NULL, L"Error displaying text as ANSI.",
-                            L"Error", MB_OK | MB_ICONERROR);
-                    }
-                }
+            // Read straight into the string the document keeps
+            std::string fileTxt(dwFileSize, '\0');
+            if (ReadFile(hFile, &fileTxt[0], dwFileSize, &dwRead, NULL)) {
+                std::wstring wideFilename = filename;
+                inputName = std::string(wideFilename.begin(),
+                    wideFilename.end());
+                fileTxt.resize(dwRead);
+                // If the file is UTF-8, it's shown as such. Otherwise it's
+                // shown as ANSI. I can't get it working with Unicode yet.
+                LoadPane(hWnd, inputPane, std::move(fileTxt));
             }
-            delete[] fileByteArray;
         }
         CloseHandle(hFile);
     }
@@ -832,23 +630,26 @@ void LoadFile(const PWSTR filename, HWND hWnd) {
 
 // Write out the contents of the OFX window to disk
 void WriteOutFile(const PWSTR filename, HWND hWnd) {
+    // CREATE_ALWAYS, so saving over a longer file doesn't leave its end
+    SyncPage(hWnd, outputPane);
     HANDLE hFile = CreateFile(filename, GENERIC_WRITE, FILE_SHARE_READ, NULL,
-        OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-    HWND hOfx = GetDlgItem(hWnd, IDC_OFX_EDIT);
-
-    std::string inputText;
-    int len = GetWindowTextLength(hOfx) + 1;
-
-    std::vector<char> buf(len);
-    GetWindowTextA(hOfx, &buf[0], len);
-    std::string s = &buf[0];
-    DWORD bytesWritten;
-    WriteFile(hFile, s.c_str(), len, &bytesWritten, NULL);
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    outputPane.document.ForEachPiece([hFile](const char* data,
+        size_t length) {
+        DWORD bytesWritten;
+        WriteFile(hFile, data, static_cast<DWORD>(length), &bytesWritten,
+            NULL);
+    });
     CloseHandle(hFile);
 }
 
-// Display the Save File Dialog and return chosen new file name.
-PWSTR SaveFileWindow() {
+// Display the Save File Dialog and return chosen new file name. Offers OFX
+// files unless other file types are given.
+PWSTR SaveFileWindow(const COMDLG_FILTERSPEC* saveTypes = NULL,
+    UINT saveTypeCount = 0) {
     HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED |
         COINIT_DISABLE_OLE1DDE);
     wchar_t tmp[1] = L"";
@@ -861,205 +662,2356 @@ PWSTR SaveFileWindow() {
             IID_IFileSaveDialog, reinterpret_cast<void**>(&pFileSave));
         if (SUCCEEDED(hr)) {
 
-            const COMDLG_FILTERSPEC c_rgSaveTypes[] =
-            { {L"OFX Files (*.ofx)",       L"*.ofx"}, };
-            hr = pFileSave->SetFileTypes(ARRAYSIZE(c_rgSaveTypes),
-                c_rgSaveTypes);
-            hr = pFileSave->SetFileTypeIndex(1);  // Uses 1-based index. groan.
-            hr = pFileSave->SetDefaultExtension(L"ofx");
-            // Show the Open dialog box.
-            hr = pFileSave->Show(NULL);
-            // Get the file name from the dialog box.
-            if (SUCCEEDED(hr)) {
-                IShellItem* pItem;
-                hr = pFileSave->GetResult(&pItem);
-                if (SUCCEEDED(hr)) {
-                    hr = pItem->GetDisplayName(SIGDN_FILESYSPATH,
-                        &pszFilePath);
+            const COMDLG_FILTERSPEC c_rgSaveTypes[] =
+            { {L"OFX Files (*.ofx)",       L"*.ofx"}, };
+            if (saveTypes == NULL) {
+                saveTypes = c_rgSaveTypes;
+                saveTypeCount = ARRAYSIZE(c_rgSaveTypes);
+            }
+            hr = pFileSave->SetFileTypes(saveTypeCount, saveTypes);
+            hr = pFileSave->SetFileTypeIndex(1);  // Uses 1-based index. groan.
+            // The extension of the first type, without the "*.". The dialog
+            // switches it when the user picks another type.
+            hr = pFileSave->SetDefaultExtension(saveTypes[0].pszSpec + 2);
+            // Show the Open dialog box.
+            hr = pFileSave->Show(NULL);
+            // Get the file name from the dialog box.
+            if (SUCCEEDED(hr)) {
+                IShellItem* pItem;
+                hr = pFileSave->GetResult(&pItem);
+                if (SUCCEEDED(hr)) {
+                    hr = pItem->GetDisplayName(SIGDN_FILESYSPATH,
+                        &pszFilePath);
+
+                    // Display the file name to the user.
+                    if (SUCCEEDED(hr)) {
+                        pFileSave->Release();
+                        return pszFilePath;
+                        //CoTaskMemFree(pszFilePath);
+                    }
+                    pItem->Release();
+                }
+            }
+            pFileSave->Release();
+        }
+        CoUninitialize();
+    }
+    return pszFilePath;
+}
+
+// Prompt the user to select a file to open and return that file name.
+PWSTR OpenFileWindow() {
+    HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED |
+        COINIT_DISABLE_OLE1DDE);
+    wchar_t tmp[1] = L"";
+    PWSTR pszFilePath = tmp;
+    if (SUCCEEDED(hr)) {
+        IFileOpenDialog* pFileOpen;
+
+        // Create the FileOpenDialog object.
+        hr = CoCreateInstance(CLSID_FileOpenDialog, NULL, CLSCTX_ALL,
+            IID_IFileOpenDialog, reinterpret_cast<void**>(&pFileOpen));
+
+        if (SUCCEEDED(hr)) {
+            // Show the Open dialog box.
+            hr = pFileOpen->Show(NULL);
+
+            // Get the file name from the dialog box.
+            if (SUCCEEDED(hr)) {
+                IShellItem* pItem;
+                hr = pFileOpen->GetResult(&pItem);
+                if (SUCCEEDED(hr)) {
+                    hr = pItem->GetDisplayName(SIGDN_FILESYSPATH,
+                        &pszFilePath);
+                    // Display the file name to the user.
+                    if (SUCCEEDED(hr)) {
+                        return pszFilePath;
+                    }
+                    pItem->Release();
+                }
+            }
+            pFileOpen->Release();
+        }
+        CoUninitialize();
+    }
+    return pszFilePath;
+}
+
+// Saving one OFX file per account. Money sometimes imports several accounts
+// faster and more reliably as separate files. Each file gets the headers,
+// the <SIGNONMSGSRSV1> and one statement response of the converted OFX.
+
+// One account's file
+struct AccountFile {
+    std::string type;  // Message set, e.g. "BANKMSGSRSV1"
+    std::string accountId;
+    const tinyxml2::XMLElement* statement = NULL;  // e.g. <STMTTRNRS>
+    std::string name;  // e.g. "000111222_20190101-20191231"
+    std::string ofx;  // With Windows new lines
+    bool written = false;
+};
+
+// The YYYYMMDD part of a <DTSTART> or <DTEND>, or "" if there isn't one
+std::string DatePart(const tinyxml2::XMLElement* parent, const char* name) {
+    const tinyxml2::XMLElement* date = parent->FirstChildElement(name);
+    if (!date || !date->GetText() || strlen(date->GetText()) < 8) {
+        return "";
+    }
+    std::string day(date->GetText(), 8);
+    for (char c : day) {
+        if (!isdigit(static_cast<unsigned char>(c))) {
+            return "";
+        }
+    }
+    return day;
+}
+
+// Find every statement response in a converted OFX document, the same way
+// ConvertQFXToOFX() finds what to prune, and name its file after the
+// account and date range. Names are unique and only use characters that
+// are safe in file names.
+std::vector<AccountFile> FindAccountFiles(tinyxml2::XMLDocument& doc) {
+    std::vector<AccountFile> files;
+    std::set<std::string> names;
+    for (const auto& mapping : TYPE_TO_BANKTRANLIST_MAP) {
+        std::vector<tinyxml2::XMLElement*> banktranlists;
+        size_t deepestMatch = 0;
+        FindBANKTRANLISTs(&doc, mapping.second, 0, banktranlists,
+            deepestMatch);
+        for (const tinyxml2::XMLElement* banktranlist : banktranlists) {
+            AccountFile file;
+            file.type = mapping.first;
+            const tinyxml2::XMLElement* stmtrs =
+                banktranlist->Parent()->ToElement();
+            file.accountId = FindAccountId(stmtrs);
+            file.statement = stmtrs->Parent()->ToElement();
+
+            std::string name;
+            for (char c : file.accountId) {
+                name += isalnum(static_cast<unsigned char>(c)) ||
+                    c == '-' ? c : '_';
+            }
+            if (name.empty()) {
+                name = "account";
+            }
+            std::string start = DatePart(banktranlist, "DTSTART");
+            std::string end = DatePart(banktranlist, "DTEND");
+            if (!start.empty() || !end.empty()) {
+                name += "_" + start + "-" + end;
+            }
+            // e.g. the same account twice in one file
+            std::string unique = name;
+            for (int n = 2; !names.insert(unique).second; ++n) {
+                unique = name + "_" + std::to_string(n);
+            }
+            file.name = unique;
+            files.push_back(file);
+        }
+    }
+    return files;
+}
+
+// The OFX for one account: headers, <SIGNONMSGSRSV1> (if any) and the
+// statement response inside its message set. Only reads from the source
+// document, so different accounts can be done on different threads.
+std::string MakeAccountOFX(const tinyxml2::XMLElement* signon,
+    const AccountFile& file) {
+    tinyxml2::XMLDocument doc;
+    std::string skeleton = XML_HEADER + "\n" + XML_OFX_HEADER + "\n<OFX><" +
+        file.type + "/></OFX>";
+    doc.Parse(skeleton.c_str(), skeleton.length());
+    tinyxml2::XMLElement* ofx = doc.FirstChildElement("OFX");
+    if (signon) {
+        ofx->InsertFirstChild(signon->DeepClone(&doc));
+    }
+    ofx->FirstChildElement(file.type.c_str())->InsertEndChild(
+        file.statement->DeepClone(&doc));
+
+    tinyxml2::XMLPrinter printer;
+    doc.Print(&printer);
+    std::string output;
+    for (const char* p = printer.CStr(); *p != '\0'; ++p) {
+        if (*p == '\n') {
+            output += '\r';
+        }
+        output += *p;
+    }
+    return output;
+}
+
+// Where an account's file goes: pathPrefix + name + ".ofx". The names are
+// ASCII (see FindAccountFiles()).
+std::wstring AccountFilePath(const std::wstring& pathPrefix,
+    const AccountFile& file) {
+    return pathPrefix + std::wstring(file.name.begin(), file.name.end()) +
+        L".ofx";
+}
+
+// Fails if path is already there, unless overwrite is set
+bool WriteAccountFile(const std::wstring& path, const std::string& ofx,
+    bool overwrite) {
+    HANDLE hFile = CreateFile(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+        NULL, overwrite ? CREATE_ALWAYS : CREATE_NEW, FILE_ATTRIBUTE_NORMAL,
+        NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD bytesWritten = 0;
+    BOOL written = WriteFile(hFile, ofx.c_str(),
+        static_cast<DWORD>(ofx.length()), &bytesWritten, NULL);
+    CloseHandle(hFile);
+    return written && bytesWritten == ofx.length();
+}
+
+// Make and write the account files at the same time, up to one thread per
+// core. AccountFilePath() is where each file goes.
+void WriteAccountFilesInParallel(const tinyxml2::XMLDocument& doc,
+    std::vector<AccountFile>& files, const std::wstring& pathPrefix,
+    bool overwrite) {
+    const tinyxml2::XMLElement* signon = doc.FirstChildElement("OFX") ?
+        doc.FirstChildElement("OFX")->FirstChildElement("SIGNONMSGSRSV1") :
+        NULL;
+    if (signon) {
+        // TinyXML-2 decodes text the first time it's read, in place. Every
+        // thread reads the sign-on, so get that done before they start.
+        tinyxml2::XMLPrinter decode;
+        signon->Accept(&decode);
+    }
+    std::atomic<size_t> next(0);
+    auto worker = [&doc, &files, &pathPrefix, &next, signon, overwrite]() {
+        for (size_t i = next++; i < files.size(); i = next++) {
+            AccountFile& file = files[i];
+            file.ofx = MakeAccountOFX(signon, file);
+            file.written = WriteAccountFile(AccountFilePath(pathPrefix, file),
+                file.ofx, overwrite);
+        }
+    };
+    size_t threadCount = std::thread::hardware_concurrency();
+    if (threadCount > files.size()) {
+        threadCount = files.size();
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; ++i) {
+        threads.push_back(std::thread(worker));
+    }
+    worker();  // This thread helps out too
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+// Save what changed in each transaction in the last conversion, for when
+// the totals in the report aren't enough
+void SaveConversionDifferences(HWND hWnd) {
+    if (lastConversionDifferences.empty()) {
+        MessageBox(hWnd,
+            _T("Nothing to save. Check \"Compare the output with the input\" "
+                "in the Config menu, then convert. If it is already checked, "
+                "no transaction changed."),
+            _T("FYI"),
+            MB_OK | MB_ICONINFORMATION);
+        return;
+    }
+    const COMDLG_FILTERSPEC textTypes[] = {
+        { L"Text Files (*.txt)", L"*.txt" },
+    };
+    PWSTR filename = SaveFileWindow(textTypes, ARRAYSIZE(textTypes));
+    if (filename[0] == L'\0') {  // User hit Cancel
+        return;
+    }
+    std::wstring path = filename;
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    out << lastConversionDifferences;
+    out.close();
+    if (!out) {
+        MessageBox(hWnd, L"Could not save the differences.", L"Error",
+            MB_OK | MB_ICONERROR);
+    }
+}
+
+// Save the converted OFX as one file per account, named after the file the
+// user picks, e.g. "June.ofx" gives "June_000111222_20190601-20190630.ofx".
+void SaveOFXSplitByAccount(HWND hWnd) {
+    SyncPage(hWnd, outputPane);
+    const std::string& ofx = outputPane.document.Contents();
+    tinyxml2::XMLDocument doc;
+    doc.Parse(ofx.c_str(), ofx.length());
+    std::vector<AccountFile> files;
+    if (doc.ErrorID() == 0) {
+        files = FindAccountFiles(doc);
+    }
+    if (files.empty()) {
+        MessageBox(hWnd,
+            _T("No bank or credit card statements found in the OFX. "
+                "Convert the input first!"),
+            _T("Error"),
+            MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    PWSTR filename = SaveFileWindow();
+    if (filename[0] == L'\0') {  // Ensure user didn't hit Cancel
+        return;
+    }
+    std::wstring pathPrefix = filename;
+    size_t extension = pathPrefix.rfind(L'.');
+    if (extension != std::wstring::npos &&
+        pathPrefix.find_first_of(L"\\/", extension) == std::wstring::npos) {
+        pathPrefix.erase(extension);
+    }
+    pathPrefix += L"_";
+
+    // The save window only asked about the name the user typed, not the
+    // per-account names made from it
+    std::string existing;
+    for (const AccountFile& file : files) {
+        if (GetFileAttributes(AccountFilePath(pathPrefix, file).c_str()) !=
+            INVALID_FILE_ATTRIBUTES) {
+            existing += "..._" + file.name + ".ofx\n";
+        }
+    }
+    bool overwrite = false;
+    if (!existing.empty()) {
+        std::string question = "These files are already there:\n\n" +
+            existing + "\nReplace them?";
+        if (MessageBoxA(hWnd, question.c_str(), "Replace Files?",
+            MB_YESNO | MB_ICONWARNING | MB_DEFBUTTON2) != IDYES) {
+            return;
+        }
+        overwrite = true;
+    }
+    WriteAccountFilesInParallel(doc, files, pathPrefix, overwrite);
+
+    std::string msg;
+    bool failed = false;
+    for (const AccountFile& file : files) {
+        msg += std::string(file.written ? "Saved " : "FAILED to save ") +
+            file.type + " account " + file.accountId + " as ..._" +
+            file.name + ".ofx\n";
+        failed = failed || !file.written;
+    }
+    MessageBoxA(hWnd, msg.c_str(), failed ? "Error" : "FYI",
+        MB_OK | (failed ? MB_ICONERROR : MB_ICONINFORMATION));
+}
+
+// Runs mnyimprt.exe with ShellExecuteEx for the ImportQueue (see
+// ImportQueue.h)
+class ShellImportLauncher : public ImportLauncher {
+public:
+    bool WriteTempFile(const std::string& ofx, std::wstring& path,
+        std::string& error);
+    ImportStatus Run(const std::wstring& handler, const std::wstring& file,
+        unsigned long timeout, const std::atomic<bool>& cancelled,
+        std::string& detail);
+    bool DeleteTempFile(const std::wstring& path) {
+        return DeleteFile(path.c_str()) != 0;
+    }
+};
+
+bool ShellImportLauncher::WriteTempFile(const std::string& ofx,
+    std::wstring& path, std::string& error) {
+    TCHAR tmpFileName[MAX_PATH];
+    TCHAR tmpFilePath[MAX_PATH];
+    // Get the Temorary File Directory
+    DWORD dwRetVal = GetTempPath(MAX_PATH, tmpFilePath);
+    if (dwRetVal > MAX_PATH || (dwRetVal == 0)) {
+        error = "Error Getting Temporary File Path.";
+        return false;
+    }
+    // Get a Temporary File Name inside the temp directory
+    dwRetVal = GetTempFileName(tmpFilePath,  // directory for tmp files
+        _T("ofx"),  // temp file name prefix, only first 3 letters used! 
+        0,
+        tmpFileName);
+    if (dwRetVal == 0) {
+        error = "Unable to get Temporary File Name.";
+        return false;
+    }
+    path = tmpFileName;
+
+    HANDLE hFile = CreateFile(tmpFileName, GENERIC_WRITE, FILE_SHARE_READ,
+        NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        error = "Unable to write the Temporary File.";
+        DeleteFile(tmpFileName);
+        return false;
+    }
+    DWORD bytesWritten = 0;
+    BOOL written = WriteFile(hFile, ofx.c_str(),
+        static_cast<DWORD>(ofx.length()), &bytesWritten, NULL);
+    CloseHandle(hFile);
+    if (!written || bytesWritten != ofx.length()) {
+        error = "Unable to write the Temporary File.";
+        DeleteFile(tmpFileName);
+        return false;
+    }
+    return true;
+}
+
+ImportStatus ShellImportLauncher::Run(const std::wstring& handler,
+    const std::wstring& file, unsigned long timeout,
+    const std::atomic<bool>& cancelled, std::string& detail) {
+    // ShellExecuteEx may hand off to Shell extensions, which need COM
+    HRESULT com = CoInitializeEx(NULL,
+        COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+
+    // Call the Import Handler with the file. The Import Handler, under the 
+    // hood, appears to create another copy of the file and update two
+    // Registry keys. When Money starts, it processes these keys and 
+    // subsequently the file(s) before deleting them.
+    SHELLEXECUTEINFO ShExecInfo;
+    ShExecInfo.cbSize = sizeof(SHELLEXECUTEINFO);
+    // No error dialogs from a background thread. We report errors ourselves.
+    ShExecInfo.fMask = SEE_MASK_NOCLOSEPROCESS | SEE_MASK_FLAG_NO_UI;
+    ShExecInfo.hwnd = NULL;
+    ShExecInfo.lpVerb = L"open";
+    ShExecInfo.lpFile = handler.c_str();
+    ShExecInfo.lpParameters = file.c_str();
+    ShExecInfo.lpDirectory = NULL;
+    ShExecInfo.nShow = SW_SHOWNORMAL;
+    ShExecInfo.hInstApp = NULL;
+    ShExecInfo.hProcess = NULL;
+    ImportStatus status = IMPORT_DONE;
+    if (!ShellExecuteEx(&ShExecInfo) || ShExecInfo.hProcess == NULL) {
+        int retVal = (int)ShExecInfo.hInstApp;
+        std::string handlerName(handler.begin(), handler.end());
+        if (retVal == SE_ERR_FNF || retVal == SE_ERR_PNF) {
+            detail = "Could not locate the MS Money Import Handler at: " +
+                handlerName;
+            status = IMPORT_HANDLER_NOT_FOUND;
+        }
+        else {
+            detail = "Could not start the MS Money Import Handler at: " +
+                handlerName + " (error " + std::to_string(retVal) + ")";
+            status = IMPORT_FAILED;
+        }
+    }
+    else {
+        // Wait in short slices, so quitting doesn't have to wait for the
+        // handler
+        const DWORD SLICE_MILLISECONDS = 100;
+        unsigned long waited = 0;
+        while (WaitForSingleObject(ShExecInfo.hProcess, SLICE_MILLISECONDS) !=
+            WAIT_OBJECT_0) {
+            waited += SLICE_MILLISECONDS;
+            if (cancelled) {
+                status = IMPORT_CANCELLED;
+                break;
+            }
+            if (waited >= timeout) {
+                TerminateProcess(ShExecInfo.hProcess, 1);
+                detail = "The MS Money Import Handler did not finish within " +
+                    std::to_string(timeout / 60000) + " minutes and was "
+                    "stopped.";
+                status = IMPORT_TIMED_OUT;
+                break;
+            }
+        }
+        CloseHandle(ShExecInfo.hProcess);
+    }
+
+    if (SUCCEEDED(com)) {
+        CoUninitialize();
+    }
+    return status;
+}
+
+ShellImportLauncher shellImportLauncher;
+// Created with the main window, so finished imports can be posted to it
+std::unique_ptr<ImportQueue> importQueue;
+
+// Send the OFX output to the MS Money Import Handler
+void SendToMoneyImportHandler(HWND hWnd) {
+    // Queue the OFX for the Import Handler, which gets it as a temporary
+    // file (see ImportQueue).
+    // The MS Money Import Handler appears to be very simple, and we could
+    // probably replicate the code here. It appears to do the following:
+    // 1) Create a temporary file with the OFX
+    // 2) Update Registry keys that point to that file
+    // 3) Prompt the user to start Money. Then Money processes the file and
+    //    deletes it and clears the registry key.
+    // Since mnyimprt.exe just works, we'll avoid doing that for now.
+
+    // First get the OFX text. Make sure it is not empty. If nothing was
+    // converted yet, the document is empty but the pane has
+    // OFX_DEFAULT_TEXT in it.
+    SyncPage(hWnd, outputPane);
+    if (outputPane.document.Length() == 0) {
+        if (GetWindowTextLength(GetDlgItem(hWnd, IDC_OFX_EDIT)) == 0) {
+            MessageBox(hWnd,
+                _T("OFX Text is empty. Nothing to Import!"),
+                _T("Error"),
+                MB_OK | MB_ICONERROR);
+        }
+        else {
+            MessageBox(hWnd,
+                _T("OFX Text is not valid. "
+                    "The right text pane needs to be updated!"),
+                _T("Error"),
+                MB_OK | MB_ICONERROR);
+        }
+        return;
+    }
+    // The same bytes Save OFX As would write
+    if (importQueue->Enqueue(IMPORT_HANDLER_EXE,
+        outputPane.document.Contents()) == 0) {
+        MessageBox(hWnd,
+            _T("The import queue has been shut down. Save the OFX data and "
+                "open that file with the Money Import Handler instead."),
+            _T("Error"),
+            MB_OK | MB_ICONERROR);
+    }
+}
+
+// An import finished. Tell the user if something went wrong.
+void ImportFinished(HWND hWnd, unsigned id) {
+    ImportJob job;
+    if (!importQueue->Find(id, job)) {
+        return;
+    }
+    if (job.status == IMPORT_HANDLER_NOT_FOUND) {
+        std::wstring errorMsg = L"Error: Do you need to change the location "
+            "of the Money Import Handler? Could not locate the "
+            "MS Money Import Handler at: ";
+        errorMsg += job.handler;
+        MessageBox(hWnd, errorMsg.c_str(), _T("Error"), MB_OK | MB_ICONERROR);
+    }
+    else if (job.status == IMPORT_FAILED || job.status == IMPORT_TIMED_OUT) {
+        std::string msg = job.detail + " Alternatively, you should save the "
+            "OFX data and open that file with the Money Import Handler.";
+        MessageBoxA(hWnd, msg.c_str(), "Error", MB_OK | MB_ICONERROR);
+    }
+    if (job.tempFileLeft) {
+        std::wstring warnMsg =
+            L"Warning: Could not delete the temporary file. "
+            "You may want to delete the file manually. File was created at: ";
+        warnMsg += job.tempFile;
+        MessageBox(hWnd,
+            warnMsg.c_str(),
+            _T("Warning: Did Not Remove Temp File"),
+            MB_OK | MB_ICONWARNING);
+    }
+}
+
+// List what's in the import queue
+void ShowImportQueue(HWND hWnd) {
+    std::vector<ImportJob> jobs = importQueue->Jobs();
+    std::string msg;
+    for (const ImportJob& job : jobs) {
+        msg += "Import " + std::to_string(job.id) + ": " +
+            IMPORT_STATUS_NAMES[job.status];
+        if (!job.detail.empty()) {
+            msg += " - " + job.detail;
+        }
+        msg += "\n";
+    }
+    MessageBoxA(hWnd,
+        msg.empty() ? "Nothing has been sent to Money yet." : msg.c_str(),
+        "Import Queue",
+        MB_OK | MB_ICONINFORMATION);
+}
+
+// For those special people out there that have mnyimprt.exe elsewhere
+// This change does not persist, so one improvement is to persist the value.
+void ChangeImportHandlerLocation(HWND hWnd) {
+    std::string msg = "Select a different location for mnyimprt.exe. You will "
+        "need to do this every time you use this program, as the new location "
+        "is NOT saved. I recommend you manually create the folder structure "
+        "and copy mnyimprt.exe to: "
+        "C:\\Program Files(x86)\\Microsoft Money Plus\\MNYCoreFiles\\mnyimprt.exe";
+    MessageBoxA(hWnd,
+        msg.c_str(),
+        "FYI",
+        MB_OK | MB_ICONINFORMATION);
+    PWSTR NEW_IMPORT_HANDLER_EXE = OpenFileWindow();
+    if (NEW_IMPORT_HANDLER_EXE[0] != L'\0') {  // Ensure user didn't hit Cancel
+        IMPORT_HANDLER_EXE = NEW_IMPORT_HANDLER_EXE;
+    }
+}
+
+// When path was last written, as a FILETIME, or 0 if it can't be found
+uint64_t LastWriteTime(const std::wstring& path) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) {
+        return 0;
+    }
+    return (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) |
+        data.ftLastWriteTime.dwLowDateTime;
+}
+
+// Convert a file that is too big to open in the window. Reads and writes
+// straight from/to disk using the bounded-memory mode.
+void ConvertLargeFile(HWND hWnd) {
+    std::string msg = "This converts a file straight to a new file without "
+        "showing it, using at most " +
+        std::to_string(boundedMemoryCap / (1024 * 1024)) + " MB of memory "
+        "(see the Config menu). Use it for statements that are too big for "
+        "the windows. First select the input file, then where to save the "
+        "OFX.";
+    MessageBoxA(hWnd, msg.c_str(), "FYI", MB_OK | MB_ICONINFORMATION);
+    PWSTR inputFilename = OpenFileWindow();
+    if (inputFilename[0] == L'\0') {  // User hit Cancel
+        return;
+    }
+    std::wstring inputPath = inputFilename;
+    PWSTR outputFilename = SaveFileWindow();
+    if (outputFilename[0] == L'\0') {
+        return;
+    }
+
+    std::ifstream in(inputPath.c_str(), std::ios::binary);
+    if (!in) {
+        MessageBox(hWnd, L"Could not open the input file.", L"Error",
+            MB_OK | MB_ICONERROR);
+        return;
+    }
+    std::ofstream out(outputFilename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        MessageBox(hWnd, L"Could not create the output file.", L"Error",
+            MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    OFXIndex index;
+    BoundedConversionResult result = ConvertStreamBounded(in, out,
+        boundedMemoryCap, settings, NULL,
+        saveTransactionIndex ? &index : NULL);
+    if (result.success && saveTransactionIndex) {
+        // Closed first, so the last write time is the one /index will see
+        out.close();
+        std::wstring indexPath = std::wstring(outputFilename) + L".idx";
+        std::ofstream indexOut(indexPath.c_str(),
+            std::ios::binary | std::ios::trunc);
+        if (!out || !index.Save(indexOut, LastWriteTime(outputFilename))) {
+            result.success = false;
+            result.errorMsg = "Could not write the index file.";
+        }
+    }
+    if (!result.success) {
+        msg = "Could not convert the file. Parts of the output may already "
+            "have been written, so don't import it.\n\n" + result.errorMsg;
+        MessageBoxA(hWnd, msg.c_str(), "Error Converting File",
+            MB_OK | MB_ICONERROR);
+        return;
+    }
+    msg = "Done! Converted " + std::to_string(result.transactionCount) +
+        " transactions.\n\nRead " + std::to_string(result.bytesRead) +
+        " bytes, wrote " + std::to_string(result.bytesWritten) + " bytes. "
+        "Peak buffered memory: " +
+        std::to_string(result.peakBufferedBytes / 1024) + " KB.";
+    if (saveTransactionIndex) {
+        msg += "\n\nSaved an index of " +
+            std::to_string(index.TransactionCount()) + " transactions "
+            "next to it (.idx).";
+    }
+    if (result.fitidsUnchecked) {
+        msg += "\n\nThe statement was too big to check all of its FITIDs "
+            "for repeats within the memory cap. Money skips transactions "
+            "with a repeated FITID.";
+    }
+    if (result.diagnosticCount > 0) {
+        msg += "\n\nThe output still has problems that may make Money "
+            "reject it:\n\n" + FormatValidationDiagnostics(
+                result.diagnostics, result.diagnosticCount, 15);
+        MessageBoxA(hWnd, msg.c_str(), "FYI: Possible Problems For Money",
+            MB_OK | MB_ICONWARNING);
+        return;
+    }
+    MessageBoxA(hWnd, msg.c_str(), "FYI", MB_OK | MB_ICONINFORMATION);
+}
+
+// A stream buffer that throws everything away, for converting only to
+// export the transactions
+class NullStreamBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return traits_type::not_eof(c); }
+    std::streamsize xsputn(const char*, std::streamsize count) override {
+        return count;
+    }
+};
+
+// Convert a file the bounded-memory way, but save its transactions as CSV
+// or JSON Lines for reports instead of saving the OFX. Works on files of
+// any size, like ConvertLargeFile().
+void ExportTransactions(HWND hWnd) {
+    MessageBox(hWnd, L"This converts a file and saves its transactions as "
+        L"CSV or JSON Lines (one JSON object per line) for spreadsheets and "
+        L"reports, instead of saving the OFX. First select the input file, "
+        L"then where to save the transactions. Pick the file type in the "
+        L"save window.", L"FYI", MB_OK | MB_ICONINFORMATION);
+    PWSTR inputFilename = OpenFileWindow();
+    if (inputFilename[0] == L'\0') {  // User hit Cancel
+        return;
+    }
+    std::wstring inputPath = inputFilename;
+    const COMDLG_FILTERSPEC exportTypes[] = {
+        { L"CSV Files (*.csv)", L"*.csv" },
+        { L"JSON Lines Files (*.jsonl)", L"*.jsonl" },
+    };
+    PWSTR exportFilename = SaveFileWindow(exportTypes,
+        ARRAYSIZE(exportTypes));
+    if (exportFilename[0] == L'\0') {
+        return;
+    }
+    std::wstring exportPath = exportFilename;
+    size_t dot = exportPath.find_last_of(L'.');
+    std::wstring extension = dot == std::wstring::npos ? L"" :
+        exportPath.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+        ::towlower);
+    ExportFormat format = extension == L".jsonl" || extension == L".json" ?
+        EXPORT_JSON_LINES : EXPORT_CSV;
+
+    std::ifstream in(inputPath.c_str(), std::ios::binary);
+    if (!in) {
+        MessageBox(hWnd, L"Could not open the input file.", L"Error",
+            MB_OK | MB_ICONERROR);
+        return;
+    }
+    std::ofstream exportOut(exportPath.c_str(),
+        std::ios::binary | std::ios::trunc);
+    if (!exportOut) {
+        MessageBox(hWnd, L"Could not create the export file.", L"Error",
+            MB_OK | MB_ICONERROR);
+        return;
+    }
+    NullStreamBuffer discard;
+    std::ostream ofxOut(&discard);
+    TransactionExporter exporter(exportOut, format);
+    BoundedConversionResult result = ConvertStreamBounded(in, ofxOut,
+        boundedMemoryCap, settings, &exporter);
+    if (!result.success) {
+        std::string msg = "Could not export the transactions. Some may "
+            "already have been written.\n\n" + result.errorMsg;
+        MessageBoxA(hWnd, msg.c_str(), "Error Exporting Transactions",
+            MB_OK | MB_ICONERROR);
+        return;
+    }
+    std::string msg = "Done! Exported " + std::to_string(exporter.Count()) +
+        " transactions.\n\nRead " + std::to_string(result.bytesRead) +
+        " bytes, wrote " + std::to_string(exporter.BytesWritten()) +
+        " bytes.";
+    MessageBoxA(hWnd, msg.c_str(), "FYI", MB_OK | MB_ICONINFORMATION);
+}
+
+// A whole input file mapped into memory, read-only, so the CSV and QIF
+// readers work on one block of memory
+class MappedInputFile {
+public:
+    MappedInputFile() {}
+    MappedInputFile(const MappedInputFile&) = delete;
+    MappedInputFile& operator=(const MappedInputFile&) = delete;
+    ~MappedInputFile();
+    // False, with a message for the user, if the file can't be mapped
+    bool Open(const std::wstring& path, std::wstring& error);
+    const char* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMapping = NULL;
+    const char* data = NULL;
+    size_t size = 0;
+};
+
+MappedInputFile::~MappedInputFile() {
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (hMapping) {
+        CloseHandle(hMapping);
+    }
+    if (hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(hFile);
+    }
+}
+
+bool MappedInputFile::Open(const std::wstring& path, std::wstring& error) {
+    hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        error = L"Could not open the input file.";
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0 ||
+        static_cast<unsigned long long>(fileSize.QuadPart) > SIZE_MAX) {
+        error = L"The input file is empty or too big.";
+        return false;
+    }
+    size = static_cast<size_t>(fileSize.QuadPart);
+    hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    data = hMapping ? static_cast<const char*>(
+        MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0)) : NULL;
+    if (!data) {
+        error = L"Could not map the input file into memory. It may be too "
+            L"big for this version of the program.";
+        return false;
+    }
+    return true;
+}
+
+// Convert a CSV export straight to an OFX file. The columns are found by
+// their header names, or by what the column mapping file next to the CSV
+// says (see ReadCSVOptions()).
+void ConvertCSVFile(HWND hWnd) {
+    std::string msg = "This converts a CSV export to an OFX file. The "
+        "columns are recognized by their names in the first row. If that "
+        "doesn't work, or to set the account number, put a column mapping "
+        "file named " + std::string(CSV_MAPPING_FILE_NAME) + " in the same "
+        "folder as the CSV (see the README). First select the CSV file, "
+        "then where to save the OFX.";
+    MessageBoxA(hWnd, msg.c_str(), "FYI", MB_OK | MB_ICONINFORMATION);
+    PWSTR inputFilename = OpenFileWindow();
+    if (inputFilename[0] == L'\0') {  // User hit Cancel
+        return;
+    }
+    std::wstring inputPath = inputFilename;
+    PWSTR outputFilename = SaveFileWindow();
+    if (outputFilename[0] == L'\0') {
+        return;
+    }
+
+    CSVOptions options;
+    std::wstring mappingPath = inputPath.substr(0,
+        inputPath.find_last_of(L"\\/") + 1) +
+        std::wstring(CSV_MAPPING_FILE_NAME,
+            CSV_MAPPING_FILE_NAME + strlen(CSV_MAPPING_FILE_NAME));
+    std::ifstream mapping(mappingPath.c_str());
+    std::string error;
+    if (mapping && !ReadCSVOptions(mapping, options, error)) {
+        MessageBoxA(hWnd, error.c_str(), "Error Reading Column Mapping",
+            MB_OK | MB_ICONERROR);
+        return;
+    }
+
+    MappedInputFile input;
+    std::wstring mapError;
+    if (!input.Open(inputPath, mapError)) {
+        MessageBox(hWnd, mapError.c_str(), L"Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+    std::ofstream out(outputFilename, std::ios::binary | std::ios::trunc);
+    CSVConversionResult result;
+    if (out) {
+        result = ConvertCSVToOFX(input.Data(), input.Size(), options, out);
+    }
+    else {
+        result.errorMsg = "Could not create the output file.";
+    }
+
+    if (!result.success) {
+        msg = "Could not convert the CSV file.\n\n" + result.errorMsg;
+        MessageBoxA(hWnd, msg.c_str(), "Error Converting File",
+            MB_OK | MB_ICONERROR);
+        return;
+    }
+    msg = "Done! Converted " + std::to_string(result.transactionCount) +
+        " transactions.\n\nRead " + std::to_string(result.bytesRead) +
+        " bytes, wrote " + std::to_string(result.bytesWritten) + " bytes.";
+    if (result.synthesizedIds > 0) {
+        msg += "\n\n" + std::to_string(result.synthesizedIds) + " rows had "
+            "no ID, so they got one made from their date, amount, payee and "
+            "memo.";
+    }
+    if (!result.hasBalance) {
+        msg += "\n\nThere is no balance column, so the statement balance is "
+            "0.00.";
+    }
+    if (result.skippedRows > 0) {
+        msg += "\n\nSkipped " + std::to_string(result.skippedRows) + " rows "
+            "without a date or amount that could be read, the first on line " +
+            std::to_string(result.firstSkippedLine) + ".";
+        MessageBoxA(hWnd, msg.c_str(), "FYI: Some Rows Skipped",
+            MB_OK | MB_ICONWARNING);
+        return;
+    }
+    MessageBoxA(hWnd, msg.c_str(), "FYI", MB_OK | MB_ICONINFORMATION);
+}
+
+void ConvertQIFFile(HWND hWnd) {
+    MessageBox(hWnd, L"This converts a QIF export to an OFX file. Bank, cash "
+        L"and credit card accounts are converted; investment accounts are "
+        L"not. First select the QIF file, then where to save the OFX.",
+        L"FYI", MB_OK | MB_ICONINFORMATION);
+    PWSTR inputFilename = OpenFileWindow();
+    if (inputFilename[0] == L'\0') {  // User hit Cancel
+        return;
+    }
+    std::wstring inputPath = inputFilename;
+    PWSTR outputFilename = SaveFileWindow();
+    if (outputFilename[0] == L'\0') {
+        return;
+    }
+
+    MappedInputFile input;
+    std::wstring mapError;
+    if (!input.Open(inputPath, mapError)) {
+        MessageBox(hWnd, mapError.c_str(), L"Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+    std::ofstream out(outputFilename, std::ios::binary | std::ios::trunc);
+    QIFConversionResult result;
+    if (out) {
+        result = ConvertQIFToOFX(input.Data(), input.Size(), out);
+    }
+    else {
+        result.errorMsg = "Could not create the output file.";
+    }
+
+    if (!result.success) {
+        std::string msg = "Could not convert the QIF file.\n\n" +
+            result.errorMsg;
+        MessageBoxA(hWnd, msg.c_str(), "Error Converting File",
+            MB_OK | MB_ICONERROR);
+        return;
+    }
+    std::string msg = "Done! Converted " +
+        std::to_string(result.transactionCount) + " transactions in " +
+        std::to_string(result.accountCount) + " account(s).\n\nRead " +
+        std::to_string(result.bytesRead) + " bytes, wrote " +
+        std::to_string(result.bytesWritten) + " bytes.";
+    if (result.dayFirst || result.decimalSeparator == ',') {
+        msg += std::string("\n\nDates were read as ") + (result.dayFirst ?
+            "day/month/year" : "month/day/year") + " and amounts with " +
+            (result.decimalSeparator == ',' ? "a decimal comma." :
+                "a decimal point.");
+    }
+    if (result.accountsWithoutBalance > 0) {
+        msg += "\n\n" + std::to_string(result.accountsWithoutBalance) +
+            " account(s) don't start with an Opening Balance, so their "
+            "statement balance is 0.00.";
+    }
+    if (result.investmentSections > 0) {
+        msg += "\n\nSkipped " + std::to_string(result.investmentSections) +
+            " investment account(s).";
+    }
+    if (result.skippedRecords > 0) {
+        msg += "\n\nSkipped " + std::to_string(result.skippedRecords) +
+            " transactions without a date or amount that could be read, "
+            "the first on line " + std::to_string(result.firstSkippedLine) +
+            ".";
+    }
+    if (result.skippedRecords > 0 || result.investmentSections > 0) {
+        MessageBoxA(hWnd, msg.c_str(), "FYI: Some Transactions Skipped",
+            MB_OK | MB_ICONWARNING);
+        return;
+    }
+    MessageBoxA(hWnd, msg.c_str(), "FYI", MB_OK | MB_ICONINFORMATION);
+}
+
+// Check the selected memory cap in the Config menu and uncheck the others.
+void SetBoundedMemoryCap(HWND hWnd, UINT menuId) {
+    const UINT capMenuIds[] = { ID_CONFIG_MEMORY_CAP_16MB,
+        ID_CONFIG_MEMORY_CAP_64MB, ID_CONFIG_MEMORY_CAP_256MB };
+    const size_t capMegabytes[] = { 16, 64, 256 };
+    HMENU configSubMenu = GetSubMenu(GetMenu(hWnd), 2);
+    for (size_t i = 0; i < ARRAYSIZE(capMenuIds); ++i) {
+        if (capMenuIds[i] == menuId) {
+            boundedMemoryCap = capMegabytes[i] * 1024 * 1024;
+            CheckMenuItem(configSubMenu, capMenuIds[i], MF_CHECKED);
+        }
+        else {
+            CheckMenuItem(configSubMenu, capMenuIds[i], MF_UNCHECKED);
+        }
+    }
+}
+
+// Benchmark mode, for catching slowdowns before they ship. Run it from a
+// command prompt:
+//
+//   ConvertToOFX.exe /benchmark benchmarks\baseline.txt [/update]
+//       [/tolerance PERCENT] [/maxmb MEGABYTES] [/corpus DIRECTORY]
+//       [/out RESULTS_FILE]
+//
+// It converts made-up QFX files from 10 KB to 500 MB (and every .qfx file in
+// the corpus directory, for real-world files with the personal bits taken
+// out), measures each conversion stage, and compares with the baseline. The
+// exit code is 0 if nothing got slower or hungrier than the tolerance
+// allows, 1 if something did or isn't in the baseline, and 2 if the
+// benchmark couldn't run. /update writes the new numbers to the baseline
+// instead of failing. A baseline with no results in it yet (like the one
+// in the repository until the gate machine writes one) has nothing to
+// compare with, so only the checks that don't need it can fail.
+struct BenchmarkOptions {
+    std::string baselinePath;
+    std::string corpusDirectory;
+    std::string resultsPath;
+    double tolerance = 0.10;
+    size_t maxBytes = 500 * 1024 * 1024;
+    bool update = false;
+};
+
+// One line of the baseline: how one stage did on one input. Stage "total"
+// is the whole conversion, and its peak is the most live heap memory seen
+// during it.
+struct BenchmarkResult {
+    std::string corpus;
+    size_t bytes;
+    std::string stage;
+    double nsPerByte;
+    unsigned long long allocations;
+    long long peakBytes;
+};
+
+const size_t BENCHMARK_SIZES[] = { 10 * 1024, 100 * 1024, 1024 * 1024,
+    10 * 1024 * 1024, 100 * 1024 * 1024, 500 * 1024 * 1024 };
+// The biggest synthetic size to also benchmark once converted
+const size_t READY_BENCHMARK_MAX = 10 * 1024 * 1024;
+// Below this, fixed costs drown out how a stage scales
+const size_t SCALING_REFERENCE_SIZE = 1024 * 1024;
+// How much worse ns/byte may get from the reference size to the largest
+// size before we call a stage superlinear
+const double SCALING_LIMIT = 2.0;
+// Differences smaller than these are noise, whatever the percentage
+const double BENCHMARK_MIN_NANOSECONDS = 1000000.0;
+const unsigned long long BENCHMARK_MIN_ALLOCATIONS = 16;
+// The made-up input for timing each policy variant (see
+// ReportPolicyVariants()), and how many times to run each one
+const size_t POLICY_BENCHMARK_SIZE = 10 * 1024 * 1024;
+const int POLICY_BENCHMARK_RUNS = 5;
+// How many amounts and dates ReportParserSpeed() parses
+const size_t PARSER_BENCHMARK_VALUES = 1024 * 1024;
+const long long BENCHMARK_MIN_PEAK_BYTES = 64 * 1024;
+
+// Convert input a few times and keep the fastest run of each stage. The
+// first run warms up the buffers, so allocations are the steady state of
+// converting one file after another. Big inputs get a single cold run,
+// because converting them a few times takes too long.
+bool MeasureConversion(const std::string& corpus, const std::string& input,
+    std::vector<BenchmarkResult>& results, std::string& error) {
+    const size_t bytes = std::max<size_t>(input.length(), 1);
+    const int runs = input.length() >= 50 * 1024 * 1024 ? 1 :
+        input.length() >= 5 * 1024 * 1024 ? 3 : 10;
+    const int warmUpRuns = runs > 1 ? 1 : 0;
+    const ConversionOptions options;
+    ConversionBuffers buffers;
+    std::string output;
+
+    double bestNanoseconds[STAGE_COUNT + 1];
+    std::fill(bestNanoseconds, bestNanoseconds + STAGE_COUNT + 1, -1.0);
+    unsigned long long allocations[STAGE_COUNT + 1] = {};
+    long long peaks[STAGE_COUNT + 1] = {};
+    for (int run = 0; run < warmUpRuns + runs; ++run) {
+        ConversionContext context(options);
+        AllocationStats stats;
+        context.allocations = &stats;
+        std::chrono::steady_clock::time_point started =
+            std::chrono::steady_clock::now();
+        bool converted = ConvertQFXToOFX(input, context, buffers, output);
+        double nanoseconds = static_cast<double>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - started).count());
+        if (!converted) {
+            error = corpus + " (" + std::to_string(input.length()) +
+                " bytes) did not convert: " + context.diagnostics.ErrorText();
+            return false;
+        }
+        if (run < warmUpRuns) {
+            continue;
+        }
+
+        allocations[STAGE_COUNT] = 0;
+        for (int i = 0; i < STAGE_COUNT; ++i) {
+            double stageNanoseconds =
+                static_cast<double>(stats.Nanoseconds(i));
+            if (bestNanoseconds[i] < 0 ||
+                stageNanoseconds < bestNanoseconds[i]) {
+                bestNanoseconds[i] = stageNanoseconds;
+            }
+            allocations[i] = stats.Allocations(i);
+            allocations[STAGE_COUNT] += allocations[i];
+            peaks[i] = std::max(peaks[i], stats.StagePeak(i));
+        }
+        peaks[STAGE_COUNT] = std::max(peaks[STAGE_COUNT], stats.Peak());
+        if (bestNanoseconds[STAGE_COUNT] < 0 ||
+            nanoseconds < bestNanoseconds[STAGE_COUNT]) {
+            bestNanoseconds[STAGE_COUNT] = nanoseconds;
+        }
+    }
+
+    for (int i = 0; i <= STAGE_COUNT; ++i) {
+        BenchmarkResult result;
+        result.corpus = corpus;
+        result.bytes = input.length();
+        result.stage = i < STAGE_COUNT ? ALLOCATION_STAGE_NAMES[i] : "total";
+        result.nsPerByte = bestNanoseconds[i] / bytes;
+        result.allocations = allocations[i];
+        result.peakBytes = peaks[i];
+        results.push_back(result);
+    }
+    return true;
+}
+
+std::string BenchmarkKey(const BenchmarkResult& result) {
+    return result.corpus + " " + std::to_string(result.bytes) + " " +
+        result.stage;
+}
+
+// Baseline lines are "corpus bytes stage nsPerByte allocations peakBytes".
+// Blank lines and lines starting with # are skipped. Returns false if the
+// file can't be opened.
+bool ReadBenchmarkBaseline(const std::string& path,
+    std::map<std::string, BenchmarkResult>& baseline, std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = "Could not open baseline " + path;
+        return false;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        if (line.empty() || line[0] == '#' || line[0] == '\r') {
+            continue;
+        }
+        BenchmarkResult result;
+        std::istringstream fields(line);
+        if (!(fields >> result.corpus >> result.bytes >> result.stage >>
+            result.nsPerByte >> result.allocations >> result.peakBytes)) {
+            error = path + " line " + std::to_string(lineNumber) +
+                " is not \"corpus bytes stage nsPerByte allocations "
+                "peakBytes\"";
+            return false;
+        }
+        baseline[BenchmarkKey(result)] = result;
+    }
+    return true;
+}
+
+bool WriteBenchmarkBaseline(const std::string& path,
+    const std::vector<BenchmarkResult>& results) {
+    std::ofstream file(path, std::ios::binary);
+    file << "# ConvertToOFX performance baseline. Regenerate with:\n"
+        "#   ConvertToOFX.exe /benchmark benchmarks\\baseline.txt /update\n"
+        "# on the release build and the machine the gate runs on.\n"
+        "# corpus bytes stage nsPerByte allocations peakBytes\n";
+    for (const BenchmarkResult& result : results) {
+        char nsPerByte[32];
+        snprintf(nsPerByte, sizeof(nsPerByte), "%.4f", result.nsPerByte);
+        file << BenchmarkKey(result) << " " << nsPerByte << " " <<
+            result.allocations << " " << result.peakBytes << "\n";
+    }
+    return static_cast<bool>(file);
+}
+
+// "+12.3%" for how much now is over then
+std::string FormatChange(double now, double then) {
+    char change[32];
+    if (then <= 0) {
+        snprintf(change, sizeof(change), "%s", now > 0 ? "new" : "+0.0%");
+    }
+    else {
+        snprintf(change, sizeof(change), "%+.1f%%",
+            (now - then) * 100.0 / then);
+    }
+    return change;
+}
+
+// Compare a result with its baseline, adding a line to the report. Returns
+// true if it regressed.
+bool CompareBenchmarkResult(const BenchmarkResult& now,
+    const BenchmarkResult& then, double tolerance, std::string& report) {
+    const double limit = 1.0 + tolerance;
+    bool slower = now.nsPerByte > then.nsPerByte * limit &&
+        (now.nsPerByte - then.nsPerByte) * now.bytes >=
+        BENCHMARK_MIN_NANOSECONDS;
+    bool moreAllocations = now.allocations > then.allocations * limit &&
+        now.allocations - then.allocations >= BENCHMARK_MIN_ALLOCATIONS;
+    bool morePeak = now.peakBytes > then.peakBytes * limit &&
+        now.peakBytes - then.peakBytes >= BENCHMARK_MIN_PEAK_BYTES;
+
+    char line[256];
+    snprintf(line, sizeof(line),
+        "%-24s %10zu %-12s %9.3f ns/B %7s %9llu allocs %7s %11lld peak %7s",
+        now.corpus.c_str(), now.bytes, now.stage.c_str(), now.nsPerByte,
+        FormatChange(now.nsPerByte, then.nsPerByte).c_str(),
+        now.allocations, FormatChange(static_cast<double>(now.allocations),
+            static_cast<double>(then.allocations)).c_str(),
+        now.peakBytes, FormatChange(static_cast<double>(now.peakBytes),
+            static_cast<double>(then.peakBytes)).c_str());
+    report += line;
+    if (slower) {
+        report += "  SLOWER";
+    }
+    if (moreAllocations) {
+        report += "  MORE ALLOCATIONS";
+    }
+    if (morePeak) {
+        report += "  MORE MEMORY";
+    }
+    report += "\n";
+    return slower || moreAllocations || morePeak;
+}
+
+// ns/byte of a few stages by synthetic input size, to show how they scale.
+// A stage whose ns/byte keeps climbing with size is superlinear somewhere,
+// which a fixed-size benchmark within tolerance would never catch. Returns
+// true if a stage got more than SCALING_LIMIT times slower per byte from
+// the reference size to the largest size.
+bool ReportScalingCurve(const std::vector<BenchmarkResult>& results,
+    std::string& report) {
+    const char* const CHECKED_STAGES[] = { "fixXML", "prune", "total" };
+    std::vector<size_t> sizes;
+    for (const BenchmarkResult& result : results) {
+        if (result.corpus == "synthetic" && (sizes.empty() ||
+            sizes.back() != result.bytes)) {
+            sizes.push_back(result.bytes);
+        }
+    }
+
+    report += "\nScaling curve (ns/byte by synthetic input size):\n";
+    char cell[64];
+    snprintf(cell, sizeof(cell), "%-12s", "stage");
+    report += cell;
+    for (size_t bytes : sizes) {
+        snprintf(cell, sizeof(cell), " %11zu", bytes);
+        report += cell;
+    }
+    report += "\n";
+
+    bool superlinear = false;
+    for (const char* stage : CHECKED_STAGES) {
+        snprintf(cell, sizeof(cell), "%-12s", stage);
+        report += cell;
+        double reference = -1, largest = -1;
+        for (const BenchmarkResult& result : results) {
+            if (result.corpus != "synthetic" || result.stage != stage) {
+                continue;
+            }
+            snprintf(cell, sizeof(cell), " %11.3f", result.nsPerByte);
+            report += cell;
+            if (result.bytes >= SCALING_REFERENCE_SIZE && reference < 0) {
+                reference = result.nsPerByte;
+            }
+            largest = result.nsPerByte;
+        }
+        // Needs at least one size past the reference to say anything
+        if (reference > 0 && sizes.size() > 1 &&
+            sizes.back() > SCALING_REFERENCE_SIZE &&
+            largest > reference * SCALING_LIMIT) {
+            snprintf(cell, sizeof(cell), "  SUPERLINEAR (%.1fx)",
+                largest / reference);
+            report += cell;
+            superlinear = true;
+        }
+        report += "\n";
+    }
+    return superlinear;
+}
+
+// Fastest of POLICY_BENCHMARK_RUNS runs of measured, in nanoseconds. prepare
+// runs before each one and isn't timed.
+template <class Prepare, class Measured>
+double FastestRun(Prepare prepare, Measured measured) {
+    double fastest = -1;
+    for (int run = 0; run < POLICY_BENCHMARK_RUNS; ++run) {
+        prepare();
+        std::chrono::steady_clock::time_point started =
+            std::chrono::steady_clock::now();
+        measured();
+        double nanoseconds = static_cast<double>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - started).count());
+        if (fastest < 0 || nanoseconds < fastest) {
+            fastest = nanoseconds;
+        }
+    }
+    return fastest;
+}
+
+// One line of ReportPolicyVariants()
+void ReportPolicyVariant(const char* loop, const std::string& variant,
+    double fixed, double runtime, size_t bytes, bool same,
+    std::string& report) {
+    char line[160];
+    snprintf(line, sizeof(line), "%-8s %-22s %9.3f %9.3f %7.2fx%s\n", loop,
+        variant.c_str(), fixed / bytes, runtime / bytes,
+        fixed > 0 ? runtime / fixed : 0.0, same ? "" : "  DIFFERENT OUTPUT");
+    report += line;
+}
+
+// Time each fixed policy (see PrunePolicy) against RuntimePolicy, on the
+// loop it's for, and check that they give the same output. The timings are
+// only for reading, since there's nothing to compare them with, but a
+// variant that gives different output fails the run. Returns true if one
+// did.
+bool ReportPolicyVariants(size_t maxBytes, std::string& report) {
+    const size_t bytes = std::min(maxBytes, POLICY_BENCHMARK_SIZE);
+    const std::string input = MakeSyntheticQFX(bytes);
+    bool different = false;
+    report += "\nPolicy variants (ns/byte of the loop, fixed policy vs. "
+        "RuntimePolicy, " + std::to_string(bytes) + " byte input):\n";
+    char header[128];
+    snprintf(header, sizeof(header), "%-8s %-22s %9s %9s %8s\n", "loop",
+        "variant", "fixed", "runtime", "speedup");
+    report += header;
+
+    for (int trim = 0; trim < 2; ++trim) {
+        ConversionOptions options;
+        options.trimLines = trim != 0;
+        std::string fixedText, runtimeText;
+        double fixed = FastestRun([&fixedText] { fixedText.clear(); }, [&] {
+            if (options.trimLines) {
+                PolishLines<PolishPolicy<true>>(input, 0, options, fixedText);
+            }
+            else {
+                PolishLines<PolishPolicy<false>>(input, 0, options,
+                    fixedText);
+            }
+        });
+        double runtime = FastestRun([&runtimeText] { runtimeText.clear(); },
+            [&] { PolishLines<RuntimePolicy>(input, 0, options,
+                runtimeText); });
+        ReportPolicyVariant("polish", "trim=" + std::to_string(trim), fixed,
+            runtime, bytes, fixedText == runtimeText, report);
+        different = different || fixedText != runtimeText;
+    }
+
+    // Pruning needs XML, so convert once without deduping. That leaves the
+    // repeated memos for the deduping variants to find.
+    ConversionOptions keepMemos;
+    keepMemos.dedupeMemoField = false;
+    ConversionContext context(keepMemos);
+    std::string ready;
+    if (!ConvertQFXToOFX(input, context, ready)) {
+        report += "Could not make the pruning input: " +
+            context.diagnostics.ErrorText();
+        return true;
+    }
+    for (int variant = 0; variant < 4; ++variant) {
+        ConversionOptions options;
+        options.dedupeMemoField = (variant & 2) != 0;
+        options.normalizeAmountsAndDates = (variant & 1) != 0;
+        const TransactionPruner pruners[2] = {
+            ChooseTransactionPruner(options),
+            PruneTransactions<RuntimePolicy> };
+        double nanoseconds[2];
+        std::string printed[2];
+        for (int i = 0; i < 2; ++i) {
+            tinyxml2::XMLDocument doc;
+            tinyxml2::XMLElement* banktranlist = NULL;
+            nanoseconds[i] = FastestRun([&] {
+                doc.Parse(ready.c_str(), ready.length());
+                tinyxml2::XMLElement* element = NULL;
+                for (const std::string& name :
+                    TYPE_TO_BANKTRANLIST_MAP.at("BANKMSGSRSV1")) {
+                    element = element ?
+                        element->FirstChildElement(name.c_str()) :
+                        doc.FirstChildElement(name.c_str());
+                    if (!element) {
+                        break;
+                    }
+                }
+                banktranlist = element;
+            }, [&] {
+                if (banktranlist) {
+                    pruners[i](banktranlist, options, NULL, NULL);
+                }
+            });
+            tinyxml2::XMLPrinter printer;
+            doc.Print(&printer);
+            printed[i] = printer.CStr();
+        }
+        ReportPolicyVariant("prune", "dedupe=" +
+            std::to_string(options.dedupeMemoField) + " normalize=" +
+            std::to_string(options.normalizeAmountsAndDates), nanoseconds[0],
+            nanoseconds[1], ready.length(), printed[0] == printed[1], report);
+        different = different || printed[0] != printed[1];
+    }
+    return different;
+}
+
+// How many values a second ParseOFXAmount() and ParseOFXDateTime() get
+// through, on values like MakeSyntheticQFX() makes. Just for reading.
+void ReportParserSpeed(std::string& report) {
+    std::string amounts, dates;
+    std::vector<size_t> amountEnds, dateEnds;
+    amountEnds.reserve(PARSER_BENCHMARK_VALUES);
+    dateEnds.reserve(PARSER_BENCHMARK_VALUES);
+    uint32_t random = 12345;
+    char text[48];
+    for (size_t i = 0; i < PARSER_BENCHMARK_VALUES; ++i) {
+        random = random * 1103515245u + 12345u;
+        uint32_t r = random >> 8;
+        snprintf(text, sizeof(text), "%s%u.%02u", (r & 1) ? "-" : "",
+            (r >> 4) % 5000, (r >> 12) % 100);
+        amounts += text;
+        amountEnds.push_back(amounts.length());
+        snprintf(text, sizeof(text), "2019%02u%02u%02u%02u00.000[-5:EST]",
+            (r >> 3) % 12 + 1, (r >> 7) % 28 + 1, (r >> 2) % 24,
+            (r >> 5) % 60);
+        dates += text;
+        dateEnds.push_back(dates.length());
+    }
+
+    // The sums are stored before the clock stops, so the parsing can't be
+    // optimized away or moved out of the timing
+    volatile long long checksum = 0;
+    double amountNanoseconds = FastestRun([] {}, [&] {
+        long long sum = 0;
+        size_t start = 0;
+        for (size_t end : amountEnds) {
+            long long minorUnits;
+            if (ParseOFXAmount(amounts.data() + start, end - start,
+                minorUnits)) {
+                sum += minorUnits;
+            }
+            start = end;
+        }
+        checksum = sum;
+    });
+    double dateNanoseconds = FastestRun([] {}, [&] {
+        long long sum = 0;
+        size_t start = 0;
+        for (size_t end : dateEnds) {
+            long long epochSeconds;
+            if (ParseOFXDateTime(dates.data() + start, end - start,
+                epochSeconds)) {
+                sum += epochSeconds;
+            }
+            start = end;
+        }
+        checksum = sum;
+    });
+
+    char line[128];
+    snprintf(line, sizeof(line), "\nParsers (millions of values per "
+        "second):\nTRNAMT   %9.1f\nDTPOSTED %9.1f\n",
+        PARSER_BENCHMARK_VALUES / amountNanoseconds * 1000,
+        PARSER_BENCHMARK_VALUES / dateNanoseconds * 1000);
+    report += line;
+}
+
+// How much the default payee rules (see PayeeRules) add to a whole
+// conversion of the policy benchmark input, which has payees for them to
+// clean up. Just for reading, like ReportParserSpeed().
+void ReportPayeeRulesCost(size_t maxBytes, std::string& report) {
+    const size_t bytes = std::min(maxBytes, POLICY_BENCHMARK_SIZE);
+    const std::string input = MakeSyntheticQFX(bytes);
+    std::istringstream defaults(DEFAULT_PAYEE_RULES);
+    std::string error;
+    std::shared_ptr<PayeeRules> rules = std::make_shared<PayeeRules>();
+    if (!rules->Compile(defaults, error)) {
+        report += "\nThe default payee rules don't compile: " + error + "\n";
+        return;
+    }
+    ConversionOptions withRules;
+    withRules.payeeRules = rules;
+
+    double nanoseconds[2];
+    for (int on = 0; on < 2; ++on) {
+        const ConversionOptions options = on ? withRules :
+            ConversionOptions();
+        ConversionBuffers buffers;
+        std::string output;
+        nanoseconds[on] = FastestRun([&output] { output.clear(); }, [&] {
+            ConversionContext context(options);
+            ConvertQFXToOFX(input, context, buffers, output);
+        });
+    }
+
+    char line[160];
+    snprintf(line, sizeof(line), "\nPayee rules (ns/byte of a whole "
+        "conversion, %zu byte input):\noff %9.3f\non  %9.3f %+7.1f%%\n",
+        bytes, nanoseconds[0] / bytes, nanoseconds[1] / bytes,
+        nanoseconds[0] > 0 ? (nanoseconds[1] / nanoseconds[0] - 1) * 100 :
+        0.0);
+    report += line;
+}
+
+// Every .qfx file in directory, sorted so runs are comparable
+std::vector<std::string> FindCorpusFiles(const std::string& directory) {
+    std::vector<std::string> files;
+    WIN32_FIND_DATAA found;
+    HANDLE search = FindFirstFileA((directory + "\\*.qfx").c_str(), &found);
+    if (search == INVALID_HANDLE_VALUE) {
+        return files;
+    }
+    do {
+        if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            files.push_back(found.cFileName);
+        }
+    } while (FindNextFileA(search, &found));
+    FindClose(search);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Returns the exit code described above BenchmarkOptions
+int RunBenchmarks(const BenchmarkOptions& options, std::string& report) {
+    std::map<std::string, BenchmarkResult> baseline;
+    std::string error;
+    if (!options.update &&
+        !ReadBenchmarkBaseline(options.baselinePath, baseline, error)) {
+        report += error + "\n";
+        return 2;
+    }
+
+    std::vector<BenchmarkResult> results;
+    for (size_t bytes : BENCHMARK_SIZES) {
+        if (bytes > options.maxBytes) {
+            break;
+        }
+        if (!MeasureConversion("synthetic", MakeSyntheticQFX(bytes), results,
+            error)) {
+            report += error + "\n";
+            return 2;
+        }
+    }
+    // The same files once converted, which should take the passthrough.
+    // Converting makes them about twice as big.
+    for (size_t bytes : BENCHMARK_SIZES) {
+        if (bytes * 2 > options.maxBytes || bytes > READY_BENCHMARK_MAX) {
+            break;
+        }
+        ConversionContext context((ConversionOptions()));
+        std::string ready;
+        if (!ConvertQFXToOFX(MakeSyntheticQFX(bytes), context, ready)) {
+            report += "Could not make the ready corpus: " +
+                context.diagnostics.ErrorText();
+            return 2;
+        }
+        if (!MeasureConversion("ready", ready, results, error)) {
+            report += error + "\n";
+            return 2;
+        }
+    }
+    if (!options.corpusDirectory.empty()) {
+        for (const std::string& name :
+            FindCorpusFiles(options.corpusDirectory)) {
+            std::ifstream file(options.corpusDirectory + "\\" + name,
+                std::ios::binary);
+            std::string input((std::istreambuf_iterator<char>(file)),
+                std::istreambuf_iterator<char>());
+            if (input.length() > options.maxBytes) {
+                continue;
+            }
+            // The baseline is split on spaces
+            std::string corpus = name;
+            std::replace(corpus.begin(), corpus.end(), ' ', '_');
+            if (!MeasureConversion(corpus, input, results, error)) {
+                report += error + "\n";
+                return 2;
+            }
+        }
+    }
+
+    bool regressed = false;
+    int missing = 0;
+    char header[128];
+    snprintf(header, sizeof(header), "Per-stage results (tolerance %.1f%%):\n",
+        options.tolerance * 100);
+    report += header;
+    for (const BenchmarkResult& result : results) {
+        std::map<std::string, BenchmarkResult>::const_iterator then =
+            baseline.find(BenchmarkKey(result));
+        if (then == baseline.end()) {
+            BenchmarkResult none = result;
+            none.nsPerByte = 0;
+            none.allocations = 0;
+            none.peakBytes = 0;
+            CompareBenchmarkResult(result, none, options.tolerance, report);
+            ++missing;
+            continue;
+        }
+        if (CompareBenchmarkResult(result, then->second, options.tolerance,
+            report)) {
+            regressed = true;
+        }
+    }
+    if (ReportScalingCurve(results, report)) {
+        regressed = true;
+    }
+    if (ReportPolicyVariants(options.maxBytes, report)) {
+        regressed = true;
+    }
+    ReportParserSpeed(report);
+    ReportPayeeRulesCost(options.maxBytes, report);
+
+    if (options.update) {
+        if (!WriteBenchmarkBaseline(options.baselinePath, results)) {
+            report += "\nCould not write baseline " + options.baselinePath +
+                "\n";
+            return 2;
+        }
+        report += "\nWrote baseline " + options.baselinePath + "\n";
+        return 0;
+    }
+    if (baseline.empty()) {
+        // No baseline yet, so there is nothing to have regressed from. Don't
+        // fail every run until someone writes one.
+        report += "\nThe baseline has no results yet, so nothing was "
+            "compared with it. Run with /update on the machine that runs the "
+            "gate to write one.\n";
+    }
+    else if (missing > 0) {
+        // Something new to the baseline. Nothing to compare with is not a
+        // pass.
+        report += "\nFAILED: " + std::to_string(missing) + " results are "
+            "not in the baseline. Run with /update on the machine that runs "
+            "the gate to add them.\n";
+        return 1;
+    }
+    report += regressed ? "\nFAILED: performance regressed. See the lines "
+        "marked above.\n" : "\nPASSED\n";
+    return regressed ? 1 : 0;
+}
+
+// Print text to the console the program was started from, if any
+void WriteToConsole(const std::string& text) {
+    FILE* console;
+    if (AttachConsole(ATTACH_PARENT_PROCESS) &&
+        freopen_s(&console, "CONOUT$", "w", stdout) == 0) {
+        fputs(text.c_str(), stdout);
+        fflush(stdout);
+    }
+}
+
+// text in codePage. Characters it doesn't have become '?'.
+std::string FromWide(const std::wstring& text, UINT codePage) {
+    if (text.empty()) {
+        return std::string();
+    }
+    int count = WideCharToMultiByte(codePage, 0, text.data(),
+        static_cast<int>(text.length()), NULL, 0, NULL, NULL);
+    std::string converted(count, '\0');
+    if (count > 0) {
+        WideCharToMultiByte(codePage, 0, text.data(),
+            static_cast<int>(text.length()), &converted[0], count, NULL, NULL);
+    }
+    return converted;
+}
+
+// The command line in the ANSI code page, which is what the ...A functions
+// and narrow file streams take
+std::vector<std::string> CommandLineArguments(int argCount, LPWSTR* argv) {
+    std::vector<std::string> args;
+    for (int i = 0; i < argCount; ++i) {
+        args.push_back(FromWide(argv[i], CP_ACP));
+    }
+    return args;
+}
+
+// Read a number from the command line. The whole argument has to be a number
+// that isn't negative, so that a typo is a usage error rather than 0.
+bool ParseCommandLineNumber(const std::string& arg, double& value) {
+    char* end = NULL;
+    value = strtod(arg.c_str(), &end);
+    return !arg.empty() && end == arg.c_str() + arg.length() &&
+        value >= 0 && value < 1e12;
+}
+
+// Handle "/benchmark ..." (see above BenchmarkOptions) instead of showing
+// the window. Prints to the console we were started from, if any.
+int RunBenchmarkCommand(int argCount, LPWSTR* argv) {
+    const std::vector<std::string> args = CommandLineArguments(argCount,
+        argv);
+
+    BenchmarkOptions options;
+    bool usable = args.size() >= 3;
+    for (size_t i = 3; usable && i < args.size(); ++i) {
+        bool hasValue = i + 1 < args.size();
+        if (args[i] == "/update") {
+            options.update = true;
+        }
+        else if (args[i] == "/tolerance" && hasValue) {
+            double percent = 0;
+            usable = ParseCommandLineNumber(args[++i], percent);
+            options.tolerance = percent / 100.0;
+        }
+        else if (args[i] == "/maxmb" && hasValue) {
+            double megabytes = 0;
+            usable = ParseCommandLineNumber(args[++i], megabytes);
+            options.maxBytes = static_cast<size_t>(megabytes * 1024 * 1024);
+        }
+        else if (args[i] == "/corpus" && hasValue) {
+            options.corpusDirectory = args[++i];
+        }
+        else if (args[i] == "/out" && hasValue) {
+            options.resultsPath = args[++i];
+        }
+        else {
+            usable = false;
+        }
+    }
+
+    std::string report;
+    int exitCode = 2;
+    if (usable) {
+        options.baselinePath = args[2];
+        exitCode = RunBenchmarks(options, report);
+    }
+    else {
+        report = "Usage: ConvertToOFX.exe /benchmark BASELINE_FILE [/update] "
+            "[/tolerance PERCENT] [/maxmb MEGABYTES] [/corpus DIRECTORY] "
+            "[/out RESULTS_FILE]\n";
+    }
+
+    if (!options.resultsPath.empty()) {
+        std::ofstream results(options.resultsPath, std::ios::binary);
+        results << report;
+    }
+    WriteToConsole(report);
+    return exitCode;
+}
+
+// /index: build FILE.ofx.idx for an OFX file (or use it if it's up to date),
+// then look things up in the file through it. See OFXIndex.
+int RunIndexCommand(int argCount, LPWSTR* argv) {
+    const std::vector<std::string> args = CommandLineArguments(argCount,
+        argv);
+    const std::string query = args.size() >= 4 ? args[3] : "";
+    bool usable = args.size() == 3 ||
+        (args.size() == 5 && (query == "/fitid" || query == "/number" ||
+            query == "/account")) ||
+        (args.size() == 6 && query == "/dates");
+    if (!usable) {
+        WriteToConsole("Usage: ConvertToOFX.exe /index OFX_FILE "
+            "[/fitid FITID | /number N | /dates FROM TO | /account ACCTID]"
+            "\nDates are YYYYMMDD. Prints the matching <STMTTRN>s (or "
+            "statement) straight from the file.\n");
+        return 2;
+    }
+
+    // The files are opened by their wide names, which the ANSI code page
+    // may not be able to spell. args[2] is only for messages.
+    const std::string path = args[2];
+    const std::wstring widePath = argv[2];
+    const std::wstring indexPath = widePath + L".idx";
+    std::ifstream file(widePath.c_str(), std::ios::binary);
+    file.seekg(0, std::ios::end);
+    const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    if (!file) {
+        WriteToConsole("Could not open " + path + "\n");
+        return 2;
+    }
+    const uint64_t modified = LastWriteTime(widePath);
+    OFXIndex index;
+    std::string report;
+    std::ifstream saved(indexPath.c_str(), std::ios::binary);
+    if (!saved || !index.Load(saved, fileSize, modified)) {
+        std::vector<char> chunk(1024 * 1024);
+        file.seekg(0);
+        while (file) {
+            file.read(&chunk[0], chunk.size());
+            index.Feed(&chunk[0], static_cast<size_t>(file.gcount()));
+        }
+        index.Finish();
+        saved.close();
+        std::ofstream indexOut(indexPath.c_str(),
+            std::ios::binary | std::ios::trunc);
+        report = index.Save(indexOut, modified) ? "Indexed " + path + ".\n" :
+            "Could not save " + path + ".idx\n";
+    }
+
+    std::vector<uint32_t> found;
+    if (query == "/fitid" || query == "/account") {
+        // The output is UTF-8, so the key is looked for as UTF-8. Rule out
+        // hash collisions by checking the key itself.
+        const std::string wanted = FromWide(argv[4], CP_UTF8);
+        std::string escaped = EscapeXML(wanted.c_str());
+        std::string key;
+        for (uint32_t entry : index.FindKey(query == "/fitid" ?
+            INDEX_STMTTRN : INDEX_STATEMENT, wanted)) {
+            const OFXIndexEntry& e = index.Entries()[entry];
+            if (ReadFileBytes(file, e.keyOffset, e.keyLength, key) &&
+                key == escaped) {
+                found.push_back(entry);
+            }
+        }
+    }
+    else if (query == "/number") {
+        size_t n = static_cast<size_t>(strtoull(args[4].c_str(), NULL, 10));
+        if (n >= 1 && n <= index.TransactionCount()) {
+            found.push_back(static_cast<uint32_t>(
+                &index.Transaction(n - 1) - &index.Entries()[0]));
+        }
+    }
+    else if (query == "/dates") {
+        found = index.TransactionsPosted(atoi(args[4].c_str()),
+            atoi(args[5].c_str()));
+    }
+    else {
+        size_t statements = 0;
+        for (const OFXIndexEntry& entry : index.Entries()) {
+            statements += entry.kind == INDEX_STATEMENT && entry.length > 0;
+        }
+        report += std::to_string(statements) + " statements, " +
+            std::to_string(index.TransactionCount()) + " transactions.\n";
+        WriteToConsole(report);
+        return 0;
+    }
+
+    std::string bytes;
+    for (uint32_t entry : found) {
+        const OFXIndexEntry& e = index.Entries()[entry];
+        if (ReadFileBytes(file, e.offset, e.length, bytes)) {
+            report += bytes + "\n";
+        }
+    }
+    report += std::to_string(found.size()) + " found.\n";
+    WriteToConsole(report);
+    return found.empty() ? 1 : 0;
+}
+
+// Batch mode: convert many files from a command prompt, without the window.
+//
+//   ConvertToOFX.exe /batch OUTPUT_DIRECTORY INPUT... [/inflight FILES]
+//
+// Each INPUT is a .qfx file or a directory of them, and each one is saved
+// in OUTPUT_DIRECTORY under its own name with .ofx. The exit code is 0 if
+// every file converted, 1 if some didn't and 2 for a usage error, which
+// includes two inputs with the same name.
+//
+// Reading, converting and writing overlap (see BatchConverter), so the disk
+// stays busy while files are converted instead of sitting idle between
+// them. A file only appears under its name once all of it is on disk: it's
+// written as NAME.tmp, flushed and then renamed, so a crash can't leave half
+// an OFX file behind for Money to import.
+struct BatchFile {
+    std::string input;
+    std::string output;
+    std::string error;  // Why it wasn't converted, if it wasn't
+    size_t inputBytes = 0;
+    size_t outputBytes = 0;
+};
+
+struct BatchOptions {
+    size_t ioThreads = 4;
+    // Files read (or being read) but not written yet. The window keeps
+    // reads ahead of the converters without reading everything at once.
+    size_t maxInFlight = 32;
+    // ...and their bytes, so a few huge files don't use up all the memory.
+    // There's always at least one file in flight, however big.
+    size_t maxInFlightBytes = 512 * 1024 * 1024;
+    // How many written files to flush and rename together
+    size_t commitBatch = 32;
+};
+
+// How big path is, or 0 if it can't be found
+size_t FileSize(const std::string& path) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data)) {
+        return 0;
+    }
+    ULARGE_INTEGER size;
+    size.LowPart = data.nFileSizeLow;
+    size.HighPart = data.nFileSizeHigh;
+    return static_cast<size_t>(std::min<ULONGLONG>(size.QuadPart, SIZE_MAX));
+}
+
+// Read all of path into text
+bool ReadWholeFile(const std::string& path, std::string& text) {
+    HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    bool read = GetFileSizeEx(hFile, &size) && size.QuadPart < MAXDWORD;
+    if (read) {
+        text.resize(static_cast<size_t>(size.QuadPart));
+        DWORD bytesRead = 0;
+        read = text.empty() || (ReadFile(hFile, &text[0],
+            static_cast<DWORD>(text.length()), &bytesRead, NULL) &&
+            bytesRead == text.length());
+    }
+    CloseHandle(hFile);
+    return read;
+}
+
+// Write text to path + ".tmp", and leave it open for CommitFiles()
+HANDLE WriteTempFile(const std::string& path, const std::string& text) {
+    const std::string temp = path + ".tmp";
+    HANDLE hFile = CreateFileA(temp.c_str(), GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return hFile;
+    }
+    DWORD bytesWritten = 0;
+    if (!WriteFile(hFile, text.data(), static_cast<DWORD>(text.length()),
+        &bytesWritten, NULL) || bytesWritten != text.length()) {
+        CloseHandle(hFile);
+        DeleteFileA(temp.c_str());
+        return INVALID_HANDLE_VALUE;
+    }
+    return hFile;
+}
+
+// A temp file from WriteTempFile() and the file it's for
+struct WrittenFile {
+    size_t file;
+    HANDLE handle;
+};
+
+// Flush the written temp files to disk, then rename each into place. A
+// failed file gets an error and its temp file is deleted.
+void CommitFiles(std::vector<BatchFile>& files,
+    const std::vector<WrittenFile>& written) {
+    for (const WrittenFile& w : written) {
+        BatchFile& file = files[w.file];
+        const std::string temp = file.output + ".tmp";
+        bool flushed = FlushFileBuffers(w.handle) != 0;
+        CloseHandle(w.handle);
+        if (!flushed) {
+            file.error = "Could not write " + temp;
+        }
+        else if (!MoveFileExA(temp.c_str(), file.output.c_str(),
+            MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+            file.error = "Could not rename " + temp + " to " + file.output;
+        }
+        if (!file.error.empty()) {
+            DeleteFileA(temp.c_str());
+        }
+    }
+}
+
+// Convert one file's text. On failure, say why in error.
+bool ConvertBatchFile(const std::string& input,
+    const ConversionOptions& options, ConversionBuffers& buffers,
+    std::string& output, std::string& error) {
+    ConversionContext context(options);
+    if (ConvertQFXToOFX(input, context, buffers, output)) {
+        return true;
+    }
+    error = "Did not convert";
+    for (const ConversionMessage& message : context.diagnostics.messages) {
+        if (message.severity == ConversionMessage::MESSAGE_ERROR) {
+            error = message.title + ": " + message.text;
+            break;
+        }
+    }
+    return false;
+}
 
-                    // Display the file name to the user.
-                    if (SUCCEEDED(hr)) {
-                        pFileSave->Release();
-                        return pszFilePath;
-                        //CoTaskMemFree(pszFilePath);
-                    }
-                    pItem->Release();
-                }
-            }
-            pFileSave->Release();
+// Convert files the way the window does: read one, convert it, write it,
+// and only then start on the next one. The benchmark compares
+// BatchConverter with this.
+void ConvertFilesOneAtATime(std::vector<BatchFile>& files,
+    const ConversionOptions& options) {
+    ConversionBuffers buffers;
+    std::string input;
+    std::string output;
+    for (size_t i = 0; i < files.size(); ++i) {
+        BatchFile& file = files[i];
+        if (!ReadWholeFile(file.input, input)) {
+            file.error = "Could not read " + file.input;
+            continue;
         }
-        CoUninitialize();
+        file.inputBytes = input.length();
+        if (!ConvertBatchFile(input, options, buffers, output, file.error)) {
+            continue;
+        }
+        HANDLE handle = WriteTempFile(file.output, output);
+        if (handle == INVALID_HANDLE_VALUE) {
+            file.error = "Could not write " + file.output + ".tmp";
+            continue;
+        }
+        file.outputBytes = output.length();
+        CommitFiles(files, std::vector<WrittenFile>(1, { i, handle }));
     }
-    return pszFilePath;
 }
 
-// Prompt the user to select a file to open and return that file name.
-PWSTR OpenFileWindow() {
-    HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED |
-        COINIT_DISABLE_OLE1DDE);
-    wchar_t tmp[1] = L"";
-    PWSTR pszFilePath = tmp;
-    if (SUCCEEDED(hr)) {
-        IFileOpenDialog* pFileOpen;
+// Converts a batch of files with reading, converting and writing
+// overlapped. A few I/O threads read files ahead (within the in-flight
+// window of BatchOptions) and write the converted ones; writes go first,
+// since they free memory. The converters, one per core, take each file's
+// text as soon as it's read and convert it where it is, keeping their
+// ConversionBuffers warm from one file to the next. Written files are
+// flushed and renamed in batches by whichever I/O thread fills a batch,
+// while the others carry on.
+class BatchConverter {
+public:
+    BatchConverter(const ConversionOptions& conversion,
+        const BatchOptions& options)
+        : conversion(conversion), options(options) {}
+
+    // Convert files, setting each one's sizes or error
+    void Run(std::vector<BatchFile>& files);
+
+private:
+    struct Job {
+        size_t file;
+        std::string text;  // What was read, and then what to write
+    };
+
+    // A file's bytes count against the window from before it's read, so
+    // the reads under way can't take it past maxInFlightBytes
+    bool CanRead() const {
+        return nextRead < files->size() &&
+            inFlight < options.maxInFlight &&
+            (inFlight == 0 || inFlightBytes + sizes[nextRead] <=
+                options.maxInFlightBytes);
+    }
+    void IOWork();
+    void ConvertWork();
+
+    const ConversionOptions conversion;
+    const BatchOptions options;
+    std::vector<BatchFile>* files = NULL;
+    std::vector<size_t> sizes;  // Each file's size before it's read
+
+    // Everything below is guarded by mutex
+    std::mutex mutex;
+    std::condition_variable ioReady;
+    std::condition_variable convertReady;
+    size_t nextRead = 0;
+    size_t reading = 0;  // Reads under way
+    size_t inFlight = 0;
+    size_t inFlightBytes = 0;
+    size_t unwritten = 0;  // Files not written or given up on yet
+    std::deque<Job> toConvert;
+    std::deque<Job> toWrite;
+    std::vector<WrittenFile> toCommit;
+};
 
-        // Create the FileOpenDialog object.
-        hr = CoCreateInstance(CLSID_FileOpenDialog, NULL, CLSCTX_ALL,
-            IID_IFileOpenDialog, reinterpret_cast<void**>(&pFileOpen));
+void BatchConverter::Run(std::vector<BatchFile>& batch) {
+    files = &batch;
+    nextRead = 0;
+    reading = 0;
+    inFlight = 0;
+    inFlightBytes = 0;
+    unwritten = batch.size();
+    sizes.clear();
+    for (const BatchFile& file : batch) {
+        sizes.push_back(FileSize(file.input));
+    }
 
-        if (SUCCEEDED(hr)) {
-            // Show the Open dialog box.
-            hr = pFileOpen->Show(NULL);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::max<size_t>(options.ioThreads, 1); ++i) {
+        threads.push_back(std::thread(&BatchConverter::IOWork, this));
+    }
+    size_t converters = std::thread::hardware_concurrency();
+    for (size_t i = 1; i < converters; ++i) {
+        threads.push_back(std::thread(&BatchConverter::ConvertWork, this));
+    }
+    ConvertWork();  // This thread helps out too
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    // The last files, which didn't fill a batch
+    CommitFiles(batch, toCommit);
+    toCommit.clear();
+    files = NULL;
+    sizes.clear();
+}
 
-            // Get the file name from the dialog box.
-            if (SUCCEEDED(hr)) {
-                IShellItem* pItem;
-                hr = pFileOpen->GetResult(&pItem);
-                if (SUCCEEDED(hr)) {
-                    hr = pItem->GetDisplayName(SIGDN_FILESYSPATH,
-                        &pszFilePath);
-                    // Display the file name to the user.
-                    if (SUCCEEDED(hr)) {
-                        return pszFilePath;
-                    }
-                    pItem->Release();
-                }
+void BatchConverter::IOWork() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        ioReady.wait(lock, [this]() {
+            return !toWrite.empty() || CanRead() || unwritten == 0;
+        });
+        if (!toWrite.empty()) {
+            Job job = std::move(toWrite.front());
+            toWrite.pop_front();
+            lock.unlock();
+            BatchFile& file = (*files)[job.file];
+            HANDLE handle = WriteTempFile(file.output, job.text);
+            const size_t bytes = job.text.length();
+            job.text = std::string();  // Give the memory back now
+            lock.lock();
+            --inFlight;
+            inFlightBytes -= bytes;
+            --unwritten;
+            if (handle == INVALID_HANDLE_VALUE) {
+                file.error = "Could not write " + file.output + ".tmp";
             }
-            pFileOpen->Release();
+            else {
+                file.outputBytes = bytes;
+                toCommit.push_back({ job.file, handle });
+            }
+            if (toCommit.size() >= options.commitBatch) {
+                std::vector<WrittenFile> batch;
+                batch.swap(toCommit);
+                lock.unlock();
+                CommitFiles(*files, batch);
+                lock.lock();
+            }
+            ioReady.notify_all();
+        }
+        else if (CanRead()) {
+            Job job = { nextRead++, std::string() };
+            const size_t reserved = sizes[job.file];
+            ++reading;
+            ++inFlight;
+            inFlightBytes += reserved;
+            lock.unlock();
+            BatchFile& file = (*files)[job.file];
+            bool read = ReadWholeFile(file.input, job.text);
+            lock.lock();
+            --reading;
+            // The file may have changed size since Run() looked
+            inFlightBytes -= reserved;
+            if (read) {
+                file.inputBytes = job.text.length();
+                inFlightBytes += job.text.length();
+                toConvert.push_back(std::move(job));
+            }
+            else {
+                file.error = "Could not read " + file.input;
+                --inFlight;
+                --unwritten;
+                ioReady.notify_all();
+            }
+            // Wake a converter, or all of them if that was the last read
+            if (nextRead == files->size() && reading == 0) {
+                convertReady.notify_all();
+            }
+            else {
+                convertReady.notify_one();
+            }
+        }
+        else {
+            return;  // Everything is written
         }
-        CoUninitialize();
     }
-    return pszFilePath;
 }
 
-// Send the OFX output to the MS Money Import Handler
-void SendToMoneyImportHandler(HWND hWnd) {
-    // Save the OFX as a temporary file and then call msmnyimprt.exe with
-    // that file as a parameter.
-    // The MS Money Import Handler appears to be very simple, and we could
-    // probably replicate the code here. It appears to do the following:
-    // 1) Create a temporary file with the OFX
-    // 2) Update Registry keys that point to that file
-    // 3) Prompt the user to start Money. Then Money processes the file and
-    //    deletes it and clears the registry key.
-    // Since mnyimprt.exe just works, we'll avoid doing that for now.
-
-    // First get the OFX text. Make sure it is not empty.
-    HWND hOfx = GetDlgItem(hWnd, IDC_OFX_EDIT);
-    std::string inputText;
-    int len = GetWindowTextLength(hOfx) + 1;
-    if (len == 1) {
-        MessageBox(hWnd,
-            _T("OFX Text is empty. Nothing to Import!"),
-            _T("Error"),
-            MB_OK | MB_ICONERROR);
-        return;
+void BatchConverter::ConvertWork() {
+    ConversionBuffers buffers;
+    std::string output;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        convertReady.wait(lock, [this]() {
+            return !toConvert.empty() ||
+                (nextRead == files->size() && reading == 0);
+        });
+        if (toConvert.empty()) {
+            return;  // Everything is read and taken
+        }
+        Job job = std::move(toConvert.front());
+        toConvert.pop_front();
+        lock.unlock();
+        BatchFile& file = (*files)[job.file];
+        std::string error;
+        bool converted = ConvertBatchFile(job.text, conversion, buffers,
+            output, error);
+        const size_t inputBytes = job.text.length();
+        // The job takes the output to the writer. The input's memory goes
+        // to the next conversion's output.
+        job.text.swap(output);
+        output.clear();
+        lock.lock();
+        inFlightBytes -= inputBytes;
+        if (converted) {
+            inFlightBytes += job.text.length();
+            toWrite.push_back(std::move(job));
+        }
+        else {
+            file.error = error;
+            --inFlight;
+            --unwritten;
+        }
+        ioReady.notify_all();
     }
-    std::vector<wchar_t> buf(len);
-    GetWindowText(hOfx, &buf[0], len);
-    std::wstring wide = &buf[0];
-    if (std::equal(buf.begin(), buf.end(), std::begin(OFX_DEFAULT_TEXT))) {
-        MessageBox(hWnd,
-            _T("OFX Text is not valid. "
-                "The right text pane needs to be updated!"),
-            _T("Error"),
-            MB_OK | MB_ICONERROR);
-        return;
+}
+
+// Make directory if it isn't there already
+bool MakeDirectory(const std::string& directory) {
+    return CreateDirectoryA(directory.c_str(), NULL) ||
+        GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+// How long converting files takes, and how much of it there was
+std::string DescribeBatch(const std::vector<BatchFile>& files,
+    double seconds) {
+    size_t converted = 0;
+    double megabytes = 0;
+    for (const BatchFile& file : files) {
+        converted += file.error.empty();
+        megabytes += file.inputBytes / (1024.0 * 1024.0);
     }
-    std::string ofxText(wide.begin(), wide.end());
+    char line[160];
+    snprintf(line, sizeof(line), "%zu of %zu files, %.1f MB in %.2f s: "
+        "%.0f files/s, %.1f MB/s", converted, files.size(), megabytes,
+        seconds, files.size() / std::max(seconds, 1e-9),
+        megabytes / std::max(seconds, 1e-9));
+    return line;
+}
 
-    // The OFX needs to be in a temporary file for the MS Money Import Handler
-    // to process it.
-    DWORD dwRetVal = 0;
-    TCHAR tmpFileName[MAX_PATH];
-    TCHAR tmpFilePath[MAX_PATH];
-    // Get the Temorary File Directory
-    dwRetVal = GetTempPath(MAX_PATH, tmpFilePath);
-    if (dwRetVal > MAX_PATH || (dwRetVal == 0)) {
-        MessageBox(hWnd,
-            _T("Error Getting Temporary File Path. Alternatively, you should "
-                "save the OFX data and open that file with the Money "
-                "Import Handler."),
-            _T("Error"),
-            MB_OK | MB_ICONERROR);
-        return;
+// Handle "/batch ..." (see above BatchFile)
+int RunBatchCommand(int argCount, LPWSTR* argv) {
+    const std::vector<std::string> args = CommandLineArguments(argCount,
+        argv);
+
+    BatchOptions options;
+    std::vector<std::string> inputs;
+    bool usable = args.size() >= 4;
+    for (size_t i = 3; usable && i < args.size(); ++i) {
+        if (args[i] == "/inflight" && i + 1 < args.size()) {
+            options.maxInFlight = std::max(atoi(args[++i].c_str()), 1);
+        }
+        else if (args[i][0] == '/') {
+            usable = false;
+        }
+        else {
+            inputs.push_back(args[i]);
+        }
     }
-    // Get a Temporary File Name inside the temp directory
-    dwRetVal = GetTempFileName(tmpFilePath,  // directory for tmp files
-        _T("ofx"),  // temp file name prefix, only first 3 letters used! 
-        0,
-        tmpFileName);
-    if (dwRetVal == 0) {
-        MessageBox(hWnd,
-            _T("Unable to get Temporary File Name. Alternatively, you should "
-                "save the OFX data and open that file with the Money Import "
-                "Handler"),
-            _T("Error"),
-            MB_OK | MB_ICONERROR);
-        return;
+    if (!usable || inputs.empty()) {
+        WriteToConsole("Usage: ConvertToOFX.exe /batch OUTPUT_DIRECTORY "
+            "INPUT... [/inflight FILES]\nEach INPUT is a .qfx file or a "
+            "directory of them.\n");
+        return 2;
+    }
+    const std::string outputDirectory = args[2];
+    if (!MakeDirectory(outputDirectory)) {
+        WriteToConsole("Could not make " + outputDirectory + "\n");
+        return 2;
     }
-    // Write out temporary file
-    WriteOutFile(tmpFileName, hWnd);
 
-    // Call the Import Handler with the file. The Import Handler, under the 
-    // hood, appears to create another copy of the file and update two
-    // Registry keys. When Money starts, it processes these keys and 
-    // subsequently the file(s) before deleting them.
-    SHELLEXECUTEINFO ShExecInfo;
-    ShExecInfo.cbSize = sizeof(SHELLEXECUTEINFO);
-    ShExecInfo.fMask = SEE_MASK_NOCLOSEPROCESS;
-    ShExecInfo.hwnd = hWnd;
-    ShExecInfo.lpVerb = L"open";
-    ShExecInfo.lpFile = IMPORT_HANDLER_EXE.c_str();
-    ShExecInfo.lpParameters = tmpFileName;
-    ShExecInfo.lpDirectory = NULL;
-    ShExecInfo.nShow = SW_SHOWNORMAL;
-    ShExecInfo.hInstApp = NULL;
-    ShellExecuteEx(&ShExecInfo);
-    // We want to wait before proceeding
-    WaitForSingleObject(ShExecInfo.hProcess, INFINITE);
-    CloseHandle(ShExecInfo.hProcess);
-
-    int retVal = (int)ShExecInfo.hInstApp;
-    if (retVal == 2) {
-        // Import Handler EXE was not found
-        std::wstring errorMsg = L"Error: Do you need to change the location "
-            "of the Money Import Handler? Could not locate the "
-            "MS Money Import Handler at: ";
-        errorMsg += IMPORT_HANDLER_EXE;
-        MessageBox(hWnd, errorMsg.c_str(), _T("Error"), MB_OK | MB_ICONERROR);
+    std::vector<BatchFile> files;
+    for (const std::string& input : inputs) {
+        DWORD attributes = GetFileAttributesA(input.c_str());
+        std::vector<std::string> paths;
+        if (attributes != INVALID_FILE_ATTRIBUTES &&
+            (attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            for (const std::string& name : FindCorpusFiles(input)) {
+                paths.push_back(input + "\\" + name);
+            }
+        }
+        else {
+            paths.push_back(input);
+        }
+        for (const std::string& path : paths) {
+            BatchFile file;
+            file.input = path;
+            size_t slash = path.find_last_of("\\/");
+            std::string name = slash == std::string::npos ? path :
+                path.substr(slash + 1);
+            size_t extension = name.rfind('.');
+            if (extension != std::string::npos && extension > 0) {
+                name.erase(extension);
+            }
+            file.output = outputDirectory + "\\" + name + ".ofx";
+            files.push_back(file);
+        }
     }
 
-    // Finally, delete the temporary file if one was created
-    if (!DeleteFile(tmpFileName)) {
-        std::wstring warnMsg =
-            L"Warning: Could not delete the temporary file. "
-            "You may want to delete the file manually. File was created at: ";
-        warnMsg += tmpFileName;
-        MessageBox(hWnd,
-            warnMsg.c_str(),
-            _T("Warning: Did Not Remove Temp File"),
-            MB_OK | MB_ICONWARNING);
+    // Two inputs with the same name (in different directories, or as a.qfx
+    // and a.QFX) would be written to the same output at the same time.
+    // Windows names don't care about case, so neither does this.
+    std::map<std::string, const BatchFile*> outputs;
+    std::string clashes;
+    for (const BatchFile& file : files) {
+        std::string key = file.output;
+        std::transform(key.begin(), key.end(), key.begin(),
+            [](unsigned char c) { return static_cast<char>(tolower(c)); });
+        auto added = outputs.insert(std::make_pair(key, &file));
+        if (!added.second) {
+            clashes += added.first->second->input + " and " + file.input +
+                " would both be saved as " + file.output + "\n";
+        }
+    }
+    if (!clashes.empty()) {
+        WriteToConsole(clashes + "Nothing was converted. Rename the inputs "
+            "or convert them to different directories.\n");
+        return 2;
     }
 
-    return;
+    std::chrono::steady_clock::time_point started =
+        std::chrono::steady_clock::now();
+    BatchConverter converter(settings, options);
+    converter.Run(files);
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - started).count();
+
+    std::string report;
+    bool failed = false;
+    for (const BatchFile& file : files) {
+        if (!file.error.empty()) {
+            report += "FAILED " + file.input + ": " + file.error + "\n";
+            failed = true;
+        }
+    }
+    report += "Converted " + DescribeBatch(files, seconds) + "\n";
+    WriteToConsole(report);
+    return failed ? 1 : 0;
 }
 
-// For those special people out there that have mnyimprt.exe elsewhere
-// This change does not persist, so one improvement is to persist the value.
-void ChangeImportHandlerLocation(HWND hWnd) {
-    std::string msg = "Select a different location for mnyimprt.exe. You will "
-        "need to do this every time you use this program, as the new location "
-        "is NOT saved. I recommend you manually create the folder structure "
-        "and copy mnyimprt.exe to: "
-        "C:\\Program Files(x86)\\Microsoft Money Plus\\MNYCoreFiles\\mnyimprt.exe";
-    MessageBoxA(hWnd,
-        msg.c_str(),
-        "FYI",
-        MB_OK | MB_ICONINFORMATION);
-    PWSTR NEW_IMPORT_HANDLER_EXE = OpenFileWindow();
-    if (NEW_IMPORT_HANDLER_EXE[0] != L'\0') {  // Ensure user didn't hit Cancel
-        IMPORT_HANDLER_EXE = NEW_IMPORT_HANDLER_EXE;
+// /batchbenchmark: how much overlapping I/O with conversion gains, on
+// thousands of small files and on a few huge ones. The made-up files are
+// written to SCRATCH_DIRECTORY, then converted one at a time and with
+// BatchConverter. Both runs read from the OS's file cache, since the files
+// were just written, so this understates the gain on a cold disk.
+int RunBatchBenchmarkCommand(int argCount, LPWSTR* argv) {
+    const std::vector<std::string> args = CommandLineArguments(argCount,
+        argv);
+    size_t maxBytes = 100 * 1024 * 1024;
+    bool usable = args.size() == 3 ||
+        (args.size() == 5 && args[3] == "/maxmb");
+    if (args.size() == 5) {
+        double megabytes = 0;
+        usable = usable && ParseCommandLineNumber(args[4], megabytes);
+        maxBytes = static_cast<size_t>(megabytes * 1024 * 1024);
+    }
+    if (!usable || maxBytes == 0) {
+        WriteToConsole("Usage: ConvertToOFX.exe /batchbenchmark "
+            "SCRATCH_DIRECTORY [/maxmb MEGABYTES]\nThe huge files are "
+            "MEGABYTES each (100 by default).\n");
+        return 2;
+    }
+    const std::string scratch = args[2];
+    const struct {
+        const char* name;
+        size_t count;
+        size_t bytes;
+    } CORPORA[] = { { "small", 2000, 10 * 1024 }, { "huge", 3, maxBytes } };
+
+    std::string report;
+    for (const auto& corpus : CORPORA) {
+        const std::string directory = scratch + "\\" + corpus.name;
+        if (!MakeDirectory(scratch) || !MakeDirectory(directory) ||
+            !MakeDirectory(directory + "\\out")) {
+            WriteToConsole("Could not make " + directory + "\n");
+            return 2;
+        }
+        const std::string qfx = MakeSyntheticQFX(corpus.bytes);
+        std::vector<BatchFile> files(corpus.count);
+        for (size_t i = 0; i < corpus.count; ++i) {
+            const std::string name = std::to_string(i);
+            files[i].input = directory + "\\" + name + ".qfx";
+            files[i].output = directory + "\\out\\" + name + ".ofx";
+            std::ofstream out(files[i].input, std::ios::binary);
+            if (!out.write(qfx.data(), qfx.length())) {
+                WriteToConsole("Could not write " + files[i].input + "\n");
+                return 2;
+            }
+        }
+
+        double seconds[2];
+        for (int pipelined = 0; pipelined < 2; ++pipelined) {
+            std::vector<BatchFile> run = files;
+            std::chrono::steady_clock::time_point started =
+                std::chrono::steady_clock::now();
+            if (pipelined) {
+                BatchConverter(ConversionOptions(), BatchOptions()).Run(run);
+            }
+            else {
+                ConvertFilesOneAtATime(run, ConversionOptions());
+            }
+            seconds[pipelined] = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - started).count();
+            for (const BatchFile& file : run) {
+                if (!file.error.empty()) {
+                    WriteToConsole(report + file.input + ": " + file.error +
+                        "\n");
+                    return 2;
+                }
+            }
+            report += std::string(corpus.name) +
+                (pipelined ? " overlapped:   " : " one at a time: ") +
+                DescribeBatch(run, seconds[pipelined]) + "\n";
+        }
+        char speedup[64];
+        snprintf(speedup, sizeof(speedup), "%s speedup: %.2fx\n\n",
+            corpus.name, seconds[0] / std::max(seconds[1], 1e-9));
+        report += speedup;
     }
+    WriteToConsole(report);
+    return 0;
 }
 
 // Main Window callback
@@ -1079,6 +3031,11 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
     case WM_CREATE: {
         GetClientRect(hWnd, &rcClient);
 
+        importQueue.reset(new ImportQueue(shellImportLauncher,
+            IMPORT_TIMEOUT_MILLISECONDS, [hWnd](unsigned id) {
+                PostMessage(hWnd, WM_IMPORT_FINISHED, id, 0);
+            }));
+
         // Input / Source File window
         hEdit = CreateWindowEx(WS_EX_CLIENTEDGE, L"EDIT", INPUT_DEFAULT_TEXT,
             WS_CHILD | WS_VISIBLE | WS_VSCROLL | WS_HSCROLL | ES_MULTILINE |
@@ -1202,6 +3159,10 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         PostQuitMessage(0);
         break;
     }
+    case WM_IMPORT_FINISHED: {
+        ImportFinished(hWnd, (unsigned)wParam);
+        break;
+    }
     case WM_COMMAND: {
         // A Menu Item was selected
         switch (LOWORD(wParam)) {
@@ -1235,10 +3196,58 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             WriteOutFile(filename, hWnd);
             break;
         }
+        case ID_ACTIONS_SAVE_SPLIT_BY_ACCOUNT: {
+            SaveOFXSplitByAccount(hWnd);
+            break;
+        }
         case ID_ACTIONS_SEND_TO_MONEY: {
             SendToMoneyImportHandler(hWnd);
             break;
         }
+        case ID_ACTIONS_VALIDATE_OFX: {
+            ValidateOFXWindow(hWnd);
+            break;
+        }
+        case ID_ACTIONS_SHOW_REPORT: {
+            MessageBoxA(hWnd,
+                lastConversionReport.empty() ?
+                    "Nothing has been converted yet." :
+                    lastConversionReport.c_str(),
+                "Last Conversion Report",
+                MB_OK | MB_ICONINFORMATION);
+            break;
+        }
+        case ID_ACTIONS_SAVE_DIFFERENCES: {
+            SaveConversionDifferences(hWnd);
+            break;
+        }
+        case ID_VIEW_NEXT_PAGE:
+        case ID_VIEW_PREVIOUS_PAGE:
+        case ID_VIEW_FIRST_PAGE:
+        case ID_VIEW_LAST_PAGE: {
+            TurnPage(hWnd, LOWORD(wParam));
+            break;
+        }
+        case ID_ACTIONS_SHOW_IMPORT_QUEUE: {
+            ShowImportQueue(hWnd);
+            break;
+        }
+        case ID_ACTIONS_CONVERT_LARGE_FILE: {
+            ConvertLargeFile(hWnd);
+            break;
+        }
+        case ID_ACTIONS_CONVERT_CSV_FILE: {
+            ConvertCSVFile(hWnd);
+            break;
+        }
+        case ID_ACTIONS_CONVERT_QIF_FILE: {
+            ConvertQIFFile(hWnd);
+            break;
+        }
+        case ID_ACTIONS_EXPORT_TRANSACTIONS: {
+            ExportTransactions(hWnd);
+            break;
+        }
         case ID_HELP_ABOUT: {
             std::wstring aboutUrl =
                 L"http://www.norcalico.com/ConvertToOFX/about/" +
@@ -1277,39 +3286,108 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         case ID_CONFIG_DEDUPE_MEMO: {
             HMENU mainMenu = GetMenu(hWnd);
             HMENU configSubMenu = GetSubMenu(mainMenu, 2);
-            if (dedupeMemoField) {
+            if (settings.dedupeMemoField) {
                 // Option was previously selected, so disable it
                 CheckMenuItem(configSubMenu, 
                               ID_CONFIG_DEDUPE_MEMO,
                               MF_UNCHECKED);
-                dedupeMemoField = false;
+                settings.dedupeMemoField = false;
             }
             else {
                 // Option was previously unselected, so enable it
                 CheckMenuItem(configSubMenu,
                               ID_CONFIG_DEDUPE_MEMO,
                               MF_CHECKED);
-                dedupeMemoField = true;
+                settings.dedupeMemoField = true;
             }
             break;
         }
         case ID_CONFIG_TRIM_LINES: {
             HMENU mainMenu = GetMenu(hWnd);
             HMENU configSubMenu = GetSubMenu(mainMenu, 2);
-            if (trimLines) {
+            if (settings.trimLines) {
                 // Option was previously selected, so disable it
                 CheckMenuItem(configSubMenu,
                     ID_CONFIG_TRIM_LINES,
                     MF_UNCHECKED);
-                trimLines = false;
+                settings.trimLines = false;
             }
             else {
                 // Option was previously unselected, so enable it
                 CheckMenuItem(configSubMenu,
                     ID_CONFIG_TRIM_LINES,
                     MF_CHECKED);
-                trimLines = true;
+                settings.trimLines = true;
+            }
+            break;
+        }
+        case ID_CONFIG_NORMALIZE_AMOUNTS_DATES: {
+            HMENU mainMenu = GetMenu(hWnd);
+            HMENU configSubMenu = GetSubMenu(mainMenu, 2);
+            settings.normalizeAmountsAndDates =
+                !settings.normalizeAmountsAndDates;
+            CheckMenuItem(configSubMenu,
+                ID_CONFIG_NORMALIZE_AMOUNTS_DATES,
+                settings.normalizeAmountsAndDates ?
+                    MF_CHECKED : MF_UNCHECKED);
+            break;
+        }
+        case ID_CONFIG_SORT_AND_DEDUPE: {
+            HMENU mainMenu = GetMenu(hWnd);
+            HMENU configSubMenu = GetSubMenu(mainMenu, 2);
+            settings.sortAndDedupeTransactions =
+                !settings.sortAndDedupeTransactions;
+            CheckMenuItem(configSubMenu,
+                ID_CONFIG_SORT_AND_DEDUPE,
+                settings.sortAndDedupeTransactions ?
+                    MF_CHECKED : MF_UNCHECKED);
+            break;
+        }
+        case ID_CONFIG_MEASURE_ALLOCATIONS: {
+            HMENU mainMenu = GetMenu(hWnd);
+            HMENU configSubMenu = GetSubMenu(mainMenu, 2);
+            measureAllocations = !measureAllocations;
+            CheckMenuItem(configSubMenu,
+                ID_CONFIG_MEASURE_ALLOCATIONS,
+                measureAllocations ? MF_CHECKED : MF_UNCHECKED);
+            break;
+        }
+        case ID_CONFIG_SAVE_INDEX: {
+            HMENU mainMenu = GetMenu(hWnd);
+            HMENU configSubMenu = GetSubMenu(mainMenu, 2);
+            saveTransactionIndex = !saveTransactionIndex;
+            CheckMenuItem(configSubMenu,
+                ID_CONFIG_SAVE_INDEX,
+                saveTransactionIndex ? MF_CHECKED : MF_UNCHECKED);
+            break;
+        }
+        case ID_CONFIG_CLEAN_UP_PAYEES: {
+            HMENU mainMenu = GetMenu(hWnd);
+            HMENU configSubMenu = GetSubMenu(mainMenu, 2);
+            if (settings.payeeRules) {
+                settings.payeeRules.reset();
+            }
+            else {
+                LoadPayeeRules(hWnd);
             }
+            CheckMenuItem(configSubMenu,
+                ID_CONFIG_CLEAN_UP_PAYEES,
+                settings.payeeRules ? MF_CHECKED : MF_UNCHECKED);
+            break;
+        }
+        case ID_CONFIG_COMPARE_WITH_INPUT: {
+            HMENU mainMenu = GetMenu(hWnd);
+            HMENU configSubMenu = GetSubMenu(mainMenu, 2);
+            compareWithInput = !compareWithInput;
+            CheckMenuItem(configSubMenu,
+                ID_CONFIG_COMPARE_WITH_INPUT,
+                compareWithInput ? MF_CHECKED : MF_UNCHECKED);
+            break;
+        }
+        case ID_CONFIG_MEMORY_CAP_16MB:
+        case ID_CONFIG_MEMORY_CAP_64MB:
+        case ID_CONFIG_MEMORY_CAP_256MB: {
+            SetBoundedMemoryCap(hWnd, LOWORD(wParam));
             break;
         }
         default:
@@ -1334,6 +3412,21 @@ int CALLBACK WinMain(
     _In_ LPSTR     lpCmdLine,
     _In_ int       nCmdShow
 ) {
+    int argCount;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLine(), &argCount);
+    if (argCount >= 2 && std::wstring(argv[1]) == L"/benchmark") {
+        return RunBenchmarkCommand(argCount, argv);
+    }
+    if (argCount >= 2 && std::wstring(argv[1]) == L"/index") {
+        return RunIndexCommand(argCount, argv);
+    }
+    if (argCount >= 2 && std::wstring(argv[1]) == L"/batch") {
+        return RunBatchCommand(argCount, argv);
+    }
+    if (argCount >= 2 && std::wstring(argv[1]) == L"/batchbenchmark") {
+        return RunBatchBenchmarkCommand(argCount, argv);
+    }
+
     WNDCLASSEX wcex;
     wcex.cbSize = sizeof(WNDCLASSEX);
     wcex.style = CS_HREDRAW | CS_VREDRAW;
@@ -1389,14 +3482,12 @@ int CALLBACK WinMain(
     UpdateWindow(hWnd);
 
     // If given a filename param (e.g. "Open with..."), open the file here.
-    int argCount;
-    LPWSTR* argv = CommandLineToArgvW(GetCommandLine(), &argCount);
     if (argCount == 2) {
         LoadFile(argv[1], hWnd);
     }
 
     // Create Keyboard Accelerators that are invoked using ALT + KEY
-    const int ACCELERATOR_TABLE_SIZE = 4;
+    const int ACCELERATOR_TABLE_SIZE = 8;
     ACCEL accelTable[ACCELERATOR_TABLE_SIZE];
     accelTable[0].cmd = ID_ACTIONS_CONVERT_TO_OFX;
     accelTable[0].fVirt = FALT | FVIRTKEY;
@@ -1410,6 +3501,18 @@ int CALLBACK WinMain(
     accelTable[3].cmd = ID_FILE_OPEN;
     accelTable[3].fVirt = FALT | FVIRTKEY;
     accelTable[3].key = 0x4F; //'O' key
+    accelTable[4].cmd = ID_VIEW_NEXT_PAGE;
+    accelTable[4].fVirt = FALT | FVIRTKEY;
+    accelTable[4].key = VK_NEXT;
+    accelTable[5].cmd = ID_VIEW_PREVIOUS_PAGE;
+    accelTable[5].fVirt = FALT | FVIRTKEY;
+    accelTable[5].key = VK_PRIOR;
+    accelTable[6].cmd = ID_VIEW_FIRST_PAGE;
+    accelTable[6].fVirt = FALT | FVIRTKEY;
+    accelTable[6].key = VK_HOME;
+    accelTable[7].cmd = ID_VIEW_LAST_PAGE;
+    accelTable[7].fVirt = FALT | FVIRTKEY;
+    accelTable[7].key = VK_END;
     HACCEL accels = CreateAcceleratorTable(accelTable, ACCELERATOR_TABLE_SIZE);
 
     // To get an idea of usage metrics, ping my web server on startup.
@@ -1482,5 +3585,7 @@ int CALLBACK WinMain(
         }
     }
 
+    // Don't leave the import worker running while the program exits
+    importQueue.reset();
     return (int)msg.wParam;
 }
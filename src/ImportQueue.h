@@ -0,0 +1,261 @@
+// The queue that sends converted OFX to the MS Money Import Handler in the
+// background. It only reaches the system through an ImportLauncher, so it
+// has no Windows code in it and builds anywhere (see tests/).
+
+#ifndef CONVERTTOOFX_IMPORTQUEUE_H
+#define CONVERTTOOFX_IMPORTQUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Sending OFX to the Money Import Handler happens in the background. The
+// handler can take a while (it may wait for the user to answer a prompt),
+// and waiting for it used to freeze the window and allow only one import at
+// a time. Now each import goes into a queue, and a worker thread runs the
+// handler on them one after another and deletes each temp file when its
+// import is done.
+enum ImportStatus {
+    IMPORT_QUEUED, IMPORT_RUNNING, IMPORT_DONE, IMPORT_HANDLER_NOT_FOUND,
+    IMPORT_FAILED, IMPORT_TIMED_OUT, IMPORT_CANCELLED
+};
+const char* const IMPORT_STATUS_NAMES[] = { "Waiting", "Importing", "Done",
+    "Import Handler not found", "Failed", "Timed out", "Cancelled" };
+
+// The import handler waits for the user, so be generous
+const unsigned long IMPORT_TIMEOUT_MILLISECONDS = 30 * 60 * 1000;
+// How many finished imports to remember for the queue window
+const size_t IMPORT_HISTORY = 50;
+
+// How the queue writes temp files and runs the import handler. This is
+// everything that touches the system, so it can be swapped for a stub.
+class ImportLauncher {
+public:
+    virtual ~ImportLauncher() {}
+
+    // Write ofx to a new temp file and set path to it. On failure, say why
+    // in error.
+    virtual bool WriteTempFile(const std::string& ofx, std::wstring& path,
+        std::string& error) = 0;
+    // Run handler on file and wait for it to exit, for at most timeout
+    // milliseconds. Stops waiting and returns IMPORT_CANCELLED once
+    // cancelled is set. On failure, say why in detail.
+    virtual ImportStatus Run(const std::wstring& handler,
+        const std::wstring& file, unsigned long timeout,
+        const std::atomic<bool>& cancelled, std::string& detail) = 0;
+    virtual bool DeleteTempFile(const std::wstring& path) = 0;
+};
+
+// One import, as shown in the queue window
+struct ImportJob {
+    unsigned id;
+    std::wstring handler;
+    std::string ofx;  // Emptied once written to the temp file
+    std::wstring tempFile;
+    ImportStatus status;
+    std::string detail;  // What went wrong, for the user
+    // The temp file is still there: we couldn't delete it, or the handler
+    // may still be reading it
+    bool tempFileLeft;
+};
+
+// Runs imports one at a time on a worker thread, in the order they were
+// added. The worker starts with the first import.
+class ImportQueue {
+public:
+    // finished is called on the worker thread with the id of each import
+    // that finished, whether it worked or not
+    ImportQueue(ImportLauncher& launcher, unsigned long timeout,
+        std::function<void(unsigned)> finished)
+        : launcher(launcher), timeout(timeout), finished(finished),
+        nextId(1), stopping(false), cancelled(false) {
+    }
+    ~ImportQueue() { Shutdown(); }
+
+    // Queue ofx for handler. Returns the import's id, or 0 if the queue
+    // has been shut down.
+    unsigned Enqueue(const std::wstring& handler, const std::string& ofx);
+    // Copy an import's status into job. False if it has been forgotten.
+    bool Find(unsigned id, ImportJob& job) const;
+    // Every import we remember, oldest first
+    std::vector<ImportJob> Jobs() const;
+    // Imports waiting or running
+    size_t Pending() const;
+    // Stop after the running import, without waiting for the handler to
+    // exit. Imports still waiting are cancelled.
+    void Shutdown();
+
+private:
+    void Work();
+    ImportJob* FindJob(unsigned id);
+    size_t CountPending() const;
+
+    ImportLauncher& launcher;
+    const unsigned long timeout;
+    std::function<void(unsigned)> finished;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<ImportJob> jobs;
+    unsigned nextId;
+    bool stopping;
+    std::atomic<bool> cancelled;
+    std::thread worker;
+};
+
+inline unsigned ImportQueue::Enqueue(const std::wstring& handler,
+    const std::string& ofx) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping) {
+        return 0;
+    }
+    // Forget the oldest finished imports
+    size_t finishedJobs = jobs.size() - CountPending();
+    for (std::deque<ImportJob>::iterator job = jobs.begin();
+        finishedJobs >= IMPORT_HISTORY && job != jobs.end();) {
+        if (job->status != IMPORT_QUEUED && job->status != IMPORT_RUNNING) {
+            job = jobs.erase(job);
+            --finishedJobs;
+        }
+        else {
+            ++job;
+        }
+    }
+
+    ImportJob job;
+    job.id = nextId++;
+    job.handler = handler;
+    job.ofx = ofx;
+    job.status = IMPORT_QUEUED;
+    job.tempFileLeft = false;
+    jobs.push_back(job);
+    if (!worker.joinable()) {
+        worker = std::thread(&ImportQueue::Work, this);
+    }
+    wake.notify_one();
+    return job.id;
+}
+
+inline ImportJob* ImportQueue::FindJob(unsigned id) {
+    for (ImportJob& job : jobs) {
+        if (job.id == id) {
+            return &job;
+        }
+    }
+    return NULL;
+}
+
+inline bool ImportQueue::Find(unsigned id, ImportJob& job) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const ImportJob& found : jobs) {
+        if (found.id == id) {
+            job = found;
+            job.ofx.clear();
+            return true;
+        }
+    }
+    return false;
+}
+
+inline std::vector<ImportJob> ImportQueue::Jobs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ImportJob> copies(jobs.begin(), jobs.end());
+    for (ImportJob& job : copies) {
+        job.ofx.clear();
+    }
+    return copies;
+}
+
+inline size_t ImportQueue::Pending() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return CountPending();
+}
+
+inline size_t ImportQueue::CountPending() const {
+    size_t pending = 0;
+    for (const ImportJob& job : jobs) {
+        if (job.status == IMPORT_QUEUED || job.status == IMPORT_RUNNING) {
+            ++pending;
+        }
+    }
+    return pending;
+}
+
+inline void ImportQueue::Shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        cancelled = true;
+    }
+    wake.notify_one();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+inline void ImportQueue::Work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        ImportJob* job = NULL;
+        wake.wait(lock, [this, &job]() {
+            for (ImportJob& waiting : jobs) {
+                if (waiting.status == IMPORT_QUEUED) {
+                    job = &waiting;
+                    break;
+                }
+            }
+            return stopping || job != NULL;
+        });
+        if (stopping) {
+            break;
+        }
+
+        job->status = IMPORT_RUNNING;
+        unsigned id = job->id;
+        std::wstring handler = job->handler;
+        std::string ofx;
+        ofx.swap(job->ofx);
+        lock.unlock();
+
+        std::wstring tempFile;
+        std::string detail;
+        ImportStatus status = IMPORT_FAILED;
+        bool tempFileLeft = false;
+        if (launcher.WriteTempFile(ofx, tempFile, detail)) {
+            ofx.clear();
+            ofx.shrink_to_fit();
+            status = launcher.Run(handler, tempFile, timeout, cancelled,
+                detail);
+            // If we stopped waiting, the handler may still need the file
+            if (status == IMPORT_CANCELLED ||
+                !launcher.DeleteTempFile(tempFile)) {
+                tempFileLeft = true;
+            }
+        }
+
+        lock.lock();
+        // Jobs only get forgotten once finished, so it's still there
+        job = FindJob(id);
+        job->tempFile = tempFile;
+        job->status = status;
+        job->detail = detail;
+        job->tempFileLeft = tempFileLeft;
+        lock.unlock();
+        finished(id);
+        lock.lock();
+    }
+
+    for (ImportJob& job : jobs) {
+        if (job.status == IMPORT_QUEUED) {
+            job.status = IMPORT_CANCELLED;
+            job.ofx.clear();
+        }
+    }
+}
+
+#endif  // CONVERTTOOFX_IMPORTQUEUE_H
@@ -0,0 +1,7298 @@
+// The conversion engine: everything that turns QFX, CSV and QIF into OFX
+// that Money accepts, without any windows. ConvertToOFX.cpp has the UI, and
+// the tests under tests/ build this on Linux.
+
+#ifndef CONVERTTOOFX_OFXCONVERSION_H
+#define CONVERTTOOFX_OFXCONVERSION_H
+
+#include "tinyxml2.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctype.h>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+// The scanners look at 16 bytes at a time with SSE2 where there is SSE2
+// (every x64 CPU), and one byte at a time anywhere else (e.g. ARM64)
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CONVERTTOOFX_SSE2
+#include <emmintrin.h>
+#endif
+
+// Where the lowest set bit of a mask (that isn't 0) is, e.g. to find the
+// first match in an SSE2 comparison
+inline unsigned LowestSetBit(int mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(static_cast<unsigned>(mask));
+#endif
+}
+
+// For the headers, spacing matters! I've observed some files not getting 
+// accepted because of spacing before and after an '='! Very strange, but
+// this is Windows so it shouldn't be surprising.
+const std::string XML_HEADER =
+"<?xml version=\"1.0\" encoding=\"utf-8\" ?>";
+const std::string XML_OFX_HEADER =
+"<?OFX OFXHEADER=\"200\" VERSION=\"202\" SECURITY=\"NONE\" "
+"OLDFILEUID=\"NONE\" NEWFILEUID=\"NONE\" ?>";
+// Allowed child elements under <STMTTRN> fields. Everything else gets deleted.
+// Remember that order matters for this whitelist array and for Money!!!
+const std::vector<std::string> STMTTRN_WHITELIST{ "TRNTYPE", "DTPOSTED", 
+    "DTUSER", "TRNAMT", "FITID", "CHECKNUM", "NAME", "CCACCTTO", "MEMO", };
+// STMTTRN_WHITELIST with the special cases worked out ahead of time, so
+// pruning doesn't compare names for every field of every transaction. When
+// a field is missing, its alternative (if any) takes its place. When both
+// are there, the alternative is dropped.
+struct WhitelistField {
+    const char* name;
+    const char* alternative;
+};
+inline const std::vector<WhitelistField>& StmttrnWhitelistFields() {
+    static const std::vector<WhitelistField> fields = [] {
+        std::vector<WhitelistField> table;
+        for (const std::string& name : STMTTRN_WHITELIST) {
+            WhitelistField field = { name.c_str(),
+                name == "NAME" ? "PAYEE" :
+                name == "CCACCTTO" ? "BANKACCTTO" : NULL };
+            table.push_back(field);
+        }
+        return table;
+    }();
+    return fields;
+}
+// The STMTTRN_WHITELIST index of a <STMTTRN> child called name (length
+// characters, which needn't end in '\0'), or -1 if it isn't allowed. An
+// alternative counts as the field it stands in for, e.g. <PAYEE> as <NAME>.
+inline int StmttrnWhitelistIndex(const char* name, size_t length) {
+    const std::vector<WhitelistField>& fields = StmttrnWhitelistFields();
+    for (size_t i = 0; i < fields.size(); ++i) {
+        for (const char* allowed : { fields[i].name, fields[i].alternative }) {
+            if (allowed && strncmp(name, allowed, length) == 0 &&
+                allowed[length] == '\0') {
+                return static_cast<int>(i);
+            }
+        }
+    }
+    return -1;
+}
+// The fields Money won't take a <STMTTRN> without
+const char* const STMTTRN_REQUIRED[] = { "TRNTYPE", "DTPOSTED", "TRNAMT",
+    "FITID" };
+// Where to find the <BANKTRANLIST> for a Message Set Type 
+const std::map<std::string, std::vector<std::string>>
+TYPE_TO_BANKTRANLIST_MAP = {
+    {"CREDITCARDMSGSRSV1",
+        {"OFX", "CREDITCARDMSGSRSV1", "CCSTMTTRNRS", "CCSTMTRS", "BANKTRANLIST"}},
+    {"BANKMSGSRSV1",
+        {"OFX", "BANKMSGSRSV1",       "STMTTRNRS",   "STMTRS",   "BANKTRANLIST"}},
+};
+class PayeeRules;
+
+// What a conversion should clean up. A conversion gets its own copy when it
+// starts (see ConversionContext), so changing the Config menu in the middle
+// of one doesn't affect it.
+struct ConversionOptions {
+    bool dedupeMemoField = true;
+    bool trimLines = true;
+    // Rewrite <TRNAMT>, <DTPOSTED> and <DTUSER> in the canonical form, e.g.
+    // "-1.00" and "20190101120000.000[-5:EST]". Dates keep their time zone.
+    bool normalizeAmountsAndDates = false;
+    // Sort each statement's transactions by <DTPOSTED> and drop repeated
+    // FITIDs
+    bool sortAndDedupeTransactions = false;
+    // Clean up <NAME> and <MEMO> with these, if set. The copies share them.
+    std::shared_ptr<const PayeeRules> payeeRules;
+};
+
+// Escape text for use inside a JSON string, onto the end of escaped
+inline void AppendEscapedJSON(std::string& escaped, const char* text,
+    size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        const char c = text[i];
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        }
+        else {
+            escaped += c;
+        }
+    }
+}
+
+inline std::string EscapeJSON(const std::string& text) {
+    std::string escaped;
+    AppendEscapedJSON(escaped, text.data(), text.length());
+    return escaped;
+}
+
+// Opt-in allocation measuring, to find out which stage of a conversion
+// drives memory use. Everything goes through the global operator new and
+// delete in ConvertToOFX.cpp (TinyXML-2 included, since it allocates with
+// new), and is counted against the stage the allocating thread is in, but
+// only while a conversion has an AllocationStats attached. Otherwise the
+// cost is one load of a global counter per allocation: the thread_local is
+// only looked at while some thread is measuring.
+enum AllocationStage {
+    STAGE_OTHER, STAGE_POLISH, STAGE_BALANCE_CHECK, STAGE_FIX_XML,
+    STAGE_PARSE, STAGE_PRUNE, STAGE_PRINT, STAGE_CRLF, STAGE_VALIDATE,
+    STAGE_PASSTHROUGH, STAGE_COUNT
+};
+const char* const ALLOCATION_STAGE_NAMES[STAGE_COUNT] = { "other",
+    "polish", "balanceCheck", "fixXML", "parse", "prune", "print", "crlf",
+    "validate", "passthrough" };
+
+// Counts for one conversion, or added up over many. Live bytes count from
+// when measuring started, so memory kept from before (see
+// ConversionBuffers) and freed during the conversion makes them negative.
+// The peak of a stage is the most live memory seen while in that stage.
+// Stage times are only kept by the timed stage scope of the main
+// conversion thread (see AllocationStageScope).
+class AllocationStats {
+public:
+    AllocationStats() { Clear(); }
+
+    void Clear();
+    void Allocated(int stage, size_t bytes);
+    void Freed(int stage, size_t bytes);
+    void AddTime(int stage, unsigned long long ns) {
+        nanoseconds[stage] += ns;
+    }
+    void CountConversion() { ++conversions; }
+    // Add another conversion's counts to ours. Peaks are the largest peak.
+    void Add(const AllocationStats& other);
+
+    // e.g. {"file":"a.qfx","conversions":1,"peakLiveBytes":123,
+    // "stages":{"polish":{"allocations":2,"bytes":100,"frees":1,
+    // "peakLiveBytes":100,"nanoseconds":5000},...}}
+    std::string ToJSON(const std::string& file) const;
+
+    unsigned long long Allocations(int stage) const {
+        return allocations[stage];
+    }
+    unsigned long long Nanoseconds(int stage) const {
+        return nanoseconds[stage];
+    }
+    long long StagePeak(int stage) const { return stagePeak[stage]; }
+    long long Peak() const { return peak; }
+
+private:
+    void RaisePeak(std::atomic<long long>& peak, long long live);
+
+    // Atomic because pruning runs on several threads
+    std::atomic<unsigned long long> allocations[STAGE_COUNT];
+    std::atomic<unsigned long long> bytes[STAGE_COUNT];
+    std::atomic<unsigned long long> frees[STAGE_COUNT];
+    std::atomic<long long> stagePeak[STAGE_COUNT];
+    std::atomic<unsigned long long> nanoseconds[STAGE_COUNT];
+    std::atomic<long long> liveBytes;
+    std::atomic<long long> peak;
+    unsigned long long conversions;
+};
+
+// What the current thread is allocating for. These are functions so that
+// every file that includes this one shares the same variables.
+inline AllocationStats*& ActiveAllocationStats() {
+    static thread_local AllocationStats* stats = NULL;
+    return stats;
+}
+inline int& ActiveAllocationStage() {
+    static thread_local int stage = STAGE_OTHER;
+    return stage;
+}
+// How many threads are counting against an AllocationStats right now
+inline std::atomic<int>& AllocationStatsThreads() {
+    static std::atomic<int> threads(0);
+    return threads;
+}
+
+inline void AllocationStats::Clear() {
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        allocations[i] = 0;
+        bytes[i] = 0;
+        frees[i] = 0;
+        stagePeak[i] = 0;
+        nanoseconds[i] = 0;
+    }
+    liveBytes = 0;
+    peak = 0;
+    conversions = 0;
+}
+
+inline void AllocationStats::RaisePeak(std::atomic<long long>& peak,
+    long long live) {
+    long long current = peak.load(std::memory_order_relaxed);
+    while (live > current && !peak.compare_exchange_weak(current, live,
+        std::memory_order_relaxed)) {
+    }
+}
+
+inline void AllocationStats::Allocated(int stage, size_t size) {
+    allocations[stage].fetch_add(1, std::memory_order_relaxed);
+    bytes[stage].fetch_add(size, std::memory_order_relaxed);
+    long long live = liveBytes.fetch_add(size, std::memory_order_relaxed) +
+        static_cast<long long>(size);
+    RaisePeak(stagePeak[stage], live);
+    RaisePeak(peak, live);
+}
+
+inline void AllocationStats::Freed(int stage, size_t size) {
+    frees[stage].fetch_add(1, std::memory_order_relaxed);
+    liveBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+inline void AllocationStats::Add(const AllocationStats& other) {
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        allocations[i] += other.allocations[i];
+        bytes[i] += other.bytes[i];
+        frees[i] += other.frees[i];
+        RaisePeak(stagePeak[i], other.stagePeak[i]);
+        nanoseconds[i] += other.nanoseconds[i];
+    }
+    RaisePeak(peak, other.peak);
+    conversions += other.conversions;
+}
+
+inline std::string AllocationStats::ToJSON(const std::string& file) const {
+    std::string json = "{\"file\":\"" + EscapeJSON(file) +
+        "\",\"conversions\":" + std::to_string(conversions) +
+        ",\"peakLiveBytes\":" + std::to_string(peak.load()) +
+        ",\"stages\":{";
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        json += std::string(i > 0 ? "," : "") + "\"" +
+            ALLOCATION_STAGE_NAMES[i] + "\":{\"allocations\":" +
+            std::to_string(allocations[i].load()) + ",\"bytes\":" +
+            std::to_string(bytes[i].load()) + ",\"frees\":" +
+            std::to_string(frees[i].load()) + ",\"peakLiveBytes\":" +
+            std::to_string(stagePeak[i].load()) + ",\"nanoseconds\":" +
+            std::to_string(nanoseconds[i].load()) + "}";
+    }
+    return json + "}}";
+}
+
+// Count allocations on this thread against stats (or nothing, if NULL)
+// until the scope ends
+class AllocationStatsScope {
+public:
+    explicit AllocationStatsScope(AllocationStats* stats)
+        : previous(ActiveAllocationStats()) {
+        ActiveAllocationStats() = stats;
+        if (stats) {
+            ++AllocationStatsThreads();
+        }
+    }
+    ~AllocationStatsScope() {
+        if (ActiveAllocationStats()) {
+            --AllocationStatsThreads();
+        }
+        ActiveAllocationStats() = previous;
+    }
+
+private:
+    AllocationStats* previous;
+};
+
+// Count allocations on this thread against a stage until the scope ends.
+// Enter() moves on to the next stage. A timed scope also adds the time
+// spent in each stage to the thread's AllocationStats, if it has one.
+class AllocationStageScope {
+public:
+    explicit AllocationStageScope(int stage, bool timed = false)
+        : previous(ActiveAllocationStage()),
+        timed(timed && ActiveAllocationStats() != NULL) {
+        ActiveAllocationStage() = stage;
+        if (this->timed) {
+            started = std::chrono::steady_clock::now();
+        }
+    }
+    ~AllocationStageScope() {
+        StopClock();
+        ActiveAllocationStage() = previous;
+    }
+    void Enter(int stage) {
+        StopClock();
+        ActiveAllocationStage() = stage;
+    }
+
+private:
+    void StopClock() {
+        if (!timed) {
+            return;
+        }
+        std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+        ActiveAllocationStats()->AddTime(ActiveAllocationStage(),
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                now - started).count());
+        started = now;
+    }
+
+    int previous;
+    bool timed;
+    std::chrono::steady_clock::time_point started;
+};
+
+// Receives the balanced XML produced by XMLFixer, one token at a time.
+// Concatenating the tokens in order gives the fixed XML.
+class XMLFixerSink {
+public:
+    virtual ~XMLFixerSink() {}
+    // Text between two tags. Never empty.
+    virtual void Value(const std::string& value) = 0;
+    // Opening tag including the brackets, e.g. "<STMTTRN>"
+    virtual void OpenTag(const std::string& tag) = 0;
+    // Closing tag. Only the raw name is passed, e.g. "STMTTRN"
+    virtual void CloseTag(const std::string& tagRawValue) = 0;
+    // Self contained tags (e.g. "<BR/>") and headers (e.g. "<?xml ?>")
+    virtual void SelfContainedTag(const std::string& tag) = 0;
+};
+
+// Attempt to fix imbalanced input into well-formatted XML, one character at
+// a time. This is the guts of FixXML(). It is incremental so that the
+// bounded-memory mode can fix files that are too big to keep in memory.
+class XMLFixer {
+public:
+    // A speculative fixer starts somewhere in the middle of the input
+    // without knowing which tags are open (see FixXMLInParallel()). Instead
+    // of giving up when it needs one of those tags, Feed() returns false
+    // *before* doing anything with the character, so that a fixer that does
+    // know can Continue() from there.
+    explicit XMLFixer(XMLFixerSink& sink, bool speculative = false)
+        : sink(sink), speculative(speculative) {}
+
+    // Process the next input character. Returns false if the XML is so bad
+    // that we can't fix it. Error() then says why.
+    bool Feed(char c);
+
+    // Close out anything still open. Call once after the last character.
+    void Finish();
+
+    const std::string& Error() const { return error; }
+
+    // True if we are not in the middle of a tag or value, which is the only
+    // place a speculative fixer can start from.
+    bool BetweenTokens() const {
+        return !processTag && tag.empty() && value.empty();
+    }
+
+    // Pick up where a speculative fixer stopped. Its sink's output must
+    // already follow ours, and we must have been BetweenTokens() where it
+    // started.
+    void Continue(const XMLFixer& speculative);
+
+    // How many bytes of input we are holding on to right now.
+    size_t BufferedBytes() const {
+        return tag.capacity() + value.capacity() + tagStackBytes;
+    }
+
+private:
+    void EmitValue() {
+        if (value.length() > 0) {
+            sink.Value(value);
+        }
+        value = "";
+    }
+    std::string PopTagRawValue() {
+        std::string topOfStack = tagStack.back();
+        tagStack.pop_back();
+        tagStackBytes -= topOfStack.length();
+        return topOfStack.substr(1, topOfStack.length() - 2);
+    }
+
+    bool InTagStack(const std::string& tagRawValue) const {
+        for (const std::string& openTag : tagStack) {
+            if (openTag.compare(1, openTag.length() - 2, tagRawValue) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    XMLFixerSink& sink;
+    bool speculative;
+    std::string tag;  // *Anything* in brackets: <.*> 
+    std::string value;  // Anything not inside brackets
+    bool processTag = false;
+    std::vector<std::string> tagStack;
+    size_t tagStackBytes = 0;
+    std::string error;
+};
+
+inline bool XMLFixer::Feed(char c) {
+    // A lot of banks really mangle their XML and this is the #1 problem
+    // with preparing a file for MS Money. By now, we've detected XML mis-match
+    // issues. Let's try to fix it by guessing where matching tags could go...
+    // * Most commonly, it occurs when an element does not have a closing tag
+    //   after a value. E.g. '<status><value>1</status>' is missing a 
+    //   '</value>'.
+    //
+    // MS Money doesn't require perfect XML to work, but getting it perfect 
+    // will help us. MS Money trips up on extra fields. Once we have valid XML,
+    // we can use standard XML APIs to remove problematic fields. Determining 
+    // which fields are problematic is an educated guess.
+
+    // To determine where to add tags, we tokenize XML tags and values.
+    // Upon encountering a closing bracket ('>'), our fixing logic kicks in.
+    // We use a stack to determine if there is an imbalance, and if to fix.
+    if (c == '>') {
+        tag += c;
+
+        if (tag.find("</") == 0) {
+            // Closing tag (e.g. </item>). Make sure we match with the top
+            // of the tag stack
+            std::string tagRawValue = tag.substr(2, tag.length() - 3);
+            if (speculative && !InTagStack(tagRawValue)) {
+                // It closes something from before we started
+                tag.pop_back();
+                return false;
+            }
+            if (tagStack.size() == 0) {
+                // This XML is so bad we can't fix it.
+                // Give up. The user will get a message
+                // later when this XML fails to parse.
+                error = "No XML tag to match closing tag with. "
+                    "Giving up. XML:\n";
+                return false;
+            }
+            std::string topOfStackRawValue = PopTagRawValue();
+            while (topOfStackRawValue != tagRawValue) {
+                if (tagStack.size() == 0) {
+                    // This XML is so bad we can't fix it.
+                    // Give up. The user will get a message
+                    // later when this XML fails to parse.
+                    error = "Ran into issues trying to fix this XML:\n";
+                    return false;
+                }
+                EmitValue();
+                sink.CloseTag(topOfStackRawValue);
+                topOfStackRawValue = PopTagRawValue();
+            }
+            EmitValue();
+            sink.CloseTag(tagRawValue);
+            tag = "";
+        }
+        else if (tag.find("/>") == tag.length() - 2 || tag.find("<?")==0 ||
+            tag.find("<!") == 0) {
+            // Self contained tag, declaration or comment. Write it out
+            // directly. Nothing to balance here.
+            EmitValue();
+            sink.SelfContainedTag(tag);
+            tag = "";
+        }
+        else {
+            // This is an opening tag, e.g. <tag>
+            if (value.length() > 0) {
+                // We have a value. This value is associated with the item 
+                // at the top of the stack. Since we didn't encounter a 
+                // closing element, this must be imbalanced, and we 
+                // manually add the closing element after the value.
+                if (tagStack.size() == 0) {
+                    if (speculative) {
+                        // The value belongs to a tag from before we started
+                        tag.pop_back();
+                        return false;
+                    }
+                    // This XML is so bad we can't fix it.
+                    // Give up. The user will get a message
+                    // later when this XML fails to parse.
+                    error = "No XML tag to match value with. Giving up. "
+                        "XML:\n";
+                    return false;
+                }
+                std::string prevTagRawValue = PopTagRawValue();
+                EmitValue();
+                sink.CloseTag(prevTagRawValue);
+            }
+            // No value (or it was just closed out), so we just write out
+            // the element.
+            sink.OpenTag(tag);
+            tagStack.push_back(tag);
+            tagStackBytes += tag.length();
+            tag = "";
+        }
+
+        // We've processed a tag. If we encounter a character later, it 
+        // belongs to a value and not an XML tag.
+        processTag = false;
+    }
+    else if (c == '<') {
+        // We are going to process an XML element
+        assert(tag.length() == 0);
+        tag += c;
+        processTag = true;
+        // If we have a value waiting, let's trim extra whitespace off
+        if (value.length() > 1) {
+            value.erase(value.find_last_not_of(" ") + 1);
+        }
+    }
+    else if (processTag) {
+        // Continue processing this character as an XML element
+        tag += c;
+    }
+    else {
+        // We are processing a value, not an XML element
+        if (value.length() == 0 && (isspace(c))) {
+            // Ignore leading (left-side) whitespace
+            return true;
+        }
+        if (c == '\r' || c == '\n') {
+            // Ignore new lines in values
+            return true;
+        }
+        value += c;
+    }
+    return true;
+}
+
+inline void XMLFixer::Finish() {
+    // If there is anything in the tagStack, close it out
+    while (tagStack.size() > 0) {
+        sink.CloseTag(PopTagRawValue());
+    }
+}
+
+inline void XMLFixer::Continue(const XMLFixer& speculative) {
+    assert(BetweenTokens());
+    for (const std::string& openTag : speculative.tagStack) {
+        tagStack.push_back(openTag);
+        tagStackBytes += openTag.length();
+    }
+    tag = speculative.tag;
+    value = speculative.value;
+    processTag = speculative.processTag;
+}
+
+// Collects the XMLFixer output into one string.
+class XMLFixerStringSink : public XMLFixerSink {
+public:
+    void Value(const std::string& value) override { fixedXML += value; }
+    void OpenTag(const std::string& tag) override { fixedXML += tag; }
+    void CloseTag(const std::string& tagRawValue) override {
+        fixedXML += "</" + tagRawValue + ">";
+    }
+    void SelfContainedTag(const std::string& tag) override {
+        fixedXML += tag;
+    }
+
+    std::string fixedXML;  // Will contain our final result.
+};
+
+// Attempt to fix the imbalanced input into well-formatted XML.
+inline std::string FixXML(const std::string& input) {
+    XMLFixerStringSink result;
+    XMLFixer fixer(result);
+    for (const char& c : input) {
+        if (!fixer.Feed(c)) {
+            // The user will get a message later when this fails to parse.
+            return fixer.Error() + result.fixedXML;
+        }
+    }
+    fixer.Finish();
+    return result.fixedXML;
+}
+
+// Same as FixXML(), but big inputs are split up and fixed on several threads.
+// We guess at split points by looking for "<STMTTRN>", since it usually
+// starts a new line of work at the same depth. Each piece after the first is
+// fixed by a speculative XMLFixer that doesn't know which tags are open.
+// Then we stitch the pieces together in order: if a piece started where we
+// guessed, its output is used up to the point where it needed to know what
+// came before, and the rest is re-scanned serially. The output is always
+// identical to FixXML().
+// pieceCount is for the tests, which need small inputs split up too. 0
+// means one piece per core, if the input is big enough.
+inline std::string FixXMLInParallel(const std::string& input,
+    size_t pieceCount = 0) {
+    const size_t MIN_PIECE_SIZE = 256 * 1024;
+    if (pieceCount == 0) {
+        pieceCount = std::thread::hardware_concurrency();
+        if (pieceCount > input.length() / MIN_PIECE_SIZE) {
+            pieceCount = input.length() / MIN_PIECE_SIZE;
+        }
+    }
+    std::vector<size_t> starts(1, 0);
+    for (size_t i = 1; i < pieceCount; ++i) {
+        size_t start = input.find("<STMTTRN>", i * input.length() / pieceCount);
+        if (start == std::string::npos) {
+            break;
+        }
+        if (start > starts.back()) {
+            starts.push_back(start);
+        }
+    }
+    if (starts.size() < 2) {
+        return FixXML(input);
+    }
+    starts.push_back(input.length());
+
+    struct Piece {
+        XMLFixerStringSink sink;
+        std::unique_ptr<XMLFixer> fixer;
+        size_t stoppedAt = 0;  // Where the fixer gave up, or the piece end
+    };
+    std::vector<Piece> pieces(starts.size() - 1);
+    AllocationStats* stats = ActiveAllocationStats();
+    int stage = ActiveAllocationStage();
+    auto fixPiece = [&input, &starts, &pieces, stats, stage](size_t k) {
+        AllocationStatsScope measuring(stats);
+        AllocationStageScope inStage(stage);
+        Piece& piece = pieces[k];
+        piece.fixer.reset(new XMLFixer(piece.sink, k > 0));
+        size_t i = starts[k];
+        while (i < starts[k + 1] && piece.fixer->Feed(input[i])) {
+            ++i;
+        }
+        piece.stoppedAt = i;
+    };
+    std::vector<std::thread> threads;
+    for (size_t k = 1; k < pieces.size(); ++k) {
+        threads.push_back(std::thread(fixPiece, k));
+    }
+    fixPiece(0);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    // The first piece is real, so carry on with its fixer.
+    XMLFixer& fixer = *pieces[0].fixer;
+    std::string& result = pieces[0].sink.fixedXML;
+    if (pieces[0].stoppedAt < starts[1]) {
+        return fixer.Error() + result;
+    }
+    for (size_t k = 1; k < pieces.size(); ++k) {
+        size_t i = starts[k];
+        if (fixer.BetweenTokens()) {
+            // Good guess. Use what we can.
+            result += pieces[k].sink.fixedXML;
+            fixer.Continue(*pieces[k].fixer);
+            i = pieces[k].stoppedAt;
+        }
+        pieces[k].sink.fixedXML = "";
+        for (; i < starts[k + 1]; ++i) {
+            if (!fixer.Feed(input[i])) {
+                return fixer.Error() + result;
+            }
+        }
+    }
+    fixer.Finish();
+    return result;
+}
+
+// Parse an OFX amount (e.g. "-1.00", "+12", "3,5") into minor units (cents).
+// Returns false if it isn't an amount, or if it has more than 2 decimals
+// that aren't zero, since we can't hold that exactly.
+inline bool ParseOFXAmount(const char* text, size_t length,
+    long long& minorUnits) {
+    const char* p = text;
+    const char* end = text + length;
+    bool negative = p < end && *p == '-';
+    p += (p < end && (*p == '-' || *p == '+'));
+
+    // Whole part. Give up past 16 digits, before value can overflow.
+    long long value = 0;
+    const char* start = p;
+    for (unsigned digit; p < end && (digit = *p - '0') <= 9; ++p) {
+        if (p - start == 16) {
+            return false;
+        }
+        value = value * 10 + digit;
+    }
+    size_t wholeDigits = p - start;
+
+    // Fraction part. Keep 2 digits, the rest must be zeros.
+    size_t fractionDigits = 0;
+    if (p < end && (*p == '.' || *p == ',')) {
+        ++p;
+        for (unsigned digit; p < end && (digit = *p - '0') <= 9; ++p) {
+            if (fractionDigits < 2) {
+                value = value * 10 + digit;
+            }
+            else if (digit != 0) {
+                return false;
+            }
+            ++fractionDigits;
+        }
+    }
+    if (p != end || wholeDigits + fractionDigits == 0) {
+        return false;
+    }
+    static const long long SCALE[] = { 100, 10, 1 };
+    value *= SCALE[fractionDigits < 2 ? fractionDigits : 2];
+    minorUnits = negative ? -value : value;
+    return true;
+}
+
+inline bool ParseOFXAmount(const std::string& text, long long& minorUnits) {
+    return ParseOFXAmount(text.c_str(), text.length(), minorUnits);
+}
+
+// The canonical form Money accepts, e.g. -100 -> "-1.00", appended to text
+// without making a string for it
+inline void AppendOFXAmount(std::string& text, long long minorUnits) {
+    unsigned long long magnitude = minorUnits < 0 ?
+        0ULL - static_cast<unsigned long long>(minorUnits) : minorUnits;
+    char digits[24];
+    char* p = digits + sizeof(digits);
+    *--p = static_cast<char>('0' + magnitude % 10);
+    *--p = static_cast<char>('0' + magnitude % 100 / 10);
+    *--p = '.';
+    unsigned long long whole = magnitude / 100;
+    do {
+        *--p = static_cast<char>('0' + whole % 10);
+        whole /= 10;
+    } while (whole > 0);
+    if (minorUnits < 0) {
+        *--p = '-';
+    }
+    text.append(p, digits + sizeof(digits) - p);
+}
+
+inline std::string FormatOFXAmount(long long minorUnits) {
+    std::string text;
+    AppendOFXAmount(text, minorUnits);
+    return text;
+}
+
+// Days since 1970-01-01 for a date in the proleptic Gregorian calendar.
+// See http://howardhinnant.github.io/date_algorithms.html
+inline long long DaysFromCivil(int year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    const long long era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned yearOfEra = static_cast<unsigned>(year - era * 400);
+    const unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) +
+        2) / 5 + day - 1;
+    const unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 -
+        yearOfEra / 100 + dayOfYear;
+    return era * 146097 + static_cast<long long>(dayOfEra) - 719468;
+}
+
+// Parse an OFX time zone, e.g. [-5:EST], [0:GMT], [+5.30:IST] or [-3.5],
+// into its offset from GMT. It must be all of text.
+inline bool ParseOFXTimeZone(const char* text, size_t length,
+    long long& offsetSeconds) {
+    size_t i = 0;
+    if (i >= length || text[i] != '[') {
+        return false;
+    }
+    ++i;
+    bool negative = i < length && text[i] == '-';
+    i += (i < length && (text[i] == '-' || text[i] == '+'));
+    size_t start = i;
+    long long hours = 0;
+    for (unsigned digit; i < length &&
+        (digit = text[i] - '0') <= 9; ++i) {
+        hours = hours * 10 + digit;
+    }
+    if (i == start || hours > 14) {
+        return false;
+    }
+    long long minutes = 0;
+    if (i < length && text[i] == '.') {
+        // Two digits are minutes (5.30), one digit is tenths (3.5)
+        size_t fractionStart = ++i;
+        long long fraction = 0;
+        for (unsigned digit; i < length &&
+            (digit = text[i] - '0') <= 9; ++i) {
+            fraction = fraction * 10 + digit;
+        }
+        size_t fractionDigits = i - fractionStart;
+        if (fractionDigits == 1) {
+            minutes = fraction * 6;
+        }
+        else if (fractionDigits == 2 && fraction < 60) {
+            minutes = fraction;
+        }
+        else {
+            return false;
+        }
+    }
+    if (i < length && text[i] == ':') {
+        // Time zone name. Informational only.
+        while (i < length && text[i] != ']') {
+            ++i;
+        }
+    }
+    if (i >= length || text[i] != ']' || i + 1 != length) {
+        return false;
+    }
+    offsetSeconds = (hours * 3600 + minutes * 60) * (negative ? -1 : 1);
+    return true;
+}
+
+// Parse an OFX date (e.g. "20190101", "20190101120000.000[-5:EST]") into
+// seconds since 1970-01-01 UTC. The time zone offset is applied. Without
+// one, OFX says the time is GMT. Milliseconds are dropped. If zoneStart is
+// given, it's set to where the time zone starts (length if there isn't one),
+// for FormatOFXDateTime().
+inline bool ParseOFXDateTime(const char* text, size_t length,
+    long long& epochSeconds, size_t* zoneStart = NULL) {
+    size_t digitCount = 0;
+    while (digitCount < length &&
+        static_cast<unsigned>(text[digitCount] - '0') <= 9) {
+        ++digitCount;
+    }
+    if (digitCount != 8 && digitCount != 12 && digitCount != 14) {
+        return false;
+    }
+    // Fixed positions, so no branching per field. Missing fields are 0.
+    unsigned d[14] = {};
+    for (size_t i = 0; i < digitCount; ++i) {
+        d[i] = text[i] - '0';
+    }
+    const int year = d[0] * 1000 + d[1] * 100 + d[2] * 10 + d[3];
+    const unsigned month = d[4] * 10 + d[5];
+    const unsigned day = d[6] * 10 + d[7];
+    const unsigned hour = d[8] * 10 + d[9];
+    const unsigned minute = d[10] * 10 + d[11];
+    const unsigned second = d[12] * 10 + d[13];
+    static const unsigned DAYS_IN_MONTH[] =
+        { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    if (month - 1 > 11 || day - 1 >= DAYS_IN_MONTH[(month - 1) % 12] ||
+        hour > 23 || minute > 59 || second > 60) {
+        return false;
+    }
+    if (month == 2 && day == 29 &&
+        !(year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))) {
+        return false;
+    }
+
+    size_t i = digitCount;
+    if (i < length && text[i] == '.' && digitCount == 14) {
+        // Milliseconds. We don't keep them.
+        size_t start = ++i;
+        while (i < length && static_cast<unsigned>(text[i] - '0') <= 9) {
+            ++i;
+        }
+        if (i == start) {
+            return false;
+        }
+    }
+
+    long long offsetSeconds = 0;
+    if (zoneStart) {
+        *zoneStart = i;
+    }
+    if (i < length && !ParseOFXTimeZone(text + i, length - i,
+        offsetSeconds)) {
+        return false;
+    }
+    epochSeconds = DaysFromCivil(year, month, day) * 86400 +
+        hour * 3600 + minute * 60 + second - offsetSeconds;
+    return true;
+}
+
+inline bool ParseOFXDateTime(const std::string& text, long long& epochSeconds,
+    size_t* zoneStart = NULL) {
+    return ParseOFXDateTime(text.c_str(), text.length(), epochSeconds,
+        zoneStart);
+}
+
+// The canonical form Money accepts, e.g. "20190101120000.000[-5:EST]". The
+// date is written in the time zone it came in (zone is its text, from
+// ParseOFXDateTime()'s zoneStart on), so it lands on the same day in Money.
+// A date without a time zone is in GMT.
+inline std::string FormatOFXDateTime(long long epochSeconds,
+    const std::string& zone = std::string()) {
+    long long offsetSeconds = 0;
+    if (!zone.empty() &&
+        !ParseOFXTimeZone(zone.data(), zone.length(), offsetSeconds)) {
+        return std::string();  // Not from ParseOFXDateTime()
+    }
+    epochSeconds += offsetSeconds;
+    long long days = epochSeconds / 86400;
+    long long secondsOfDay = epochSeconds % 86400;
+    if (secondsOfDay < 0) {
+        secondsOfDay += 86400;
+        --days;
+    }
+    // Inverse of DaysFromCivil()
+    days += 719468;
+    const long long era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned dayOfEra = static_cast<unsigned>(days - era * 146097);
+    const unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 +
+        dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const unsigned dayOfYear = dayOfEra -
+        (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const unsigned mp = (5 * dayOfYear + 2) / 153;
+    const unsigned day = dayOfYear - (153 * mp + 2) / 5 + 1;
+    const unsigned month = mp < 10 ? mp + 3 : mp - 9;
+    const long long year = yearOfEra + era * 400 + (month <= 2);
+
+    char text[48];  // Room for any long long year
+    snprintf(text, sizeof(text), "%04lld%02u%02u%02u%02u%02u.000",
+        year, month, day,
+        static_cast<unsigned>(secondsOfDay / 3600),
+        static_cast<unsigned>(secondsOfDay / 60 % 60),
+        static_cast<unsigned>(secondsOfDay % 60));
+    return text + (zone.empty() ? std::string("[0:GMT]") : zone);
+}
+
+// A problem in converted OFX that will probably make Money reject the file.
+struct ValidationDiagnostic {
+    unsigned long long offset;  // Byte offset of the offending tag
+    unsigned long long line;  // Line number of the offending tag (1-based)
+    std::string message;
+};
+
+// Payee cleanup: rules that tidy up <NAME> and <MEMO>, like taking
+// "POS PURCHASE" off the front or the store number off the end. A rule is
+// an action and a piece of text, one per line:
+//
+//   prefix POS PURCHASE            Remove it from the start of the field
+//   suffix CARD {digits}           Remove it from the end of the field
+//   remove #{digits}               Remove it anywhere
+//   replace AMZN MKTP US = AMAZON  Replace it anywhere
+//
+// Text is matched ignoring case, and only as whole words. It can end with
+// {digits} (one or more digits), {word} (anything up to the next space) or
+// {rest} (everything to the end of the field).
+//
+// std::regex is too slow for this, and has memory trouble on long lines
+// (see ConvertQFXToOFX()). Instead, the texts of all the rules are compiled
+// into one Aho-Corasick automaton, with the failure links folded into the
+// transitions so it's a plain DFA. One pass over a field finds every rule
+// that matches, at a table lookup per byte; only the rules that matched
+// then look at the {...} at their end. Once compiled, the rules are only
+// read, so every thread of every conversion shares one copy (see
+// ConversionOptions).
+class PayeeRules {
+public:
+    // Compile rules, one per line. Blank lines and lines starting with #
+    // are ignored. On failure, says which line is wrong in error.
+    bool Compile(std::istream& in, std::string& error);
+    size_t RuleCount() const { return rules.size(); }
+
+    // Clean up text into cleaned, with the spaces left behind tidied up.
+    // Returns false, and leaves cleaned alone, if no rule changed it (or
+    // the rules would leave nothing).
+    bool Apply(const char* text, size_t length, std::string& cleaned) const;
+    bool Apply(const std::string& text, std::string& cleaned) const {
+        return Apply(text.data(), text.length(), cleaned);
+    }
+
+private:
+    enum Action { RULE_PREFIX, RULE_SUFFIX, RULE_REMOVE, RULE_REPLACE };
+    enum Tail { TAIL_NONE, TAIL_DIGITS, TAIL_WORD, TAIL_REST };
+    struct Rule {
+        Action action;
+        std::string literal;  // Upper case
+        Tail tail;
+        std::string replacement;
+    };
+    struct Match {
+        size_t start, end;
+        uint32_t rule;
+    };
+
+    void Build();
+    // Where tail ends if it starts at text[at], or npos if it isn't there
+    static size_t TailEnd(Tail tail, const char* text, size_t at,
+        size_t length);
+
+    std::vector<Rule> rules;
+    // Bytes that appear in no rule all share class 0, so the transition
+    // table only needs a column per byte the rules actually use
+    uint8_t byteClass[256];
+    uint32_t classCount = 1;
+    std::vector<uint32_t> next;  // [state * classCount + class]
+    // The rules whose literal ends at each state, failure links included:
+    // outputs[outputStart[state]] up to outputs[outputStart[state + 1]]
+    std::vector<uint32_t> outputStart;
+    std::vector<uint32_t> outputs;
+};
+
+// The rules used when there is no rules file. Each one is common in bank
+// downloads and never part of a payee's real name.
+const char DEFAULT_PAYEE_RULES[] =
+    "prefix POS PURCHASE\n"
+    "prefix POS DEBIT\n"
+    "prefix DEBIT CARD PURCHASE\n"
+    "prefix CHECKCARD {word}\n"
+    "prefix PURCHASE AUTHORIZED ON {word}\n"
+    "suffix CARD {digits}\n"
+    "suffix XXXX{digits}\n"
+    "remove #{digits}\n";
+
+inline bool IsWordByte(char c) {
+    return isalnum(static_cast<unsigned char>(c)) != 0;
+}
+
+inline bool IsAllSpace(const char* text, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (!isspace(static_cast<unsigned char>(text[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool PayeeRules::Compile(std::istream& in, std::string& error) {
+    static const struct { const char* name; Action action; } ACTIONS[] = {
+        { "prefix", RULE_PREFIX }, { "suffix", RULE_SUFFIX },
+        { "remove", RULE_REMOVE }, { "replace", RULE_REPLACE } };
+    static const struct { const char* name; Tail tail; } TAILS[] = {
+        { "{digits}", TAIL_DIGITS }, { "{word}", TAIL_WORD },
+        { "{rest}", TAIL_REST } };
+    rules.clear();
+    std::string line;
+    for (int lineNumber = 1; std::getline(in, line); ++lineNumber) {
+        const std::string where = "Line " + std::to_string(lineNumber) +
+            " of the payee rules: ";
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        size_t space = line.find_first_of(" \t", first);
+        std::string keyword = line.substr(first, space == std::string::npos ?
+            std::string::npos : space - first);
+        std::transform(keyword.begin(), keyword.end(), keyword.begin(),
+            [](unsigned char c) { return static_cast<char>(tolower(c)); });
+        Rule rule = { RULE_REMOVE, "", TAIL_NONE, "" };
+        bool known = false;
+        for (const auto& action : ACTIONS) {
+            if (keyword == action.name) {
+                rule.action = action.action;
+                known = true;
+            }
+        }
+        if (!known) {
+            error = where + "\"" + keyword + "\" should be prefix, suffix, "
+                "remove or replace.";
+            return false;
+        }
+
+        std::string text = space == std::string::npos ? "" :
+            line.substr(space);
+        if (rule.action == RULE_REPLACE) {
+            size_t equals = text.find(" = ");
+            if (equals == std::string::npos) {
+                error = where + "replace needs \"TEXT = NEW TEXT\".";
+                return false;
+            }
+            rule.replacement = text.substr(equals + 3);
+            text.erase(equals);
+            size_t end = rule.replacement.find_last_not_of(" \t\r");
+            rule.replacement.erase(end == std::string::npos ? 0 : end + 1);
+            size_t start = rule.replacement.find_first_not_of(" \t");
+            rule.replacement.erase(0, start);
+        }
+        size_t start = text.find_first_not_of(" \t");
+        size_t end = text.find_last_not_of(" \t\r");
+        text = start == std::string::npos ? "" :
+            text.substr(start, end - start + 1);
+        for (const auto& tail : TAILS) {
+            size_t tailLength = strlen(tail.name);
+            if (text.length() >= tailLength &&
+                text.compare(text.length() - tailLength, tailLength,
+                    tail.name) == 0) {
+                rule.tail = tail.tail;
+                text.erase(text.length() - tailLength);
+            }
+        }
+        if (text.empty()) {
+            error = where + "the rule needs some text to look for, not just "
+                "{digits}, {word} or {rest}.";
+            return false;
+        }
+        std::transform(text.begin(), text.end(), text.begin(),
+            [](unsigned char c) { return static_cast<char>(toupper(c)); });
+        rule.literal = text;
+        rules.push_back(rule);
+    }
+    Build();
+    return true;
+}
+
+inline void PayeeRules::Build() {
+    // Give every byte used by a rule its own class. Letters are matched
+    // ignoring case, so both cases of a letter share a class.
+    std::fill(byteClass, byteClass + 256, 0);
+    classCount = 1;
+    for (const Rule& rule : rules) {
+        for (char c : rule.literal) {
+            const unsigned char u = static_cast<unsigned char>(c);
+            if (byteClass[u] == 0 && classCount < 256) {
+                byteClass[u] = static_cast<uint8_t>(classCount);
+                byteClass[tolower(u)] = static_cast<uint8_t>(classCount);
+                ++classCount;
+            }
+        }
+    }
+
+    // The trie of the literals, with 0 for "no transition yet". State 0 is
+    // the root, so no transition goes back to it until the failure links
+    // are folded in.
+    next.assign(classCount, 0);
+    std::vector<std::vector<uint32_t>> ruleEnds(1);
+    for (uint32_t r = 0; r < rules.size(); ++r) {
+        uint32_t state = 0;
+        for (char c : rules[r].literal) {
+            uint32_t& target = next[state * classCount +
+                byteClass[static_cast<unsigned char>(c)]];
+            if (target == 0) {
+                target = static_cast<uint32_t>(ruleEnds.size());
+                ruleEnds.emplace_back();
+                next.resize(next.size() + classCount, 0);
+            }
+            state = next[state * classCount +
+                byteClass[static_cast<unsigned char>(c)]];
+        }
+        ruleEnds[state].push_back(r);
+    }
+
+    // Breadth first, so each state's failure state is done before it: fill
+    // in the missing transitions from the failure state, and inherit its
+    // outputs
+    const size_t stateCount = ruleEnds.size();
+    std::vector<uint32_t> fail(stateCount, 0);
+    std::deque<uint32_t> queue;
+    for (uint32_t c = 0; c < classCount; ++c) {
+        if (next[c] != 0) {
+            queue.push_back(next[c]);
+        }
+    }
+    while (!queue.empty()) {
+        uint32_t state = queue.front();
+        queue.pop_front();
+        const std::vector<uint32_t>& inherited = ruleEnds[fail[state]];
+        ruleEnds[state].insert(ruleEnds[state].end(), inherited.begin(),
+            inherited.end());
+        for (uint32_t c = 0; c < classCount; ++c) {
+            uint32_t& target = next[state * classCount + c];
+            const uint32_t fallback = next[fail[state] * classCount + c];
+            if (target == 0) {
+                target = fallback;
+            }
+            else {
+                fail[target] = fallback;
+                queue.push_back(target);
+            }
+        }
+    }
+
+    outputStart.assign(1, 0);
+    outputs.clear();
+    for (const std::vector<uint32_t>& ends : ruleEnds) {
+        outputs.insert(outputs.end(), ends.begin(), ends.end());
+        outputStart.push_back(static_cast<uint32_t>(outputs.size()));
+    }
+}
+
+inline size_t PayeeRules::TailEnd(Tail tail, const char* text, size_t at,
+    size_t length) {
+    size_t end = at;
+    switch (tail) {
+    case TAIL_NONE:
+        return at;
+    case TAIL_DIGITS:
+        while (end < length && isdigit(static_cast<unsigned char>(
+            text[end]))) {
+            ++end;
+        }
+        break;
+    case TAIL_WORD:
+        while (end < length && text[end] != ' ' && text[end] != '\t') {
+            ++end;
+        }
+        break;
+    case TAIL_REST:
+        return length;
+    }
+    return end > at ? end : std::string::npos;
+}
+
+inline bool PayeeRules::Apply(const char* text, size_t length,
+    std::string& cleaned) const {
+    if (rules.empty()) {
+        return false;
+    }
+    // Find every match in one pass. There are hardly ever any, so this
+    // doesn't allocate until there is one.
+    std::vector<Match> matches;
+    uint32_t state = 0;
+    for (size_t i = 0; i < length; ++i) {
+        state = next[state * classCount +
+            byteClass[static_cast<unsigned char>(text[i])]];
+        for (uint32_t o = outputStart[state]; o < outputStart[state + 1];
+            ++o) {
+            const Rule& rule = rules[outputs[o]];
+            Match match = { i + 1 - rule.literal.length(), 0, outputs[o] };
+            match.end = TailEnd(rule.tail, text, i + 1, length);
+            if (match.end == std::string::npos) {
+                continue;
+            }
+            // Whole words only
+            if ((match.start > 0 && IsWordByte(text[match.start]) &&
+                IsWordByte(text[match.start - 1])) ||
+                (match.end < length && IsWordByte(text[match.end - 1]) &&
+                    IsWordByte(text[match.end]))) {
+                continue;
+            }
+            if ((rule.action == RULE_PREFIX &&
+                !IsAllSpace(text, match.start)) ||
+                (rule.action == RULE_SUFFIX &&
+                    !IsAllSpace(text + match.end, length - match.end))) {
+                continue;
+            }
+            matches.push_back(match);
+        }
+    }
+    if (matches.empty()) {
+        return false;
+    }
+
+    // Leftmost first, then longest, and skip anything overlapping one
+    // that's already applied
+    std::sort(matches.begin(), matches.end(),
+        [](const Match& a, const Match& b) {
+        return a.start != b.start ? a.start < b.start : a.end > b.end;
+    });
+    std::string result;
+    size_t copied = 0;
+    for (const Match& match : matches) {
+        if (match.start < copied) {
+            continue;
+        }
+        result.append(text + copied, match.start - copied);
+        result += rules[match.rule].replacement;
+        copied = match.end;
+    }
+    result.append(text + copied, length - copied);
+
+    // Removing text leaves spaces behind. Squeeze them, and trim the ends.
+    std::string squeezed;
+    squeezed.reserve(result.length());
+    for (char c : result) {
+        if (c == ' ' || c == '\t') {
+            if (!squeezed.empty() && squeezed.back() != ' ') {
+                squeezed += ' ';
+            }
+        }
+        else {
+            squeezed += c;
+        }
+    }
+    if (!squeezed.empty() && squeezed.back() == ' ') {
+        squeezed.pop_back();
+    }
+    if (squeezed.empty() || squeezed.compare(0, std::string::npos, text,
+        length) == 0) {
+        return false;
+    }
+    cleaned.swap(squeezed);
+    return true;
+}
+
+// Stores each distinct string once and hands out 32-bit IDs for it. Payees
+// and memos repeat constantly (the same few hundred merchants across tens of
+// thousands of transactions), so this is much smaller than a heap string per
+// occurrence. Text lives in big arena blocks; the index is an open-addressing
+// hash table of IDs. ID 0 is always the empty string.
+class StringPool {
+public:
+    StringPool() : index(1024, 0) { Intern("", 0); }
+
+    uint32_t Intern(const char* text, size_t length);
+    uint32_t Intern(const char* text) { return Intern(text, strlen(text)); }
+    uint32_t Intern(const std::string& text) {
+        return Intern(text.c_str(), text.length());
+    }
+
+    const char* CStr(uint32_t id) const { return entries[id].text; }
+    size_t Length(uint32_t id) const { return entries[id].length; }
+    // How many distinct strings are stored
+    size_t Count() const { return entries.size(); }
+    // How many times Intern() was called, and the total length of every
+    // string passed to it (repeats included)
+    unsigned long long References() const { return references; }
+    unsigned long long BytesReferenced() const { return bytesReferenced; }
+    // Estimate of one heap string per occurrence, which is what we'd
+    // use without the pool
+    unsigned long long BytesAsSeparateStrings() const {
+        return bytesReferenced + references * sizeof(std::string);
+    }
+    // What the pool actually uses: arena blocks, entries and the index
+    size_t BytesStored() const {
+        return blockBytes + entries.capacity() * sizeof(Entry) +
+            index.capacity() * sizeof(uint32_t);
+    }
+
+private:
+    struct Entry {
+        const char* text;
+        uint32_t length;
+        uint32_t hash;
+    };
+    static uint32_t Hash(const char* text, size_t length) {
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < length; ++i) {
+            hash = (hash ^ static_cast<unsigned char>(text[i])) * 16777619u;
+        }
+        return hash;
+    }
+    char* Allocate(size_t bytes);
+    void Grow();
+
+    static const size_t BLOCK_SIZE = 64 * 1024;
+    std::vector<Entry> entries;  // Indexed by ID
+    std::vector<uint32_t> index;  // ID + 1, or 0 if the slot is empty
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char* blockPosition = NULL;
+    size_t blockRemaining = 0;
+    size_t blockBytes = 0;
+    unsigned long long references = 0;
+    unsigned long long bytesReferenced = 0;
+};
+
+inline uint32_t StringPool::Intern(const char* text, size_t length) {
+    ++references;
+    bytesReferenced += length;
+    const uint32_t hash = Hash(text, length);
+    const size_t mask = index.size() - 1;
+    size_t slot = hash & mask;
+    while (index[slot] != 0) {
+        const Entry& entry = entries[index[slot] - 1];
+        if (entry.hash == hash && entry.length == length &&
+            memcmp(entry.text, text, length) == 0) {
+            return index[slot] - 1;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    char* copy = Allocate(length + 1);
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    const uint32_t id = static_cast<uint32_t>(entries.size());
+    entries.push_back({ copy, static_cast<uint32_t>(length), hash });
+    index[slot] = id + 1;
+    // Keep the table at most half full so probes stay short.
+    if (entries.size() * 2 > index.size()) {
+        Grow();
+    }
+    return id;
+}
+
+inline char* StringPool::Allocate(size_t bytes) {
+    if (bytes > blockRemaining) {
+        // Oversized strings get a block of their own so we don't waste
+        // the rest of the current one.
+        size_t size = bytes > BLOCK_SIZE / 4 ? bytes : BLOCK_SIZE;
+        blocks.push_back(std::unique_ptr<char[]>(new char[size]));
+        blockBytes += size;
+        if (size != BLOCK_SIZE) {
+            return blocks.back().get();
+        }
+        blockPosition = blocks.back().get();
+        blockRemaining = size;
+    }
+    char* result = blockPosition;
+    blockPosition += bytes;
+    blockRemaining -= bytes;
+    return result;
+}
+
+inline void StringPool::Grow() {
+    std::vector<uint32_t> bigger(index.size() * 2, 0);
+    const size_t mask = bigger.size() - 1;
+    for (uint32_t id = 0; id < entries.size(); ++id) {
+        size_t slot = entries[id].hash & mask;
+        while (bigger[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        bigger[slot] = id + 1;
+    }
+    index.swap(bigger);
+}
+
+// A small DOM just for OFX, for when we need a tree but TinyXML-2 is more
+// than we need (it allocates every element and every text run separately,
+// and copies every string). Every node is 32 bytes in one vector and they
+// link to each other by index, so moving nodes around is just relinking and
+// the whole document goes away at once. Tag names are atoms from a
+// StringPool. Text is an offset and length into our copy of the source,
+// still escaped; new text is appended to the end of that copy.
+//
+// It only handles what XMLFixer produces for OFX: elements and text. No
+// attributes, comments, CDATA or <?...?> headers. Parse() returns false for
+// those, and the caller can use TinyXML-2 instead.
+class OFXDocument {
+public:
+    // Node 0 is the document itself, which is never anyone's child or
+    // sibling, so 0 also means "no node".
+    static const uint32_t DOCUMENT = 0;
+    static const uint32_t NONE = 0;
+    static const uint32_t TEXT = 0;  // Atom of text nodes ("")
+
+    OFXDocument() { Clear(); }
+
+    // Forget everything. Keeps the memory, for the next Parse(). Atoms
+    // stay the same.
+    void Clear();
+    bool Parse(const char* xml, size_t length);
+    bool Parse(const std::string& xml) {
+        return Parse(xml.c_str(), xml.length());
+    }
+    // Where Parse() gave up, in bytes
+    size_t ErrorOffset() const { return errorOffset; }
+
+    uint32_t Atom(const char* name) { return atoms.Intern(name); }
+    const char* Name(uint32_t node) const {
+        return atoms.CStr(nodes[node].atom);
+    }
+    bool IsText(uint32_t node) const { return nodes[node].atom == TEXT; }
+
+    uint32_t Parent(uint32_t node) const { return nodes[node].parent; }
+    uint32_t FirstChild(uint32_t node) const {
+        return nodes[node].firstChild;
+    }
+    uint32_t Next(uint32_t node) const { return nodes[node].next; }
+    uint32_t FirstChildElement(uint32_t node, uint32_t atom) const;
+    uint32_t NextSiblingElement(uint32_t node, uint32_t atom) const;
+
+    // Same idea as TinyXML-2's GetText(): an element whose content starts
+    // with text has text. Text() has the entities decoded.
+    bool HasText(uint32_t node) const { return nodes[node].textLength > 0; }
+    std::string Text(uint32_t node) const;
+    void AppendText(uint32_t node, std::string& out) const {
+        AppendDecoded(&source[nodes[node].textOffset],
+            nodes[node].textLength, out, false);
+    }
+    void SetText(uint32_t element, const std::string& value);
+    void RemoveText(uint32_t element) { nodes[element].textLength = 0; }
+
+    // Move node (and its children) to the end of parent's children
+    void InsertEndChild(uint32_t parent, uint32_t node);
+    // Take node out of the tree. Its slot is reused after Clear().
+    void Unlink(uint32_t node);
+
+    // Print node the same way TinyXML-2's XMLPrinter would with the given
+    // starting depth, so that output doesn't change depending on which DOM
+    // was used.
+    void Print(uint32_t node, int depth, std::string& out) const;
+
+    size_t NodeCount() const { return nodes.size(); }
+    size_t BytesUsed() const {
+        return nodes.capacity() * sizeof(Node) + source.capacity() +
+            atoms.BytesStored();
+    }
+
+private:
+    struct Node {
+        uint32_t atom;
+        uint32_t parent;
+        uint32_t firstChild;
+        uint32_t lastChild;
+        uint32_t next;
+        uint32_t previous;
+        // The element's text, if its content starts with text (or a text
+        // node's text). Escaped, in source.
+        uint32_t textOffset;
+        uint32_t textLength;
+    };
+    static_assert(sizeof(Node) <= 32, "OFXDocument nodes should stay small");
+
+    uint32_t NewNode(uint32_t atom, uint32_t parent);
+    static void AppendDecoded(const char* text, size_t length,
+        std::string& out, bool escape);
+
+    std::vector<Node> nodes;
+    std::string source;
+    StringPool atoms;
+    size_t errorOffset = 0;
+};
+
+inline void OFXDocument::Clear() {
+    nodes.clear();
+    source.clear();
+    errorOffset = 0;
+    Node document = { TEXT, NONE, NONE, NONE, NONE, NONE, 0, 0 };
+    nodes.push_back(document);
+}
+
+inline uint32_t OFXDocument::NewNode(uint32_t atom, uint32_t parent) {
+    uint32_t node = static_cast<uint32_t>(nodes.size());
+    Node newNode = { atom, NONE, NONE, NONE, NONE, NONE, 0, 0 };
+    nodes.push_back(newNode);
+    InsertEndChild(parent, node);
+    return node;
+}
+
+inline bool OFXDocument::Parse(const char* xml, size_t length) {
+    Clear();
+    if (length >= UINT32_MAX) {
+        return false;
+    }
+    source.assign(xml, length);
+    uint32_t current = DOCUMENT;
+    size_t i = 0;
+    while (i < length) {
+        if (source[i] != '<') {
+            // Like TinyXML-2, drop text that is nothing but whitespace.
+            size_t start = i;
+            while (i < length && isspace(static_cast<unsigned char>(
+                source[i]))) {
+                ++i;
+            }
+            if (i == length || source[i] == '<') {
+                continue;
+            }
+            size_t end = source.find('<', i);
+            if (end == std::string::npos) {
+                end = length;
+            }
+            i = start;
+            if (current == DOCUMENT) {
+                errorOffset = i;  // Text outside of any element
+                return false;
+            }
+            uint32_t owner = current;
+            if (nodes[current].firstChild != NONE || HasText(current)) {
+                owner = NewNode(TEXT, current);  // Mixed content
+            }
+            nodes[owner].textOffset = static_cast<uint32_t>(i);
+            nodes[owner].textLength = static_cast<uint32_t>(end - i);
+            i = end;
+            continue;
+        }
+        size_t close = source.find('>', i);
+        if (close == std::string::npos || source[i + 1] == '?' ||
+            source[i + 1] == '!') {
+            errorOffset = i;
+            return false;
+        }
+        if (source[i + 1] == '/') {
+            const char* name = &source[i + 2];
+            size_t nameLength = close - i - 2;
+            if (current == DOCUMENT ||
+                atoms.Length(nodes[current].atom) != nameLength ||
+                memcmp(Name(current), name, nameLength) != 0) {
+                errorOffset = i;
+                return false;
+            }
+            current = nodes[current].parent;
+        }
+        else {
+            bool selfContained = source[close - 1] == '/';
+            size_t nameEnd = selfContained ? close - 1 : close;
+            while (nameEnd > i + 1 && isspace(static_cast<unsigned char>(
+                source[nameEnd - 1]))) {
+                --nameEnd;
+            }
+            const char* name = &source[i + 1];
+            size_t nameLength = nameEnd - i - 1;
+            for (size_t j = 0; j < nameLength; ++j) {
+                if (isspace(static_cast<unsigned char>(name[j])) ||
+                    name[j] == '"' || name[j] == '\'' || name[j] == '=') {
+                    errorOffset = i;  // Attributes
+                    return false;
+                }
+            }
+            if (nameLength == 0) {
+                errorOffset = i;
+                return false;
+            }
+            uint32_t element = NewNode(atoms.Intern(name, nameLength),
+                current);
+            if (!selfContained) {
+                current = element;
+            }
+        }
+        i = close + 1;
+    }
+    if (current != DOCUMENT) {
+        errorOffset = length;  // Something wasn't closed
+        return false;
+    }
+    return true;
+}
+
+inline uint32_t OFXDocument::FirstChildElement(uint32_t node,
+    uint32_t atom) const {
+    for (uint32_t child = nodes[node].firstChild; child != NONE;
+        child = nodes[child].next) {
+        if (nodes[child].atom == atom) {
+            return child;
+        }
+    }
+    return NONE;
+}
+
+inline uint32_t OFXDocument::NextSiblingElement(uint32_t node,
+    uint32_t atom) const {
+    for (uint32_t sibling = nodes[node].next; sibling != NONE;
+        sibling = nodes[sibling].next) {
+        if (nodes[sibling].atom == atom) {
+            return sibling;
+        }
+    }
+    return NONE;
+}
+
+inline std::string OFXDocument::Text(uint32_t node) const {
+    std::string text;
+    AppendDecoded(&source[nodes[node].textOffset], nodes[node].textLength,
+        text, false);
+    return text;
+}
+
+inline void OFXDocument::SetText(uint32_t element, const std::string& value) {
+    assert(HasText(element) && value.length() > 0);
+    nodes[element].textOffset = static_cast<uint32_t>(source.length());
+    nodes[element].textLength = static_cast<uint32_t>(value.length());
+    for (const char& c : value) {
+        if (c == '&') {
+            source += "&amp;";
+            nodes[element].textLength += 4;
+        }
+        else if (c == '<') {
+            source += "&lt;";
+            nodes[element].textLength += 3;
+        }
+        else {
+            source += c;
+        }
+    }
+}
+
+inline void OFXDocument::Unlink(uint32_t node) {
+    Node& n = nodes[node];
+    if (n.parent == NONE && n.previous == NONE &&
+        nodes[DOCUMENT].firstChild != node) {
+        return;  // Not linked. (The document's children have parent 0.)
+    }
+    if (n.previous != NONE) {
+        nodes[n.previous].next = n.next;
+    }
+    else {
+        nodes[n.parent].firstChild = n.next;
+    }
+    if (n.next != NONE) {
+        nodes[n.next].previous = n.previous;
+    }
+    else {
+        nodes[n.parent].lastChild = n.previous;
+    }
+    n.parent = n.next = n.previous = NONE;
+}
+
+inline void OFXDocument::InsertEndChild(uint32_t parent, uint32_t node) {
+    Unlink(node);
+    Node& n = nodes[node];
+    n.parent = parent;
+    n.previous = nodes[parent].lastChild;
+    if (n.previous != NONE) {
+        nodes[n.previous].next = node;
+    }
+    else {
+        nodes[parent].firstChild = node;
+    }
+    nodes[parent].lastChild = node;
+}
+
+// Decode entities the way TinyXML-2 does, and optionally escape the result
+// again the way its printer does (only '&', '<' and '>').
+inline void OFXDocument::AppendDecoded(const char* text, size_t length,
+    std::string& out, bool escape) {
+    static const struct {
+        const char* name;
+        size_t length;
+        char value;
+    } ENTITIES[] = { { "quot;", 5, '"' }, { "amp;", 4, '&' },
+        { "apos;", 5, '\'' }, { "lt;", 3, '<' }, { "gt;", 3, '>' } };
+    const char* end = text + length;
+    for (const char* p = text; p < end; ++p) {
+        char c = *p;
+        std::string decoded(1, c);
+        if (c == '\r') {
+            // New lines become '\n'
+            decoded = "\n";
+            if (p + 1 < end && *(p + 1) == '\n') {
+                ++p;
+            }
+        }
+        else if (c == '&' && p + 1 < end && *(p + 1) == '#') {
+            // Character reference, e.g. &#39; or &#x27;
+            const char* q = p + 2;
+            bool hex = q < end && (*q == 'x' || *q == 'X');
+            if (hex) {
+                ++q;
+            }
+            unsigned long code = 0;
+            const char* digits = q;
+            while (q < end && (hex ? isxdigit(static_cast<unsigned char>(*q))
+                : isdigit(static_cast<unsigned char>(*q))) && code < 0x110000) {
+                code = code * (hex ? 16 : 10) + (isdigit(
+                    static_cast<unsigned char>(*q)) ? *q - '0' :
+                    (tolower(*q) - 'a' + 10));
+                ++q;
+            }
+            if (q > digits && q < end && *q == ';' && code > 0 &&
+                code < 0x110000) {
+                // UTF-8 encode it
+                decoded = "";
+                if (code < 0x80) {
+                    decoded += static_cast<char>(code);
+                }
+                else if (code < 0x800) {
+                    decoded += static_cast<char>(0xC0 | (code >> 6));
+                    decoded += static_cast<char>(0x80 | (code & 0x3F));
+                }
+                else if (code < 0x10000) {
+                    decoded += static_cast<char>(0xE0 | (code >> 12));
+                    decoded += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                    decoded += static_cast<char>(0x80 | (code & 0x3F));
+                }
+                else {
+                    decoded += static_cast<char>(0xF0 | (code >> 18));
+                    decoded += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+                    decoded += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                    decoded += static_cast<char>(0x80 | (code & 0x3F));
+                }
+                p = q;
+            }
+        }
+        else if (c == '&') {
+            for (const auto& entity : ENTITIES) {
+                if (static_cast<size_t>(end - p - 1) >= entity.length &&
+                    strncmp(p + 1, entity.name, entity.length) == 0) {
+                    decoded = std::string(1, entity.value);
+                    p += entity.length;
+                    break;
+                }
+            }
+        }
+        if (!escape) {
+            out += decoded;
+            continue;
+        }
+        for (const char& d : decoded) {
+            if (d == '&') {
+                out += "&amp;";
+            }
+            else if (d == '<') {
+                out += "&lt;";
+            }
+            else if (d == '>') {
+                out += "&gt;";
+            }
+            else {
+                out += d;
+            }
+        }
+    }
+}
+
+inline void OFXDocument::Print(uint32_t node, int depth,
+    std::string& out) const {
+    // This follows XMLPrinter's OpenElement(), PushText() and
+    // CloseElement(), including its quirks: no new line before the first
+    // element, and nothing but text and children on one line once an
+    // element has text.
+    int textDepth = -1;
+    bool elementJustOpened = false;
+    bool firstElement = true;
+    auto newLine = [&out](int spaces) {
+        out += '\n';
+        out.append(4 * spaces, ' ');
+    };
+    auto pushText = [&](uint32_t owner) {
+        textDepth = depth - 1;
+        if (elementJustOpened) {
+            out += '>';
+            elementJustOpened = false;
+        }
+        AppendDecoded(&source[nodes[owner].textOffset],
+            nodes[owner].textLength, out, true);
+    };
+    uint32_t current = node;
+    while (true) {
+        // Open the current node
+        if (IsText(current)) {
+            pushText(current);
+        }
+        else {
+            if (elementJustOpened) {
+                out += '>';
+            }
+            if (textDepth < 0 && !firstElement) {
+                newLine(depth);
+            }
+            out += '<';
+            out += Name(current);
+            elementJustOpened = true;
+            firstElement = false;
+            ++depth;
+            if (HasText(current)) {
+                pushText(current);
+            }
+            if (nodes[current].firstChild != NONE) {
+                current = nodes[current].firstChild;
+                continue;
+            }
+        }
+        // Close it, and any parents we've finished
+        while (true) {
+            if (!IsText(current)) {
+                --depth;
+                if (elementJustOpened) {
+                    out += "/>";
+                }
+                else {
+                    if (textDepth < 0) {
+                        newLine(depth);
+                    }
+                    out += "</";
+                    out += Name(current);
+                    out += '>';
+                }
+                if (textDepth == depth) {
+                    textDepth = -1;
+                }
+                if (depth == 0) {
+                    out += '\n';
+                }
+                elementJustOpened = false;
+            }
+            if (current == node) {
+                return;
+            }
+            if (nodes[current].next != NONE) {
+                current = nodes[current].next;
+                break;
+            }
+            current = nodes[current].parent;
+        }
+    }
+}
+
+// Transaction types from the OFX spec. The store keeps the index (1 byte).
+const std::vector<std::string> TRNTYPE_CODES{ "CREDIT", "DEBIT", "INT",
+    "DIV", "FEE", "SRVCHG", "DEP", "ATM", "POS", "XFER", "CHECK", "PAYMENT",
+    "CASH", "DIRECTDEP", "DIRECTDEBIT", "REPEATPMT", "HOLD", "OTHER", };
+
+// Escape text for use as an XML value.
+inline std::string EscapeXML(const char* text) {
+    std::string escaped;
+    for (const char* p = text; *p != '\0'; ++p) {
+        switch (*p) {
+        case '&': escaped += "&amp;"; break;
+        case '<': escaped += "&lt;"; break;
+        case '>': escaped += "&gt;"; break;
+        default: escaped += *p; break;
+        }
+    }
+    return escaped;
+}
+
+// The <ACCTID> of the <BANKACCTFROM>/<CCACCTFROM> in a <STMTRS>/<CCSTMTRS>
+inline const char* FindAccountId(const tinyxml2::XMLElement* stmtrs) {
+    const char* FROM_ELEMENTS[] = { "BANKACCTFROM", "CCACCTFROM" };
+    for (const char* from : FROM_ELEMENTS) {
+        const tinyxml2::XMLElement* acctfrom =
+            stmtrs ? stmtrs->FirstChildElement(from) : NULL;
+        const tinyxml2::XMLElement* acctid =
+            acctfrom ? acctfrom->FirstChildElement("ACCTID") : NULL;
+        if (acctid && acctid->GetText()) {
+            return acctid->GetText();
+        }
+    }
+    return "";
+}
+
+// The converted <STMTTRN>s of a statement, stored column by column instead
+// of as TinyXML nodes. Sorting, de-duping and filtering run over contiguous
+// arrays instead of re-walking the DOM, and the rows can be written back out
+// as <STMTTRN> XML. Text is kept once in a StringPool and referenced by ID.
+class TransactionStore {
+public:
+    static const uint32_t NO_STRING = 0;  // String ID for "not present"
+    static const long long NO_DATE = LLONG_MIN;
+
+    // Add a <STMTTRN> that PruneSTMTTRN() has already cleaned up. Returns
+    // false (and adds nothing) if a field can't be held exactly, e.g. an
+    // unknown <TRNTYPE> or a date that doesn't parse.
+    bool Add(const tinyxml2::XMLElement* stmttrn, const char* accountId);
+
+    size_t Size() const { return amount.size(); }
+    // How many <STMTTRN>s Add() had to turn away
+    size_t Rejected() const { return rejected; }
+    // The amounts of the turned away <STMTTRN>s, as far as they could be
+    // read, and how many couldn't
+    long long RejectedAmount() const { return rejectedAmount; }
+    size_t UnreadAmounts() const { return unreadAmounts; }
+    const char* String(uint32_t id) const { return pool.CStr(id); }
+    StringPool& Pool() { return pool; }
+    const StringPool& Pool() const { return pool; }
+
+    // Row numbers sorted by <DTPOSTED>. Ties keep their original order.
+    std::vector<uint32_t> SortedByPosted() const;
+    // Drop rows whose account and <FITID> were already seen
+    std::vector<uint32_t> Dedupe(const std::vector<uint32_t>& rows) const;
+    // Keep rows posted in [from, to)
+    std::vector<uint32_t> FilterByPosted(const std::vector<uint32_t>& rows,
+        long long from, long long to) const;
+    std::vector<uint32_t> AllRows() const;
+
+    // Write a row out as a <STMTTRN>, fields in STMTTRN_WHITELIST order.
+    void AppendSTMTTRN(uint32_t row, std::string& xml) const;
+
+    // The columns. All have Size() entries.
+    std::vector<unsigned char> type;  // Index into TRNTYPE_CODES
+    std::vector<long long> posted;  // Epoch seconds (UTC)
+    std::vector<long long> user;  // Epoch seconds (UTC) or NO_DATE
+    // The time zones the dates came in, e.g. "[-5:EST]", so they're written
+    // back out on the same day
+    std::vector<uint32_t> postedZone;
+    std::vector<uint32_t> userZone;
+    std::vector<long long> amount;  // Minor units (cents)
+    std::vector<uint32_t> fitid;
+    std::vector<uint32_t> checknum;
+    std::vector<uint32_t> name;  // <NAME> text
+    std::vector<uint32_t> payee;  // Printed <PAYEE> (used if no <NAME>)
+    std::vector<uint32_t> acctto;  // Printed <CCACCTTO>/<BANKACCTTO>
+    std::vector<uint32_t> memo;
+    std::vector<uint32_t> account;  // <ACCTID> of the statement
+
+private:
+    uint32_t InternText(const tinyxml2::XMLElement* element);
+    uint32_t InternPrinted(const tinyxml2::XMLElement* element);
+
+    StringPool pool;
+    size_t rejected = 0;
+    long long rejectedAmount = 0;
+    size_t unreadAmounts = 0;
+};
+
+inline uint32_t TransactionStore::InternText(
+    const tinyxml2::XMLElement* element) {
+    if (!element || !element->GetText()) {
+        return NO_STRING;
+    }
+    return pool.Intern(element->GetText());
+}
+
+inline uint32_t TransactionStore::InternPrinted(
+    const tinyxml2::XMLElement* element) {
+    if (!element) {
+        return NO_STRING;
+    }
+    tinyxml2::XMLPrinter printer(NULL, true);
+    element->Accept(&printer);
+    return pool.Intern(printer.CStr());
+}
+
+inline bool TransactionStore::Add(const tinyxml2::XMLElement* stmttrn,
+    const char* accountId) {
+    const tinyxml2::XMLElement* trntype =
+        stmttrn->FirstChildElement("TRNTYPE");
+    const tinyxml2::XMLElement* dtposted =
+        stmttrn->FirstChildElement("DTPOSTED");
+    const tinyxml2::XMLElement* dtuser = stmttrn->FirstChildElement("DTUSER");
+    const tinyxml2::XMLElement* trnamt = stmttrn->FirstChildElement("TRNAMT");
+
+    size_t typeCode = TRNTYPE_CODES.size();
+    if (trntype && trntype->GetText()) {
+        for (typeCode = 0; typeCode < TRNTYPE_CODES.size(); ++typeCode) {
+            if (TRNTYPE_CODES[typeCode] == trntype->GetText()) {
+                break;
+            }
+        }
+    }
+    long long postedSeconds;
+    long long userSeconds = NO_DATE;
+    size_t postedZoneStart, userZoneStart;
+    long long minorUnits;
+    if (typeCode == TRNTYPE_CODES.size() ||
+        !dtposted || !dtposted->GetText() ||
+        !ParseOFXDateTime(dtposted->GetText(), strlen(dtposted->GetText()),
+            postedSeconds, &postedZoneStart) ||
+        (dtuser && (!dtuser->GetText() ||
+            !ParseOFXDateTime(dtuser->GetText(), strlen(dtuser->GetText()),
+                userSeconds, &userZoneStart))) ||
+        !trnamt || !trnamt->GetText() ||
+        !ParseOFXAmount(trnamt->GetText(), strlen(trnamt->GetText()),
+            minorUnits)) {
+        ++rejected;
+        // Still count the amount towards the balance check
+        if (trnamt && trnamt->GetText() &&
+            ParseOFXAmount(trnamt->GetText(), strlen(trnamt->GetText()),
+                minorUnits)) {
+            rejectedAmount += minorUnits;
+        }
+        else {
+            ++unreadAmounts;
+        }
+        return false;
+    }
+
+    const tinyxml2::XMLElement* accttoElement =
+        stmttrn->FirstChildElement("CCACCTTO");
+    if (!accttoElement) {
+        accttoElement = stmttrn->FirstChildElement("BANKACCTTO");
+    }
+    type.push_back(static_cast<unsigned char>(typeCode));
+    posted.push_back(postedSeconds);
+    user.push_back(userSeconds);
+    postedZone.push_back(pool.Intern(dtposted->GetText() + postedZoneStart));
+    userZone.push_back(dtuser ?
+        pool.Intern(dtuser->GetText() + userZoneStart) : NO_STRING);
+    amount.push_back(minorUnits);
+    fitid.push_back(InternText(stmttrn->FirstChildElement("FITID")));
+    checknum.push_back(InternText(stmttrn->FirstChildElement("CHECKNUM")));
+    name.push_back(InternText(stmttrn->FirstChildElement("NAME")));
+    payee.push_back(InternPrinted(stmttrn->FirstChildElement("PAYEE")));
+    acctto.push_back(InternPrinted(accttoElement));
+    memo.push_back(InternText(stmttrn->FirstChildElement("MEMO")));
+    account.push_back(pool.Intern(accountId));
+    return true;
+}
+
+inline std::vector<uint32_t> TransactionStore::AllRows() const {
+    std::vector<uint32_t> rows(Size());
+    for (uint32_t i = 0; i < rows.size(); ++i) {
+        rows[i] = i;
+    }
+    return rows;
+}
+
+inline std::vector<uint32_t> TransactionStore::SortedByPosted() const {
+    std::vector<uint32_t> rows = AllRows();
+    const std::vector<long long>& dates = posted;
+    std::stable_sort(rows.begin(), rows.end(),
+        [&dates](uint32_t a, uint32_t b) { return dates[a] < dates[b]; });
+    return rows;
+}
+
+inline std::vector<uint32_t> TransactionStore::Dedupe(
+    const std::vector<uint32_t>& rows) const {
+    // FITIDs are unique per account, so key on both string IDs.
+    std::set<std::pair<uint32_t, uint32_t>> seen;
+    std::vector<uint32_t> unique;
+    unique.reserve(rows.size());
+    for (uint32_t row : rows) {
+        if (fitid[row] == NO_STRING ||
+            seen.insert(std::make_pair(account[row], fitid[row])).second) {
+            unique.push_back(row);
+        }
+    }
+    return unique;
+}
+
+inline std::vector<uint32_t> TransactionStore::FilterByPosted(
+    const std::vector<uint32_t>& rows, long long from, long long to) const {
+    std::vector<uint32_t> kept;
+    for (uint32_t row : rows) {
+        if (posted[row] >= from && posted[row] < to) {
+            kept.push_back(row);
+        }
+    }
+    return kept;
+}
+
+inline void TransactionStore::AppendSTMTTRN(uint32_t row,
+    std::string& xml) const {
+    xml += "<STMTTRN><TRNTYPE>" + TRNTYPE_CODES[type[row]] + "</TRNTYPE>";
+    xml += "<DTPOSTED>" + FormatOFXDateTime(posted[row],
+        pool.CStr(postedZone[row])) + "</DTPOSTED>";
+    if (user[row] != NO_DATE) {
+        xml += "<DTUSER>" + FormatOFXDateTime(user[row],
+            pool.CStr(userZone[row])) + "</DTUSER>";
+    }
+    xml += "<TRNAMT>" + FormatOFXAmount(amount[row]) + "</TRNAMT>";
+    if (fitid[row] != NO_STRING) {
+        xml += "<FITID>" + EscapeXML(pool.CStr(fitid[row])) +
+            "</FITID>";
+    }
+    if (checknum[row] != NO_STRING) {
+        xml += "<CHECKNUM>" + EscapeXML(pool.CStr(checknum[row])) +
+            "</CHECKNUM>";
+    }
+    if (name[row] != NO_STRING) {
+        xml += "<NAME>" + EscapeXML(pool.CStr(name[row])) + "</NAME>";
+    }
+    else if (payee[row] != NO_STRING) {
+        xml += pool.CStr(payee[row]);  // Already printed XML
+    }
+    if (acctto[row] != NO_STRING) {
+        xml += pool.CStr(acctto[row]);
+    }
+    if (memo[row] != NO_STRING) {
+        xml += "<MEMO>" + EscapeXML(pool.CStr(memo[row])) + "</MEMO>";
+    }
+    xml += "</STMTTRN>";
+}
+
+// Replace the <STMTTRN>s in a <BANKTRANLIST> with the given store rows.
+inline bool WriteSTMTTRNsFromStore(const TransactionStore& store,
+    const std::vector<uint32_t>& rows, tinyxml2::XMLElement* banktranlist) {
+    std::string xml = "<BANKTRANLIST>";
+    for (uint32_t row : rows) {
+        store.AppendSTMTTRN(row, xml);
+    }
+    xml += "</BANKTRANLIST>";
+    tinyxml2::XMLDocument scratch;
+    scratch.Parse(xml.c_str(), xml.length());
+    if (scratch.ErrorID() != 0) {
+        return false;
+    }
+    tinyxml2::XMLElement* stmttrn;
+    while ((stmttrn = banktranlist->FirstChildElement("STMTTRN")) != NULL) {
+        banktranlist->DeleteChild(stmttrn);
+    }
+    for (stmttrn = scratch.FirstChildElement()->FirstChildElement("STMTTRN");
+        stmttrn; stmttrn = stmttrn->NextSiblingElement("STMTTRN")) {
+        banktranlist->InsertEndChild(
+            stmttrn->DeepClone(banktranlist->GetDocument()));
+    }
+    return true;
+}
+
+// The loops that run for every transaction or every line are templates on
+// a policy that says which clean ups are on. A fixed policy has the answers
+// built in, so the compiler drops the checks (and the code for clean ups
+// that are off), and each combination of options gets its own loop. The
+// one to use is picked once per document or <BANKTRANLIST> (see
+// ChooseTransactionPruner()), not once per transaction. RuntimePolicy reads
+// the options every time, which is how it used to work. /benchmark times
+// each fixed policy against it (see ReportPolicyVariants()).
+// Payee rules aren't part of the policy. They're a pointer check next to a
+// lot of work when they're on.
+template <bool DEDUPE_MEMO, bool NORMALIZE>
+struct PrunePolicy {
+    static bool DedupeMemo(const ConversionOptions&) {
+        return DEDUPE_MEMO;
+    }
+    static bool NormalizeAmountsAndDates(const ConversionOptions&) {
+        return NORMALIZE;
+    }
+};
+template <bool TRIM_LINES>
+struct PolishPolicy {
+    static bool TrimLines(const ConversionOptions&) { return TRIM_LINES; }
+};
+struct RuntimePolicy {
+    static bool DedupeMemo(const ConversionOptions& options) {
+        return options.dedupeMemoField;
+    }
+    static bool NormalizeAmountsAndDates(const ConversionOptions& options) {
+        return options.normalizeAmountsAndDates;
+    }
+    static bool TrimLines(const ConversionOptions& options) {
+        return options.trimLines;
+    }
+};
+
+// The two DOMs we prune, behind the same few operations, so the rules for
+// a <STMTTRN> are only written once, in PruneOneSTMTTRN(). Node is what the
+// DOM calls a node, and None() is "no node".
+class TinyXMLTree {
+public:
+    typedef tinyxml2::XMLNode* Node;
+
+    // If a graveyard is given, see PruneTransactions()
+    TinyXMLTree(tinyxml2::XMLDocument* doc, tinyxml2::XMLElement* graveyard)
+        : doc(doc), graveyard(graveyard) {}
+
+    static Node None() { return NULL; }
+    Node FirstChild(Node node) const { return node->FirstChild(); }
+    Node Child(Node node, const char* name) const {
+        return node->FirstChildElement(name);
+    }
+    bool HasText(Node element) const {
+        return element->ToElement()->GetText() != NULL;
+    }
+    // The element's text, decoded, or NULL if it has none. scratch is for
+    // DOMs that have to decode it somewhere.
+    const char* Text(Node element, std::string&) const {
+        return element->ToElement()->GetText();
+    }
+    void SetText(Node element, const std::string& text) {
+        element->ToElement()->SetText(text.c_str());
+    }
+    void InsertEndChild(Node parent, Node node) {
+        parent->InsertEndChild(node);
+    }
+    void Discard(Node node) {
+        if (graveyard) {
+            graveyard->InsertEndChild(node);
+        }
+        else {
+            doc->DeleteNode(node);
+        }
+    }
+    // TinyXML-2 keeps text in nodes, which are discarded like the rest
+    void DiscardOwnText(Node) {}
+
+private:
+    tinyxml2::XMLDocument* doc;
+    tinyxml2::XMLElement* graveyard;
+};
+
+class OFXDocumentTree {
+public:
+    typedef uint32_t Node;
+
+    explicit OFXDocumentTree(OFXDocument& doc) : doc(doc) {}
+
+    static Node None() { return OFXDocument::NONE; }
+    Node FirstChild(Node node) const { return doc.FirstChild(node); }
+    Node Child(Node node, const char* name) const {
+        return doc.FirstChildElement(node, doc.Atom(name));
+    }
+    bool HasText(Node element) const { return doc.HasText(element); }
+    const char* Text(Node element, std::string& scratch) const {
+        if (!doc.HasText(element)) {
+            return NULL;
+        }
+        scratch.clear();
+        doc.AppendText(element, scratch);
+        return scratch.c_str();
+    }
+    void SetText(Node element, const std::string& text) {
+        doc.SetText(element, text);
+    }
+    void InsertEndChild(Node parent, Node node) {
+        doc.InsertEndChild(parent, node);
+    }
+    void Discard(Node node) { doc.Unlink(node); }
+    // Text in front of the first child is kept in the element itself
+    void DiscardOwnText(Node element) { doc.RemoveText(element); }
+
+private:
+    OFXDocument& doc;
+};
+
+// Clean up <NAME> and <MEMO> with rules
+template <class Tree>
+void CleanUpPayee(Tree& tree, typename Tree::Node stmttrn,
+    const PayeeRules& rules) {
+    const char* FIELDS[] = { "NAME", "MEMO" };
+    std::string scratch;
+    std::string cleaned;
+    for (const char* field : FIELDS) {
+        typename Tree::Node element = tree.Child(stmttrn, field);
+        const char* text = element != Tree::None() ?
+            tree.Text(element, scratch) : NULL;
+        if (text && rules.Apply(text, strlen(text), cleaned)) {
+            tree.SetText(element, cleaned);
+        }
+    }
+}
+
+// Rewrite <TRNAMT>, <DTPOSTED> and <DTUSER> in the canonical form. Values
+// we can't parse are left alone for the validator to complain about.
+template <class Tree>
+void NormalizeAmountAndDates(Tree& tree, typename Tree::Node stmttrn) {
+    std::string scratch;
+    typename Tree::Node trnamt = tree.Child(stmttrn, "TRNAMT");
+    const char* text = trnamt != Tree::None() ?
+        tree.Text(trnamt, scratch) : NULL;
+    long long minorUnits;
+    if (text && ParseOFXAmount(text, strlen(text), minorUnits)) {
+        tree.SetText(trnamt, FormatOFXAmount(minorUnits));
+    }
+    const char* DATE_FIELDS[] = { "DTPOSTED", "DTUSER" };
+    for (const char* field : DATE_FIELDS) {
+        typename Tree::Node date = tree.Child(stmttrn, field);
+        text = date != Tree::None() ? tree.Text(date, scratch) : NULL;
+        long long epochSeconds;
+        size_t zoneStart;
+        if (text && ParseOFXDateTime(text, strlen(text), epochSeconds,
+            &zoneStart)) {
+            tree.SetText(date, FormatOFXDateTime(epochSeconds,
+                text + zoneStart));
+        }
+    }
+}
+
+// Remove a <STMTTRN>'s extra child elements and order the rest correctly,
+// on either DOM. PruneTransactions() and PruneTransaction() both come here,
+// so the full conversion and the bounded-memory one can't drift apart.
+template <class Policy, class Tree>
+void PruneOneSTMTTRN(Tree& tree, typename Tree::Node stmttrn,
+    const ConversionOptions& options) {
+    typedef typename Tree::Node Node;
+    // The <STMTTRN> is where all the magic and trouble happens.
+    // Extra elements under it will choke MS Money. Also, so will
+    // out-of-order elements!
+    // Let's remove any extra elements that don't match a whitelist AND
+    // put it in order.
+    /*
+        Here's an example of a sanitized STMTTRN:
+        <STMTTRN>
+          <TRNTYPE>CHECK</TRNTYPE>
+          <DTPOSTED>20190101120000.000[0:GMT]</DTPOSTED>
+          <TRNAMT>-1.00</TRNAMT>
+          <FITID>0123456789ABCDEF</FITID>
+          <CHECKNUM>100</CHECKNUM>
+          <NAME>CHECK# 100 CHECK WITHDRAWAL</NAME>
+          <MEMO>CHECK# 100 CHECK WITHDRAWAL</MEMO>
+        </STMTTRN>
+    */
+
+    // Cleanup: Payee rules go first, since a cleaned up MEMO may now
+    // match the NAME
+    if (options.payeeRules) {
+        CleanUpPayee(tree, stmttrn, *options.payeeRules);
+    }
+
+    // Cleanup: De-dupe (aka Delete) MEMO field if it is identical to NAME
+    if (Policy::DedupeMemo(options)) {
+        // If <NAME> == <MEMO>, then delete MEMO field.
+        // Personally, I hate when this gets duplicated. Waste of space!
+        Node name = tree.Child(stmttrn, "NAME");
+        Node memo = tree.Child(stmttrn, "MEMO");
+        std::string nameScratch;
+        std::string memoScratch;
+        const char* nameText = name != Tree::None() ?
+            tree.Text(name, nameScratch) : NULL;
+        const char* memoText = memo != Tree::None() ?
+            tree.Text(memo, memoScratch) : NULL;
+        if (nameText && memoText && strcmp(nameText, memoText) == 0) {
+            tree.Discard(memo);
+        }
+    }
+
+    // Cleanup: Rewrite amounts and dates in the form Money likes best
+    if (Policy::NormalizeAmountsAndDates(options)) {
+        NormalizeAmountAndDates(tree, stmttrn);
+    }
+
+    // The children to keep, in order
+    std::vector<Node> ordered;
+    for (const WhitelistField& field : StmttrnWhitelistFields()) {
+        // Go through the whitelist, which is in correct order, and
+        // collect the children in that order
+        Node child = tree.Child(stmttrn, field.name);
+
+        // If Child is an empty value, skip it
+        if (child != Tree::None() && !tree.HasText(child)) {
+            continue;
+        }
+
+        // Special Case 1: If no <NAME>, check if <PAYEE> and use that. 
+        // But, delete <PAYEE> if both elements are present.
+        // Special Case 2: If no <CCACCTTO>, check <BANKACCTTO>.
+        // But, delete <BANKACCTTO> if both present. Presence of both
+        // will cause issues.
+        // Neither one is required, so it's no problem if both the
+        // field and its alternative are missing.
+        if (field.alternative) {
+            Node other = tree.Child(stmttrn, field.alternative);
+            if (child == Tree::None()) {
+                child = other;
+            }
+            else if (other != Tree::None()) {
+                tree.Discard(other);
+            }
+        }
+
+        if (child != Tree::None()) {
+            ordered.push_back(child);
+        }
+    }
+
+    // I want to preserve the order of the STMTTRN element, so leave it in
+    // place and relink the children in order by moving each one to the
+    // end. Whatever is left in front of them is not wanted, and neither is
+    // text directly under <STMTTRN>.
+    for (Node child : ordered) {
+        tree.InsertEndChild(stmttrn, child);
+    }
+    Node firstKept = ordered.empty() ? Tree::None() : ordered[0];
+    while (tree.FirstChild(stmttrn) != firstKept) {
+        tree.Discard(tree.FirstChild(stmttrn));
+    }
+    tree.DiscardOwnText(stmttrn);
+}
+
+// Remove any extra STMTTRN child elements. Order elements correctly.
+// If a store is given, each cleaned up STMTTRN is also added to it.
+// If a graveyard is given, removed elements are moved there instead of being
+// deleted, and nothing is allocated from the document. That makes it safe to
+// prune different <BANKTRANLIST>s of the same document on different threads.
+// The caller deletes the graveyard afterwards.
+// Call PruneSTMTTRN(), which picks the Policy that matches the options.
+template <class Policy>
+void PruneTransactions(tinyxml2::XMLElement* banktranlist,
+    const ConversionOptions& options, TransactionStore* store,
+    tinyxml2::XMLElement* graveyard) {
+    // We need to prune extra elements because they can cause MS Money to 
+    // reject the file. This increases our chances of success. They also
+    // need to be in the correct order.
+
+    // * I've observed STMTRN elements as children under the following:
+    //   * <OFX><CREDITCARDMSGSRSV1><CCSTMTTRNRS><CCSTMTRS><BANKTRANLIST>
+    //   * <OFX><BANKMSGSRSV1><STMTTRNRS><STMTRS><BANKTRANLIST>
+    //   * Are there others that I should care about?
+    const char* accountId = store ?
+        FindAccountId(banktranlist->Parent()->ToElement()) : "";
+    TinyXMLTree tree(banktranlist->GetDocument(), graveyard);
+    tinyxml2::XMLElement* stmttrn = banktranlist->FirstChildElement("STMTTRN");
+    while (stmttrn) {  // For every STMTTRN element
+        tinyxml2::XMLElement* current_stmttrn = stmttrn;
+        // Get pointer to next element first, since doing it at the end
+        // (after all our modifications) means NextSiblingElement is NULL.
+        stmttrn = stmttrn->NextSiblingElement("STMTTRN");
+        PruneOneSTMTTRN<Policy>(tree, current_stmttrn, options);
+        if (store) {
+            store->Add(current_stmttrn, accountId);
+        }
+    }
+}
+
+typedef void (*TransactionPruner)(tinyxml2::XMLElement* banktranlist,
+    const ConversionOptions& options, TransactionStore* store,
+    tinyxml2::XMLElement* graveyard);
+
+// The PruneTransactions() made for options
+inline TransactionPruner ChooseTransactionPruner(
+    const ConversionOptions& options) {
+    static const TransactionPruner PRUNERS[2][2] = {
+        { PruneTransactions<PrunePolicy<false, false>>,
+            PruneTransactions<PrunePolicy<false, true>> },
+        { PruneTransactions<PrunePolicy<true, false>>,
+            PruneTransactions<PrunePolicy<true, true>> },
+    };
+    return PRUNERS[options.dedupeMemoField]
+        [options.normalizeAmountsAndDates];
+}
+
+// See PruneTransactions()
+inline void PruneSTMTTRN(tinyxml2::XMLElement* banktranlist,
+    const ConversionOptions& options,
+    TransactionStore* store = NULL,
+    tinyxml2::XMLElement* graveyard = NULL) {
+    ChooseTransactionPruner(options)(banktranlist, options, store,
+        graveyard);
+}
+
+// PruneTransactions() for one <STMTTRN> of an OFXDocument
+template <class Policy>
+void PruneTransaction(OFXDocument& doc, uint32_t stmttrn,
+    const ConversionOptions& options) {
+    OFXDocumentTree tree(doc);
+    PruneOneSTMTTRN<Policy>(tree, stmttrn, options);
+}
+
+typedef void (*BlockPruner)(OFXDocument& doc, uint32_t stmttrn,
+    const ConversionOptions& options);
+
+// The PruneTransaction() made for options
+inline BlockPruner ChooseBlockPruner(const ConversionOptions& options) {
+    static const BlockPruner PRUNERS[2][2] = {
+        { PruneTransaction<PrunePolicy<false, false>>,
+            PruneTransaction<PrunePolicy<false, true>> },
+        { PruneTransaction<PrunePolicy<true, false>>,
+            PruneTransaction<PrunePolicy<true, true>> },
+    };
+    return PRUNERS[options.dedupeMemoField]
+        [options.normalizeAmountsAndDates];
+}
+
+// Follow a TYPE_TO_BANKTRANLIST_MAP path down from parent and collect every
+// <BANKTRANLIST> at the end of it. Unlike FirstChildElement(), this follows
+// every sibling with a matching name at each level, because banks that
+// bundle several accounts in one download repeat <STMTTRNRS> (and sometimes
+// the message set). deepestMatch is set to how many path elements we found,
+// for error messages.
+inline void FindBANKTRANLISTs(tinyxml2::XMLNode* parent,
+    const std::vector<std::string>& path, size_t depth,
+    std::vector<tinyxml2::XMLElement*>& found, size_t& deepestMatch) {
+    const char* name = path[depth].c_str();
+    for (tinyxml2::XMLElement* element = parent->FirstChildElement(name);
+        element; element = element->NextSiblingElement(name)) {
+        if (depth + 1 > deepestMatch) {
+            deepestMatch = depth + 1;
+        }
+        if (depth + 1 == path.size()) {
+            found.push_back(element);
+        }
+        else {
+            FindBANKTRANLISTs(element, path, depth + 1, found, deepestMatch);
+        }
+    }
+}
+
+// One statement response (<STMTTRNRS> or <CCSTMTTRNRS>) to be pruned
+struct StatementToPrune {
+    std::string type;  // Message set, e.g. "BANKMSGSRSV1"
+    std::string accountId;
+    tinyxml2::XMLElement* banktranlist = NULL;
+    tinyxml2::XMLElement* graveyard = NULL;  // See PruneTransactions()
+    // Only when sorting, since filling it parses and interns every field
+    std::unique_ptr<TransactionStore> store;
+    double milliseconds = 0;
+};
+
+// Statements don't share any elements, so prune them at the same time,
+// up to one thread per core. The graveyards must already exist, since
+// creating elements is not thread-safe.
+inline void PruneStatementsInParallel(std::vector<StatementToPrune>& statements,
+    const ConversionOptions& options) {
+    std::atomic<size_t> next(0);
+    AllocationStats* stats = ActiveAllocationStats();
+    int stage = ActiveAllocationStage();
+    auto worker = [&statements, &options, &next, stats, stage]() {
+        AllocationStatsScope measuring(stats);
+        AllocationStageScope inStage(stage);
+        for (size_t i = next++; i < statements.size(); i = next++) {
+            StatementToPrune& statement = statements[i];
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            PruneSTMTTRN(statement.banktranlist, options,
+                statement.store.get(), statement.graveyard);
+            statement.milliseconds = std::chrono::duration<double,
+                std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    };
+    size_t threadCount = std::thread::hardware_concurrency();
+    if (threadCount > statements.size()) {
+        threadCount = statements.size();
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; ++i) {
+        threads.push_back(std::thread(worker));
+    }
+    worker();  // This thread helps out too
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+// Sum of amounts in minor units. Four independent sums instead of one long
+// chain of adds, so the compiler can use SIMD adds and the CPU can overlap
+// them.
+inline long long SumMinorUnits(const long long* amounts, size_t count) {
+    long long sums[4] = { 0, 0, 0, 0 };
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        sums[0] += amounts[i];
+        sums[1] += amounts[i + 1];
+        sums[2] += amounts[i + 2];
+        sums[3] += amounts[i + 3];
+    }
+    for (; i < count; ++i) {
+        sums[0] += amounts[i];
+    }
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+// Does a statement's opening balance plus its transactions add up to its
+// <LEDGERBAL>? If not, the bank probably cut the file short. All amounts
+// are in minor units (cents), so the sums are exact.
+struct BalanceCheck {
+    enum Result {
+        NO_LEDGERBAL,  // Nothing to check against
+        NO_OPENING_BALANCE,  // See impliedOpeningBalance
+        UNREADABLE,  // An amount couldn't be read
+        BALANCED,
+        MISMATCH
+    };
+    Result result = NO_LEDGERBAL;
+    size_t transactions = 0;
+    long long transactionTotal = 0;
+    long long ledgerBalance = 0;
+    long long openingBalance = 0;
+    // What the opening balance must have been, given the ledger balance
+    long long impliedOpeningBalance = 0;
+    // Ledger balance minus (opening balance + transactions)
+    long long difference = 0;
+};
+
+// Does a <BAL>'s <NAME> say it's the opening balance?
+inline bool IsOpeningBalanceName(const char* name, size_t length) {
+    std::string upper(name, length);
+    std::transform(upper.begin(), upper.end(), upper.begin(),
+        [](unsigned char c) { return static_cast<char>(toupper(c)); });
+    return upper.find("OPENING") != std::string::npos ||
+        upper.find("BEGINNING") != std::string::npos;
+}
+
+// OFX has no element for the opening balance, but some banks put it in the
+// <BALLIST>, e.g. <BAL><NAME>Opening Balance<BALTYPE>DOLLAR<VALUE>12.34
+inline bool FindOpeningBalance(const tinyxml2::XMLElement* stmtrs,
+    long long& minorUnits) {
+    const tinyxml2::XMLElement* ballist = stmtrs->FirstChildElement("BALLIST");
+    if (!ballist) {
+        return false;
+    }
+    for (const tinyxml2::XMLElement* bal = ballist->FirstChildElement("BAL");
+        bal; bal = bal->NextSiblingElement("BAL")) {
+        const tinyxml2::XMLElement* name = bal->FirstChildElement("NAME");
+        const tinyxml2::XMLElement* value = bal->FirstChildElement("VALUE");
+        if (!name || !name->GetText() || !value || !value->GetText()) {
+            continue;
+        }
+        if (IsOpeningBalanceName(name->GetText(), strlen(name->GetText())) &&
+            ParseOFXAmount(value->GetText(), strlen(value->GetText()),
+                minorUnits)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The rest of a balance check, once the statement's transactions are added
+// up in check. ledgerBalance is NULL if the <BALAMT> or a <TRNAMT> couldn't
+// be read, and openingBalance is NULL if the statement doesn't have one.
+inline void CompareWithLedgerBalance(BalanceCheck& check,
+    const long long* ledgerBalance, const long long* openingBalance) {
+    if (!ledgerBalance) {
+        check.result = BalanceCheck::UNREADABLE;
+        return;
+    }
+    check.ledgerBalance = *ledgerBalance;
+    check.impliedOpeningBalance = check.ledgerBalance - check.transactionTotal;
+    if (!openingBalance) {
+        check.result = BalanceCheck::NO_OPENING_BALANCE;
+        return;
+    }
+    check.openingBalance = *openingBalance;
+    check.difference = check.impliedOpeningBalance - check.openingBalance;
+    check.result = check.difference == 0 ? BalanceCheck::BALANCED :
+        BalanceCheck::MISMATCH;
+}
+
+// Uses the amounts PruneSTMTTRN() already read into the statement's store,
+// if it has one, so this doesn't walk the transactions again. The
+// transactions are counted even if there's no <LEDGERBAL>, for the report.
+inline BalanceCheck CheckStatementBalance(const StatementToPrune& statement) {
+    BalanceCheck check;
+    size_t unreadAmounts = 0;
+    if (statement.store) {
+        const TransactionStore& store = *statement.store;
+        check.transactions = store.Size() + store.Rejected();
+        check.transactionTotal = SumMinorUnits(store.amount.data(),
+            store.amount.size()) + store.RejectedAmount();
+        unreadAmounts = store.UnreadAmounts();
+    }
+    else {
+        for (const tinyxml2::XMLElement* stmttrn =
+            statement.banktranlist->FirstChildElement("STMTTRN"); stmttrn;
+            stmttrn = stmttrn->NextSiblingElement("STMTTRN")) {
+            const tinyxml2::XMLElement* trnamt =
+                stmttrn->FirstChildElement("TRNAMT");
+            long long minorUnits;
+            ++check.transactions;
+            if (trnamt && trnamt->GetText() && ParseOFXAmount(
+                trnamt->GetText(), strlen(trnamt->GetText()), minorUnits)) {
+                check.transactionTotal += minorUnits;
+            }
+            else {
+                ++unreadAmounts;
+            }
+        }
+    }
+
+    const tinyxml2::XMLElement* stmtrs =
+        statement.banktranlist->Parent()->ToElement();
+    const tinyxml2::XMLElement* balamt = stmtrs->FirstChildElement(
+        "LEDGERBAL") ? stmtrs->FirstChildElement("LEDGERBAL")->
+        FirstChildElement("BALAMT") : NULL;
+    if (!balamt) {
+        return check;
+    }
+    long long ledgerBalance;
+    long long openingBalance;
+    bool readable = balamt->GetText() && ParseOFXAmount(balamt->GetText(),
+        strlen(balamt->GetText()), ledgerBalance) && unreadAmounts == 0;
+    bool hasOpeningBalance = FindOpeningBalance(stmtrs, openingBalance);
+    CompareWithLedgerBalance(check, readable ? &ledgerBalance : NULL,
+        hasOpeningBalance ? &openingBalance : NULL);
+    return check;
+}
+
+// Is the XML balanced correctly with proper opening and closing tags?
+inline bool isXMLBalanced(const std::string& xml) {
+    // TinyXML2 does not always appear to be correct when determining if
+    // the XML is valid and balanced. Thus, this is used to make that 
+    // determination. 
+    // We use a stack to determine if the XML is balanced. It's very
+    // similar to the previous FixXML() method.
+    // Since our XML input files don't have attribute values, the code is a 
+    // little simpler. If the XML ever gets attributes, then 
+    // expect this code to break.
+    std::string tag;  // *Anything* in brackets: <.*> 
+    std::string value;  // Anything not inside brackets
+    bool processTag = false;
+    std::vector<std::string> tagStack;
+
+    for (const char& c : xml) {
+        if (c == '>') {
+            tag += c;
+            if (tag.find("</") == 0) {
+                // Closing tag (e.g. </item>)
+                if (tagStack.size() == 0) {
+                    // No opening tag to match this closing tag. Unbalanced.
+                    return false;
+                }
+                std::string tagRawValue = tag.substr(2, tag.length() - 3);
+                std::string topOfStack = tagStack.back();
+                tagStack.pop_back();
+                std::string topOfStackRawValue = topOfStack.substr(
+                    1,
+                    topOfStack.length() - 2);
+                if (topOfStackRawValue != tagRawValue) {
+                    // The top of the stack does not match this closing tag. 
+                    // Therefore, XML is unbalanced.
+                    return false;
+                }
+                value = tag = "";  // tags match. close out tag and value vars.
+            }
+            else if (tag.find("/>") == tag.length() - 2 ||
+                tag.find("<?") == 0 || tag.find("<!") == 0) {
+                // Self contained tag, declaration or comment. Nothing to
+                // balance here.
+                value = tag = "";
+                processTag = false;
+                continue;
+            }
+            else {
+                // This is the end of an opening tag, e.g. <tag>
+                if (value.length() > 0) {
+                    // We have a previous value that wasn't closed out with a 
+                    // closing tag. Therefore, the xml is unbalanced.
+                    return false;
+                }
+                tagStack.push_back(tag);
+                value = tag = "";
+            }
+
+            // We've processed a tag. If we encounter a character later, it 
+            // belongs to a value and not an XML tag.
+            processTag = false;
+        }
+        else if (c == '<') {
+            // We are going to process an XML element
+            assert(tag.length() == 0);
+            tag += c;
+            processTag = true;
+        }
+        else if (processTag) {
+            // Continue processing this character as an XML element
+            tag += c;
+        }
+        else {
+            if (value.length() == 0 && (isspace(c))) {
+                // Ignore leading (left-side) whitespace
+                continue;
+            }
+            if (c == '\r' || c == '\n') {
+                // Ignore new lines in values
+                continue;
+            }
+            value += c;
+        }
+    }
+
+    if (tagStack.size() > 0) {
+        return false;
+    }
+    return true;
+}
+
+// Is this an OFX amount, e.g. "-1.00"? Some banks use a ',' for the decimal.
+inline bool IsOFXAmount(const std::string& value) {
+    size_t i = 0;
+    if (i < value.length() && (value[i] == '-' || value[i] == '+')) {
+        ++i;
+    }
+    size_t digits = 0;
+    while (i < value.length() &&
+        isdigit(static_cast<unsigned char>(value[i]))) {
+        ++i;
+        ++digits;
+    }
+    if (i < value.length() && (value[i] == '.' || value[i] == ',')) {
+        ++i;
+        while (i < value.length() &&
+            isdigit(static_cast<unsigned char>(value[i]))) {
+            ++i;
+            ++digits;
+        }
+    }
+    return digits > 0 && i == value.length();
+}
+
+// Is this an OFX date, e.g. "20190101", "20190101120000.000[-5:EST]"?
+inline bool IsOFXDateTime(const std::string& value) {
+    long long epochSeconds;
+    return ParseOFXDateTime(value, epochSeconds);
+}
+
+// Checks converted OFX for the things Money chokes on, in a single pass:
+// <STMTTRN> children that are not in STMTTRN_WHITELIST or are out of order,
+// missing required fields, both <NAME> and <PAYEE>, bad amounts and dates,
+// and duplicate <FITID>s in a <BANKTRANLIST>. It is fed the output text in
+// pieces, so it works on the bounded-memory output too.
+class MoneyValidator {
+public:
+    void Feed(const char* data, size_t length);
+    void Feed(const std::string& data) { Feed(data.c_str(), data.length()); }
+    // Call once after the last piece.
+    void Finish();
+
+    const std::vector<ValidationDiagnostic>& Diagnostics() const {
+        return diagnostics;
+    }
+    // Diagnostics past MAX_DIAGNOSTICS are counted but not kept.
+    size_t DiagnosticCount() const { return diagnosticCount; }
+
+    // Stop looking for repeated FITIDs in a <BANKTRANLIST> once remembering
+    // them would take more than about bytes, so a huge statement can be
+    // checked in bounded memory
+    void LimitFITIDMemory(size_t bytes) { fitidLimit = bytes; }
+    // Whether some FITIDs weren't checked because of the limit
+    bool StoppedCheckingFITIDs() const { return stoppedCheckingFITIDs; }
+    // About how much memory the FITIDs we remember take
+    size_t FITIDBytes() const { return fitidBytes; }
+
+    static const size_t MAX_DIAGNOSTICS = 1000;
+
+private:
+    void ProcessTag();
+    void OpenElement(const std::string& name);
+    void CloseElement(const std::string& name);
+    void PopElement();
+    void CheckValue(const std::string& name);
+    void FinishSTMTTRN();
+    void Report(unsigned long long offset, unsigned long long line,
+        const std::string& message);
+
+    unsigned long long offset = 0;
+    unsigned long long line = 1;
+    bool inTag = false;
+    std::string tag;
+    unsigned long long tagOffset = 0;
+    unsigned long long tagLine = 1;
+    std::string value;
+    std::vector<std::string> tagStack;
+
+    // State for the <STMTTRN> we are in, if any
+    bool inSTMTTRN = false;
+    size_t stmttrnDepth = 0;  // tagStack size once <STMTTRN> is pushed
+    unsigned long long stmttrnOffset = 0;
+    unsigned long long stmttrnLine = 0;
+    int lastWhitelistIndex = -1;
+    std::vector<bool> seenWhitelistIndex;
+    // Where the child of <STMTTRN> we are in opened, for its value's
+    // diagnostics. By the time the value is checked, the tag we are at is
+    // the closing one.
+    unsigned long long fieldOffset = 0;
+    unsigned long long fieldLine = 1;
+    bool hasName = false;
+    bool hasPayee = false;
+    std::set<std::string> fitids;  // FITIDs seen in this <BANKTRANLIST>
+    size_t fitidBytes = 0;
+    size_t fitidLimit = SIZE_MAX;
+    bool checkingFITIDs = true;  // Until this <BANKTRANLIST> hits the limit
+    bool stoppedCheckingFITIDs = false;
+
+    std::vector<ValidationDiagnostic> diagnostics;
+    size_t diagnosticCount = 0;
+};
+
+inline void MoneyValidator::Feed(const char* data, size_t length) {
+    for (size_t i = 0; i < length; ++i, ++offset) {
+        const char c = data[i];
+        if (c == '<') {
+            inTag = true;
+            tag = "";
+            tagOffset = offset;
+            tagLine = line;
+        }
+        else if (c == '>' && inTag) {
+            inTag = false;
+            ProcessTag();
+            value = "";
+        }
+        else if (inTag) {
+            tag += c;
+        }
+        else if (inSTMTTRN) {
+            // Only values inside <STMTTRN> are checked
+            value += c;
+        }
+        if (c == '\n') {
+            ++line;
+        }
+    }
+}
+
+inline void MoneyValidator::Finish() {
+    if (tagStack.size() > 0) {
+        Report(offset, line, "<" + tagStack.back() + "> is never closed.");
+    }
+}
+
+inline void MoneyValidator::ProcessTag() {
+    if (tag.length() == 0 || tag[0] == '?' || tag[0] == '!') {
+        return;  // Headers and comments
+    }
+    if (tag[0] == '/') {
+        CloseElement(tag.substr(1));
+    }
+    else if (tag[tag.length() - 1] == '/') {
+        std::string name = tag.substr(0, tag.length() - 1);
+        OpenElement(name);
+        CloseElement(name);
+    }
+    else {
+        OpenElement(tag);
+    }
+}
+
+inline void MoneyValidator::OpenElement(const std::string& name) {
+    if (inSTMTTRN && tagStack.size() == stmttrnDepth) {
+        // A direct child of <STMTTRN>. Check it against the whitelist.
+        fieldOffset = tagOffset;
+        fieldLine = tagLine;
+        hasPayee = hasPayee || name == "PAYEE";
+        hasName = hasName || name == "NAME";
+        int index = StmttrnWhitelistIndex(name.c_str(), name.length());
+        if (index < 0) {
+            Report(tagOffset, tagLine,
+                "<" + name + "> is not allowed in <STMTTRN>.");
+        }
+        else if (seenWhitelistIndex[index]) {
+            // <NAME> plus <PAYEE> gets its own message in FinishSTMTTRN()
+            if (!(hasName && hasPayee)) {
+                Report(tagOffset, tagLine,
+                    "<" + name + "> appears more than once in <STMTTRN>.");
+            }
+        }
+        else {
+            if (index < lastWhitelistIndex) {
+                Report(tagOffset, tagLine, "<" + name + "> is out of order. "
+                    "It must come before <" +
+                    STMTTRN_WHITELIST[lastWhitelistIndex] + ">.");
+            }
+            else {
+                lastWhitelistIndex = index;
+            }
+            seenWhitelistIndex[index] = true;
+        }
+    }
+    tagStack.push_back(name);
+    if (name == "STMTTRN" && !inSTMTTRN) {
+        inSTMTTRN = true;
+        stmttrnDepth = tagStack.size();
+        stmttrnOffset = tagOffset;
+        stmttrnLine = tagLine;
+        lastWhitelistIndex = -1;
+        seenWhitelistIndex.assign(STMTTRN_WHITELIST.size(), false);
+        hasName = hasPayee = false;
+    }
+    else if (name == "BANKTRANLIST") {
+        fitids.clear();
+        fitidBytes = 0;
+        checkingFITIDs = true;
+    }
+}
+
+inline void MoneyValidator::CloseElement(const std::string& name) {
+    if (tagStack.size() == 0 || tagStack.back() != name) {
+        Report(tagOffset, tagLine, "</" + name + "> does not match " +
+            (tagStack.size() == 0 ? std::string("any opening tag.") :
+                "<" + tagStack.back() + ">."));
+        // If it closes a tag further up, the ones in between were never
+        // closed. Close them here, or every close tag after this one would
+        // be off by one and get reported too. A close tag with nothing to
+        // match is just skipped.
+        if (std::find(tagStack.begin(), tagStack.end(), name) ==
+            tagStack.end()) {
+            return;
+        }
+        while (tagStack.back() != name) {
+            PopElement();
+        }
+    }
+    if (inSTMTTRN && tagStack.size() == stmttrnDepth + 1) {
+        CheckValue(name);
+    }
+    PopElement();
+}
+
+inline void MoneyValidator::PopElement() {
+    if (inSTMTTRN && tagStack.size() == stmttrnDepth) {
+        FinishSTMTTRN();
+    }
+    tagStack.pop_back();
+}
+
+// Check the value of a direct child of <STMTTRN>.
+inline void MoneyValidator::CheckValue(const std::string& name) {
+    size_t start = value.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) {
+        value = "";
+    }
+    else {
+        value = value.substr(start,
+            value.find_last_not_of(" \t\r\n") - start + 1);
+    }
+    if (name == "TRNAMT") {
+        if (value.length() == 0) {
+            Report(fieldOffset, fieldLine, "<TRNAMT> is empty.");
+        }
+        else if (!IsOFXAmount(value)) {
+            Report(fieldOffset, fieldLine,
+                "<TRNAMT> is not a valid amount: " + value);
+        }
+    }
+    else if (name == "DTPOSTED" || name == "DTUSER") {
+        if (!IsOFXDateTime(value)) {
+            Report(fieldOffset, fieldLine,
+                "<" + name + "> is not a valid date: " + value);
+        }
+    }
+    else if (name == "FITID") {
+        if (value.length() == 0) {
+            Report(fieldOffset, fieldLine, "<FITID> is empty.");
+        }
+        else if (!checkingFITIDs) {
+            return;
+        }
+        else if (fitidBytes + value.length() + 64 > fitidLimit) {
+            // The set's node and the string's own header are about 64 bytes
+            std::set<std::string>().swap(fitids);
+            fitidBytes = 0;
+            checkingFITIDs = false;
+            stoppedCheckingFITIDs = true;
+        }
+        else if (!fitids.insert(value).second) {
+            Report(fieldOffset, fieldLine, "<FITID> " + value + " is used by "
+                "more than one transaction. Money will skip duplicates.");
+        }
+        else {
+            fitidBytes += value.length() + 64;
+        }
+    }
+}
+
+inline void MoneyValidator::FinishSTMTTRN() {
+    for (const char* required : STMTTRN_REQUIRED) {
+        if (!seenWhitelistIndex[StmttrnWhitelistIndex(required,
+            strlen(required))]) {
+            Report(stmttrnOffset, stmttrnLine, "<STMTTRN> is missing <" +
+                std::string(required) + ">.");
+        }
+    }
+    if (hasName && hasPayee) {
+        Report(stmttrnOffset, stmttrnLine,
+            "<STMTTRN> has both <NAME> and <PAYEE>.");
+    }
+    inSTMTTRN = false;
+}
+
+inline void MoneyValidator::Report(unsigned long long offset,
+    unsigned long long line, const std::string& message) {
+    ++diagnosticCount;
+    if (diagnostics.size() < MAX_DIAGNOSTICS) {
+        diagnostics.push_back({ offset, line, message });
+    }
+}
+
+// Turn validator output into something short enough for a MessageBox.
+inline std::string FormatValidationDiagnostics(
+    const std::vector<ValidationDiagnostic>& diagnostics,
+    size_t diagnosticCount, size_t maxShown) {
+    std::string text;
+    for (size_t i = 0; i < diagnostics.size() && i < maxShown; ++i) {
+        text += "Line " + std::to_string(diagnostics[i].line) + " (byte " +
+            std::to_string(diagnostics[i].offset) + "): " +
+            diagnostics[i].message + "\n";
+    }
+    if (diagnosticCount > maxShown) {
+        text += "...and " + std::to_string(diagnosticCount - maxShown) +
+            " more.\n";
+    }
+    return text;
+}
+
+// Transaction export, for feeding converted statements into our own
+// reports without parsing the OFX again. The bounded-memory converter hands
+// each <STMTTRN> to a TransactionExporter right after PruneSTMTTRN(), which
+// writes it as a CSV row or a JSON Lines object. Writes are buffered, and
+// nothing is kept per transaction.
+
+// The exported fields: the account, then <STMTTRN> fields as they are in
+// the output OFX
+const struct {
+    const char* column;  // CSV header and JSON key
+    const char* element;  // NULL for the account
+} EXPORT_FIELDS[] = {
+    { "account", NULL },
+    { "type", "TRNTYPE" },
+    { "posted", "DTPOSTED" },
+    { "user_date", "DTUSER" },
+    { "amount", "TRNAMT" },
+    { "fitid", "FITID" },
+    { "checknum", "CHECKNUM" },
+    { "name", "NAME" },
+    { "memo", "MEMO" },
+};
+const size_t EXPORT_FIELD_COUNT = sizeof(EXPORT_FIELDS) / sizeof(EXPORT_FIELDS[0]);
+
+enum ExportFormat { EXPORT_CSV, EXPORT_JSON_LINES };
+
+class TransactionExporter {
+public:
+    TransactionExporter(std::ostream& out, ExportFormat format);
+    // values[i] is the text of EXPORT_FIELDS[i], empty if there isn't one
+    void Add(const std::string* values);
+    // Write out what's buffered. False if writing failed.
+    bool Finish();
+
+    size_t Count() const { return count; }
+    unsigned long long BytesWritten() const { return bytesWritten; }
+
+private:
+    void Flush();
+
+    std::ostream& out;
+    const ExportFormat format;
+    std::string buffer;
+    size_t count = 0;
+    unsigned long long bytesWritten = 0;
+};
+
+inline TransactionExporter::TransactionExporter(std::ostream& out,
+    ExportFormat format) : out(out), format(format) {
+    buffer.reserve(1024 * 1024 + 4096);
+    if (format == EXPORT_CSV) {
+        for (size_t i = 0; i < EXPORT_FIELD_COUNT; ++i) {
+            buffer.append(i > 0 ? "," : "").append(EXPORT_FIELDS[i].column);
+        }
+        buffer += "\r\n";
+    }
+}
+
+inline void TransactionExporter::Add(const std::string* values) {
+    if (format == EXPORT_CSV) {
+        for (size_t i = 0; i < EXPORT_FIELD_COUNT; ++i) {
+            const std::string& value = values[i];
+            if (i > 0) {
+                buffer += ',';
+            }
+            if (value.find_first_of(",\"\r\n") == std::string::npos) {
+                buffer += value;
+                continue;
+            }
+            buffer += '"';
+            for (const char& c : value) {
+                buffer.append(c == '"' ? 2 : 1, c);
+            }
+            buffer += '"';
+        }
+        buffer += "\r\n";
+    }
+    else {
+        for (size_t i = 0; i < EXPORT_FIELD_COUNT; ++i) {
+            buffer.append(i > 0 ? ",\"" : "{\"")
+                .append(EXPORT_FIELDS[i].column).append("\":\"");
+            AppendEscapedJSON(buffer, values[i].data(), values[i].length());
+            buffer += '"';
+        }
+        buffer += "}\n";
+    }
+    ++count;
+    if (buffer.length() >= 1024 * 1024) {
+        Flush();
+    }
+}
+
+inline bool TransactionExporter::Finish() {
+    Flush();
+    out.flush();
+    return static_cast<bool>(out);
+}
+
+inline void TransactionExporter::Flush() {
+    out.write(buffer.data(), buffer.length());
+    bytesWritten += buffer.length();
+    buffer.clear();
+}
+
+// 64-bit FNV-1a. It's the same from run to run, so it can go in FITIDs
+// and index files.
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+
+inline uint64_t HashBytes(uint64_t hash, const char* data, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// A side index of an OFX file. It records where each statement response,
+// each <BANKTRANLIST> and each <STMTTRN> is, in bytes, plus each
+// transaction's FITID and DTPOSTED and each statement's ACCTID. With it,
+// we can seek straight to the bytes for:
+// - a transaction by FITID
+// - the 40,000th transaction
+// - the transactions in a date range
+// - one account's statement
+// The file doesn't have to be parsed again. The index is built by feeding
+// it the file's bytes as they are written, or read. It can be kept in
+// memory or saved next to the file as FILE.ofx.idx.
+
+enum OFXIndexKind {
+    INDEX_STATEMENT,  // <STMTTRNRS> or <CCSTMTTRNRS>
+    INDEX_BANKTRANLIST,
+    INDEX_STMTTRN,
+};
+
+struct OFXIndexEntry {
+    uint64_t offset;  // Of the '<' of the opening tag
+    uint64_t length;  // Through the '>' of the closing tag. 0 if unclosed.
+    // The FITID of a <STMTTRN> or the ACCTID of a statement, as it is in
+    // the file (escaped): where it is, and its hash for lookups
+    uint64_t keyHash;
+    uint64_t keyOffset;
+    uint32_t keyLength;
+    int32_t date;  // <DTPOSTED> of a <STMTTRN> as YYYYMMDD, or 0
+    uint32_t parent;  // The enclosing entry, or OFXIndex::NO_PARENT
+    uint32_t kind;  // OFXIndexKind
+};
+
+class OFXIndex {
+public:
+    static const uint32_t NO_PARENT = 0xFFFFFFFF;
+
+    // Index the next bytes of the file. Feed all of them, in order.
+    void Feed(const char* data, size_t length);
+    // Call after the last Feed()
+    void Finish();
+
+    // modified is when the file was last written, in whatever units the
+    // caller likes (FILETIME on Windows). Load() checks it along with the
+    // size, since an edit that keeps the size would make the offsets wrong.
+    bool Save(std::ostream& out, uint64_t modified) const;
+    // False if in isn't an index, or not one for a file of fileSize bytes
+    // last written at modified
+    bool Load(std::istream& in, uint64_t fileSize, uint64_t modified);
+
+    const std::vector<OFXIndexEntry>& Entries() const { return entries; }
+    uint64_t FileSize() const { return fed; }
+    size_t TransactionCount() const { return transactions.size(); }
+    // The nth <STMTTRN> in the file, from 0
+    const OFXIndexEntry& Transaction(size_t n) const {
+        return entries[transactions[n]];
+    }
+    // Entries of the kind whose key hashes the same as key. Compare their
+    // key bytes with EscapeXML(key) to rule out a hash collision.
+    std::vector<uint32_t> FindKey(OFXIndexKind kind,
+        const std::string& key) const;
+    // The <STMTTRN>s posted from first to last (YYYYMMDD), in file order
+    std::vector<uint32_t> TransactionsPosted(int first, int last) const;
+
+private:
+    void Tag(uint64_t tagEnd);
+    void EndCapture();
+    void BuildLookups();
+
+    std::vector<OFXIndexEntry> entries;
+    std::vector<uint32_t> transactions;  // Closed <STMTTRN>s, in order
+    std::vector<std::pair<uint64_t, uint32_t>> keys;  // (keyHash, entry)
+
+    // Tokenizer state. Only the first few characters of a tag matter.
+    uint64_t fed = 0;
+    bool inTag = false;
+    uint64_t tagStart = 0;
+    std::string tag;
+    std::vector<uint32_t> open;  // Unclosed entries, innermost last
+    enum { NO_CAPTURE, CAPTURE_KEY, CAPTURE_DATE } capture = NO_CAPTURE;
+    uint32_t captureEntry = 0;
+    uint64_t captureStart = 0;
+    std::string captured;
+};
+
+const size_t INDEX_TAG_LIMIT = 16;  // More than the longest name we want
+const size_t INDEX_KEY_LIMIT = 255;  // FITIDs are at most 255 characters
+
+inline void OFXIndex::Feed(const char* data, size_t length) {
+    const char* p = data;
+    const char* end = data + length;
+    while (p < end) {
+        if (inTag) {
+            const char* close = static_cast<const char*>(
+                memchr(p, '>', end - p));
+            const char* stop = close ? close : end;
+            if (tag.length() < INDEX_TAG_LIMIT) {
+                tag.append(p, std::min<size_t>(stop - p,
+                    INDEX_TAG_LIMIT - tag.length()));
+            }
+            p = stop;
+            if (close) {
+                ++p;
+                inTag = false;
+                Tag(fed + (p - data));
+            }
+            continue;
+        }
+        // Skip straight to the next tag
+        const char* lt = static_cast<const char*>(memchr(p, '<', end - p));
+        const char* stop = lt ? lt : end;
+        if (capture != NO_CAPTURE && captured.length() < INDEX_KEY_LIMIT) {
+            captured.append(p, std::min<size_t>(stop - p,
+                INDEX_KEY_LIMIT - captured.length()));
+        }
+        p = stop;
+        if (lt) {
+            if (capture != NO_CAPTURE) {
+                EndCapture();
+            }
+            inTag = true;
+            tagStart = fed + (lt - data);
+            tag.clear();
+            ++p;
+        }
+    }
+    fed += length;
+}
+
+// A tag just ended, at tagEnd (just past its '>')
+inline void OFXIndex::Tag(uint64_t tagEnd) {
+    bool closing = !tag.empty() && tag[0] == '/';
+    size_t nameStart = closing ? 1 : 0;
+    size_t nameEnd = tag.find_first_of(" \t\r\n/", nameStart);
+    if (nameEnd == std::string::npos) {
+        nameEnd = tag.length();
+    }
+    auto is = [&](const char* name) {
+        return tag.compare(nameStart, nameEnd - nameStart, name) == 0;
+    };
+    int kind = is("STMTTRN") ? INDEX_STMTTRN :
+        is("BANKTRANLIST") ? INDEX_BANKTRANLIST :
+        is("STMTTRNRS") || is("CCSTMTTRNRS") ? INDEX_STATEMENT : -1;
+    const bool selfClosing = !tag.empty() && tag.back() == '/';
+    if (closing) {
+        if (kind < 0) {
+            return;
+        }
+        // Close the innermost open entry of this kind, and anything left
+        // open inside it
+        for (size_t i = open.size(); i-- > 0;) {
+            if (entries[open[i]].kind == static_cast<uint32_t>(kind)) {
+                entries[open[i]].length = tagEnd - entries[open[i]].offset;
+                open.resize(i);
+                break;
+            }
+        }
+        return;
+    }
+    if (kind >= 0 && !selfClosing) {
+        OFXIndexEntry entry = {};
+        entry.offset = tagStart;
+        entry.kind = kind;
+        entry.parent = open.empty() ? NO_PARENT : open.back();
+        open.push_back(static_cast<uint32_t>(entries.size()));
+        entries.push_back(entry);
+        return;
+    }
+    if (open.empty() || selfClosing) {
+        return;
+    }
+    // The keys are the first FITID and DTPOSTED directly in a <STMTTRN>,
+    // and the first ACCTID in a statement outside its transactions
+    const OFXIndexEntry& innermost = entries[open.back()];
+    if ((innermost.kind == INDEX_STMTTRN && is("FITID")) ||
+        (innermost.kind == INDEX_STATEMENT && is("ACCTID"))) {
+        capture = innermost.keyLength == 0 ? CAPTURE_KEY : NO_CAPTURE;
+    }
+    else if (innermost.kind == INDEX_STMTTRN && is("DTPOSTED")) {
+        capture = innermost.date == 0 ? CAPTURE_DATE : NO_CAPTURE;
+    }
+    else {
+        return;
+    }
+    captureEntry = open.back();
+    captureStart = tagEnd;
+    captured.clear();
+}
+
+inline void OFXIndex::EndCapture() {
+    OFXIndexEntry& entry = entries[captureEntry];
+    size_t first = captured.find_first_not_of(" \t\r\n");
+    if (first != std::string::npos) {
+        size_t last = captured.find_last_not_of(" \t\r\n");
+        if (capture == CAPTURE_KEY) {
+            entry.keyOffset = captureStart + first;
+            entry.keyLength = static_cast<uint32_t>(last - first + 1);
+            entry.keyHash = HashBytes(FNV_OFFSET_BASIS,
+                captured.data() + first, entry.keyLength);
+        }
+        else {
+            int date = 0;
+            size_t i = first;
+            for (; i <= last && i < first + 8 && isdigit(
+                static_cast<unsigned char>(captured[i])); ++i) {
+                date = date * 10 + (captured[i] - '0');
+            }
+            entry.date = i == first + 8 ? date : 0;
+        }
+    }
+    capture = NO_CAPTURE;
+}
+
+inline void OFXIndex::Finish() {
+    if (capture != NO_CAPTURE) {
+        EndCapture();
+    }
+    open.clear();
+    BuildLookups();
+}
+
+inline void OFXIndex::BuildLookups() {
+    transactions.clear();
+    keys.clear();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const OFXIndexEntry& entry = entries[i];
+        if (entry.length == 0) {
+            continue;
+        }
+        if (entry.kind == INDEX_STMTTRN) {
+            transactions.push_back(static_cast<uint32_t>(i));
+        }
+        if (entry.keyLength > 0) {
+            keys.push_back(std::make_pair(entry.keyHash,
+                static_cast<uint32_t>(i)));
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+}
+
+inline std::vector<uint32_t> OFXIndex::FindKey(OFXIndexKind kind,
+    const std::string& key) const {
+    std::string escaped = EscapeXML(key.c_str());
+    uint64_t hash = HashBytes(FNV_OFFSET_BASIS, escaped.data(),
+        escaped.length());
+    std::vector<uint32_t> found;
+    for (auto it = std::lower_bound(keys.begin(), keys.end(),
+        std::make_pair(hash, 0u)); it != keys.end() && it->first == hash;
+        ++it) {
+        if (entries[it->second].kind == static_cast<uint32_t>(kind)) {
+            found.push_back(it->second);
+        }
+    }
+    return found;
+}
+
+inline std::vector<uint32_t> OFXIndex::TransactionsPosted(int first,
+    int last) const {
+    std::vector<uint32_t> found;
+    for (uint32_t transaction : transactions) {
+        int date = entries[transaction].date;
+        if (date >= first && date <= last) {
+            found.push_back(transaction);
+        }
+    }
+    return found;
+}
+
+// FILE.ofx.idx starts with this, then the version, the entry size, the size
+// and last write time of the file it indexes and the entry count, then the
+// entries as they are in memory
+const char INDEX_MAGIC[8] = { 'O', 'F', 'X', 'I', 'N', 'D', 'E', 'X' };
+const uint32_t INDEX_VERSION = 2;
+
+inline bool OFXIndex::Save(std::ostream& out, uint64_t modified) const {
+    const uint32_t header[2] = { INDEX_VERSION, sizeof(OFXIndexEntry) };
+    const uint64_t sizes[3] = { fed, modified, entries.size() };
+    out.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+    if (!entries.empty()) {
+        out.write(reinterpret_cast<const char*>(&entries[0]),
+            entries.size() * sizeof(OFXIndexEntry));
+    }
+    return static_cast<bool>(out);
+}
+
+inline bool OFXIndex::Load(std::istream& in, uint64_t fileSize,
+    uint64_t modified) {
+    char magic[sizeof(INDEX_MAGIC)];
+    uint32_t header[2];
+    uint64_t sizes[3];
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    in.read(reinterpret_cast<char*>(sizes), sizeof(sizes));
+    if (!in || memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0 ||
+        header[0] != INDEX_VERSION || header[1] != sizeof(OFXIndexEntry) ||
+        sizes[0] != fileSize || sizes[1] != modified || sizes[2] > fileSize) {
+        return false;  // Not an index, or out of date
+    }
+    entries.resize(static_cast<size_t>(sizes[2]));
+    if (!entries.empty()) {
+        in.read(reinterpret_cast<char*>(&entries[0]),
+            entries.size() * sizeof(OFXIndexEntry));
+    }
+    if (!in) {
+        entries.clear();
+        return false;
+    }
+    fed = fileSize;
+    BuildLookups();
+    return true;
+}
+
+// Read length bytes at offset, e.g. for an index entry
+inline bool ReadFileBytes(std::istream& in, uint64_t offset, uint64_t length,
+    std::string& bytes) {
+    bytes.resize(static_cast<size_t>(length));
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(offset));
+    if (length > 0) {
+        in.read(&bytes[0], static_cast<std::streamsize>(length));
+    }
+    return static_cast<bool>(in);
+}
+
+// Bounded-memory mode. ConvertInputToOFX() keeps the whole statement in
+// memory several times over (input text, polished copy, DOM, printer output,
+// CRLF copy), which falls over on statements that are bigger than RAM. This
+// mode reads the input in chunks, normalizes each <STMTTRN> block with
+// PruneSTMTTRN() as soon as it completes, and flushes the output as it goes.
+// Memory use stays under the cap it's given, or we stop with an error.
+
+// What happened during a bounded-memory conversion, for the user.
+struct BoundedConversionResult {
+    bool success = false;
+    std::string errorMsg;
+    unsigned long long bytesRead = 0;
+    unsigned long long bytesWritten = 0;
+    size_t transactionCount = 0;
+    size_t peakBufferedBytes = 0;
+    std::vector<ValidationDiagnostic> diagnostics;
+    size_t diagnosticCount = 0;
+    // The statement was too big to check all of its FITIDs for repeats
+    bool fitidsUnchecked = false;
+};
+
+class BoundedConverter : public XMLFixerSink {
+public:
+    // If exporter isn't NULL, each transaction is exported to it too. If
+    // index isn't NULL, the output is indexed as it is written.
+    BoundedConverter(std::ostream& out, size_t memoryCap,
+        const ConversionOptions& options,
+        TransactionExporter* exporter = NULL, OFXIndex* index = NULL)
+        : out(out), memoryCap(memoryCap), options(options),
+        pruneBlock(ChooseBlockPruner(options)), fixer(*this),
+        exporter(exporter), index(index) {
+        // Flush often enough that output never dominates the budget.
+        flushThreshold = memoryCap / 8 < 1024 * 1024 ?
+            memoryCap / 8 : 1024 * 1024;
+        chunkSize = flushThreshold;
+        // A quarter of the cap is plenty to check most statements for
+        // repeated FITIDs
+        validator.LimitFITIDMemory(memoryCap / 4);
+        for (size_t i = 1; i < EXPORT_FIELD_COUNT; ++i) {
+            exportAtoms[i] = blockDom.Atom(EXPORT_FIELDS[i].element);
+        }
+    }
+
+    BoundedConversionResult Run(std::istream& in);
+
+    void Value(const std::string& value) override;
+    void OpenTag(const std::string& tag) override;
+    void CloseTag(const std::string& tagRawValue) override;
+    void SelfContainedTag(const std::string& tag) override;
+
+private:
+    // How many input bytes we go between checks of the memory cap
+    static const unsigned long long CAP_CHECK_BYTES = 4096;
+
+    bool Polish(char c);
+    bool Emit(char c);
+    void NewLine();
+    bool IsStatementTransaction() const;
+    void NormalizeBlock();
+    void ExportBlock(uint32_t stmttrn);
+    void ExportBlock(const tinyxml2::XMLElement* stmttrn);
+    bool Flush();
+    // Everything we hold on to, including the input chunk and anything
+    // TinyXML-2 is holding for a block blockDom couldn't parse
+    size_t BufferedBytes() const {
+        return chunkSize + fixer.BufferedBytes() + block.capacity() +
+            buffer.capacity() + pendingSpace.capacity() +
+            blockDom.BytesUsed() + wrapped.capacity() + blockDocBytes +
+            openTagBytes + validator.FITIDBytes();
+    }
+    bool CheckMemoryCap(size_t extra = 0);
+
+    std::ostream& out;
+    size_t memoryCap;
+    const ConversionOptions options;
+    BlockPruner pruneBlock;  // Picked once, for every block
+    size_t flushThreshold;
+    size_t chunkSize;
+    XMLFixer fixer;
+    MoneyValidator validator;  // Checks the output as it is flushed
+    BoundedConversionResult result;
+
+    // Polishing state (see ConvertInputToOFX for the non-streaming version)
+    bool seenOFX = false;
+    size_t ofxMatched = 0;  // How much of "<OFX>" we've matched so far
+    bool atLineStart = true;
+    std::string pendingSpace;  // Held back in case it is trailing space
+    char lastChar = '\0';
+    size_t lineLength = 0;
+
+    // Output state. We do our own pretty printing outside of <STMTTRN>.
+    std::string buffer;
+    int depth = 0;
+    // The names of the open elements outside the blocks, from <OFX> down,
+    // to tell a statement's <STMTTRN> from an investment one
+    std::vector<std::string> openTags;
+    size_t openTagBytes = 0;
+    bool lastWasValue = false;
+    bool lastWasOpenTag = false;
+
+    // The <STMTTRN> block currently being collected.
+    bool inBlock = false;
+    int blockDepth = 0;
+    unsigned long long blockStart = 0;
+    std::string block;
+    OFXDocument blockDom;  // Reused for every block
+    // For blocks blockDom can't handle, with the block wrapped in a
+    // <BANKTRANLIST>. TinyXML-2 doesn't say how much memory it uses, so
+    // blockDocBytes is a generous guess while it holds a block.
+    tinyxml2::XMLDocument blockDoc;
+    std::string wrapped;
+    size_t blockDocBytes = 0;
+
+    // Exporting. The account is the last <ACCTID> outside the blocks,
+    // which comes before the statement's <BANKTRANLIST>.
+    TransactionExporter* exporter;
+    bool inAccountId = false;
+    std::string exportValues[EXPORT_FIELD_COUNT];  // Reused for every block
+    uint32_t exportAtoms[EXPORT_FIELD_COUNT] = {};
+
+    OFXIndex* index;
+};
+
+inline BoundedConversionResult BoundedConverter::Run(std::istream& in) {
+    buffer = XML_HEADER + "\r\n" + XML_OFX_HEADER;
+
+    // Read in chunks. The chunk counts against the cap too. The cap is
+    // checked every few KB of input, so a block or value that is too big is
+    // caught soon after it passes the cap rather than a chunk later.
+    std::vector<char> chunk(chunkSize);
+    while (in) {
+        in.read(&chunk[0], chunk.size());
+        std::streamsize got = in.gcount();
+        for (std::streamsize i = 0; i < got; ++i) {
+            ++result.bytesRead;
+            if (!Polish(chunk[i])) {
+                return result;
+            }
+            if (result.bytesRead % CAP_CHECK_BYTES == 0 && !CheckMemoryCap()) {
+                return result;
+            }
+        }
+        if (!CheckMemoryCap()) {
+            return result;
+        }
+    }
+    if (!seenOFX) {
+        result.errorMsg = "Could not find the <OFX> element in the input.";
+        return result;
+    }
+    fixer.Finish();
+    buffer += "\r\n";
+    if (!Flush()) {
+        return result;
+    }
+    if (exporter && !exporter->Finish()) {
+        result.errorMsg = "Could not write the export file.";
+        return result;
+    }
+    if (index) {
+        index->Finish();
+    }
+    validator.Finish();
+    result.diagnostics = validator.Diagnostics();
+    result.diagnosticCount = validator.DiagnosticCount();
+    result.fitidsUnchecked = validator.StoppedCheckingFITIDs();
+    result.success = true;
+    return result;
+}
+
+// Record how much we hold (plus extra, which we are about to need) and fail
+// if it's over the cap
+inline bool BoundedConverter::CheckMemoryCap(size_t extra) {
+    if (!result.errorMsg.empty()) {
+        return false;
+    }
+    size_t buffered = BufferedBytes() + extra;
+    if (buffered > result.peakBufferedBytes) {
+        result.peakBufferedBytes = buffered;
+    }
+    if (buffered <= memoryCap) {
+        return true;
+    }
+    if (inBlock) {
+        result.errorMsg = "The <STMTTRN> block starting at input "
+            "byte " + std::to_string(blockStart) + " is bigger than "
+            "the memory cap of " +
+            std::to_string(memoryCap / (1024 * 1024)) + " MB. The "
+            "file is probably missing a </STMTTRN>, or the cap is "
+            "too small for this file.";
+    }
+    else {
+        result.errorMsg = "Ran out of the memory cap of " +
+            std::to_string(memoryCap / (1024 * 1024)) + " MB near "
+            "input byte " + std::to_string(result.bytesRead) +
+            ". A single value or tag in the file is too large.";
+    }
+    return false;
+}
+
+// Same cleanup that ConvertInputToOFX does line by line: drop anything before
+// <OFX>, trim both sides of each line, and drop new lines after a '>'.
+inline bool BoundedConverter::Polish(char c) {
+    if (!seenOFX) {
+        const char OFX_TAG[] = "<OFX>";
+        if (c == OFX_TAG[ofxMatched]) {
+            ++ofxMatched;
+        }
+        else {
+            ofxMatched = (c == '<') ? 1 : 0;
+        }
+        if (ofxMatched == 5) {
+            seenOFX = true;
+            atLineStart = false;
+            for (size_t i = 0; i < 5; ++i) {
+                if (!Emit(OFX_TAG[i])) {
+                    return false;
+                }
+            }
+            lastChar = '>';
+            lineLength = 5;
+        }
+        return true;
+    }
+    if (c == '\n') {
+        // If the line ends with ">", don't add a new line.
+        bool keepNewLine = !(lineLength > 1 && lastChar == '>');
+        pendingSpace = "";
+        atLineStart = true;
+        lastChar = '\0';
+        lineLength = 0;
+        return keepNewLine ? Emit('\n') : true;
+    }
+    if (options.trimLines && std::isspace(static_cast<unsigned char>(c))) {
+        if (!atLineStart) {
+            pendingSpace += c;
+        }
+        return true;
+    }
+    for (const char& space : pendingSpace) {
+        if (!Emit(space)) {
+            return false;
+        }
+    }
+    lineLength += pendingSpace.length() + 1;
+    pendingSpace = "";
+    atLineStart = false;
+    lastChar = c;
+    return Emit(c);
+}
+
+inline bool BoundedConverter::Emit(char c) {
+    if (!fixer.Feed(c)) {
+        result.errorMsg = "Could not fix the XML near input byte " +
+            std::to_string(result.bytesRead) + ". " + fixer.Error();
+        return false;
+    }
+    if (buffer.length() >= flushThreshold) {
+        return Flush();
+    }
+    return result.errorMsg.empty();
+}
+
+inline void BoundedConverter::NewLine() {
+    buffer += "\r\n";
+    buffer.append(4 * depth, ' ');
+}
+
+inline void BoundedConverter::Value(const std::string& value) {
+    if (inBlock) {
+        block += value;
+        return;
+    }
+    if (inAccountId) {
+        exportValues[0] = value;
+    }
+    buffer += value;
+    lastWasValue = true;
+}
+
+inline void BoundedConverter::OpenTag(const std::string& tag) {
+    if (inBlock) {
+        block += tag;
+        ++blockDepth;
+        return;
+    }
+    if (tag == "<STMTTRN>" && IsStatementTransaction()) {
+        inBlock = true;
+        blockDepth = 0;
+        blockStart = result.bytesRead;
+        block = tag;
+        return;
+    }
+    inAccountId = tag == "<ACCTID>";
+    NewLine();
+    buffer += tag;
+    ++depth;
+    openTags.push_back(tag.substr(1, tag.length() - 2));
+    openTagBytes += tag.length();
+    lastWasValue = false;
+    lastWasOpenTag = true;
+}
+
+inline void BoundedConverter::CloseTag(const std::string& tagRawValue) {
+    if (inBlock) {
+        block += "</" + tagRawValue + ">";
+        if (blockDepth > 0) {
+            --blockDepth;
+        }
+        else {
+            // The fixer keeps things balanced, so this must be </STMTTRN>.
+            NormalizeBlock();
+            inBlock = false;
+        }
+        return;
+    }
+    inAccountId = false;
+    --depth;
+    if (!openTags.empty()) {
+        openTagBytes -= openTags.back().length() + 2;
+        openTags.pop_back();
+    }
+    if (!lastWasValue && !lastWasOpenTag) {
+        NewLine();
+    }
+    buffer += "</" + tagRawValue + ">";
+    lastWasValue = false;
+    lastWasOpenTag = false;
+}
+
+inline void BoundedConverter::SelfContainedTag(const std::string& tag) {
+    if (inBlock) {
+        block += tag;
+        return;
+    }
+    inAccountId = false;
+    NewLine();
+    buffer += tag;
+    lastWasValue = false;
+    lastWasOpenTag = false;
+}
+
+// Whether a <STMTTRN> opening now is in a statement's <BANKTRANLIST>, at
+// the end of a TYPE_TO_BANKTRANLIST_MAP path, like the ones
+// ConvertQFXToOFX() prunes. Investment statements keep theirs as they are.
+inline bool BoundedConverter::IsStatementTransaction() const {
+    for (const auto& mapping : TYPE_TO_BANKTRANLIST_MAP) {
+        if (openTags == mapping.second) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Run a completed <STMTTRN> block through pruneBlock (or PruneSTMTTRN() if
+// blockDom can't parse it) and write it out.
+inline void BoundedConverter::NormalizeBlock() {
+    if (!result.errorMsg.empty()) {
+        return;
+    }
+    // Print at the current depth so it lines up with our pretty printing.
+    std::string printed;
+    if (blockDom.Parse(block)) {
+        // The block's one and only top-level element is the <STMTTRN>.
+        uint32_t stmttrn = blockDom.FirstChild(OFXDocument::DOCUMENT);
+        pruneBlock(blockDom, stmttrn, options);
+        blockDom.Print(stmttrn, depth, printed);
+        if (exporter) {
+            ExportBlock(stmttrn);
+        }
+    }
+    else {
+        // PruneSTMTTRN works on a <BANKTRANLIST>, so give it one. TinyXML-2
+        // copies the text and adds a node per element and value, so guess
+        // it needs a few times the text.
+        if (!CheckMemoryCap(4 * block.length())) {
+            return;
+        }
+        wrapped = "<BANKTRANLIST>" + block + "</BANKTRANLIST>";
+        blockDocBytes = 3 * wrapped.length();
+        blockDoc.Clear();
+        blockDoc.Parse(wrapped.c_str(), wrapped.length());
+        if (blockDoc.ErrorID() != 0) {
+            result.errorMsg = "Could not parse the <STMTTRN> block starting "
+                "at input byte " + std::to_string(blockStart) + ". Parser "
+                "error message: " + std::to_string(blockDoc.ErrorID()) +
+                ":\n" + blockDoc.ErrorStr();
+            return;
+        }
+        tinyxml2::XMLElement* banktranlist = blockDoc.FirstChildElement();
+        PruneSTMTTRN(banktranlist, options);
+        tinyxml2::XMLPrinter printer(NULL, false, depth);
+        banktranlist->FirstChildElement("STMTTRN")->Accept(&printer);
+        printed = printer.CStr();
+        if (exporter) {
+            ExportBlock(banktranlist->FirstChildElement("STMTTRN"));
+        }
+        blockDoc.Clear();
+        std::string().swap(wrapped);
+        blockDocBytes = 0;
+    }
+    if (!CheckMemoryCap(printed.capacity())) {
+        return;
+    }
+    NewLine();
+    for (const char* p = printed.c_str(); *p != '\0'; ++p) {
+        if (*p == '\n') {
+            if (*(p + 1) != '\0') {
+                buffer += "\r\n";
+            }
+        }
+        else {
+            buffer += *p;
+        }
+    }
+    block = "";
+    lastWasValue = false;
+    lastWasOpenTag = false;
+    ++result.transactionCount;
+}
+
+// Export the pruned <STMTTRN>, straight from the DOM it was pruned in
+inline void BoundedConverter::ExportBlock(uint32_t stmttrn) {
+    for (size_t i = 1; i < EXPORT_FIELD_COUNT; ++i) {
+        exportValues[i].clear();
+        uint32_t field = blockDom.FirstChildElement(stmttrn, exportAtoms[i]);
+        if (field != OFXDocument::NONE && blockDom.HasText(field)) {
+            blockDom.AppendText(field, exportValues[i]);
+        }
+    }
+    exporter->Add(exportValues);
+}
+
+inline void BoundedConverter::ExportBlock(const tinyxml2::XMLElement* stmttrn) {
+    for (size_t i = 1; i < EXPORT_FIELD_COUNT; ++i) {
+        const tinyxml2::XMLElement* field =
+            stmttrn->FirstChildElement(EXPORT_FIELDS[i].element);
+        const char* text = field ? field->GetText() : NULL;
+        exportValues[i] = text ? text : "";
+    }
+    exporter->Add(exportValues);
+}
+
+inline bool BoundedConverter::Flush() {
+    validator.Feed(buffer);
+    if (index) {
+        index->Feed(buffer.data(), buffer.length());
+    }
+    out.write(buffer.c_str(), buffer.length());
+    if (!out) {
+        result.errorMsg = "Could not write the output file.";
+        return false;
+    }
+    result.bytesWritten += buffer.length();
+    buffer = "";
+    return true;
+}
+
+// Convert a QFX stream to OFX using at most about memoryCap bytes. If
+// exporter isn't NULL, the transactions are exported to it as well. If
+// index isn't NULL, it ends up indexing the output.
+inline BoundedConversionResult ConvertStreamBounded(std::istream& in,
+    std::ostream& out, size_t memoryCap, const ConversionOptions& options,
+    TransactionExporter* exporter = NULL, OFXIndex* index = NULL) {
+    BoundedConverter converter(out, memoryCap, options, exporter, index);
+    return converter.Run(in);
+}
+
+// CSV input. Some banks and credit unions only export CSV, so this turns a
+// CSV export into a bank (or credit card) statement. The input is
+// memory-mapped and read twice: once for the date range, which the OFX
+// needs before the first transaction, and once to write the transactions.
+// Nothing is kept per row, so memory use doesn't grow with the file.
+
+// Which column holds what. Columns are 0-based, -1 if there isn't one.
+struct CSVColumnMapping {
+    int date = -1;
+    int amount = -1;
+    int debit = -1;  // Withdrawals, if not in amount
+    int credit = -1;  // Deposits, if not in amount
+    int payee = -1;
+    int memo = -1;
+    int id = -1;
+    int checknum = -1;
+    int balance = -1;  // Running balance, for <LEDGERBAL>
+};
+
+// The mapping keys, and the header names each one is found under when the
+// mapping file doesn't say (lower case, separated by |)
+const struct {
+    const char* key;
+    int CSVColumnMapping::* column;
+    const char* headers;
+} CSV_FIELDS[] = {
+    { "date", &CSVColumnMapping::date, "date|posting date|posted date|"
+        "post date|transaction date|trans date|trans. date" },
+    { "amount", &CSVColumnMapping::amount, "amount|transaction amount" },
+    { "debit", &CSVColumnMapping::debit, "debit|debits|withdrawal|"
+        "withdrawals|debit amount" },
+    { "credit", &CSVColumnMapping::credit, "credit|credits|deposit|"
+        "deposits|credit amount" },
+    { "payee", &CSVColumnMapping::payee, "payee|description|name|"
+        "merchant|transaction description" },
+    { "memo", &CSVColumnMapping::memo, "memo|notes|note|details|"
+        "extended description" },
+    { "id", &CSVColumnMapping::id, "id|fitid|transaction id|reference|"
+        "reference number" },
+    { "checknum", &CSVColumnMapping::checknum, "check number|check|"
+        "check #|check no|checknum" },
+    { "balance", &CSVColumnMapping::balance, "balance|running balance" },
+};
+
+// Where ConvertCSVFile() looks for the column mapping: in the CSV's folder
+const char CSV_MAPPING_FILE_NAME[] = "ConvertToOFX-columns.txt";
+
+// The account a converted CSV or QIF statement is for
+struct StatementAccount {
+    std::string accountId = "CSV";
+    std::string bankId = "000000000";
+    // CHECKING, SAVINGS, MONEYMRKT, CREDITLINE or CREDITCARD
+    std::string accountType = "CHECKING";
+    std::string currency = "USD";
+};
+
+// How to read a CSV export and what account it is for. Read from the
+// column mapping file, see ReadCSVOptions().
+struct CSVOptions {
+    CSVColumnMapping columns;
+    // Mapping file entries for columns: a header name or a 1-based number
+    std::map<std::string, std::string> columnNames;
+    char delimiter = ',';
+    bool dayFirst = false;  // 31/12/2019 rather than 12/31/2019
+    char decimalSeparator = '.';  // ',' for 1.234,56
+    // The first record names the columns. If not, every record is a
+    // transaction, and the columns must be given by number.
+    bool hasHeader = true;
+    StatementAccount account;
+};
+
+inline std::string TrimAndLower(const std::string& text) {
+    size_t start = text.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) {
+        return "";
+    }
+    std::string trimmed = text.substr(start,
+        text.find_last_not_of(" \t\r\n") - start + 1);
+    std::transform(trimmed.begin(), trimmed.end(), trimmed.begin(),
+        [](unsigned char c) { return static_cast<char>(tolower(c)); });
+    return trimmed;
+}
+
+// The column mapping file has one "key = value" per line. Lines starting
+// with # are comments. For example:
+//   date = Posting Date
+//   amount = 4
+//   delimiter = ;
+//   account = 000111222
+// Column keys are in CSV_FIELDS. The others are header (yes or no),
+// delimiter (a character or "tab"), dateorder (mdy or dmy), decimal (. or
+// ,), account, bankid, accounttype and currency.
+inline bool ReadCSVOptions(std::istream& in, CSVOptions& options,
+    std::string& error) {
+    std::string line;
+    for (int lineNumber = 1; std::getline(in, line); ++lineNumber) {
+        // Only whole-line comments, since headers like "Check #" are common.
+        std::string trimmed = TrimAndLower(line);
+        if (trimmed.empty() || trimmed[0] == '#') {
+            continue;
+        }
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            error = "Line " + std::to_string(lineNumber) + " of the column "
+                "mapping is not \"key = value\".";
+            return false;
+        }
+        std::string key = TrimAndLower(line.substr(0, equals));
+        std::string value = line.substr(equals + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+
+        bool isColumn = false;
+        for (const auto& field : CSV_FIELDS) {
+            if (key == field.key) {
+                options.columnNames[key] = value;
+                isColumn = true;
+            }
+        }
+        if (isColumn) {
+            continue;
+        }
+        if (key == "header" && (TrimAndLower(value) == "yes" ||
+            TrimAndLower(value) == "no")) {
+            options.hasHeader = TrimAndLower(value) == "yes";
+        }
+        else if (key == "delimiter" && (value.length() == 1 ||
+            TrimAndLower(value) == "tab")) {
+            options.delimiter = value.length() == 1 ? value[0] : '\t';
+        }
+        else if (key == "dateorder" && (TrimAndLower(value) == "mdy" ||
+            TrimAndLower(value) == "dmy")) {
+            options.dayFirst = TrimAndLower(value) == "dmy";
+        }
+        else if (key == "decimal" && (value == "." || value == ",")) {
+            options.decimalSeparator = value[0];
+        }
+        else if (key == "account" && !value.empty()) {
+            options.account.accountId = value;
+        }
+        else if (key == "bankid" && !value.empty()) {
+            options.account.bankId = value;
+        }
+        else if (key == "accounttype" && !value.empty()) {
+            std::string& type = options.account.accountType;
+            type = value;
+            std::transform(type.begin(), type.end(), type.begin(),
+                [](unsigned char c) { return static_cast<char>(toupper(c)); });
+        }
+        else if (key == "currency" && !value.empty()) {
+            options.account.currency = value;
+        }
+        else {
+            error = "Line " + std::to_string(lineNumber) + " of the column "
+                "mapping: don't know what to do with \"" + key + " = " +
+                value + "\".";
+            return false;
+        }
+    }
+    return true;
+}
+
+// One field of a CSV record. Points into the input, or into the reader's
+// scratch space for quoted fields that had "" in them.
+struct CSVField {
+    const char* text;
+    size_t length;
+};
+
+// Splits CSV text into records (RFC 4180, but forgiving). Unquoted fields,
+// which are most of them, are found 16 bytes at a time with SSE2 (where
+// there is SSE2).
+class CSVReader {
+public:
+    CSVReader(const char* data, size_t length, char delimiter)
+        : position(data), end(data + length), delimiter(delimiter),
+        line(1), recordLine(1) {
+    }
+
+    // Read the next record into fields. False at the end of the input.
+    bool Next(std::vector<CSVField>& fields);
+    // The line the last record started on
+    size_t Line() const { return recordLine; }
+
+private:
+    // The next delimiter, quote, CR or LF from p, or end
+    const char* FindSpecial(const char* p) const;
+
+    const char* position;
+    const char* const end;
+    const char delimiter;
+    size_t line;
+    size_t recordLine;
+    // Unescaped copies of quoted fields, one per field. A deque, so adding
+    // one doesn't move the others.
+    std::deque<std::string> scratch;
+};
+
+inline const char* CSVReader::FindSpecial(const char* p) const {
+#ifdef CONVERTTOOFX_SSE2
+    const __m128i delimiters = _mm_set1_epi8(delimiter);
+    const __m128i quotes = _mm_set1_epi8('"');
+    const __m128i newLines = _mm_set1_epi8('\n');
+    const __m128i returns = _mm_set1_epi8('\r');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, delimiters),
+                _mm_cmpeq_epi8(chunk, quotes)),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, newLines),
+                _mm_cmpeq_epi8(chunk, returns)));
+        int mask = _mm_movemask_epi8(special);
+        if (mask != 0) {
+            return p + LowestSetBit(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != delimiter && *p != '"' && *p != '\n' &&
+        *p != '\r') {
+        ++p;
+    }
+    return p;
+}
+
+inline bool CSVReader::Next(std::vector<CSVField>& fields) {
+    fields.clear();
+    if (position >= end) {
+        return false;
+    }
+    recordLine = line;
+    while (true) {
+        CSVField field;
+        if (*position == '"') {
+            const char* start = ++position;
+            std::string* copy = NULL;
+            while (true) {
+                const char* quote = static_cast<const char*>(
+                    memchr(position, '"', end - position));
+                const char* stop = quote ? quote : end;
+                line += std::count(position, stop, '\n');
+                if (quote && quote + 1 < end && quote[1] == '"') {
+                    // "" is a quote inside the field
+                    if (!copy) {
+                        while (scratch.size() <= fields.size()) {
+                            scratch.push_back(std::string());
+                        }
+                        copy = &scratch[fields.size()];
+                        copy->assign(start, quote + 1);
+                    }
+                    else {
+                        copy->append(position, quote + 1);
+                    }
+                    position = quote + 2;
+                    continue;
+                }
+                // The closing quote, or the end if there isn't one
+                if (copy) {
+                    copy->append(position, stop);
+                    field.text = copy->data();
+                    field.length = copy->length();
+                }
+                else {
+                    field.text = start;
+                    field.length = stop - start;
+                }
+                position = quote ? quote + 1 : end;
+                break;
+            }
+            // Skip whatever is between the closing quote and the delimiter
+            while (position < end && *position != delimiter &&
+                *position != '\n' && *position != '\r') {
+                ++position;
+            }
+        }
+        else {
+            const char* start = position;
+            position = FindSpecial(position);
+            // A quote inside an unquoted field is just a character
+            while (position < end && *position == '"') {
+                position = FindSpecial(position + 1);
+            }
+            field.text = start;
+            field.length = position - start;
+        }
+        fields.push_back(field);
+
+        if (position < end && *position == delimiter) {
+            ++position;
+            if (position == end) {
+                fields.push_back(CSVField{ end, 0 });
+                return true;
+            }
+            continue;
+        }
+        // CR, LF or CR LF ends the record
+        if (position < end && *position == '\r') {
+            ++position;
+        }
+        if (position < end && *position == '\n') {
+            ++position;
+        }
+        ++line;
+        return true;
+    }
+}
+
+// Dates like 12/31/2019, 31/12/2019 (if dayFirst), 2019-12-31, 12-31-19
+// and 20191231, with or without a time after them. Also Quicken's QIF
+// dates, which pad with spaces and put ' before years from 2000 on, like
+// 1/ 2'20. Sets yyyymmdd, e.g. 20191231.
+inline bool ParseCSVDate(const char* text, size_t length, bool dayFirst,
+    int& yyyymmdd) {
+    const char* p = text;
+    const char* end = text + length;
+    while (p < end && isspace(static_cast<unsigned char>(*p))) {
+        ++p;
+    }
+    int parts[3] = { 0, 0, 0 };
+    int digits[3] = { 0, 0, 0 };
+    int part = 0;
+    bool apostropheYear = false;
+    for (; p < end && part < 3; ++p) {
+        if (isdigit(static_cast<unsigned char>(*p))) {
+            parts[part] = parts[part] * 10 + (*p - '0');
+            ++digits[part];
+            if (digits[part] > 8) {
+                return false;
+            }
+        }
+        else if ((*p == '/' || *p == '-' || *p == '.' || *p == '\'') &&
+            digits[part] > 0) {
+            apostropheYear = *p == '\'' && part == 1;
+            ++part;
+        }
+        else if (*p == ' ' && part > 0 && digits[part] == 0) {
+            continue;  // Padding, like the space in 1/ 2/2020
+        }
+        else {
+            break;  // A time, or junk
+        }
+    }
+    int year, month, day;
+    if (part == 0 && digits[0] == 8) {
+        year = parts[0] / 10000;
+        month = parts[0] / 100 % 100;
+        day = parts[0] % 100;
+    }
+    else if ((part == 2 || part == 3) && digits[2] > 0) {
+        if (digits[0] == 4) {
+            year = parts[0];
+            month = parts[1];
+            day = parts[2];
+        }
+        else {
+            year = parts[2];
+            month = dayFirst ? parts[1] : parts[0];
+            day = dayFirst ? parts[0] : parts[1];
+            if (digits[2] <= 2) {
+                year += apostropheYear || year < 70 ? 2000 : 1900;
+            }
+        }
+    }
+    else {
+        return false;
+    }
+    static const int DAYS_IN_MONTH[] =
+        { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    if (month < 1 || month > 12 || year < 1900 || year > 9999) {
+        return false;
+    }
+    bool leapDay = month == 2 && day == 29 &&
+        year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    if (day < 1 || (day > DAYS_IN_MONTH[month - 1] && !leapDay)) {
+        return false;
+    }
+    yyyymmdd = year * 10000 + month * 100 + day;
+    return true;
+}
+
+// Amounts like -1234.56, 1,234.56, $1,234.56 and (1,234.56), which is
+// negative, or 1.234,56 if the decimal separator is ','. Sets minorUnits
+// (cents). Empty is not an amount.
+inline bool ParseCSVAmount(const char* text, size_t length,
+    char decimalSeparator, long long& minorUnits) {
+    const char thousandsSeparator = decimalSeparator == ',' ? '.' : ',';
+    char clean[64];
+    size_t cleanLength = 0;
+    bool negative = false;
+    for (size_t i = 0; i < length; ++i) {
+        char c = text[i];
+        if (c == '(' || c == ')') {
+            negative = true;
+        }
+        else if (c == '-' && cleanLength > 0) {
+            negative = true;  // Trailing minus, e.g. 12.00-
+        }
+        else if (c != '$' && c != thousandsSeparator && c != '+' &&
+            !isspace(static_cast<unsigned char>(c))) {
+            if (cleanLength + 1 >= sizeof(clean)) {
+                return false;
+            }
+            clean[cleanLength++] = c == decimalSeparator ? '.' : c;
+        }
+    }
+    if (!ParseOFXAmount(clean, cleanLength, minorUnits)) {
+        return false;
+    }
+    if (negative) {
+        minorUnits = -minorUnits;
+    }
+    return true;
+}
+
+// Escape &, < and > of text onto the end of xml
+inline void AppendEscapedXML(std::string& xml, const char* text,
+    size_t length) {
+    const char* end = text + length;
+    while (text < end) {
+        const char* special = text;
+        while (special < end && *special != '&' && *special != '<' &&
+            *special != '>') {
+            ++special;
+        }
+        xml.append(text, special);
+        if (special == end) {
+            break;
+        }
+        xml += *special == '&' ? "&amp;" : *special == '<' ? "&lt;" : "&gt;";
+        text = special + 1;
+    }
+}
+
+// Trim spaces off a field
+inline CSVField TrimField(CSVField field) {
+    while (field.length > 0 &&
+        isspace(static_cast<unsigned char>(field.text[0]))) {
+        ++field.text;
+        --field.length;
+    }
+    while (field.length > 0 && isspace(
+        static_cast<unsigned char>(field.text[field.length - 1]))) {
+        --field.length;
+    }
+    return field;
+}
+
+// Append a date as YYYYMMDD at noon GMT, so no time zone moves it to
+// another day
+inline void AppendOFXDate(std::string& xml, int yyyymmdd) {
+    char date[8];
+    for (int i = 7; i >= 0; --i) {
+        date[i] = static_cast<char>('0' + yyyymmdd % 10);
+        yyyymmdd /= 10;
+    }
+    xml.append(date, sizeof(date)).append("120000.000[0:GMT]");
+}
+
+// One transaction to write as a <STMTTRN>. The text points into the input
+// (or a scratch buffer) and is escaped when written.
+struct StatementTransaction {
+    int date = 0;  // YYYYMMDD
+    long long amount = 0;  // In minor units (cents)
+    CSVField payee = { "", 0 };
+    CSVField memo = { "", 0 };
+    CSVField id = { "", 0 };  // Empty to make one up
+    CSVField checknum = { "", 0 };
+    // <TRNTYPE>, or NULL for CHECK, DEBIT or CREDIT from the other fields
+    const char* type = NULL;
+};
+
+// Writes OFX for input that isn't OFX to begin with (CSV and QIF), one
+// transaction at a time, with the same header and field order as the
+// converted QFX. Output is buffered and written in 1 MB chunks. All the
+// bank statements must come before the credit card ones, since each kind
+// has its own message set.
+class OFXStatementWriter {
+public:
+    // idPrefix starts each made-up FITID. serverDate is for <DTSERVER>.
+    OFXStatementWriter(std::ostream& out, const char* idPrefix,
+        int serverDate);
+    void BeginStatement(const StatementAccount& account, int firstDate,
+        int lastDate);
+    void Add(const StatementTransaction& transaction);
+    void EndStatement(long long balance, int balanceDate);
+    // Close the message set and <OFX>. False if writing failed.
+    bool Finish();
+
+    unsigned long long BytesWritten() const { return bytesWritten; }
+    size_t Transactions() const { return transactions; }
+    size_t SynthesizedIds() const { return synthesizedIds; }
+
+private:
+    void Flush();
+
+    // Money wants the fields of a <STMTTRN> in STMTTRN_WHITELIST order
+    enum { TRNTYPE, DTPOSTED, TRNAMT, FITID, CHECKNUM, NAME, MEMO, NONE };
+
+    std::ostream& out;
+    const char* idPrefix;
+    std::string xml;
+    std::vector<int> order;
+    bool inMessageSet = false;
+    bool creditCard = false;  // Which message set is open
+    // Identical transactions on the same day (two coffees, say) need
+    // different FITIDs, so count them. Exports are grouped by date, so
+    // only the current date's transactions are remembered.
+    std::map<uint64_t, unsigned> sameDay;
+    int sameDayDate = 0;
+    unsigned long long bytesWritten = 0;
+    size_t transactions = 0;
+    size_t synthesizedIds = 0;
+};
+
+inline OFXStatementWriter::OFXStatementWriter(std::ostream& out,
+    const char* idPrefix, int serverDate)
+    : out(out), idPrefix(idPrefix) {
+    const char* const FIELD_NAMES[] = { "TRNTYPE", "DTPOSTED", "TRNAMT",
+        "FITID", "CHECKNUM", "NAME", "MEMO" };
+    for (const std::string& name : STMTTRN_WHITELIST) {
+        for (int i = 0; i < NONE; ++i) {
+            if (name == FIELD_NAMES[i]) {
+                order.push_back(i);
+            }
+        }
+    }
+    xml.reserve(1024 * 1024 + 4096);
+    xml.append(XML_HEADER).append("\r\n").append(XML_OFX_HEADER)
+        .append("\r\n<OFX>\r\n<SIGNONMSGSRSV1><SONRS><STATUS><CODE>0"
+            "</CODE><SEVERITY>INFO</SEVERITY></STATUS><DTSERVER>");
+    AppendOFXDate(xml, serverDate);
+    xml.append("</DTSERVER><LANGUAGE>ENG</LANGUAGE></SONRS>"
+        "</SIGNONMSGSRSV1>\r\n");
+}
+
+inline void OFXStatementWriter::BeginStatement(const StatementAccount& account,
+    int firstDate, int lastDate) {
+    bool isCreditCard = account.accountType == "CREDITCARD";
+    if (inMessageSet && isCreditCard != creditCard) {
+        xml += creditCard ? "</CREDITCARDMSGSRSV1>\r\n" :
+            "</BANKMSGSRSV1>\r\n";
+        inMessageSet = false;
+    }
+    if (!inMessageSet) {
+        xml += isCreditCard ? "<CREDITCARDMSGSRSV1>" : "<BANKMSGSRSV1>";
+        inMessageSet = true;
+        creditCard = isCreditCard;
+    }
+    xml += creditCard ? "<CCSTMTTRNRS>" : "<STMTTRNRS>";
+    xml.append("<TRNUID>0</TRNUID><STATUS><CODE>0</CODE><SEVERITY>INFO"
+        "</SEVERITY></STATUS>").append(creditCard ? "<CCSTMTRS>" :
+            "<STMTRS>").append("<CURDEF>");
+    AppendEscapedXML(xml, account.currency.data(), account.currency.length());
+    xml += "</CURDEF>";
+    if (creditCard) {
+        xml += "<CCACCTFROM><ACCTID>";
+        AppendEscapedXML(xml, account.accountId.data(),
+            account.accountId.length());
+        xml += "</ACCTID></CCACCTFROM>\r\n";
+    }
+    else {
+        xml += "<BANKACCTFROM><BANKID>";
+        AppendEscapedXML(xml, account.bankId.data(), account.bankId.length());
+        xml += "</BANKID><ACCTID>";
+        AppendEscapedXML(xml, account.accountId.data(),
+            account.accountId.length());
+        xml += "</ACCTID><ACCTTYPE>";
+        AppendEscapedXML(xml, account.accountType.data(),
+            account.accountType.length());
+        xml += "</ACCTTYPE></BANKACCTFROM>\r\n";
+    }
+    xml += "<BANKTRANLIST><DTSTART>";
+    AppendOFXDate(xml, firstDate);
+    xml += "</DTSTART><DTEND>";
+    AppendOFXDate(xml, lastDate);
+    xml += "</DTEND>\r\n";
+    sameDay.clear();
+    sameDayDate = 0;
+}
+
+inline void OFXStatementWriter::Add(const StatementTransaction& transaction) {
+    char fitid[16];  // Hex digits of the made-up FITID
+    if (transaction.id.length == 0) {
+        // The same transaction in the next export gets the same FITID, so
+        // Money doesn't import it twice
+        uint64_t hash = FNV_OFFSET_BASIS;
+        hash = HashBytes(hash, reinterpret_cast<const char*>(
+            &transaction.date), sizeof(transaction.date));
+        hash = HashBytes(hash, reinterpret_cast<const char*>(
+            &transaction.amount), sizeof(transaction.amount));
+        hash = HashBytes(hash, transaction.payee.text,
+            transaction.payee.length);
+        hash = HashBytes(hash, "\0", 1);
+        hash = HashBytes(hash, transaction.memo.text,
+            transaction.memo.length);
+        if (transaction.date != sameDayDate) {
+            sameDay.clear();
+            sameDayDate = transaction.date;
+        }
+        unsigned repeat = sameDay[hash]++;
+        hash = HashBytes(hash, reinterpret_cast<const char*>(&repeat),
+            sizeof(repeat));
+        for (int i = 15; i >= 0; --i) {
+            fitid[i] = "0123456789abcdef"[hash & 15];
+            hash >>= 4;
+        }
+        ++synthesizedIds;
+    }
+
+    xml += "<STMTTRN>";
+    for (int field : order) {
+        switch (field) {
+        case TRNTYPE:
+            xml += "<TRNTYPE>";
+            xml += transaction.type ? transaction.type :
+                transaction.checknum.length > 0 ? "CHECK" :
+                transaction.amount < 0 ? "DEBIT" : "CREDIT";
+            xml += "</TRNTYPE>";
+            break;
+        case DTPOSTED:
+            xml += "<DTPOSTED>";
+            AppendOFXDate(xml, transaction.date);
+            xml += "</DTPOSTED>";
+            break;
+        case TRNAMT:
+            xml += "<TRNAMT>";
+            AppendOFXAmount(xml, transaction.amount);
+            xml += "</TRNAMT>";
+            break;
+        case FITID:
+            xml += "<FITID>";
+            if (transaction.id.length > 0) {
+                AppendEscapedXML(xml, transaction.id.text,
+                    transaction.id.length);
+            }
+            else {
+                xml.append(idPrefix).append(fitid, sizeof(fitid));
+            }
+            xml += "</FITID>";
+            break;
+        case CHECKNUM:
+            if (transaction.checknum.length > 0) {
+                xml += "<CHECKNUM>";
+                AppendEscapedXML(xml, transaction.checknum.text,
+                    transaction.checknum.length);
+                xml += "</CHECKNUM>";
+            }
+            break;
+        case NAME:
+            if (transaction.payee.length > 0) {
+                xml += "<NAME>";
+                AppendEscapedXML(xml, transaction.payee.text,
+                    transaction.payee.length);
+                xml += "</NAME>";
+            }
+            break;
+        case MEMO:
+            if (transaction.memo.length > 0) {
+                xml += "<MEMO>";
+                AppendEscapedXML(xml, transaction.memo.text,
+                    transaction.memo.length);
+                xml += "</MEMO>";
+            }
+            break;
+        }
+    }
+    xml += "</STMTTRN>\r\n";
+    ++transactions;
+    if (xml.length() >= 1024 * 1024) {
+        Flush();
+    }
+}
+
+inline void OFXStatementWriter::EndStatement(long long balance,
+    int balanceDate) {
+    xml += "</BANKTRANLIST><LEDGERBAL><BALAMT>";
+    AppendOFXAmount(xml, balance);
+    xml += "</BALAMT><DTASOF>";
+    AppendOFXDate(xml, balanceDate);
+    xml += "</DTASOF></LEDGERBAL>\r\n";
+    xml += creditCard ? "</CCSTMTRS></CCSTMTTRNRS>\r\n" :
+        "</STMTRS></STMTTRNRS>\r\n";
+}
+
+inline bool OFXStatementWriter::Finish() {
+    if (inMessageSet) {
+        xml += creditCard ? "</CREDITCARDMSGSRSV1>\r\n" :
+            "</BANKMSGSRSV1>\r\n";
+        inMessageSet = false;
+    }
+    xml += "</OFX>\r\n";
+    Flush();
+    return static_cast<bool>(out);
+}
+
+inline void OFXStatementWriter::Flush() {
+    out.write(xml.data(), xml.length());
+    bytesWritten += xml.length();
+    xml.clear();
+}
+
+struct CSVConversionResult {
+    bool success = false;
+    std::string errorMsg;
+    unsigned long long bytesRead = 0;
+    unsigned long long bytesWritten = 0;
+    size_t transactionCount = 0;
+    size_t synthesizedIds = 0;  // Rows without an ID that got a FITID
+    size_t skippedRows = 0;  // Rows without a readable date or amount
+    size_t firstSkippedLine = 0;
+    bool hasBalance = false;  // <LEDGERBAL> came from the balance column
+};
+
+// Find the columns: from the mapping file where it names them, otherwise
+// by the header names in CSV_FIELDS
+inline bool ResolveCSVColumns(const std::vector<CSVField>& header,
+    CSVOptions& options, std::string& error) {
+    std::vector<std::string> names;
+    for (const CSVField& field : header) {
+        names.push_back(TrimAndLower(std::string(field.text, field.length)));
+    }
+    for (const auto& field : CSV_FIELDS) {
+        int& column = options.columns.*field.column;
+        std::map<std::string, std::string>::const_iterator named =
+            options.columnNames.find(field.key);
+        if (named != options.columnNames.end()) {
+            std::string name = TrimAndLower(named->second);
+            column = -1;
+            if (!name.empty() && std::all_of(name.begin(), name.end(),
+                [](unsigned char c) { return isdigit(c) != 0; })) {
+                column = atoi(name.c_str()) - 1;
+            }
+            for (size_t i = 0; column < 0 && i < names.size(); ++i) {
+                if (names[i] == name) {
+                    column = static_cast<int>(i);
+                }
+            }
+            if (column < 0) {
+                error = "The column mapping says " + std::string(field.key) +
+                    " is in column \"" + named->second + "\", but the CSV "
+                    "has no such column.";
+                return false;
+            }
+            continue;
+        }
+        if (column >= 0) {
+            continue;
+        }
+        std::string aliases = std::string("|") + field.headers + "|";
+        for (size_t i = 0; column < 0 && i < names.size(); ++i) {
+            if (!names[i].empty() &&
+                aliases.find("|" + names[i] + "|") != std::string::npos) {
+                column = static_cast<int>(i);
+            }
+        }
+    }
+    const CSVColumnMapping& columns = options.columns;
+    if (columns.date < 0 || (columns.amount < 0 && columns.debit < 0 &&
+        columns.credit < 0)) {
+        error = "Could not tell which columns hold the date and the amount. "
+            "Name them in a column mapping file (see the README).";
+        return false;
+    }
+    return true;
+}
+
+// Convert a CSV export to OFX, written to out. The first record is the
+// header row, unless options say there isn't one.
+inline CSVConversionResult ConvertCSVToOFX(const char* data, size_t length,
+    CSVOptions options, std::ostream& out) {
+    CSVConversionResult result;
+    result.bytesRead = length;
+    // Skip a UTF-8 byte order mark
+    if (length >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0) {
+        data += 3;
+        length -= 3;
+    }
+    std::vector<CSVField> fields;
+    CSVReader header(data, length, options.delimiter);
+    // Without a header row, there are no names to go by
+    if (!header.Next(fields) || !ResolveCSVColumns(options.hasHeader ?
+        fields : std::vector<CSVField>(), options, result.errorMsg)) {
+        if (result.errorMsg.empty()) {
+            result.errorMsg = "The CSV file is empty.";
+        }
+        return result;
+    }
+    // Where the transactions start
+    const CSVReader records = options.hasHeader ? header :
+        CSVReader(data, length, options.delimiter);
+    const CSVColumnMapping& columns = options.columns;
+    auto column = [&fields](int index) {
+        return index >= 0 && static_cast<size_t>(index) < fields.size() ?
+            TrimField(fields[index]) : CSVField{ "", 0 };
+    };
+
+    // First pass: the date range, and whether the newest rows come first
+    int firstDate = INT_MAX, lastDate = 0;
+    int firstRowDate = 0, lastRowDate = 0;
+    CSVReader dates = records;
+    while (dates.Next(fields)) {
+        int date;
+        CSVField dateField = column(columns.date);
+        if (ParseCSVDate(dateField.text, dateField.length, options.dayFirst,
+            date)) {
+            firstDate = std::min(firstDate, date);
+            lastDate = std::max(lastDate, date);
+            if (firstRowDate == 0) {
+                firstRowDate = date;
+            }
+            lastRowDate = date;
+        }
+    }
+    const bool newestFirst = firstRowDate > lastRowDate;
+    if (lastDate == 0) {
+        result.errorMsg = "None of the rows have a date that can be read.";
+        return result;
+    }
+
+    OFXStatementWriter writer(out, "CSV", lastDate);
+    writer.BeginStatement(options.account, firstDate, lastDate);
+
+    // Second pass: the transactions
+    long long balance = 0;
+    int balanceDate = 0;
+    CSVReader reader = records;
+    while (reader.Next(fields)) {
+        if (fields.size() == 1 && fields[0].length == 0) {
+            continue;  // Blank line
+        }
+        StatementTransaction transaction;
+        CSVField dateField = column(columns.date);
+        bool readable = ParseCSVDate(dateField.text, dateField.length,
+            options.dayFirst, transaction.date);
+        if (columns.amount >= 0) {
+            CSVField amountField = column(columns.amount);
+            readable = readable && ParseCSVAmount(amountField.text,
+                amountField.length, options.decimalSeparator,
+                transaction.amount);
+        }
+        else {
+            // Separate withdrawal and deposit columns. Either may be empty.
+            long long debit = 0, credit = 0;
+            CSVField debitField = column(columns.debit);
+            CSVField creditField = column(columns.credit);
+            bool hasDebit = debitField.length > 0 && ParseCSVAmount(
+                debitField.text, debitField.length,
+                options.decimalSeparator, debit);
+            bool hasCredit = creditField.length > 0 && ParseCSVAmount(
+                creditField.text, creditField.length,
+                options.decimalSeparator, credit);
+            readable = readable && (hasDebit || hasCredit);
+            transaction.amount = credit - (debit < 0 ? -debit : debit);
+        }
+        if (!readable) {
+            if (result.skippedRows++ == 0) {
+                result.firstSkippedLine = reader.Line();
+            }
+            continue;
+        }
+
+        transaction.payee = column(columns.payee);
+        transaction.memo = column(columns.memo);
+        transaction.id = column(columns.id);
+        transaction.checknum = column(columns.checknum);
+        CSVField balanceField = column(columns.balance);
+        long long rowBalance;
+        // The balance after the newest transaction. Of the rows on the
+        // newest day, that's the first one if the newest rows come first.
+        if (balanceField.length > 0 && ParseCSVAmount(balanceField.text,
+            balanceField.length, options.decimalSeparator, rowBalance) &&
+            (transaction.date > balanceDate ||
+                (transaction.date == balanceDate && !newestFirst))) {
+            balance = rowBalance;
+            balanceDate = transaction.date;
+            result.hasBalance = true;
+        }
+        writer.Add(transaction);
+    }
+
+    writer.EndStatement(balance, result.hasBalance ? balanceDate : lastDate);
+    bool written = writer.Finish();
+    result.bytesWritten = writer.BytesWritten();
+    result.transactionCount = writer.Transactions();
+    result.synthesizedIds = writer.SynthesizedIds();
+    if (!written) {
+        result.errorMsg = "Could not write the output file.";
+        return result;
+    }
+    result.success = true;
+    return result;
+}
+
+// QIF input. Older accounts only export QIF (Quicken Interchange Format):
+// one field per line, a letter code and then the value, with ^ after each
+// record and "!Type:" lines saying what kind of records come next. Like
+// CSV, the file is memory-mapped and read twice, first for each account's
+// date range and then to write the transactions. Nothing is kept per
+// transaction, so memory use doesn't grow with the file.
+
+// Reads a QIF file a line at a time
+class QIFReader {
+public:
+    QIFReader(const char* data, size_t length, size_t firstLine = 1)
+        : position(data), end(data + length), line(firstLine - 1) {}
+    // The next non-empty line without its line end or trailing spaces:
+    // code is its first character and value the rest. False at the end.
+    bool Next(char& code, CSVField& value);
+    // Where the next line starts
+    const char* Position() const { return position; }
+    size_t Line() const { return line; }
+
+private:
+    const char* position;
+    const char* const end;
+    size_t line;
+};
+
+inline bool QIFReader::Next(char& code, CSVField& value) {
+    while (position < end) {
+        const char* start = position;
+        const char* newline = static_cast<const char*>(
+            memchr(position, '\n', end - position));
+        const char* lineEnd = newline ? newline : end;
+        position = newline ? newline + 1 : end;
+        ++line;
+        while (lineEnd > start && isspace(static_cast<unsigned char>(
+            lineEnd[-1]))) {
+            --lineEnd;
+        }
+        if (lineEnd > start) {
+            code = *start;
+            value.text = start + 1;
+            value.length = lineEnd - start - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+// QIF account types (lower case) that can become a bank or credit card
+// statement, and their <ACCTTYPE>. Investment accounts can't.
+const struct {
+    const char* type;
+    const char* accountType;
+} QIF_ACCOUNT_TYPES[] = {
+    { "bank", "CHECKING" },
+    { "cash", "CHECKING" },
+    { "ccard", "CREDITCARD" },
+    { "oth a", "SAVINGS" },
+    { "oth l", "CREDITLINE" },
+};
+
+// What the N (number) field can say instead of a check number, and the
+// <TRNTYPE> for it
+const struct {
+    const char* number;
+    const char* type;
+} QIF_TRNTYPES[] = {
+    { "atm", "ATM" },
+    { "dep", "DEP" },
+    { "deposit", "DEP" },
+    { "xfer", "XFER" },
+    { "transfer", "XFER" },
+    { "txfr", "XFER" },
+    { "pos", "POS" },
+    { "int", "INT" },
+    { "div", "DIV" },
+    { "fee", "FEE" },
+    { "cash", "CASH" },
+};
+
+// The transaction records after one "!Type:" line, up to the next "!" line
+struct QIFSection {
+    size_t begin = 0;  // Byte offsets of the records
+    size_t end = 0;
+    size_t firstLine = 0;
+    StatementAccount account;
+    // The date range read month first [0] and day first [1], since QIF
+    // doesn't say which it uses
+    int firstDate[2] = { INT_MAX, INT_MAX };
+    int lastDate[2] = { 0, 0 };
+    size_t records = 0;
+    // The first record is Quicken's "Opening Balance". It isn't a
+    // transaction, just where the balance starts.
+    bool openingBalance = false;
+};
+
+struct QIFConversionResult {
+    bool success = false;
+    std::string errorMsg;
+    unsigned long long bytesRead = 0;
+    unsigned long long bytesWritten = 0;
+    size_t accountCount = 0;
+    size_t transactionCount = 0;
+    size_t synthesizedIds = 0;
+    size_t skippedRecords = 0;  // Records without a readable date or amount
+    size_t firstSkippedLine = 0;
+    size_t investmentSections = 0;  // Skipped, OFX can't take them here
+    size_t accountsWithoutBalance = 0;  // <LEDGERBAL> is 0.00 for these
+    bool dayFirst = false;  // Dates were read as 31/12/2019
+    char decimalSeparator = '.';
+};
+
+// First pass over a QIF file: find the sections of bank and credit card
+// transactions, their accounts and date ranges, and vote on the date
+// order and decimal separator.
+inline std::vector<QIFSection> ScanQIFSections(const char* data, size_t length,
+    QIFConversionResult& result) {
+    std::vector<QIFSection> sections;
+    enum { OTHER, ACCOUNT, TRANSACTIONS } mode = OTHER;
+    // The last !Account record's name and type. It names the sections
+    // after it, if they are of its type.
+    std::string accountName;
+    std::string accountType;
+    int dateFailures[2] = { 0, 0 };
+    int commaVotes = 0, dotVotes = 0;
+    bool firstRecord = false;
+    QIFReader reader(data, length);
+    const char* lineStart = reader.Position();
+    char code;
+    CSVField value;
+    while (reader.Next(code, value)) {
+        if (code == '!') {
+            if (mode == TRANSACTIONS) {
+                sections.back().end = lineStart - data;
+            }
+            std::string header = TrimAndLower(std::string(value.text,
+                value.length));
+            if (header == "account") {
+                mode = ACCOUNT;
+                accountName.clear();
+                accountType.clear();
+            }
+            else if (header.compare(0, 5, "type:") == 0) {
+                std::string type = TrimAndLower(header.substr(5));
+                mode = OTHER;
+                for (const auto& known : QIF_ACCOUNT_TYPES) {
+                    if (type != known.type) {
+                        continue;
+                    }
+                    mode = TRANSACTIONS;
+                    sections.push_back(QIFSection());
+                    QIFSection& section = sections.back();
+                    section.begin = reader.Position() - data;
+                    section.firstLine = reader.Line() + 1;
+                    section.account.accountType = known.accountType;
+                    section.account.accountId = !accountName.empty() &&
+                        (accountType.empty() || accountType == type) ?
+                        accountName : "QIF";
+                    firstRecord = true;
+                }
+                if (type == "invst") {
+                    ++result.investmentSections;
+                }
+            }
+            // !Option: and !Clear: lines don't change what comes next
+            lineStart = reader.Position();
+            continue;
+        }
+        lineStart = reader.Position();
+        if (mode == ACCOUNT) {
+            if (code == 'N') {
+                accountName.assign(value.text, value.length);
+            }
+            else if (code == 'T') {
+                accountType = TrimAndLower(std::string(value.text,
+                    value.length));
+            }
+            else if (code == '^') {
+                mode = OTHER;  // Until the next !Account or !Type:
+            }
+            continue;
+        }
+        if (mode != TRANSACTIONS) {
+            continue;
+        }
+        QIFSection& section = sections.back();
+        switch (code) {
+        case 'D':
+            for (int dayFirst = 0; dayFirst < 2; ++dayFirst) {
+                int date;
+                if (ParseCSVDate(value.text, value.length, dayFirst != 0,
+                    date)) {
+                    section.firstDate[dayFirst] = std::min(
+                        section.firstDate[dayFirst], date);
+                    section.lastDate[dayFirst] = std::max(
+                        section.lastDate[dayFirst], date);
+                }
+                else {
+                    ++dateFailures[dayFirst];
+                }
+            }
+            break;
+        case 'T':
+        case 'U':
+        case '$': {
+            // The last separator with 1 or 2 digits after it is the
+            // decimal point
+            const char* separator = NULL;
+            for (size_t i = 0; i < value.length; ++i) {
+                if (value.text[i] == '.' || value.text[i] == ',') {
+                    separator = value.text + i;
+                }
+            }
+            size_t after = separator ?
+                value.text + value.length - separator - 1 : 0;
+            if (separator && (after == 1 || after == 2)) {
+                ++(*separator == ',' ? commaVotes : dotVotes);
+            }
+            break;
+        }
+        case 'P':
+            if (firstRecord && TrimAndLower(std::string(value.text,
+                value.length)) == "opening balance") {
+                section.openingBalance = true;
+            }
+            break;
+        case '^':
+            ++section.records;
+            firstRecord = false;
+            break;
+        }
+    }
+    if (mode == TRANSACTIONS) {
+        sections.back().end = length;
+    }
+    result.dayFirst = dateFailures[0] > dateFailures[1];
+    result.decimalSeparator = commaVotes > dotVotes ? ',' : '.';
+    return sections;
+}
+
+// Convert a QIF export to OFX, written to out. Bank, cash and credit card
+// accounts each become a statement. Split transactions stay one
+// transaction, with the splits listed in the memo.
+inline QIFConversionResult ConvertQIFToOFX(const char* data, size_t length,
+    std::ostream& out) {
+    QIFConversionResult result;
+    result.bytesRead = length;
+    std::vector<QIFSection> sections = ScanQIFSections(data, length, result);
+    const int order = result.dayFirst ? 1 : 0;
+    int serverDate = 0;
+    for (const QIFSection& section : sections) {
+        serverDate = std::max(serverDate, section.lastDate[order]);
+    }
+    if (serverDate == 0) {
+        result.errorMsg = result.investmentSections > 0 ?
+            "The file only has investment accounts, which can't be "
+            "converted." : "There are no bank, cash or credit card "
+            "transactions with a date that can be read. Is this a QIF file?";
+        return result;
+    }
+
+    OFXStatementWriter writer(out, "QIF", serverDate);
+    std::string memo;  // The memo plus the splits
+    std::string splits;
+    // Bank statements first, then credit cards, each in its message set
+    for (int creditCards = 0; creditCards < 2; ++creditCards) {
+        for (const QIFSection& section : sections) {
+            if ((section.account.accountType == "CREDITCARD") !=
+                (creditCards != 0) || section.lastDate[order] == 0) {
+                continue;
+            }
+            writer.BeginStatement(section.account,
+                section.firstDate[order], section.lastDate[order]);
+            ++result.accountCount;
+            long long balance = 0;
+            StatementTransaction transaction;
+            bool hasDate = false, hasAmount = false, hasFields = false;
+            CSVField plainMemo = { "", 0 };
+            CSVField splitCategory = { "", 0 };
+            CSVField splitMemo = { "", 0 };
+            long long splitTotal = 0;
+            size_t recordLine = 0;
+            bool firstRecord = true;
+            splits.clear();
+            QIFReader reader(data + section.begin,
+                section.end - section.begin, section.firstLine);
+            char code;
+            CSVField value;
+            bool more = true;
+            while (more) {
+                more = reader.Next(code, value);
+                if (!more) {
+                    code = '^';  // A last record without its ^
+                    if (!hasFields) {
+                        break;
+                    }
+                }
+                if (code != '^') {
+                    if (!hasFields) {
+                        recordLine = reader.Line();
+                    }
+                    hasFields = true;
+                }
+                long long amount;
+                switch (code) {
+                case 'D':
+                    hasDate = ParseCSVDate(value.text, value.length,
+                        result.dayFirst, transaction.date);
+                    break;
+                case 'T':
+                case 'U':
+                    if (!hasAmount) {
+                        hasAmount = ParseCSVAmount(value.text, value.length,
+                            result.decimalSeparator, transaction.amount);
+                    }
+                    break;
+                case 'P':
+                    transaction.payee = TrimField(value);
+                    break;
+                case 'M':
+                    plainMemo = TrimField(value);
+                    break;
+                case 'N': {
+                    CSVField number = TrimField(value);
+                    if (number.length > 0 && std::all_of(number.text,
+                        number.text + number.length,
+                        [](unsigned char c) { return isdigit(c) != 0; })) {
+                        transaction.checknum = number;
+                        break;
+                    }
+                    std::string lower = TrimAndLower(std::string(
+                        number.text, number.length));
+                    for (const auto& known : QIF_TRNTYPES) {
+                        if (lower == known.number) {
+                            transaction.type = known.type;
+                        }
+                    }
+                    break;
+                }
+                case 'S':
+                    splitCategory = TrimField(value);
+                    splitMemo = CSVField{ "", 0 };
+                    break;
+                case 'E':
+                    splitMemo = TrimField(value);
+                    break;
+                case '$':
+                    if (!ParseCSVAmount(value.text, value.length,
+                        result.decimalSeparator, amount)) {
+                        break;
+                    }
+                    splitTotal += amount;
+                    splits += splits.empty() ? "Split: " : ", ";
+                    splits.append(splitCategory.text, splitCategory.length)
+                        .append(splitCategory.length > 0 ? " " : "")
+                        .append(FormatOFXAmount(amount));
+                    if (splitMemo.length > 0) {
+                        splits.append(" (").append(splitMemo.text,
+                            splitMemo.length).append(")");
+                    }
+                    splitCategory = CSVField{ "", 0 };
+                    splitMemo = CSVField{ "", 0 };
+                    break;
+                case '^':
+                    if (!hasAmount && !splits.empty()) {
+                        transaction.amount = splitTotal;
+                        hasAmount = true;
+                    }
+                    if (hasDate && hasAmount && firstRecord &&
+                        section.openingBalance) {
+                        // Importing it into an existing account would add
+                        // the whole balance again as a deposit
+                        balance += transaction.amount;
+                    }
+                    else if (hasDate && hasAmount) {
+                        memo.assign(plainMemo.text, plainMemo.length);
+                        if (!splits.empty()) {
+                            memo.append(memo.empty() ? "" : " ")
+                                .append(splits);
+                        }
+                        transaction.memo = CSVField{ memo.data(),
+                            memo.length() };
+                        writer.Add(transaction);
+                        balance += transaction.amount;
+                    }
+                    else if (hasFields && result.skippedRecords++ == 0) {
+                        result.firstSkippedLine = recordLine;
+                    }
+                    transaction = StatementTransaction();
+                    firstRecord = false;
+                    hasDate = hasAmount = hasFields = false;
+                    plainMemo = splitCategory = splitMemo = CSVField{ "", 0 };
+                    splitTotal = 0;
+                    splits.clear();
+                    break;
+                }
+            }
+            // Without the opening balance, the real balance isn't known
+            if (!section.openingBalance) {
+                balance = 0;
+                ++result.accountsWithoutBalance;
+            }
+            writer.EndStatement(balance, section.lastDate[order]);
+        }
+    }
+
+    bool written = writer.Finish();
+    result.bytesWritten = writer.BytesWritten();
+    result.transactionCount = writer.Transactions();
+    result.synthesizedIds = writer.SynthesizedIds();
+    if (!written) {
+        result.errorMsg = "Could not write the output file.";
+        return result;
+    }
+    result.success = true;
+    return result;
+}
+
+// Hash text the way the XML parser will read it: the basic entities are
+// decoded and new lines are dropped, so "A&amp;B" in the output matches
+// "A&B" in the input.
+inline uint64_t HashXMLText(uint64_t hash, const char* text, size_t length) {
+    static const struct { const char* entity; size_t length; char c; }
+    ENTITIES[] = { { "&amp;", 5, '&' }, { "&lt;", 4, '<' },
+        { "&gt;", 4, '>' }, { "&quot;", 6, '"' }, { "&apos;", 6, '\'' } };
+    size_t i = 0;
+    while (i < length) {
+        // Hash runs of ordinary characters in one go
+        size_t run = i;
+        while (run < length && text[run] != '&' && text[run] != '\r' &&
+            text[run] != '\n') {
+            ++run;
+        }
+        hash = HashBytes(hash, text + i, run - i);
+        i = run;
+        if (i == length) {
+            break;
+        }
+        char c = text[i++];
+        if (c != '&') {
+            continue;  // New lines don't count
+        }
+        for (const auto& entity : ENTITIES) {
+            if (length - i + 1 >= entity.length &&
+                memcmp(text + i - 1, entity.entity, entity.length) == 0) {
+                c = entity.c;
+                i += entity.length - 1;
+                break;
+            }
+        }
+        hash = HashBytes(hash, &c, 1);
+    }
+    return hash;
+}
+
+// Compares the transactions of the input with the converted output, so the
+// user can see what the conversion did to them. This used to be a single
+// "Nothing changed" check, which doesn't help when a 50 MB file comes out
+// different in a thousand small ways.
+//
+// Both sides are scanned once, without a DOM, into a list of <STMTTRN>s.
+// The scanner closes tags the same way XMLFixer does, so it also sees which
+// tags FixXML() had to close. Transactions are paired up by FITID (plus the
+// ACCTID of their statement) with a hash table. Whatever is left, like
+// transactions without a FITID, is paired by content (type, amount, date
+// and name) with a Myers O(ND) diff. There are usually only a few of those,
+// and D is capped, so the whole thing stays linear in the file size. Each
+// pair is then scanned again and compared field by field.
+class StructuralDiff {
+public:
+    // input is the text before FixXML() (if it was needed), output is the
+    // converted OFX. If details is set, a line goes there for every
+    // transaction that changed.
+    void Compare(const char* input, size_t inputLength, const char* output,
+        size_t outputLength, std::ostream* details);
+
+    // The totals, for the conversion report
+    std::string Summary() const;
+
+private:
+    static const size_t NO_MATCH = SIZE_MAX;
+    // Give up on pairing by content after this many differences
+    static const int MAX_CONTENT_EDITS = 1000;
+
+    // A child of a <STMTTRN>. Anything below it only goes into valueHash.
+    // When scanning a whole file, valueHash leaves out the field's own text,
+    // since only ContentHash() needs it.
+    struct Field {
+        const char* name;
+        size_t nameLength;
+        uint64_t nameHash;
+        const char* value;  // Trimmed, as it is in the text
+        size_t valueLength;
+        uint64_t valueHash;
+        bool autoClosed;
+    };
+    struct Transaction {
+        size_t begin;  // Where the <STMTTRN> starts...
+        size_t end;  // ...and where whatever closed it ends
+        uint64_t key;  // FITID and ACCTID. 0 if there is no FITID.
+        uint64_t content;  // For pairing by content
+        size_t match;  // The paired transaction on the other side
+    };
+
+    static void Scan(const char* text, size_t length,
+        std::vector<Transaction>* transactions, std::vector<Field>& fields,
+        size_t& autoClosedTags, size_t& autoClosedInTransactions);
+    static uint64_t ContentHash(const std::vector<Field>& fields);
+    void Pair(size_t before, size_t after);
+    void AlignByContent(const std::vector<size_t>& before,
+        const std::vector<size_t>& after);
+    void ComparePair(size_t number, std::ostream* details);
+
+    const char* input = NULL;
+    const char* output = NULL;
+    std::vector<Transaction> inputTransactions;
+    std::vector<Transaction> outputTransactions;
+    // Scratch space for ComparePair()
+    std::vector<Field> inputFields;
+    std::vector<Field> outputFields;
+    std::vector<size_t> keptAt;
+    std::vector<bool> used;
+
+    size_t pairedByFITID = 0;
+    size_t pairedByContent = 0;
+    bool gaveUpOnContent = false;
+    size_t transactionsMoved = 0;
+    size_t transactionsReordered = 0;
+    size_t fieldsMoved = 0;
+    size_t memosDeduped = 0;
+    size_t payeesUsedAsName = 0;
+    size_t payeesDroppedForName = 0;
+    size_t inputAutoClosed = 0;
+    size_t inputAutoClosedInTransactions = 0;
+    std::map<std::string, size_t> dropped;
+    std::map<std::string, size_t> added;
+    std::map<std::string, size_t> rewritten;
+    double milliseconds = 0;
+};
+
+// Scan text for <STMTTRN>s. With transactions set, every transaction is
+// added there and fields is only scratch space. Without, text should be one
+// transaction and its fields are added to fields.
+inline void StructuralDiff::Scan(const char* text, size_t length,
+    std::vector<Transaction>* transactions, std::vector<Field>& fields,
+    size_t& autoClosedTags, size_t& autoClosedInTransactions) {
+    const size_t NONE = SIZE_MAX;
+    struct OpenTag {
+        const char* name;
+        size_t length;
+    };
+    std::vector<OpenTag> stack;
+    size_t transactionDepth = NONE;  // Where <STMTTRN> is in the stack
+    size_t transactionBegin = 0;
+    uint64_t childHash = FNV_OFFSET_BASIS;  // Whatever is below a field
+    uint64_t accountHash = FNV_OFFSET_BASIS;  // The last <ACCTID>
+    const char* value = NULL;  // The text since the last tag
+    size_t valueLength = 0;
+
+    // Close the top of the stack. The value always goes with the first
+    // tag closed, just like in XMLFixer.
+    auto close = [&](bool autoClosed, size_t closedAt) {
+        OpenTag tag = stack.back();
+        stack.pop_back();
+        autoClosedTags += autoClosed;
+        autoClosedInTransactions += autoClosed && transactionDepth != NONE;
+        size_t depth = stack.size();
+        if (transactionDepth == NONE) {
+            if (tag.length == 6 && memcmp(tag.name, "ACCTID", 6) == 0) {
+                accountHash = HashXMLText(FNV_OFFSET_BASIS, value,
+                    valueLength);
+            }
+        }
+        else if (depth == transactionDepth) {
+            // The <STMTTRN> itself
+            transactionDepth = NONE;
+            if (transactions) {
+                Transaction transaction = { transactionBegin, closedAt, 0,
+                    ContentHash(fields), NO_MATCH };
+                for (const Field& field : fields) {
+                    if (field.nameLength == 5 &&
+                        memcmp(field.name, "FITID", 5) == 0) {
+                        transaction.key = HashXMLText(accountHash,
+                            field.value, field.valueLength) | 1;
+                        break;
+                    }
+                }
+                transactions->push_back(transaction);
+                fields.clear();
+            }
+        }
+        else if (depth == transactionDepth + 1) {
+            Field field = { tag.name, tag.length,
+                HashBytes(FNV_OFFSET_BASIS, tag.name, tag.length),
+                value, valueLength, transactions ? childHash :
+                    HashXMLText(childHash, value, valueLength), autoClosed };
+            fields.push_back(field);
+        }
+        else {
+            childHash = HashBytes(childHash, tag.name, tag.length);
+            childHash = HashXMLText(childHash, value, valueLength);
+        }
+        value = NULL;
+        valueLength = 0;
+    };
+
+    size_t i = 0;
+    while (i < length) {
+        const char* open = static_cast<const char*>(
+            memchr(text + i, '<', length - i));
+        size_t tagStart = open ? open - text : length;
+        // Keep the text before the tag, trimmed
+        size_t first = i;
+        size_t last = tagStart;
+        while (first < last &&
+            isspace(static_cast<unsigned char>(text[first]))) {
+            ++first;
+        }
+        while (last > first &&
+            isspace(static_cast<unsigned char>(text[last - 1]))) {
+            --last;
+        }
+        if (first < last) {
+            value = text + first;
+            valueLength = last - first;
+        }
+        if (!open) {
+            break;
+        }
+        const char* closeBracket = static_cast<const char*>(
+            memchr(open, '>', length - tagStart));
+        if (!closeBracket) {
+            break;
+        }
+        size_t tagEnd = closeBracket - text + 1;
+        const char* name = open + 1;
+        size_t nameLength = closeBracket - name;
+        i = tagEnd;
+
+        if (nameLength > 0 && name[0] == '/') {
+            // Close everything down to the matching tag. If it isn't open
+            // at all, the text ends here as far as we are concerned.
+            ++name;
+            --nameLength;
+            size_t match = stack.size();
+            while (match > 0 && (stack[match - 1].length != nameLength ||
+                memcmp(stack[match - 1].name, name, nameLength) != 0)) {
+                --match;
+            }
+            if (match == 0) {
+                if (!transactions) {
+                    break;
+                }
+                value = NULL;
+                valueLength = 0;
+                continue;
+            }
+            while (stack.size() > match) {
+                close(true, tagStart);
+            }
+            close(false, tagEnd);
+        }
+        else if (nameLength == 0 || name[nameLength - 1] == '/' ||
+            name[0] == '?' || name[0] == '!') {
+            // Self contained, or a header. Nothing to balance.
+            value = NULL;
+            valueLength = 0;
+        }
+        else {
+            // An opening tag. A value in front of it belongs to the tag on
+            // top of the stack, which was never closed.
+            if (value && !stack.empty()) {
+                close(true, tagStart);
+            }
+            value = NULL;
+            valueLength = 0;
+            for (size_t n = 0; n < nameLength; ++n) {
+                if (isspace(static_cast<unsigned char>(name[n]))) {
+                    nameLength = n;
+                    break;
+                }
+            }
+            if (transactionDepth == NONE && nameLength == 7 &&
+                memcmp(name, "STMTTRN", 7) == 0) {
+                transactionDepth = stack.size();
+                transactionBegin = tagStart;
+                fields.clear();
+            }
+            else if (transactionDepth != NONE &&
+                stack.size() == transactionDepth + 1) {
+                childHash = FNV_OFFSET_BASIS;
+            }
+            OpenTag tag = { name, nameLength };
+            stack.push_back(tag);
+        }
+    }
+    // Close out anything still open
+    while (!stack.empty()) {
+        close(true, length);
+    }
+}
+
+// What a transaction is, as far as pairing by content goes. Amounts and
+// dates are compared by value, since the conversion may rewrite them.
+inline uint64_t StructuralDiff::ContentHash(const std::vector<Field>& fields) {
+    const char* NAMES[] = { "TRNTYPE", "TRNAMT", "DTPOSTED", "NAME" };
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (const char* name : NAMES) {
+        size_t nameLength = strlen(name);
+        const Field* found = NULL;
+        const Field* payee = NULL;
+        for (const Field& field : fields) {
+            if (field.nameLength == nameLength &&
+                memcmp(field.name, name, nameLength) == 0) {
+                found = &field;
+                break;
+            }
+            if (field.nameLength == 5 && memcmp(field.name, "PAYEE", 5) == 0) {
+                payee = &field;
+            }
+        }
+        if (!found && nameLength == 4) {
+            found = payee;  // <PAYEE> stands in for a missing <NAME>
+        }
+        long long number = 0;
+        if (!found) {
+            hash = HashBytes(hash, "\0", 1);
+        }
+        else if ((nameLength == 6 &&
+            ParseOFXAmount(found->value, found->valueLength, number)) ||
+            (nameLength == 8 &&
+                ParseOFXDateTime(found->value, found->valueLength, number))) {
+            hash = HashBytes(hash, reinterpret_cast<const char*>(&number),
+                sizeof(number));
+        }
+        else {
+            hash = HashXMLText(hash, found->value, found->valueLength);
+            hash = HashBytes(hash,
+                reinterpret_cast<const char*>(&found->valueHash),
+                sizeof(found->valueHash));
+        }
+    }
+    return hash;
+}
+
+inline void StructuralDiff::Pair(size_t before, size_t after) {
+    inputTransactions[before].match = after;
+    outputTransactions[after].match = before;
+}
+
+// Pair up what is left with Myers' O(ND) diff. A transaction pairs with one
+// that has the same content, as long as they are in the same order.
+inline void StructuralDiff::AlignByContent(const std::vector<size_t>& before,
+    const std::vector<size_t>& after) {
+    auto same = [&](size_t b, size_t a) {
+        return inputTransactions[before[b]].content ==
+            outputTransactions[after[a]].content;
+    };
+    // The ends usually match, so take them off first
+    size_t start = 0;
+    while (start < before.size() && start < after.size() &&
+        same(start, start)) {
+        Pair(before[start], after[start]);
+        ++pairedByContent;
+        ++start;
+    }
+    size_t endBefore = before.size();
+    size_t endAfter = after.size();
+    while (endBefore > start && endAfter > start &&
+        same(endBefore - 1, endAfter - 1)) {
+        --endBefore;
+        --endAfter;
+        Pair(before[endBefore], after[endAfter]);
+        ++pairedByContent;
+    }
+    const int n = static_cast<int>(endBefore - start);
+    const int m = static_cast<int>(endAfter - start);
+    if (n == 0 || m == 0) {
+        return;
+    }
+
+    // v[k] is how far along before the furthest path on diagonal k got.
+    // trace[d] is v[-d..d] before step d, for walking back.
+    // Not std::min(), which would take MAX_CONTENT_EDITS by reference and
+    // need it defined outside the class
+    const int maxD = n + m < MAX_CONTENT_EDITS ? n + m : MAX_CONTENT_EDITS;
+    const int offset = maxD + 1;
+    std::vector<int> v(2 * maxD + 3, 0);
+    std::vector<std::vector<int>> trace;
+    int found = -1;
+    for (int d = 0; d <= maxD && found < 0; ++d) {
+        trace.push_back(std::vector<int>(v.begin() + offset - d,
+            v.begin() + offset + d + 1));
+        for (int k = -d; k <= d; k += 2) {
+            int x = k == -d || (k != d &&
+                v[offset + k - 1] < v[offset + k + 1]) ?
+                v[offset + k + 1] : v[offset + k - 1] + 1;
+            int y = x - k;
+            while (x < n && y < m && same(start + x, start + y)) {
+                ++x;
+                ++y;
+            }
+            v[offset + k] = x;
+            if (x >= n && y >= m) {
+                found = d;
+                break;
+            }
+        }
+    }
+    if (found < 0) {
+        gaveUpOnContent = true;
+        return;
+    }
+
+    int x = n;
+    int y = m;
+    for (int d = found; d > 0; --d) {
+        const std::vector<int>& previous = trace[d];
+        int k = x - y;
+        int previousK = k == -d || (k != d &&
+            previous[k - 1 + d] < previous[k + 1 + d]) ? k + 1 : k - 1;
+        int previousX = previous[previousK + d];
+        int previousY = previousX - previousK;
+        while (x > previousX && y > previousY) {
+            --x;
+            --y;
+            Pair(before[start + x], after[start + y]);
+            ++pairedByContent;
+        }
+        x = previousX;
+        y = previousY;
+    }
+    while (x > 0 && y > 0) {
+        --x;
+        --y;
+        Pair(before[start + x], after[start + y]);
+        ++pairedByContent;
+    }
+}
+
+// How many of the numbers are not part of the longest increasing run
+// through them, i.e. how many had to move
+inline size_t CountMoved(const std::vector<size_t>& positions) {
+    std::vector<size_t> tails;  // Smallest tail of each run length
+    for (size_t position : positions) {
+        auto it = std::lower_bound(tails.begin(), tails.end(), position);
+        if (it == tails.end()) {
+            tails.push_back(position);
+        }
+        else {
+            *it = position;
+        }
+    }
+    return positions.size() - tails.size();
+}
+
+inline void StructuralDiff::Compare(const char* inputText, size_t inputLength,
+    const char* outputText, size_t outputLength, std::ostream* details) {
+    auto start = std::chrono::steady_clock::now();
+    input = inputText;
+    output = outputText;
+    Scan(input, inputLength, &inputTransactions, inputFields,
+        inputAutoClosed, inputAutoClosedInTransactions);
+    size_t ignored = 0;
+    Scan(output, outputLength, &outputTransactions, outputFields, ignored,
+        ignored);
+
+    // Pair by FITID. Repeated FITIDs pair up in order.
+    std::unordered_map<uint64_t, size_t> firstWithKey;
+    std::vector<size_t> nextWithKey(outputTransactions.size(),
+        size_t(NO_MATCH));
+    firstWithKey.reserve(outputTransactions.size());
+    for (size_t j = outputTransactions.size(); j-- > 0;) {
+        uint64_t key = outputTransactions[j].key;
+        if (key != 0) {
+            auto it = firstWithKey.find(key);
+            if (it != firstWithKey.end()) {
+                nextWithKey[j] = it->second;
+            }
+            firstWithKey[key] = j;
+        }
+    }
+    std::vector<size_t> leftBefore;
+    for (size_t i = 0; i < inputTransactions.size(); ++i) {
+        auto it = firstWithKey.find(inputTransactions[i].key);
+        if (inputTransactions[i].key == 0 || it == firstWithKey.end() ||
+            it->second == NO_MATCH) {
+            leftBefore.push_back(i);
+            continue;
+        }
+        Pair(i, it->second);
+        it->second = nextWithKey[it->second];
+        ++pairedByFITID;
+    }
+    std::vector<size_t> leftAfter;
+    for (size_t j = 0; j < outputTransactions.size(); ++j) {
+        if (outputTransactions[j].match == NO_MATCH) {
+            leftAfter.push_back(j);
+        }
+    }
+    AlignByContent(leftBefore, leftAfter);
+
+    // Compare the pairs in input order
+    std::vector<size_t> positions;
+    for (size_t i = 0; i < inputTransactions.size(); ++i) {
+        if (inputTransactions[i].match == NO_MATCH) {
+            if (details) {
+                *details << "Transaction " << i + 1 << " of the input is not "
+                    "in the output\r\n";
+            }
+            continue;
+        }
+        positions.push_back(inputTransactions[i].match);
+        ComparePair(i, details);
+    }
+    transactionsMoved = CountMoved(positions);
+    if (details) {
+        for (size_t j = 0; j < outputTransactions.size(); ++j) {
+            if (outputTransactions[j].match == NO_MATCH) {
+                *details << "Transaction " << j + 1 << " of the output is "
+                    "not in the input\r\n";
+            }
+        }
+    }
+    milliseconds = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Compare input transaction number with its pair, field by field
+inline void StructuralDiff::ComparePair(size_t number, std::ostream* details) {
+    const Transaction& before = inputTransactions[number];
+    const Transaction& after = outputTransactions[before.match];
+    size_t closedTags = 0;
+    size_t ignored = 0;
+    inputFields.clear();
+    outputFields.clear();
+    Scan(input + before.begin, before.end - before.begin, NULL, inputFields,
+        closedTags, ignored);
+    Scan(output + after.begin, after.end - after.begin, NULL, outputFields,
+        ignored, ignored);
+
+    auto is = [](const Field& field, const char* name) {
+        return field.nameLength == strlen(name) &&
+            memcmp(field.name, name, field.nameLength) == 0;
+    };
+    const Field* name = NULL;
+    const Field* fitid = NULL;
+    for (const Field& field : inputFields) {
+        if (!name && is(field, "NAME")) {
+            name = &field;
+        }
+        if (!fitid && is(field, "FITID")) {
+            fitid = &field;
+        }
+    }
+    // Only spell things out if someone is going to read them
+    std::string droppedNames;
+    std::string addedNames;
+    std::string rewrittenNames;
+    std::string notes;
+    auto note = [details](std::string& names, const Field& field) {
+        if (details) {
+            names.append(names.empty() ? "" : ", ").append(field.name,
+                field.nameLength);
+        }
+    };
+
+    keptAt.clear();
+    used.assign(outputFields.size(), false);
+    for (const Field& field : inputFields) {
+        size_t at = 0;
+        while (at < outputFields.size() && (used[at] ||
+            outputFields[at].nameHash != field.nameHash)) {
+            ++at;
+        }
+        if (at < outputFields.size()) {
+            used[at] = true;
+            keptAt.push_back(at);
+            if (outputFields[at].valueHash != field.valueHash) {
+                ++rewritten[std::string(field.name, field.nameLength)];
+                note(rewrittenNames, field);
+            }
+            if (!name && is(field, "PAYEE")) {
+                ++payeesUsedAsName;
+                notes += "; PAYEE used as NAME";
+            }
+        }
+        else if (name && is(field, "MEMO") &&
+            field.valueHash == name->valueHash) {
+            ++memosDeduped;
+            notes += "; MEMO deduped";
+        }
+        else if (name && is(field, "PAYEE")) {
+            ++payeesDroppedForName;
+            notes += "; PAYEE dropped for NAME";
+        }
+        else {
+            ++dropped[std::string(field.name, field.nameLength)];
+            note(droppedNames, field);
+        }
+    }
+    for (size_t at = 0; at < outputFields.size(); ++at) {
+        if (!used[at]) {
+            const Field& field = outputFields[at];
+            ++added[std::string(field.name, field.nameLength)];
+            note(addedNames, field);
+        }
+    }
+    size_t moved = CountMoved(keptAt);
+    if (moved > 0) {
+        ++transactionsReordered;
+        fieldsMoved += moved;
+        notes += "; " + std::to_string(moved) + " fields moved";
+    }
+    if (!details) {
+        return;
+    }
+
+    std::string line;
+    if (!droppedNames.empty()) {
+        line += "; dropped " + droppedNames;
+    }
+    if (!addedNames.empty()) {
+        line += "; added " + addedNames;
+    }
+    line += notes;
+    if (!rewrittenNames.empty()) {
+        line += "; rewrote " + rewrittenNames;
+    }
+    if (closedTags > 0) {
+        line += "; closed " + std::to_string(closedTags) + " tags";
+    }
+    if (line.empty()) {
+        return;
+    }
+    *details << "Transaction " << number + 1;
+    if (fitid) {
+        *details << " (FITID ";
+        details->write(fitid->value, fitid->valueLength);
+        *details << ")";
+    }
+    *details << ": " << line.substr(2) << "\r\n";
+}
+
+// "3 (SIC 2, CORRECTFITID 1)"
+inline std::string FormatTally(const std::map<std::string, size_t>& tally) {
+    size_t total = 0;
+    std::string names;
+    size_t shown = 0;
+    for (const auto& name : tally) {
+        total += name.second;
+        if (shown++ < 8) {
+            names += (names.empty() ? "" : ", ") + name.first + " " +
+                std::to_string(name.second);
+        }
+    }
+    if (shown > 8) {
+        names += ", ...";
+    }
+    return std::to_string(total) + " (" + names + ")";
+}
+
+inline std::string StructuralDiff::Summary() const {
+    char time[32];
+    snprintf(time, sizeof(time), "%.2f", milliseconds);
+    std::string summary = "Compared " +
+        std::to_string(inputTransactions.size()) + " input with " +
+        std::to_string(outputTransactions.size()) + " output transactions "
+        "in " + time + " ms. " + std::to_string(pairedByFITID) + " paired "
+        "by FITID, " + std::to_string(pairedByContent) + " by content.\r\n";
+    size_t paired = pairedByFITID + pairedByContent;
+    if (paired < inputTransactions.size()) {
+        summary += "- Not in the output: " +
+            std::to_string(inputTransactions.size() - paired) +
+            " transactions" + (gaveUpOnContent ? " (or too different to "
+                "pair up)" : "") + "\r\n";
+    }
+    if (paired < outputTransactions.size()) {
+        summary += "- Not in the input: " +
+            std::to_string(outputTransactions.size() - paired) +
+            " transactions\r\n";
+    }
+    if (transactionsMoved > 0) {
+        summary += "- Transactions in a different order: " +
+            std::to_string(transactionsMoved) + "\r\n";
+    }
+    if (!dropped.empty()) {
+        summary += "- Fields dropped: " + FormatTally(dropped) + "\r\n";
+    }
+    if (!added.empty()) {
+        summary += "- Fields added: " + FormatTally(added) + "\r\n";
+    }
+    if (transactionsReordered > 0) {
+        summary += "- Fields reordered in " +
+            std::to_string(transactionsReordered) + " transactions (" +
+            std::to_string(fieldsMoved) + " fields moved)\r\n";
+    }
+    if (memosDeduped > 0) {
+        summary += "- MEMOs deduped: " + std::to_string(memosDeduped) +
+            "\r\n";
+    }
+    if (payeesUsedAsName + payeesDroppedForName > 0) {
+        summary += "- PAYEE used in place of NAME: " +
+            std::to_string(payeesUsedAsName) + ", dropped because there "
+            "was a NAME: " + std::to_string(payeesDroppedForName) + "\r\n";
+    }
+    if (!rewritten.empty()) {
+        summary += "- Values rewritten: " + FormatTally(rewritten) + "\r\n";
+    }
+    if (inputAutoClosed > 0) {
+        summary += "- Tags closed by FixXML: " +
+            std::to_string(inputAutoClosed) + " (" +
+            std::to_string(inputAutoClosedInTransactions) + " inside "
+            "transactions)\r\n";
+    }
+    return summary;
+}
+
+// Something a conversion wants the user to know about. The UI decides how
+// to show it; ConvertQFXToOFX() never touches a window.
+struct ConversionMessage {
+    enum Severity { MESSAGE_INFO, MESSAGE_WARNING, MESSAGE_ERROR };
+    Severity severity;
+    std::string title;
+    std::string text;
+};
+
+// Collects the messages and statistics of one conversion, in order.
+struct ConversionDiagnostics {
+    std::vector<ConversionMessage> messages;
+    std::string report;  // Statistics, for the curious
+
+    void Add(ConversionMessage::Severity severity, const std::string& title,
+        const std::string& text) {
+        ConversionMessage message = { severity, title, text };
+        messages.push_back(message);
+    }
+    // The error messages, one per line, e.g. for the console
+    std::string ErrorText() const {
+        std::string text;
+        for (const ConversionMessage& message : messages) {
+            if (message.severity == ConversionMessage::MESSAGE_ERROR) {
+                text += message.title + ": " + message.text + "\n";
+            }
+        }
+        return text;
+    }
+};
+
+// Everything one conversion job needs. The options are a copy and the
+// tables it reads (TYPE_TO_BANKTRANLIST_MAP, STMTTRN_WHITELIST) are const,
+// so any number of conversions can run on separate threads, as long as each
+// has its own context.
+class ConversionContext {
+public:
+    explicit ConversionContext(const ConversionOptions& options)
+        : options(options) {}
+
+    const ConversionOptions options;
+    ConversionDiagnostics diagnostics;
+    AllocationStats* allocations = NULL;  // Measure allocations, if set
+    // If set, compare the output with the input (see StructuralDiff). The
+    // totals go in the report and what changed in each transaction goes
+    // here.
+    std::ostream* differences = NULL;
+};
+
+// Memory that a worker keeps from one conversion to the next, so that a
+// batch of files doesn't allocate and free the same big buffers and document
+// pools for every file. Reset() keeps the memory for the next file, unless it
+// was only needed for an unusually big one: anything more than twice what
+// the last few files needed is given back.
+class ConversionBuffers {
+public:
+    std::string polishedText;
+    std::string fixedXML;
+
+    // Both are cleared by Reset(), and kept warm otherwise
+    tinyxml2::XMLDocument& Document();
+    tinyxml2::XMLPrinter& Printer();
+
+    // Get ready for the next conversion
+    void Reset();
+
+private:
+    static const size_t HISTORY = 8;  // How many conversions to look back
+    static const size_t ALWAYS_KEEP = 1024 * 1024;
+
+    std::unique_ptr<tinyxml2::XMLDocument> document;
+    std::unique_ptr<tinyxml2::XMLPrinter> printer;
+    size_t documentPeak = 0;  // Largest input the document has parsed
+    size_t recentUse[HISTORY] = {};
+    size_t conversions = 0;
+};
+
+inline tinyxml2::XMLDocument& ConversionBuffers::Document() {
+    if (!document) {
+        document.reset(new tinyxml2::XMLDocument());
+    }
+    return *document;
+}
+
+inline tinyxml2::XMLPrinter& ConversionBuffers::Printer() {
+    if (!printer) {
+        printer.reset(new tinyxml2::XMLPrinter());
+    }
+    return *printer;
+}
+
+inline void ConversionBuffers::Reset() {
+    size_t used = std::max(polishedText.length(), fixedXML.length());
+    recentUse[conversions++ % HISTORY] = used;
+    size_t keep = ALWAYS_KEEP;
+    for (size_t recent : recentUse) {
+        keep = std::max(keep, 2 * recent);
+    }
+
+    if (polishedText.capacity() > keep) {
+        std::string().swap(polishedText);
+    }
+    if (fixedXML.capacity() > keep) {
+        std::string().swap(fixedXML);
+    }
+    polishedText.clear();
+    fixedXML.clear();
+
+    // TinyXML-2 keeps its node pools until the document is destroyed, and
+    // the printer keeps its buffer, so trimming them means starting over.
+    documentPeak = std::max(documentPeak, used);
+    if (documentPeak > keep) {
+        document.reset();
+        printer.reset();
+        documentPeak = 0;
+    }
+    if (document) {
+        document->Clear();
+    }
+#if defined(TIXML2_MAJOR_VERSION) && TIXML2_MAJOR_VERSION >= 8
+    if (printer) {
+        printer->ClearBuffer();
+    }
+#else
+    // Before TinyXML-2 8, ClearBuffer() didn't forget that the printer had
+    // printed an element, so the next document would start with a blank
+    // line. Start with a new printer instead.
+    printer.reset();
+#endif
+}
+
+// Tell the user how a statement's balance check went
+inline void ReportBalanceCheck(const BalanceCheck& balance,
+    const std::string& account, ConversionDiagnostics& diagnostics) {
+    std::string& report = diagnostics.report;
+    switch (balance.result) {
+    case BalanceCheck::NO_LEDGERBAL:
+        break;
+    case BalanceCheck::UNREADABLE:
+        report += "Balance check for " + account + " skipped: the "
+            "<LEDGERBAL> or a <TRNAMT> could not be read.\r\n";
+        break;
+    case BalanceCheck::NO_OPENING_BALANCE:
+        report += "Balance check for " + account + ": " +
+            std::to_string(balance.transactions) + " transactions add up "
+            "to " + FormatOFXAmount(balance.transactionTotal) +
+            ", so with a ledger balance of " +
+            FormatOFXAmount(balance.ledgerBalance) + " the opening "
+            "balance was " +
+            FormatOFXAmount(balance.impliedOpeningBalance) + ". The file "
+            "has no opening balance to compare with.\r\n";
+        break;
+    case BalanceCheck::BALANCED:
+        report += "Balance check for " + account + ": opening balance " +
+            FormatOFXAmount(balance.openingBalance) + " plus " +
+            std::to_string(balance.transactions) + " transactions (" +
+            FormatOFXAmount(balance.transactionTotal) + ") matches the "
+            "ledger balance of " + FormatOFXAmount(balance.ledgerBalance) +
+            ".\r\n";
+        break;
+    case BalanceCheck::MISMATCH: {
+        std::string msg = "The transactions of " + account + " don't add "
+            "up. The opening balance of " +
+            FormatOFXAmount(balance.openingBalance) + " plus " +
+            std::to_string(balance.transactions) + " transactions (" +
+            FormatOFXAmount(balance.transactionTotal) + ") is " +
+            FormatOFXAmount(balance.openingBalance +
+                balance.transactionTotal) + ", but the ledger balance is " +
+            FormatOFXAmount(balance.ledgerBalance) + " (off by " +
+            FormatOFXAmount(balance.difference) + "). The bank may have "
+            "cut the file short, so some transactions could be missing.";
+        report += msg + "\r\n";
+        diagnostics.Add(ConversionMessage::MESSAGE_WARNING,
+            "FYI: Balances Don't Add Up", msg);
+        break;
+    }
+    }
+}
+
+// A statement that PassthroughVerifier checked, for the report
+struct PassthroughStatement {
+    std::string type;  // Message set, e.g. "BANKMSGSRSV1"
+    std::string accountId;
+    size_t transactions = 0;
+    BalanceCheck balance;
+};
+
+// Proves, in one pass over the text and without a DOM, that a file is
+// already what ConvertQFXToOFX() would make of it, apart from the headers,
+// the indenting and the line endings:
+// - every tag is closed, in the right order, under one <OFX>
+// - every <STMTTRN> has only STMTTRN_WHITELIST fields, in order and once
+//   each, and each has a value (<PAYEE> and <BANKACCTTO> may stand in for
+//   <NAME> and <CCACCTTO>, like PruneSTMTTRN() allows)
+// - there is nothing for the Config options to dedupe or rewrite
+// - every message set we prune has its <BANKTRANLIST>s where we look
+// It looks fields up with StmttrnWhitelistIndex() and checks values with the
+// same helpers as PruneSTMTTRN() and MoneyValidator, and MoneyValidator
+// still checks the copy, so the rules only live in one place.
+// Tags and entities are found 16 bytes at a time with SSE2. If it says no,
+// the file just goes the usual way, so it also says no to anything unusual:
+// comments, self-closing tags, attributes, entities other than the five XML
+// ones, mixed content and values with spaces around them or new lines in
+// them.
+class PassthroughVerifier {
+public:
+    explicit PassthroughVerifier(const ConversionOptions& options);
+
+    // text must start at <OFX>
+    bool Verify(const char* text, size_t length);
+
+    // Every statement whose <BANKTRANLIST> PruneSTMTTRN() would get
+    const std::vector<PassthroughStatement>& Statements() const {
+        return statements;
+    }
+
+private:
+    static const size_t NONE = SIZE_MAX;
+    static const size_t MAX_FIELDS = 16;
+
+    struct OpenTag {
+        const char* name;
+        size_t length;
+        bool hasChildren;
+    };
+    // Some text between two tags
+    struct Text {
+        const char* text;
+        size_t length;
+    };
+    // What we need from the <STMTRS> or <CCSTMTRS> we are in, if we prune it
+    struct Statement {
+        PassthroughStatement result;
+        size_t banktranlists = 0;
+        long long total = 0;
+        size_t unreadAmounts = 0;
+        // How many <BANKACCTFROM>s and <CCACCTFROM>s so far, and the text of
+        // the first <ACCTID> in the first of each
+        size_t acctfroms[2] = {};
+        bool acctidSeen[2] = {};
+        std::string acctid[2];
+        // How many <LEDGERBAL>s so far, and the first <BALAMT> in the first
+        size_t ledgerbals = 0;
+        bool balamtSeen = false;
+        Text balamt = {};
+        // How many <BALLIST>s so far, and the first <NAME> and <VALUE> of
+        // the <BAL> we are in, in the first one
+        size_t ballists = 0;
+        Text balName = {};
+        Text balValue = {};
+        bool hasOpeningBalance = false;
+        long long openingBalance = 0;
+    };
+
+    bool Open(const char* name, size_t length);
+    bool Close(const char* name, size_t length, Text text);
+    bool OpenField(const char* name, size_t length);
+    bool FinishSTMTTRN();
+    void CloseInStatement(const OpenTag& tag, Text text);
+    bool OnPath(size_t depth, const char* name, size_t length) const;
+    bool FITIDsAreUnique();
+    bool HasField(int index) const {
+        return (seenFields & (1u << index)) != 0;
+    }
+
+    const ConversionOptions& options;
+    // Whitelist indexes of the fields we check
+    int dtpostedField, dtuserField, trnamtField, fitidField, nameField,
+        memoField;
+    unsigned requiredFields = 0;  // A bit per STMTTRN_REQUIRED field
+
+    std::vector<OpenTag> stack;
+    bool rootClosed = false;
+    // Message sets under <OFX>, a bit per TYPE_TO_BANKTRANLIST_MAP entry,
+    // and how many <BANKTRANLIST>s each has
+    unsigned messageSets = 0;
+    bool hasInvestments = false;
+    std::vector<size_t> banktranlists;
+    size_t typeIndex = NONE;  // The message set we are in, if we prune it
+
+    Statement statement;
+    bool inStatement = false;
+
+    // The <STMTTRN> we are in, if any
+    size_t stmttrnDepth = NONE;  // Its place in the stack
+    bool stmttrnCounts = false;  // Is it in a <BANKTRANLIST> we prune?
+    int lastField = -1;  // Whitelist index of the last field
+    bool nestingAllowed = false;  // <PAYEE> and <BANKACCTTO> are kept whole
+    Text fields[MAX_FIELDS];  // By whitelist index
+    unsigned seenFields = 0;  // A bit per whitelist index
+    // Hashes of the FITIDs in this <BANKTRANLIST>. Sorting them once is a
+    // lot quicker than a hash set.
+    std::vector<uint64_t> fitids;
+
+    std::vector<PassthroughStatement> statements;
+};
+
+inline PassthroughVerifier::PassthroughVerifier(
+    const ConversionOptions& options)
+    : options(options) {
+    assert(STMTTRN_WHITELIST.size() <= MAX_FIELDS);
+    auto index = [](const char* field) {
+        return StmttrnWhitelistIndex(field, strlen(field));
+    };
+    for (const char* required : STMTTRN_REQUIRED) {
+        requiredFields |= 1u << index(required);
+    }
+    dtpostedField = index("DTPOSTED");
+    dtuserField = index("DTUSER");
+    trnamtField = index("TRNAMT");
+    fitidField = index("FITID");
+    nameField = index("NAME");
+    memoField = index("MEMO");
+}
+
+inline bool NameIs(const char* name, size_t length, const char* expected) {
+    return strncmp(name, expected, length) == 0 && expected[length] == '\0';
+}
+
+// The next '<' or '&' from p, or end
+inline const char* FindTagOrEntity(const char* p, const char* end) {
+#ifdef CONVERTTOOFX_SSE2
+    const __m128i tags = _mm_set1_epi8('<');
+    const __m128i entities = _mm_set1_epi8('&');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(chunk, tags), _mm_cmpeq_epi8(chunk, entities)));
+        if (mask != 0) {
+            return p + LowestSetBit(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '<' && *p != '&') {
+        ++p;
+    }
+    return p;
+}
+
+inline bool PassthroughVerifier::Verify(const char* text, size_t length) {
+    const char* const end = text + length;
+    banktranlists.assign(TYPE_TO_BANKTRANLIST_MAP.size(), 0);
+    const char* textStart = text;  // Text since the last tag
+    const char* p = text;
+    while ((p = FindTagOrEntity(p, end)) != end) {
+        if (*p == '&') {
+            const char* const ENTITIES[] = { "&amp;", "&lt;", "&gt;",
+                "&quot;", "&apos;" };
+            size_t entityLength = 0;
+            for (const char* entity : ENTITIES) {
+                size_t n = strlen(entity);
+                if (static_cast<size_t>(end - p) >= n &&
+                    memcmp(p, entity, n) == 0) {
+                    entityLength = n;
+                    break;
+                }
+            }
+            if (entityLength == 0) {
+                return false;
+            }
+            p += entityLength;
+            continue;
+        }
+        const char* closeBracket = static_cast<const char*>(
+            memchr(p, '>', end - p));
+        if (!closeBracket || closeBracket == p + 1) {
+            return false;
+        }
+        Text between = { textStart, static_cast<size_t>(p - textStart) };
+        const char* name = p + 1;
+        size_t nameLength = closeBracket - name;
+        if (name[0] == '/') {
+            if (!Close(name + 1, nameLength - 1, between)) {
+                return false;
+            }
+        }
+        else if (!IsAllSpace(between.text, between.length) ||
+            !Open(name, nameLength)) {
+            return false;
+        }
+        p = textStart = closeBracket + 1;
+    }
+    if (!rootClosed || !IsAllSpace(textStart, end - textStart) ||
+        (messageSets == 0 && !hasInvestments) || !FITIDsAreUnique()) {
+        return false;
+    }
+    // A message set without <BANKTRANLIST>s gets a message the usual way
+    for (size_t i = 0; i < banktranlists.size(); ++i) {
+        if ((messageSets & (1u << i)) && banktranlists[i] == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A hash collision only means we say no to a file we could have passed
+// through
+inline bool PassthroughVerifier::FITIDsAreUnique() {
+    std::sort(fitids.begin(), fitids.end());
+    return std::adjacent_find(fitids.begin(), fitids.end()) == fitids.end();
+}
+
+// Would the stack down to depth, plus name, be on the path to the
+// <BANKTRANLIST> of the message set we are in?
+inline bool PassthroughVerifier::OnPath(size_t depth, const char* name,
+    size_t length) const {
+    if (typeIndex == NONE) {
+        return false;
+    }
+    auto mapping = TYPE_TO_BANKTRANLIST_MAP.begin();
+    std::advance(mapping, typeIndex);
+    const std::vector<std::string>& path = mapping->second;
+    if (depth >= path.size() || !NameIs(name, length, path[depth].c_str())) {
+        return false;
+    }
+    for (size_t i = 0; i < depth; ++i) {
+        if (!NameIs(stack[i].name, stack[i].length, path[i].c_str())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool PassthroughVerifier::Open(const char* name, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        char c = name[i];
+        if (isspace(static_cast<unsigned char>(c)) || c == '/' || c == '!' ||
+            c == '?' || c == '=' || c == '"' || c == '<') {
+            return false;  // Attributes, comments and so on
+        }
+    }
+    const size_t depth = stack.size();
+    if (depth == 0 && (rootClosed || !NameIs(name, length, "OFX"))) {
+        return false;
+    }
+    if (depth > 0) {
+        stack.back().hasChildren = true;
+    }
+    const size_t pathLength = TYPE_TO_BANKTRANLIST_MAP.begin()->second.size();
+
+    if (stmttrnDepth != NONE) {
+        if (depth == stmttrnDepth + 1) {
+            if (!OpenField(name, length)) {
+                return false;
+            }
+        }
+        else if (!nestingAllowed || NameIs(name, length, "STMTTRN") ||
+            NameIs(name, length, "BANKTRANLIST")) {
+            return false;  // A field with fields, or something tricky
+        }
+    }
+    else if (NameIs(name, length, "STMTTRN")) {
+        stmttrnDepth = depth;
+        stmttrnCounts = inStatement && depth == pathLength &&
+            OnPath(depth - 1, stack[depth - 1].name, stack[depth - 1].length);
+        lastField = -1;
+        seenFields = 0;
+        nestingAllowed = false;
+    }
+    else if (NameIs(name, length, "BANKTRANLIST")) {
+        if (!FITIDsAreUnique()) {
+            return false;
+        }
+        fitids.clear();
+        if (inStatement && depth + 1 == pathLength &&
+            OnPath(depth, name, length)) {
+            // PruneSTMTTRN() would get each one with the same balance
+            if (++statement.banktranlists > 1) {
+                return false;
+            }
+            ++banktranlists[typeIndex];
+        }
+    }
+
+    if (depth == 1) {
+        // A message set. Is it one we prune?
+        typeIndex = NONE;
+        size_t i = 0;
+        for (const auto& mapping : TYPE_TO_BANKTRANLIST_MAP) {
+            if (NameIs(name, length, mapping.first.c_str())) {
+                typeIndex = i;
+                messageSets |= 1u << i;
+            }
+            ++i;
+        }
+        hasInvestments = hasInvestments ||
+            NameIs(name, length, "INVSTMTMSGSRSV1");
+    }
+    else if (depth + 2 == pathLength && OnPath(depth, name, length)) {
+        // A <STMTRS> or <CCSTMTRS>, which may have a <BANKTRANLIST> to prune
+        statement = Statement();
+        auto mapping = TYPE_TO_BANKTRANLIST_MAP.begin();
+        std::advance(mapping, typeIndex);
+        statement.result.type = mapping->first;
+        inStatement = true;
+    }
+    else if (inStatement && depth + 1 == pathLength) {
+        const char* const FROM[] = { "BANKACCTFROM", "CCACCTFROM" };
+        for (int i = 0; i < 2; ++i) {
+            statement.acctfroms[i] += NameIs(name, length, FROM[i]);
+        }
+        statement.ledgerbals += NameIs(name, length, "LEDGERBAL");
+        statement.ballists += NameIs(name, length, "BALLIST");
+    }
+    else if (inStatement && depth == pathLength &&
+        statement.ballists == 1 &&
+        NameIs(stack[depth - 1].name, stack[depth - 1].length, "BALLIST")) {
+        // A <BAL>, or something else in the first <BALLIST>
+        statement.balName = Text();
+        statement.balValue = Text();
+    }
+
+    OpenTag tag = { name, length, false };
+    stack.push_back(tag);
+    return true;
+}
+
+// A direct child of a <STMTTRN>. Like MoneyValidator, <PAYEE> counts as
+// <NAME> and <BANKACCTTO> as <CCACCTTO>, so having both is a repeat.
+inline bool PassthroughVerifier::OpenField(const char* name, size_t length) {
+    const int index = StmttrnWhitelistIndex(name, length);
+    // Only a field after the last one can be in order
+    if (index <= lastField) {
+        return false;  // Not allowed, repeated or out of order
+    }
+    // The alternatives are kept whole by PruneSTMTTRN()
+    nestingAllowed = !NameIs(name, length,
+        StmttrnWhitelistFields()[index].name);
+    lastField = index;
+    seenFields |= 1u << index;
+    fields[index] = Text();
+    return true;
+}
+
+inline bool PassthroughVerifier::Close(const char* name, size_t length,
+    Text text) {
+    if (stack.empty() || stack.back().length != length ||
+        memcmp(stack.back().name, name, length) != 0) {
+        return false;
+    }
+    OpenTag tag = stack.back();
+    stack.pop_back();
+    const size_t depth = stack.size();
+
+    // Only a value on its own, without spaces around it, is the same to
+    // TinyXML-2, the polishing and us
+    if (!IsAllSpace(text.text, text.length)) {
+        if (tag.hasChildren ||
+            isspace(static_cast<unsigned char>(text.text[0])) ||
+            isspace(static_cast<unsigned char>(text.text[text.length - 1])) ||
+            memchr(text.text, '\n', text.length) ||
+            memchr(text.text, '\r', text.length)) {
+            return false;
+        }
+    }
+    else {
+        text.length = 0;
+    }
+
+    if (stmttrnDepth != NONE && depth == stmttrnDepth + 1 &&
+        !nestingAllowed) {
+        // PruneSTMTTRN() drops fields without a value
+        if (text.length == 0) {
+            return false;
+        }
+        fields[lastField] = text;
+    }
+    else if (depth == stmttrnDepth && !FinishSTMTTRN()) {
+        return false;
+    }
+    if (inStatement) {
+        CloseInStatement(tag, text);
+    }
+    rootClosed = depth == 0;
+    return true;
+}
+
+// Check a <STMTTRN> the way PruneSTMTTRN() and MoneyValidator would
+inline bool PassthroughVerifier::FinishSTMTTRN() {
+    stmttrnDepth = NONE;
+    if ((seenFields & requiredFields) != requiredFields) {
+        return false;
+    }
+    const Text& amount = fields[trnamtField];
+    if (!IsOFXAmount(std::string(amount.text, amount.length))) {
+        return false;
+    }
+    long long minorUnits;
+    bool amountRead = ParseOFXAmount(amount.text, amount.length, minorUnits);
+    if (amountRead && options.normalizeAmountsAndDates &&
+        FormatOFXAmount(minorUnits).compare(0, std::string::npos,
+            amount.text, amount.length) != 0) {
+        return false;
+    }
+    const int DATES[] = { dtpostedField, dtuserField };
+    for (int date : DATES) {
+        long long epochSeconds;
+        size_t zoneStart;
+        if (!HasField(date)) {
+            continue;
+        }
+        const Text& text = fields[date];
+        if (!ParseOFXDateTime(text.text, text.length, epochSeconds,
+            &zoneStart)) {
+            return false;
+        }
+        if (options.normalizeAmountsAndDates &&
+            FormatOFXDateTime(epochSeconds, std::string(text.text +
+                zoneStart, text.length - zoneStart)).compare(0,
+                std::string::npos, text.text, text.length) != 0) {
+            return false;
+        }
+    }
+    const Text& fitid = fields[fitidField];
+    fitids.push_back(HashXMLText(FNV_OFFSET_BASIS, fitid.text, fitid.length));
+    // A <PAYEE> counts as <NAME> too, but PruneSTMTTRN() doesn't compare
+    // it, so its text is left empty.
+    const Text& name = fields[nameField];
+    const Text& memo = fields[memoField];
+    // The rules see decoded text, so anything with an entity in it is left
+    // to PruneSTMTTRN() to be sure
+    if (options.payeeRules) {
+        const int FIELDS[] = { nameField, memoField };
+        std::string cleaned;
+        for (int field : FIELDS) {
+            const Text& text = fields[field];
+            if (HasField(field) && (memchr(text.text, '&', text.length) ||
+                options.payeeRules->Apply(text.text, text.length,
+                    cleaned))) {
+                return false;
+            }
+        }
+    }
+    if (options.dedupeMemoField && HasField(nameField) &&
+        HasField(memoField) && name.length > 0 &&
+        HashXMLText(FNV_OFFSET_BASIS, name.text, name.length) ==
+        HashXMLText(FNV_OFFSET_BASIS, memo.text, memo.length)) {
+        return false;
+    }
+
+    if (stmttrnCounts) {
+        ++statement.result.transactions;
+        if (amountRead) {
+            statement.total += minorUnits;
+        }
+        else {
+            ++statement.unreadAmounts;
+        }
+    }
+    return true;
+}
+
+// Collect what CheckStatementBalance() and FindAccountId() look at. Like
+// them, we only look at the first of each element.
+inline void PassthroughVerifier::CloseInStatement(const OpenTag& tag,
+    Text text) {
+    const size_t depth = stack.size();  // Where tag was
+    const size_t pathLength = TYPE_TO_BANKTRANLIST_MAP.begin()->second.size();
+    auto is = [&tag](const char* name) {
+        return NameIs(tag.name, tag.length, name);
+    };
+    auto parentIs = [this, depth](const char* name) {
+        return NameIs(stack[depth - 1].name, stack[depth - 1].length, name);
+    };
+    Statement& s = statement;
+    if (depth == pathLength) {
+        // In an element of the statement
+        const char* const FROM[] = { "BANKACCTFROM", "CCACCTFROM" };
+        for (int i = 0; i < 2; ++i) {
+            if (s.acctfroms[i] == 1 && !s.acctidSeen[i] && is("ACCTID") &&
+                parentIs(FROM[i])) {
+                s.acctidSeen[i] = true;
+                s.acctid[i].assign(text.text, text.length);
+            }
+        }
+        if (s.ledgerbals == 1 && !s.balamtSeen && is("BALAMT") &&
+            parentIs("LEDGERBAL")) {
+            s.balamtSeen = true;
+            s.balamt = text;
+        }
+        if (s.ballists == 1 && !s.hasOpeningBalance && is("BAL") &&
+            parentIs("BALLIST") && s.balName.length > 0 &&
+            s.balValue.length > 0) {
+            s.hasOpeningBalance = IsOpeningBalanceName(s.balName.text,
+                s.balName.length) && ParseOFXAmount(s.balValue.text,
+                    s.balValue.length, s.openingBalance);
+        }
+    }
+    else if (depth == pathLength + 1 && s.ballists == 1 && parentIs("BAL") &&
+        NameIs(stack[depth - 2].name, stack[depth - 2].length, "BALLIST")) {
+        // In a <BAL> of the first <BALLIST>. Only the first <NAME> and
+        // <VALUE> count, even if they are empty.
+        if (is("NAME") && !s.balName.text) {
+            s.balName = text;
+        }
+        if (is("VALUE") && !s.balValue.text) {
+            s.balValue = text;
+        }
+    }
+    else if (depth + 2 == pathLength) {
+        // The statement is done
+        inStatement = false;
+        if (s.banktranlists == 0) {
+            return;
+        }
+        PassthroughStatement& result = s.result;
+        result.accountId = !s.acctid[0].empty() ? s.acctid[0] : s.acctid[1];
+        if (s.balamtSeen) {
+            result.balance.transactions = result.transactions;
+            result.balance.transactionTotal = s.total;
+            long long ledgerBalance;
+            bool readable = s.balamt.length > 0 && ParseOFXAmount(
+                s.balamt.text, s.balamt.length, ledgerBalance) &&
+                s.unreadAmounts == 0;
+            CompareWithLedgerBalance(result.balance,
+                readable ? &ledgerBalance : NULL,
+                s.hasOpeningBalance ? &s.openingBalance : NULL);
+        }
+        statements.push_back(result);
+    }
+}
+
+// If the input is already ready for Money, copy it to output behind our
+// headers, with Windows new lines, and report on it like a conversion
+// would. False if it isn't, and then output and diagnostics are untouched.
+inline bool PassThroughReadyOFX(const std::string& s, size_t ofxStart,
+    const ConversionOptions& options, ConversionDiagnostics& diagnostics,
+    std::string& output) {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    const char* text = s.data() + ofxStart;
+    const size_t length = s.length() - ofxStart;
+    PassthroughVerifier verifier(options);
+    if (!verifier.Verify(text, length)) {
+        return false;
+    }
+
+    size_t newLines = 0;
+    for (const char* p = text; (p = static_cast<const char*>(
+        memchr(p, '\n', text + length - p))) != NULL; ++p) {
+        newLines += p == text || p[-1] != '\r';
+    }
+    output.clear();
+    output.reserve(XML_HEADER.length() + XML_OFX_HEADER.length() + 4 +
+        length + newLines);
+    output.append(XML_HEADER).append("\r\n");
+    output.append(XML_OFX_HEADER).append("\r\n");
+    const char* copied = text;
+    for (const char* p = text; (p = static_cast<const char*>(
+        memchr(p, '\n', text + length - p))) != NULL; ++p) {
+        if (p == text || p[-1] != '\r') {
+            output.append(copied, p).append("\r");
+            copied = p;
+        }
+    }
+    output.append(copied, text + length);
+
+    // In the order ConvertQFXToOFX() would report them
+    std::string& report = diagnostics.report;
+    const char* const TYPES[] = { "CREDITCARDMSGSRSV1", "BANKMSGSRSV1" };
+    for (const char* type : TYPES) {
+        for (const PassthroughStatement& statement : verifier.Statements()) {
+            if (statement.type != type) {
+                continue;
+            }
+            std::string account = statement.type + " account " +
+                statement.accountId;
+            report += account + ": " +
+                std::to_string(statement.transactions) +
+                " transactions, already as Money wants them.\r\n";
+            ReportBalanceCheck(statement.balance, account, diagnostics);
+        }
+    }
+    char milliseconds[32];
+    snprintf(milliseconds, sizeof(milliseconds), "%.2f",
+        std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count());
+    report += "The input needed no changes, so it was copied as it is in " +
+        std::string(milliseconds) + " ms.\r\n";
+    return true;
+}
+
+// Warn about anything in output that Money may reject (see MoneyValidator)
+inline void ReportMoneyProblems(const std::string& output,
+    ConversionDiagnostics& diagnostics) {
+    MoneyValidator validator;
+    validator.Feed(output);
+    validator.Finish();
+    if (validator.DiagnosticCount() > 0) {
+        std::string msg = "The converted OFX still has problems that may "
+            "make Money reject it. You can fix them by hand in the right "
+            "window pane.\n\n" +
+            FormatValidationDiagnostics(validator.Diagnostics(),
+                validator.DiagnosticCount(), 15);
+        diagnostics.Add(ConversionMessage::MESSAGE_WARNING,
+            "FYI: Possible Problems For Money", msg);
+    }
+}
+
+// Tell the user if the conversion didn't change anything, and if asked,
+// say what it changed, transaction by transaction
+inline void ReportOnOutput(const std::string& s, const char* compared,
+    size_t comparedLength, ConversionContext& context,
+    AllocationStageScope& stage, const std::string& output) {
+    if (s == output) {
+        context.diagnostics.Add(ConversionMessage::MESSAGE_INFO, "FYI",
+            "FYI: Nothing changed after attempting to convert!");
+    }
+    if (context.differences) {
+        stage.Enter(STAGE_OTHER);
+        StructuralDiff diff;
+        diff.Compare(compared, comparedLength, output.data(),
+            output.length(), context.differences);
+        context.diagnostics.report += diff.Summary();
+    }
+}
+
+// Append the lines of s from lineStart on to polishedText, the way
+// ConvertQFXToOFX() polishes them. Templated on the policy like
+// PruneTransactions(), since this runs for every line of the input.
+template <class Policy>
+void PolishLines(const std::string& s, size_t lineStart,
+    const ConversionOptions& options, std::string& polishedText) {
+    while (lineStart < s.length()) {
+        size_t lineEnd = s.find('\n', lineStart);
+        if (lineEnd == std::string::npos) {
+            lineEnd = s.length();
+        }
+        size_t first = lineStart;
+        size_t last = lineEnd;  // One past the end
+        lineStart = lineEnd + 1;
+        if (Policy::TrimLines(options)) {
+            // Some banks include a ton of space and new lines.
+            // Let's trim the excess space on both sides of the line.
+            while (first < last &&
+                std::isspace(static_cast<unsigned char>(s[first]))) {
+                ++first;
+            }
+            while (last > first + 1 &&
+                std::isspace(static_cast<unsigned char>(s[last - 1]))) {
+                --last;
+            }
+        }
+
+        polishedText.append(s, first, last - first);
+        // If the line ends with ">", don't add a new line.
+        if (!(last - first > 1 && s[last - 1] == '>')) {
+            //New-line just helps me debug later. XML Parser does all
+            //the nice formatting.
+            polishedText += '\n';
+        }
+    }
+}
+
+// Convert QFX XML to a MS Money-acceptable OFX format. On success, output
+// is the OFX with Windows new lines. On failure, output is the XML as far
+// as we got, for debugging. Either way, see context.diagnostics for what
+// happened. Intermediate results are kept in buffers, which the caller can
+// reuse for the next conversion on the same thread.
+inline bool ConvertQFXToOFX(const std::string& s, ConversionContext& context,
+    ConversionBuffers& buffers, std::string& output) {
+    const ConversionOptions& options = context.options;
+    ConversionDiagnostics& diagnostics = context.diagnostics;
+
+    buffers.Reset();
+    AllocationStatsScope measuring(context.allocations);
+    if (context.allocations) {
+        context.allocations->CountConversion();
+    }
+    AllocationStageScope stage(STAGE_POLISH, true);
+
+    // Files we converted before, or that the bank got right, don't need the
+    // DOM at all. Sorting always does, so it isn't worth checking for.
+    const size_t ofxStart = s.find("<OFX>");
+    if (ofxStart != std::string::npos &&
+        !options.sortAndDedupeTransactions) {
+        stage.Enter(STAGE_PASSTHROUGH);
+        if (PassThroughReadyOFX(s, ofxStart, options, diagnostics, output)) {
+            ReportOnOutput(s, s.data() + ofxStart, s.length() - ofxStart,
+                context, stage, output);
+            // PassthroughVerifier shouldn't have let through anything this
+            // finds, but it's one quick pass to be sure
+            stage.Enter(STAGE_VALIDATE);
+            ReportMoneyProblems(output, diagnostics);
+            return true;
+        }
+        stage.Enter(STAGE_POLISH);
+    }
+
+    // Polish the input text before converting into OFX-happy XML.
+    // Add OFX XML-style headers. Version may be wrong, but Money doesn't care.
+    std::string& polishedText = buffers.polishedText;
+    polishedText.append(XML_HEADER).append("\n");
+    polishedText.append(XML_OFX_HEADER).append("\n");
+
+    // Remove anything before <OFX> - it's junk to Money or headers that can
+    // be replaced. Some banks, i.e. Wells Fargo, jam everything into one line.
+    // std::regex's search and match have memory issues with long lines, so
+    // that's why this logic is very simple - to avoid using that library.
+    // We go through the lines in place, without copying each one out.
+    size_t lineStart = ofxStart;
+    if (lineStart != std::string::npos) {
+        // The rest of the line starting at <OFX> goes in as is.
+        size_t lineEnd = s.find('\n', lineStart);
+        if (lineEnd == std::string::npos) {
+            lineEnd = s.length();
+        }
+        polishedText.append(s, lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+    }
+    // Now append the rest
+    if (options.trimLines) {
+        PolishLines<PolishPolicy<true>>(s, lineStart, options, polishedText);
+    }
+    else {
+        PolishLines<PolishPolicy<false>>(s, lineStart, options,
+            polishedText);
+    }
+
+    // Convert text to an XML object
+    stage.Enter(STAGE_PARSE);
+    tinyxml2::XMLDocument& doc = buffers.Document();
+    const char* inxml = polishedText.c_str();
+    std::string& fixedXML = buffers.fixedXML;  // Only if the XML needs fixing
+    doc.Parse(inxml, polishedText.length());
+
+    // Check if the elements are balanced. TinyXML is not always 100% correct
+    // (sometimes give success / code 0 for broken XML. So we also check again.
+    bool unbalanced = doc.ErrorID() == 14;
+    if (doc.ErrorID() == 0) {
+        stage.Enter(STAGE_BALANCE_CHECK);
+        unbalanced = !isXMLBalanced(polishedText);
+    }
+    if (unbalanced) {
+        // Mis-matched brackets. Let's attempt to fix it, 
+        // but inform the user first.
+        std::string msg;
+        if (doc.ErrorID() == 14) {
+            msg = "Input XML does not have matching brackets according to the "
+                "XML Parser. Will attempt to fix it!\n\n"
+                "XML Parser Error Message: ";
+            msg += doc.ErrorStr();
+        }
+        else {
+            msg = "Input XML appears to be unbalanced. Will try to fix it!";
+        }
+        diagnostics.Add(ConversionMessage::MESSAGE_WARNING,
+            "FYI: XML is unbalanced", msg);
+        stage.Enter(STAGE_FIX_XML);
+        fixedXML = FixXMLInParallel(polishedText);
+        inxml = fixedXML.c_str();
+        stage.Enter(STAGE_PARSE);
+        doc.Parse(inxml);
+        if (doc.ErrorID() != 0) {
+            std::string msg = "Could not fix the XML. This XML either needs "
+                "to be fixed at the source, or this program needs extra "
+                "modifications to handle the XML.\n\nParser error message: ";
+            msg += std::to_string(doc.ErrorID()) + ":\n";
+            msg += doc.ErrorStr();
+            diagnostics.Add(ConversionMessage::MESSAGE_ERROR,
+                "Error Parsing XML Again", msg);
+            output = inxml;
+            return false;
+        }
+    }
+    else if (doc.ErrorID() != 0) {
+        std::string msg =
+            "Parser Error when processing XML. Cannot continue: ";
+        msg += std::to_string(doc.ErrorID()) + ":\n";
+        msg += doc.ErrorStr();
+        diagnostics.Add(ConversionMessage::MESSAGE_ERROR,
+            "Error Parsing XML", msg);
+        output = inxml;
+        return false;
+    }
+
+    // Determine if this is a CreditCard statement or a Bank statement.
+    stage.Enter(STAGE_PRUNE);
+    tinyxml2::XMLElement* ofxRoot = doc.FirstChildElement("OFX");
+    if (!ofxRoot) {
+        diagnostics.Add(ConversionMessage::MESSAGE_ERROR, "Error Parsing XML",
+            "OFX is missing <OFX> element at the root. Cannot parse.");
+        output = inxml;
+        return false;
+    }
+    tinyxml2::XMLHandle docHandle(&doc);
+
+    // Determine what "types" this statement contains. Some include both
+    // Credit Card and Bank statements, or have both with 1 empty. It's crazy.
+    // Currently, only CreditCard and Bank statements are supported,
+    // since they are the only 2 types which I see have a BANKTRANLIST child.
+    // There are other types, but I couldn't see if they have BANKTRANLIST
+    // children. For a list of other types, see: 
+    // https://schemas.liquid-technologies.com/OFX/2.1.1/?page=ofxresponse.html
+    std::vector<std::string> statementTypes = { };
+    if (docHandle.FirstChildElement("OFX").
+        FirstChildElement("CREDITCARDMSGSRSV1").ToElement()) {
+        // We have a Credit Card Statement
+        statementTypes.push_back("CREDITCARDMSGSRSV1");
+    }
+    if (docHandle.FirstChildElement("OFX").
+        FirstChildElement("BANKMSGSRSV1").ToElement()) {
+        // We have a Bank Statement
+        statementTypes.push_back("BANKMSGSRSV1");
+    }
+    if (docHandle.FirstChildElement("OFX").
+        FirstChildElement("INVSTMTMSGSRSV1").ToElement()) {
+        // We have a Bank Statement
+        statementTypes.push_back("INVSTMTMSGSRSV1");
+    }
+
+    if (statementTypes.size() == 0) {
+        // Error: Found zero statements
+        diagnostics.Add(ConversionMessage::MESSAGE_ERROR, "Error Parsing XML",
+            "OFX is missing valid elements under the <OFX> root (like "
+            "<CREDITCARDMSGSRSV1> or <BANKMSGSRSV1>). Cannot parse.");
+        output = inxml;
+        return false;
+    }
+
+    // Using the Statement Type as a key name, we lookup its expected 
+    // <BANKTRANLIST> path from a map data structure. Every statement
+    // response along that path gets pruned, not just the first one.
+    std::vector<std::pair<std::string, tinyxml2::XMLElement*>> found;
+    for (std::string& type : statementTypes) {
+        if (type == "INVSTMTMSGSRSV1") {
+            // Nothing to do yet for this type. Just pretty print the XML
+            // and add headers.
+            continue;
+        }
+        std::map<std::string, std::vector<std::string>>::const_iterator
+            mapping = TYPE_TO_BANKTRANLIST_MAP.find(type);
+        if (mapping == TYPE_TO_BANKTRANLIST_MAP.end()) {
+            diagnostics.Add(ConversionMessage::MESSAGE_ERROR, "Fatal Error",
+                "Cannot find TYPE_TO_BANKTRANLIST_MAP mapping for " + type +
+                "; Code error! Skipping it!");
+            continue;
+        }
+        const std::vector<std::string>& pathToBanktranlist = mapping->second;
+
+        // Now that we have an expected <BANKTRANLIST> path, see if any
+        // items exist at that path.
+        std::vector<tinyxml2::XMLElement*> banktranlists;
+        size_t deepestMatch = 0;
+        FindBANKTRANLISTs(&doc, pathToBanktranlist, 0, banktranlists,
+            deepestMatch);
+        if (banktranlists.size() == 0) {
+            // Possible Problem: Could not find element in expected path...
+            // Let user know right now and stop processing for this type.
+            std::string fullPath;
+            for (size_t j = 0; j < pathToBanktranlist.size(); ++j) {
+                fullPath += "<" + pathToBanktranlist[j] + ">";
+            }
+            std::string errorMsg = "Not modifiying " + type + " because "
+                "we encountered problems locating this element: " +
+                pathToBanktranlist[deepestMatch] + " in the path " +
+                fullPath + ". We were expecting it to be present. This "
+                "might be a problem (or not, if it was purposely left out): "
+                "inspect the output to make sure you are okay with results.";
+            diagnostics.Add(ConversionMessage::MESSAGE_INFO,
+                "FYI: Possible Error", errorMsg);
+            continue;
+        }
+        for (tinyxml2::XMLElement* banktranlist : banktranlists) {
+            found.push_back(std::make_pair(type, banktranlist));
+        }
+    }
+
+    // We got the <BANKTRANLIST> elements. Now, prune unnecessary elements,
+    // all statements at once.
+    std::chrono::steady_clock::time_point pruneStart =
+        std::chrono::steady_clock::now();
+    std::vector<StatementToPrune> statements(found.size());
+    for (size_t i = 0; i < found.size(); ++i) {
+        statements[i].type = found[i].first;
+        statements[i].banktranlist = found[i].second;
+        statements[i].accountId =
+            FindAccountId(found[i].second->Parent()->ToElement());
+        statements[i].graveyard = doc.NewElement("GRAVEYARD");
+        if (options.sortAndDedupeTransactions) {
+            statements[i].store.reset(new TransactionStore);
+        }
+    }
+    PruneStatementsInParallel(statements, options);
+    std::string& report = diagnostics.report;
+    for (StatementToPrune& statement : statements) {
+        doc.DeleteNode(statement.graveyard);
+        char milliseconds[32];
+        snprintf(milliseconds, sizeof(milliseconds), "%.2f",
+            statement.milliseconds);
+        BalanceCheck balance = CheckStatementBalance(statement);
+        report += statement.type + " account " + statement.accountId +
+            ": " + std::to_string(balance.transactions) +
+            " transactions in " + milliseconds + " ms.";
+        if (statement.store) {
+            const StringPool& pool = statement.store->Pool();
+            report += " Text fields: " +
+                std::to_string(pool.References()) + " values, " +
+                std::to_string(pool.Count()) + " distinct, stored in " +
+                std::to_string(pool.BytesStored() / 1024) + " KB (about " +
+                std::to_string(pool.BytesAsSeparateStrings() / 1024) +
+                " KB as separate strings).";
+        }
+        report += "\r\n";
+        ReportBalanceCheck(balance, statement.type + " account " +
+            statement.accountId, diagnostics);
+
+        if (statement.store) {
+            TransactionStore& store = *statement.store;
+            if (store.Rejected() > 0) {
+                std::string msg = "Not sorting the transactions of " +
+                    statement.type + " account " + statement.accountId +
+                    ": " + std::to_string(store.Rejected()) + " of them "
+                    "have a type, date or amount that could not be read. "
+                    "They were left in their original order.";
+                diagnostics.Add(ConversionMessage::MESSAGE_INFO,
+                    "FYI: Did Not Sort", msg);
+            }
+            else if (!WriteSTMTTRNsFromStore(store,
+                store.Dedupe(store.SortedByPosted()),
+                statement.banktranlist)) {
+                std::string msg = "Could not sort the transactions of " +
+                    statement.type + " account " + statement.accountId +
+                    ": the sorted transactions could not be read back in. "
+                    "They were left in their original order.";
+                diagnostics.Add(ConversionMessage::MESSAGE_WARNING,
+                    "FYI: Did Not Sort", msg);
+            }
+        }
+    }
+    char totalMilliseconds[32];
+    snprintf(totalMilliseconds, sizeof(totalMilliseconds), "%.2f",
+        std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - pruneStart).count());
+    report += std::to_string(statements.size()) + " statements pruned in " +
+        totalMilliseconds + " ms.\r\n";
+
+    // Pretty Print XML
+    stage.Enter(STAGE_PRINT);
+    tinyxml2::XMLPrinter& printer = buffers.Printer();
+    doc.Print(&printer);
+    const char* prettyXml = printer.CStr();
+
+    // We want the editor to display text nicely. In Windows land,
+    // we need to add carriage returns before the newlines...
+    stage.Enter(STAGE_CRLF);
+    output.clear();
+    const char* p = &prettyXml[0];
+    while (*p != '\0') {
+        if (*p == '\n') {
+            output += "\r\n";
+        }
+        else {
+            output += *p;
+        }
+        ++p;
+    }
+
+    // Compare with the text FixXML() got, so we can tell which tags it had
+    // to close.
+    ReportOnOutput(s, polishedText.data(), polishedText.length(), context,
+        stage, output);
+
+    // Catch anything Money will reject before the user tries to import.
+    stage.Enter(STAGE_VALIDATE);
+    ReportMoneyProblems(output, diagnostics);
+    return true;
+}
+
+// ConvertQFXToOFX() with buffers that are thrown away afterwards
+inline bool ConvertQFXToOFX(const std::string& s, ConversionContext& context,
+    std::string& output) {
+    ConversionBuffers buffers;
+    return ConvertQFXToOFX(s, context, buffers, output);
+}
+
+// A made-up QFX file of about the given size, the way banks send them: SGML
+// headers, values without closing tags and extra elements Money doesn't
+// want. The same size always gives the same file, so runs are comparable.
+// For /benchmark and the tests.
+inline std::string MakeSyntheticQFX(size_t bytes) {
+    const char* const PAYEES[] = { "GROCERY OUTLET #123", "SHELL OIL 5744",
+        "AMAZON.COM*2K4", "NETFLIX.COM", "CITY OF SPRINGFIELD UTIL",
+        "PAYROLL DEPOSIT ACME CO", "STARBUCKS STORE 0042",
+        "TRANSFER TO SAVINGS" };
+    const std::string tail = "</BANKTRANLIST>\r\n<LEDGERBAL>\r\n"
+        "<BALAMT>1234.56\r\n<DTASOF>20200101120000.000\r\n</LEDGERBAL>\r\n"
+        "</STMTRS>\r\n</STMTTRNRS>\r\n</BANKMSGSRSV1>\r\n</OFX>\r\n";
+    std::string qfx = "OFXHEADER:100\r\nDATA:OFXSGML\r\nVERSION:102\r\n"
+        "SECURITY:NONE\r\nENCODING:USASCII\r\nCHARSET:1252\r\n"
+        "COMPRESSION:NONE\r\nOLDFILEUID:NONE\r\nNEWFILEUID:NONE\r\n\r\n"
+        "<OFX>\r\n<SIGNONMSGSRSV1>\r\n<SONRS>\r\n<STATUS>\r\n<CODE>0\r\n"
+        "<SEVERITY>INFO\r\n</STATUS>\r\n<DTSERVER>20200102120000.000[-8:PST]"
+        "\r\n<LANGUAGE>ENG\r\n</SONRS>\r\n</SIGNONMSGSRSV1>\r\n"
+        "<BANKMSGSRSV1>\r\n<STMTTRNRS>\r\n<TRNUID>0\r\n<STATUS>\r\n"
+        "<CODE>0\r\n<SEVERITY>INFO\r\n</STATUS>\r\n<STMTRS>\r\n"
+        "<CURDEF>USD\r\n<BANKACCTFROM>\r\n<BANKID>123456789\r\n"
+        "<ACCTID>000111222\r\n<ACCTTYPE>CHECKING\r\n</BANKACCTFROM>\r\n"
+        "<BANKTRANLIST>\r\n<DTSTART>20190101120000.000\r\n"
+        "<DTEND>20200101120000.000\r\n";
+    qfx.reserve(bytes + 1024);
+
+    uint32_t random = 12345;
+    for (size_t fitid = 0; qfx.length() + tail.length() < bytes; ++fitid) {
+        random = random * 1103515245u + 12345u;
+        uint32_t r = random >> 8;
+        const char* payee = PAYEES[r % (sizeof(PAYEES) / sizeof(PAYEES[0]))];
+        char amount[32];
+        snprintf(amount, sizeof(amount), "%s%u.%02u", (r & 1) ? "-" : "",
+            (r >> 4) % 500, (r >> 12) % 100);
+        char date[16];
+        snprintf(date, sizeof(date), "2019%02u%02u", (r >> 3) % 12 + 1,
+            (r >> 7) % 28 + 1);
+        qfx.append("<STMTTRN>\r\n<TRNTYPE>")
+            .append((r & 1) ? "DEBIT" : "CREDIT")
+            .append("\r\n<DTPOSTED>").append(date)
+            .append("120000.000\r\n<DTUSER>").append(date)
+            .append("\r\n<TRNAMT>").append(amount)
+            .append("\r\n<FITID>").append(std::to_string(fitid))
+            .append("\r\n<NAME>").append(payee)
+            .append("\r\n<MEMO>");
+        // Some memos just repeat the payee, so memo deduping has work
+        if ((r >> 9) % 4 == 0) {
+            qfx.append(payee);
+        }
+        else {
+            qfx.append("POS PURCHASE REF ").append(std::to_string(r % 100000));
+        }
+        qfx.append("\r\n<SIC>5411\r\n<CORRECTACTION>REPLACE\r\n"
+            "</STMTTRN>\r\n");
+    }
+    return qfx + tail;
+}
+
+#endif  // CONVERTTOOFX_OFXCONVERSION_H
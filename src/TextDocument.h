@@ -0,0 +1,370 @@
+// The document model behind the text panes: a piece table with an index of
+// the new lines. The tests build it too (see tests/TextDocumentTest.cpp).
+
+#ifndef CONVERTTOOFX_TEXTDOCUMENT_H
+#define CONVERTTOOFX_TEXTDOCUMENT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+// The text of one of the panes, as a piece table. The text as it was loaded
+// is never changed. Anything typed or pasted is appended to a second buffer,
+// and the document is a list of pieces of the two buffers. An edit only
+// adds or cuts pieces, so it costs the same for a 50 MB file as for a small
+// one. The pieces are kept in a treap (a binary tree balanced by random
+// priorities) ordered by position, and each node knows the length and new
+// lines of its subtree, so finding an offset or a line takes O(log n). Each
+// buffer keeps where its new lines are, so counting the new lines in part of
+// a piece is a binary search as well.
+// Nothing here knows about windows. See EditorPane in ConvertToOFX.cpp for
+// how a pane shows it.
+class TextDocument {
+public:
+    TextDocument() { Load(std::string()); }
+
+    // Start over with text, which is kept without copying it
+    void Load(std::string text);
+
+    size_t Length() const { return SubtreeLength(root); }
+    // Lines are counted from 0, and are ended by "\n". The text after the
+    // last new line is a line too, even if it's empty.
+    size_t LineCount() const { return SubtreeNewLines(root) + 1; }
+    // Where a line starts, or Length() for lines past the end
+    size_t OffsetOfLine(size_t line) const;
+    size_t LineOfOffset(size_t offset) const;
+    char At(size_t offset) const;
+
+    void Insert(size_t offset, const char* text, size_t length);
+    void Erase(size_t offset, size_t length);
+    void Replace(size_t offset, size_t length, const std::string& text) {
+        Erase(offset, length);
+        Insert(offset, text.data(), text.length());
+    }
+
+    // Append length bytes starting at offset to out. Only the pieces in that
+    // range are visited.
+    void Read(size_t offset, size_t length, std::string& out) const;
+    // Call visit with each piece of the document in order
+    void ForEachPiece(
+        const std::function<void(const char*, size_t)>& visit) const;
+    // The whole document as one string. Until it's edited, that's the text
+    // that was loaded, so it costs nothing. After an edit, the pieces are
+    // joined once and that becomes the loaded text.
+    const std::string& Contents();
+
+private:
+    static const uint32_t NONE = UINT32_MAX;
+    enum { LOADED, ADDED };
+
+    // Offsets of new lines are 32 bits to keep the index small.
+    // ConvertToOFX.cpp's LoadFile can't read files of 4 GB or more
+    // (GetFileSize), so that's plenty.
+    struct Buffer {
+        std::string text;
+        std::vector<uint32_t> newLines;
+
+        // Find the new lines in text from offset on
+        void IndexFrom(size_t offset);
+        size_t NewLinesBefore(size_t offset) const {
+            return std::lower_bound(newLines.begin(), newLines.end(),
+                offset) - newLines.begin();
+        }
+    };
+    struct Piece {
+        uint32_t left, right;
+        uint32_t priority;
+        int buffer;
+        size_t start, length, newLines;
+        // This piece plus everything under it
+        size_t subtreeLength, subtreeNewLines;
+    };
+
+    size_t SubtreeLength(uint32_t node) const {
+        return node == NONE ? 0 : pieces[node].subtreeLength;
+    }
+    size_t SubtreeNewLines(uint32_t node) const {
+        return node == NONE ? 0 : pieces[node].subtreeNewLines;
+    }
+    uint32_t NewPiece(int buffer, size_t start, size_t length);
+    void Update(uint32_t node);
+    // Cut the tree at node into the first offset bytes and the rest
+    void Split(uint32_t node, size_t offset, uint32_t& left,
+        uint32_t& right);
+    uint32_t Merge(uint32_t left, uint32_t right);
+    void Visit(uint32_t node, size_t& skip, size_t& length,
+        const std::function<void(const char*, size_t)>& visit) const;
+
+    Buffer buffers[2];
+    // Pieces that are cut out of the document stay here until the next
+    // Load(). Each edit leaves at most three behind.
+    std::vector<Piece> pieces;
+    uint32_t root = NONE;
+    uint32_t seed = 2463534242u;
+};
+
+inline void TextDocument::Buffer::IndexFrom(size_t offset) {
+    const char* data = text.data();
+    const char* end = data + text.length();
+    const char* found = data + offset;
+    while ((found = static_cast<const char*>(
+        memchr(found, '\n', end - found))) != NULL) {
+        newLines.push_back(static_cast<uint32_t>(found - data));
+        ++found;
+    }
+}
+
+inline void TextDocument::Load(std::string text) {
+    buffers[LOADED].text = std::move(text);
+    buffers[LOADED].newLines.clear();
+    buffers[LOADED].IndexFrom(0);
+    buffers[ADDED].text.clear();
+    buffers[ADDED].newLines.clear();
+    pieces.clear();
+    root = NONE;
+    if (!buffers[LOADED].text.empty()) {
+        root = NewPiece(LOADED, 0, buffers[LOADED].text.length());
+    }
+}
+
+inline uint32_t TextDocument::NewPiece(int buffer, size_t start,
+    size_t length) {
+    // xorshift is random enough to keep the tree balanced
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    const Buffer& b = buffers[buffer];
+    Piece piece = { NONE, NONE, seed, buffer, start, length,
+        b.NewLinesBefore(start + length) - b.NewLinesBefore(start),
+        0, 0 };
+    pieces.push_back(piece);
+    uint32_t node = static_cast<uint32_t>(pieces.size() - 1);
+    Update(node);
+    return node;
+}
+
+inline void TextDocument::Update(uint32_t node) {
+    Piece& p = pieces[node];
+    p.subtreeLength = SubtreeLength(p.left) + p.length +
+        SubtreeLength(p.right);
+    p.subtreeNewLines = SubtreeNewLines(p.left) + p.newLines +
+        SubtreeNewLines(p.right);
+}
+
+inline void TextDocument::Split(uint32_t node, size_t offset, uint32_t& left,
+    uint32_t& right) {
+    if (node == NONE) {
+        left = right = NONE;
+        return;
+    }
+    size_t leftLength = SubtreeLength(pieces[node].left);
+    if (offset <= leftLength) {
+        uint32_t rest;
+        Split(pieces[node].left, offset, left, rest);
+        pieces[node].left = rest;
+        Update(node);
+        right = node;
+    }
+    else if (offset >= leftLength + pieces[node].length) {
+        uint32_t rest;
+        Split(pieces[node].right, offset - leftLength - pieces[node].length,
+            rest, right);
+        pieces[node].right = rest;
+        Update(node);
+        left = node;
+    }
+    else {
+        // The cut is inside this piece. It keeps the part before the cut,
+        // and the part after becomes a new piece in front of the right
+        // subtree. (Careful: NewPiece() can move pieces.)
+        size_t cut = offset - leftLength;
+        uint32_t tail = NewPiece(pieces[node].buffer,
+            pieces[node].start + cut, pieces[node].length - cut);
+        Piece& p = pieces[node];
+        const Buffer& b = buffers[p.buffer];
+        p.length = cut;
+        p.newLines = b.NewLinesBefore(p.start + cut) -
+            b.NewLinesBefore(p.start);
+        right = Merge(tail, p.right);
+        pieces[node].right = NONE;
+        Update(node);
+        left = node;
+    }
+}
+
+inline uint32_t TextDocument::Merge(uint32_t left, uint32_t right) {
+    if (left == NONE) {
+        return right;
+    }
+    if (right == NONE) {
+        return left;
+    }
+    if (pieces[left].priority > pieces[right].priority) {
+        uint32_t merged = Merge(pieces[left].right, right);
+        pieces[left].right = merged;
+        Update(left);
+        return left;
+    }
+    uint32_t merged = Merge(left, pieces[right].left);
+    pieces[right].left = merged;
+    Update(right);
+    return right;
+}
+
+inline size_t TextDocument::OffsetOfLine(size_t line) const {
+    if (line == 0) {
+        return 0;
+    }
+    if (line > SubtreeNewLines(root)) {
+        return Length();
+    }
+    // Find the new line that ends the line before, the line'th one
+    size_t offset = 0;
+    uint32_t node = root;
+    while (node != NONE) {
+        const Piece& p = pieces[node];
+        size_t leftNewLines = SubtreeNewLines(p.left);
+        if (line <= leftNewLines) {
+            node = p.left;
+            continue;
+        }
+        line -= leftNewLines;
+        offset += SubtreeLength(p.left);
+        if (line <= p.newLines) {
+            const Buffer& b = buffers[p.buffer];
+            size_t newLine = b.newLines[b.NewLinesBefore(p.start) + line - 1];
+            return offset + (newLine - p.start) + 1;
+        }
+        line -= p.newLines;
+        offset += p.length;
+        node = p.right;
+    }
+    return Length();
+}
+
+inline size_t TextDocument::LineOfOffset(size_t offset) const {
+    size_t line = 0;
+    uint32_t node = root;
+    while (node != NONE) {
+        const Piece& p = pieces[node];
+        size_t leftLength = SubtreeLength(p.left);
+        if (offset < leftLength) {
+            node = p.left;
+            continue;
+        }
+        line += SubtreeNewLines(p.left);
+        offset -= leftLength;
+        if (offset < p.length) {
+            const Buffer& b = buffers[p.buffer];
+            return line + b.NewLinesBefore(p.start + offset) -
+                b.NewLinesBefore(p.start);
+        }
+        line += p.newLines;
+        offset -= p.length;
+        node = p.right;
+    }
+    return line;
+}
+
+inline char TextDocument::At(size_t offset) const {
+    uint32_t node = root;
+    while (node != NONE) {
+        const Piece& p = pieces[node];
+        size_t leftLength = SubtreeLength(p.left);
+        if (offset < leftLength) {
+            node = p.left;
+            continue;
+        }
+        offset -= leftLength;
+        if (offset < p.length) {
+            return buffers[p.buffer].text[p.start + offset];
+        }
+        offset -= p.length;
+        node = p.right;
+    }
+    return '\0';
+}
+
+inline void TextDocument::Insert(size_t offset, const char* text,
+    size_t length) {
+    if (length == 0) {
+        return;
+    }
+    Buffer& added = buffers[ADDED];
+    size_t start = added.text.length();
+    added.text.append(text, length);
+    added.IndexFrom(start);
+    uint32_t left, right;
+    Split(root, std::min(offset, Length()), left, right);
+    root = Merge(Merge(left, NewPiece(ADDED, start, length)), right);
+}
+
+inline void TextDocument::Erase(size_t offset, size_t length) {
+    if (length == 0 || offset >= Length()) {
+        return;
+    }
+    uint32_t left, middle, right;
+    Split(root, offset, left, right);
+    Split(right, length, middle, right);
+    root = Merge(left, right);
+}
+
+inline void TextDocument::Visit(uint32_t node, size_t& skip, size_t& length,
+    const std::function<void(const char*, size_t)>& visit) const {
+    if (node == NONE || length == 0) {
+        return;
+    }
+    const Piece& p = pieces[node];
+    if (skip >= p.subtreeLength) {
+        skip -= p.subtreeLength;
+        return;
+    }
+    Visit(p.left, skip, length, visit);
+    if (length == 0) {
+        return;
+    }
+    if (skip >= p.length) {
+        skip -= p.length;
+    }
+    else {
+        size_t count = std::min(p.length - skip, length);
+        visit(buffers[p.buffer].text.data() + p.start + skip, count);
+        skip = 0;
+        length -= count;
+    }
+    Visit(p.right, skip, length, visit);
+}
+
+inline void TextDocument::Read(size_t offset, size_t length,
+    std::string& out) const {
+    Visit(root, offset, length, [&out](const char* data, size_t count) {
+        out.append(data, count);
+    });
+}
+
+inline void TextDocument::ForEachPiece(
+    const std::function<void(const char*, size_t)>& visit) const {
+    size_t skip = 0;
+    size_t length = Length();
+    Visit(root, skip, length, visit);
+}
+
+inline const std::string& TextDocument::Contents() {
+    const Buffer& loaded = buffers[LOADED];
+    bool asLoaded = root == NONE ? loaded.text.empty() :
+        pieces[root].buffer == LOADED && pieces[root].start == 0 &&
+        pieces[root].subtreeLength == loaded.text.length() &&
+        pieces[root].length == loaded.text.length();
+    if (!asLoaded) {
+        std::string joined;
+        joined.reserve(Length());
+        Read(0, Length(), joined);
+        Load(std::move(joined));
+    }
+    return buffers[LOADED].text;
+}
+
+#endif  // CONVERTTOOFX_TEXTDOCUMENT_H
@@ -0,0 +1,234 @@
+// Tests for the bounded-memory converter (BoundedConverter): a statement
+// many times the memory cap converts with the process's peak memory staying
+// near the cap, blocks that are too big fail soon after passing the cap,
+// and investment transactions are left alone the way ConvertQFXToOFX()
+// leaves them.
+//
+// The big input is made up as it is read, so it never sits in memory. It is
+// 256 MB, four times the cap, unless CONVERTTOOFX_BOUNDED_TEST_MB says
+// otherwise; the long test (ctest -L long) runs it again with 2 GB.
+
+#include "OFXConversion.h"
+#include "TestCheck.h"
+
+#include <streambuf>
+
+namespace {
+
+const size_t MEGABYTE = 1024 * 1024;
+const size_t MEMORY_CAP = 64 * MEGABYTE;
+
+// A QFX statement of about the given size: MakeSyntheticQFX()'s headers,
+// then its transactions over and over, then its end. Each time round, the
+// FITIDs get a new prefix, so they are all different like in a real file.
+class SyntheticQFXBuf : public std::streambuf {
+public:
+    explicit SyntheticQFXBuf(unsigned long long bytes) {
+        const std::string qfx = MakeSyntheticQFX(MEGABYTE);
+        const size_t first = qfx.find("<STMTTRN>");
+        const size_t end = qfx.rfind("</STMTTRN>") + strlen("</STMTTRN>\r\n");
+        head = qfx.substr(0, first);
+        body = qfx.substr(first, end - first);
+        tail = qfx.substr(end);
+        for (size_t fitid = body.find("<FITID>"); fitid != std::string::npos;
+            fitid = body.find("<FITID>", fitid + 1)) {
+            fitids.push_back(fitid + strlen("<FITID>"));
+        }
+        bodyBytes = bytes > qfx.length() ? bytes - head.length() -
+            tail.length() : body.length();
+        next = &head;
+    }
+
+protected:
+    int_type underflow() override {
+        if (next == NULL) {
+            return traits_type::eof();
+        }
+        const std::string* piece = next;
+        if (piece == &head) {
+            next = &body;
+        }
+        else if (piece == &body) {
+            bodyBytes -= std::min<unsigned long long>(bodyBytes,
+                body.length());
+            if (bodyBytes == 0) {
+                next = &tail;
+            }
+            const std::string prefix = std::to_string(++repeats) + "-";
+            numbered.clear();
+            size_t copied = 0;
+            for (size_t fitid : fitids) {
+                numbered.append(body, copied, fitid - copied).append(prefix);
+                copied = fitid;
+            }
+            numbered.append(body, copied, std::string::npos);
+            piece = &numbered;
+        }
+        else {
+            next = NULL;
+        }
+        char* start = const_cast<char*>(piece->data());
+        setg(start, start, start + piece->length());
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    std::string head;
+    std::string body;
+    std::string tail;
+    std::vector<size_t> fitids;  // Where each FITID in body starts
+    std::string numbered;  // body with this time round's FITIDs
+    unsigned repeats = 0;
+    const std::string* next;
+    unsigned long long bodyBytes;  // Still to come
+};
+
+// Throws the output away, counting it
+class CountingBuf : public std::streambuf {
+public:
+    unsigned long long bytes = 0;
+
+protected:
+    std::streamsize xsputn(const char*, std::streamsize count) override {
+        bytes += count;
+        return count;
+    }
+    int_type overflow(int_type c) override {
+        ++bytes;
+        return traits_type::not_eof(c);
+    }
+};
+
+// The process's resident memory now and at its peak, from /proc, in bytes.
+// 0 where there is no /proc.
+size_t ProcessMemory(const char* field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, strlen(field), field) == 0) {
+            return strtoull(line.c_str() + strlen(field) + 1, NULL, 10) * 1024;
+        }
+    }
+    return 0;
+}
+
+BoundedConversionResult ConvertBounded(const std::string& input,
+    size_t memoryCap, std::string& output) {
+    std::istringstream in(input);
+    std::ostringstream out;
+    BoundedConversionResult result = ConvertStreamBounded(in, out, memoryCap,
+        ConversionOptions());
+    output = out.str();
+    return result;
+}
+
+// Converting a statement far bigger than the cap keeps the peak resident
+// memory near the cap
+void TestPeakMemory() {
+    unsigned long long megabytes = 256;
+    if (const char* size = getenv("CONVERTTOOFX_BOUNDED_TEST_MB")) {
+        megabytes = strtoull(size, NULL, 10);
+    }
+    SyntheticQFXBuf inBuf(megabytes * MEGABYTE);
+    std::istream in(&inBuf);
+    CountingBuf outBuf;
+    std::ostream out(&outBuf);
+
+    const size_t before = ProcessMemory("VmRSS:");
+    std::chrono::steady_clock::time_point started =
+        std::chrono::steady_clock::now();
+    BoundedConversionResult result = ConvertStreamBounded(in, out,
+        MEMORY_CAP, ConversionOptions());
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - started).count();
+    const size_t peak = ProcessMemory("VmHWM:");
+
+    printf("Converted %llu MB (%zu transactions) in %.1f s; buffered at most "
+        "%zu KB; peak resident memory %zu MB over %zu MB before\n",
+        result.bytesRead / MEGABYTE, result.transactionCount, seconds,
+        result.peakBufferedBytes / 1024, (peak - before) / MEGABYTE,
+        before / MEGABYTE);
+    Check(result.success, result.errorMsg.c_str());
+    Check(result.bytesRead >= megabytes * MEGABYTE,
+        "the whole input is read");
+    Check(outBuf.bytes == result.bytesWritten, "all the output is written");
+    Check(result.peakBufferedBytes <= MEMORY_CAP,
+        "the buffered bytes stay under the cap");
+    if (peak > 0) {
+        // The cap is for what the converter holds. Allow some for the heap
+        // not giving memory back right away.
+        Check(peak - before <= MEMORY_CAP + 16 * MEGABYTE,
+            "the peak resident memory stays near the cap");
+    }
+}
+
+// A <STMTTRN> or value bigger than the cap fails with a clear message,
+// soon after it passes the cap rather than at the end of the file
+void TestTooBig() {
+    const size_t cap = 4 * MEGABYTE;
+    const std::string qfx = MakeSyntheticQFX(64 * 1024);
+    const size_t memo = qfx.find("<MEMO>") + strlen("<MEMO>");
+    std::string hugeMemo = qfx;
+    hugeMemo.insert(memo, std::string(16 * MEGABYTE, 'x'));
+    std::string output;
+    BoundedConversionResult result = ConvertBounded(hugeMemo, cap, output);
+    Check(!result.success && result.errorMsg.find("<STMTTRN> block starting "
+        "at input byte") != std::string::npos,
+        "a <STMTTRN> bigger than the cap is reported");
+    Check(result.bytesRead < memo + cap, "the block is stopped at the cap");
+    // Strings grow by doubling, so the last step can overshoot
+    Check(result.peakBufferedBytes < 2 * cap,
+        "the block doesn't get far past the cap");
+
+    const size_t server = qfx.find("<DTSERVER>") + strlen("<DTSERVER>");
+    std::string hugeValue = qfx;
+    hugeValue.insert(server, std::string(16 * MEGABYTE, '1'));
+    result = ConvertBounded(hugeValue, cap, output);
+    Check(!result.success && result.errorMsg.find("A single value or tag in "
+        "the file is too large") != std::string::npos,
+        "a value bigger than the cap is reported");
+    Check(result.bytesRead < server + cap, "the value is stopped at the cap");
+}
+
+// Only a statement's <STMTTRN>s are pruned. An investment statement's are
+// left as they are, like ConvertQFXToOFX() leaves them.
+void TestInvestmentTransactions() {
+    std::string qfx = MakeSyntheticQFX(4 * 1024);
+    const std::string investment = "<INVSTMTMSGSRSV1>\r\n<INVSTMTTRNRS>\r\n"
+        "<TRNUID>0\r\n<INVSTMTRS>\r\n<DTASOF>20200101\r\n<CURDEF>USD\r\n"
+        "<INVACCTFROM>\r\n<BROKERID>example.com\r\n<ACCTID>555\r\n"
+        "</INVACCTFROM>\r\n<INVTRANLIST>\r\n<DTSTART>20190101\r\n"
+        "<DTEND>20200101\r\n<INVBANKTRAN>\r\n<STMTTRN>\r\n<TRNTYPE>CREDIT\r\n"
+        "<DTPOSTED>20190105\r\n<TRNAMT>10.00\r\n<FITID>INV1\r\n"
+        "<NAME>DIVIDEND\r\n<SIC>6211\r\n</STMTTRN>\r\n"
+        "<SUBACCTFUND>CASH\r\n</INVBANKTRAN>\r\n</INVTRANLIST>\r\n"
+        "</INVSTMTRS>\r\n</INVSTMTTRNRS>\r\n</INVSTMTMSGSRSV1>\r\n";
+    qfx.insert(qfx.find("</OFX>"), investment);
+
+    std::string bounded;
+    Check(ConvertBounded(qfx, MEMORY_CAP, bounded).success,
+        "the bounded converter converts a bank and investment file");
+    ConversionContext context((ConversionOptions()));
+    std::string dom;
+    Check(ConvertQFXToOFX(qfx, context, dom),
+        "ConvertQFXToOFX() converts a bank and investment file");
+
+    for (const std::string* output : { &bounded, &dom }) {
+        const size_t split = output->find("<INVSTMTMSGSRSV1>");
+        Check(split != std::string::npos, "the investment statement is kept");
+        Check(output->find("<SIC>") == output->find("<SIC>", split),
+            "the bank transactions are pruned");
+        Check(output->find("<SIC>6211</SIC>", split) != std::string::npos,
+            "the investment transaction is left alone");
+    }
+}
+
+}  // namespace
+
+int main() {
+    // First, since the peak is for the whole process
+    TestPeakMemory();
+    TestInvestmentTransactions();
+    TestTooBig();
+    return TestResult();
+}
@@ -0,0 +1,367 @@
+// Tests for the CSV input: CSVReader against a plain reference on random
+// records, the date parser, the column mapping file, and whole conversions,
+// including the FITIDs made up for rows without one.
+
+#include "OFXConversion.h"
+#include "TestCheck.h"
+
+#include <iterator>
+#include <random>
+#include <sstream>
+
+namespace {
+
+// Random fields, written the way a spreadsheet would: quoted if they need
+// it (and sometimes when they don't), with "" for a quote. Field lengths
+// vary so that quotes, delimiters and line ends land all over the 16 bytes
+// FindSpecial() looks at at once.
+std::string RandomField(std::mt19937& random) {
+    const char SPECIAL[] = ",\"\r\n ";
+    std::string field(random() % 40, 'a');
+    for (char& c : field) {
+        c = random() % 8 == 0 ? SPECIAL[random() % 5] :
+            static_cast<char>('a' + random() % 26);
+    }
+    return field;
+}
+
+std::string WriteField(std::mt19937& random, const std::string& field) {
+    if (field.find_first_of(",\"\r\n") == std::string::npos &&
+        random() % 4 != 0) {
+        return field;
+    }
+    std::string quoted = "\"";
+    for (char c : field) {
+        quoted += c == '"' ? "\"\"" : std::string(1, c);
+    }
+    return quoted + "\"";
+}
+
+void TestRandomRecords() {
+    const char* const LINE_ENDS[] = { "\n", "\r\n", "\r" };
+    unsigned differed = 0;
+    for (uint32_t seed = 1; seed <= 300; ++seed) {
+        std::mt19937 random(seed);
+        std::vector<std::vector<std::string>> records(random() % 50 + 1);
+        std::vector<size_t> lines;
+        std::string csv;
+        size_t line = 1;
+        for (std::vector<std::string>& record : records) {
+            record.resize(random() % 6 + 1);
+            lines.push_back(line);
+            for (size_t i = 0; i < record.size(); ++i) {
+                record[i] = RandomField(random);
+                // A record that is one empty field is a blank line, unless
+                // it is quoted
+                csv += record.size() == 1 && record[i].empty() ? "\"\"" :
+                    WriteField(random, record[i]);
+                csv += i + 1 < record.size() ? "," :
+                    LINE_ENDS[random() % 3];
+                line += std::count(record[i].begin(), record[i].end(), '\n');
+            }
+            ++line;
+        }
+
+        CSVReader reader(csv.data(), csv.length(), ',');
+        std::vector<CSVField> fields;
+        size_t count = 0;
+        bool same = true;
+        while (same && reader.Next(fields)) {
+            same = count < records.size() &&
+                fields.size() == records[count].size() &&
+                reader.Line() == lines[count];
+            for (size_t i = 0; same && i < fields.size(); ++i) {
+                same = std::string(fields[i].text, fields[i].length) ==
+                    records[count][i];
+            }
+            ++count;
+        }
+        if (!same || count != records.size()) {
+            if (differed++ == 0) {
+                printf("Seed %u, record %zu differs. CSV:\n%s\n", seed,
+                    count, csv.c_str());
+            }
+        }
+    }
+    Check(differed == 0, "CSVReader reads random records as written");
+}
+
+// Edge cases of the format that a spreadsheet wouldn't write
+void TestOddRecords() {
+    const struct {
+        const char* csv;
+        const char* fields;  // Joined with |, records with /
+    } CASES[] = {
+        { "a,b,\n", "a|b|/" },
+        { "a,b,", "a|b|/" },
+        { "a\"b,c\n", "a\"b|c/" },
+        { "\"a\"junk,b\n", "a|b/" },
+        { "\"unclosed,b\n", "unclosed,b\n/" },
+        { "a;b,c\r\nd", "a;b|c/d/" },
+        { "\n\na\n", "/" "/a/" },
+        { "\"0123456789012345,\"\"\"\"0123456789\"\n",
+            "0123456789012345,\"\"0123456789/" },
+    };
+    for (const auto& odd : CASES) {
+        const std::string csv = odd.csv;
+        CSVReader reader(csv.data(), csv.length(), ',');
+        std::vector<CSVField> fields;
+        std::string read;
+        while (reader.Next(fields)) {
+            for (size_t i = 0; i < fields.size(); ++i) {
+                read.append(i > 0 ? "|" : "").append(fields[i].text,
+                    fields[i].length);
+            }
+            read += "/";
+        }
+        if (read != odd.fields) {
+            printf("\"%s\" is read as \"%s\"\n", odd.csv, read.c_str());
+            Check(false, "odd CSV records are read as in the table");
+        }
+    }
+}
+
+void TestDates() {
+    const struct {
+        const char* text;
+        bool dayFirst;
+        int yyyymmdd;  // 0 if it isn't a date
+    } DATES[] = {
+        { "12/31/2019", false, 20191231 },
+        { "31/12/2019", true, 20191231 },
+        { "31/12/2019", false, 0 },
+        { "12/31/2019", true, 0 },
+        { "2019-12-31", true, 20191231 },
+        { "20191231", false, 20191231 },
+        { "12-31-19", false, 20191231 },
+        { "12/31/69", false, 20691231 },
+        { "12/31/70", false, 19701231 },
+        { "12/31/2019 10:15 AM", false, 20191231 },
+        { " 1/ 2/2020", false, 20200102 },
+        // Quicken's years from 2000 on
+        { "1/ 2'20", false, 20200102 },
+        { "2/ 1'20", true, 20200102 },
+        { "12/31'99", false, 20991231 },
+        // The days each month has
+        { "2/29/2020", false, 20200229 },
+        { "2/29/2000", false, 20000229 },
+        { "2/29/2019", false, 0 },
+        { "2/29/1900", false, 0 },
+        { "2/30/2020", false, 0 },
+        { "4/31/2019", false, 0 },
+        { "4/30/2019", false, 20190430 },
+        { "1/32/2019", false, 0 },
+        { "1/0/2019", false, 0 },
+        { "0/1/2019", false, 0 },
+        { "13/1/2019", false, 0 },
+        { "1/1/1899", false, 0 },
+        { "", false, 0 },
+        { "12/31", false, 0 },
+        { "yesterday", false, 0 },
+        { "123456789/1/2019", false, 0 },
+    };
+    for (const auto& row : DATES) {
+        int yyyymmdd = 0;
+        if (!ParseCSVDate(row.text, strlen(row.text), row.dayFirst,
+            yyyymmdd)) {
+            yyyymmdd = 0;
+        }
+        if (yyyymmdd != row.yyyymmdd) {
+            printf("ParseCSVDate(\"%s\", %s) is %d\n", row.text,
+                row.dayFirst ? "day first" : "month first", yyyymmdd);
+            Check(false, "CSV dates parse as in the table");
+        }
+    }
+}
+
+struct Converted {
+    CSVConversionResult result;
+    std::string ofx;
+};
+
+// Convert csv with the column mapping file mapping
+Converted Convert(const std::string& csv, const std::string& mapping) {
+    CSVOptions options;
+    std::istringstream mappingFile(mapping);
+    std::string error;
+    Converted converted;
+    if (!ReadCSVOptions(mappingFile, options, error)) {
+        converted.result.errorMsg = error;
+        return converted;
+    }
+    std::ostringstream out;
+    converted.result = ConvertCSVToOFX(csv.data(), csv.length(), options,
+        out);
+    converted.ofx = out.str();
+    return converted;
+}
+
+// The <STMTTRN>s of some OFX
+std::vector<std::string> Transactions(const std::string& ofx) {
+    std::vector<std::string> transactions;
+    const std::string END = "</STMTTRN>";
+    for (size_t start = ofx.find("<STMTTRN>"); start != std::string::npos;
+        start = ofx.find("<STMTTRN>", start + 1)) {
+        size_t end = ofx.find(END, start);
+        transactions.push_back(ofx.substr(start,
+            end + END.length() - start));
+    }
+    return transactions;
+}
+
+// The value of the first <name> in xml, or "none"
+std::string Field(const std::string& xml, const std::string& name) {
+    size_t start = xml.find("<" + name + ">");
+    if (start == std::string::npos) {
+        return "none";
+    }
+    start += name.length() + 2;
+    return xml.substr(start, xml.find("</" + name + ">", start) - start);
+}
+
+// The output is what Money would take
+bool IsValid(const std::string& ofx) {
+    MoneyValidator validator;
+    validator.Feed(ofx);
+    validator.Finish();
+    return validator.DiagnosticCount() == 0;
+}
+
+const std::string EXPORT = "Date,Description,Amount,Balance\r\n"
+    "12/31/2019,\"COFFEE, LARGE\",-3.50,96.50\r\n"
+    "12/31/2019,\"COFFEE, LARGE\",-3.50,93.00\r\n"
+    "01/02/2020,\"PAY\nCHECK <&>\",\"1,000.00\",\"1,093.00\"\r\n"
+    "not a date,SKIPPED,1.00,\r\n";
+
+void TestConversion() {
+    const Converted converted = Convert(EXPORT, "");
+    const std::vector<std::string> transactions =
+        Transactions(converted.ofx);
+    Check(converted.result.success && IsValid(converted.ofx),
+        "a CSV export converts to OFX Money takes");
+    Check(transactions.size() == 3 &&
+        converted.result.transactionCount == 3 &&
+        converted.result.synthesizedIds == 3 &&
+        converted.result.skippedRows == 1 &&
+        converted.result.firstSkippedLine == 6,
+        "rows without a date are skipped, and counted");
+    if (transactions.size() != 3) {
+        return;
+    }
+    Check(Field(transactions[0], "NAME") == "COFFEE, LARGE" &&
+        Field(transactions[0], "TRNAMT") == "-3.50" &&
+        Field(transactions[0], "TRNTYPE") == "DEBIT" &&
+        Field(transactions[0], "DTPOSTED") == "20191231120000.000[0:GMT]",
+        "the columns are found by their header names");
+    Check(Field(transactions[2], "NAME") == "PAY\nCHECK &lt;&amp;&gt;" &&
+        Field(transactions[2], "TRNAMT") == "1000.00",
+        "quoted values keep their new lines, and are escaped");
+    Check(Field(converted.ofx, "DTSTART") == "20191231120000.000[0:GMT]" &&
+        Field(converted.ofx, "DTEND") == "20200102120000.000[0:GMT]" &&
+        Field(converted.ofx, "BALAMT") == "1093.00",
+        "the statement has the date range and the newest balance");
+}
+
+// Made-up FITIDs are the same every time the same transaction is
+// exported, and different for transactions that look the same
+void TestStableIds() {
+    auto ids = [](const std::string& csv) {
+        std::vector<std::string> ids;
+        for (const std::string& transaction :
+            Transactions(Convert(csv, "").ofx)) {
+            ids.push_back(Field(transaction, "FITID"));
+        }
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    };
+    const std::vector<std::string> first = ids(EXPORT);
+    Check(first.size() == 3 &&
+        std::adjacent_find(first.begin(), first.end()) == first.end(),
+        "two identical transactions get different FITIDs");
+    Check(ids(EXPORT) == first, "the same export gets the same FITIDs");
+
+    // The next export has one more, and the newest first
+    const std::string next = "Date,Description,Amount\r\n"
+        "01/03/2020,TEA,-2.00\r\n"
+        "01/02/2020,\"PAY\nCHECK <&>\",\"1,000.00\"\r\n"
+        "12/31/2019,\"COFFEE, LARGE\",-3.50\r\n"
+        "12/31/2019,\"COFFEE, LARGE\",-3.50\r\n";
+    std::vector<std::string> again = ids(next);
+    Check(again.size() == 4, "the next export converts");
+    std::vector<std::string> common;
+    std::set_intersection(first.begin(), first.end(), again.begin(),
+        again.end(), std::back_inserter(common));
+    Check(common == first,
+        "a transaction keeps its FITID in the next export");
+    Check(Transactions(Convert("Date,Amount,ID\n1/1/2020,1,BANK-7\n",
+        "").ofx).size() == 1 && Convert("Date,Amount,ID\n1/1/2020,1,"
+        "BANK-7\n", "").result.synthesizedIds == 0,
+        "a FITID in the export is used as it is");
+}
+
+void TestColumnMapping() {
+    // By name, by number, with another delimiter and the day first
+    const std::string csv = "Posted;Amt;What;Notes\n"
+        "31/12/2019;-1,50;SHOP;FIRST\n"
+        "1/1/2020;2,00;WORK;SECOND\n";
+    const Converted named = Convert(csv, "# Our credit union\n"
+        "date = Posted\namount = amt\npayee = 3\nmemo = NOTES\n"
+        "delimiter = ;\ndateorder = dmy\ndecimal = ,\n"
+        "account = 42\naccounttype = savings\n");
+    std::vector<std::string> transactions = Transactions(named.ofx);
+    Check(named.result.success && transactions.size() == 2 &&
+        Field(transactions[0], "DTPOSTED") == "20191231120000.000[0:GMT]" &&
+        Field(transactions[0], "TRNAMT") == "-1.50" &&
+        Field(transactions[0], "NAME") == "SHOP" &&
+        Field(transactions[1], "MEMO") == "SECOND" &&
+        Field(named.ofx, "ACCTID") == "42" &&
+        Field(named.ofx, "ACCTTYPE") == "SAVINGS",
+        "columns are found by the names and numbers the mapping gives");
+
+    // No header row, so every row is a transaction
+    const std::string noHeader = "12/31/2019,SHOP,-1.50\n"
+        "1/1/2020,WORK,2.00\n";
+    const Converted numbered = Convert(noHeader,
+        "header = no\ndate = 1\namount = 3\npayee = 2\n");
+    transactions = Transactions(numbered.ofx);
+    Check(numbered.result.success && transactions.size() == 2 &&
+        Field(transactions[0], "NAME") == "SHOP",
+        "without a header, the first row is a transaction");
+    Check(!Convert(noHeader, "header = no\n").result.success &&
+        !Convert(noHeader, "header = no\ndate = Date\namount = 3\n")
+        .result.success,
+        "without a header, columns can only be given by number");
+    Check(!Convert(csv, "date = Posted\namount = Nope\ndelimiter = ;\n")
+        .result.success, "a column the CSV doesn't have is an error");
+    // Headers and mapping values in Windows-1252, with bytes past 127,
+    // which must not reach tolower() and the like as negative chars
+    const Converted accented = Convert("Fecha,Importe,Descripci\xF3n\n"
+        "1/1/2020,-1.00,CAF\xC9\n", "date = FECHA\namount = importe\n"
+        "payee = Descripci\xF3n\naccounttype = \xE9pargne\n");
+    Check(accented.result.success &&
+        Field(accented.ofx, "NAME") == "CAF\xC9" &&
+        Field(accented.ofx, "ACCTTYPE") == "\xE9PARGNE",
+        "names with bytes past 127 are matched and upper-cased");
+
+    const char* const BAD_MAPPINGS[] = { "date Posted\n", "header = maybe\n",
+        "dateorder = ymd\n", "delimiter = ;;\n", "colour = blue\n" };
+    for (const char* bad : BAD_MAPPINGS) {
+        CSVOptions options;
+        std::istringstream in(bad);
+        std::string error;
+        Check(!ReadCSVOptions(in, options, error) && !error.empty(),
+            "a mapping file line that makes no sense is an error");
+    }
+}
+
+}  // namespace
+
+int main() {
+    TestRandomRecords();
+    TestOddRecords();
+    TestDates();
+    TestConversion();
+    TestStableIds();
+    TestColumnMapping();
+    return TestResult();
+}
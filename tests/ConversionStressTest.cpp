@@ -0,0 +1,183 @@
+// Runs many conversions at once on separate threads, each with its own
+// ConversionContext and ConversionBuffers, and checks that every output and
+// message matches converting the same input alone. Build it with
+// -DCONVERTTOOFX_SANITIZER=thread to have ThreadSanitizer check for races
+// (see tests/CMakeLists.txt).
+
+#include "OFXConversion.h"
+#include "TestCheck.h"
+
+namespace {
+
+const unsigned THREADS = 8;
+// How many conversions each thread runs. Together they run every job twice.
+const unsigned JOBS_PER_THREAD = 16;
+
+// Several statements, so PruneStatementsInParallel() has work for more than
+// one thread: two bank statements and a credit card one
+std::string MakeMultiStatementQFX() {
+    const std::string qfx = MakeSyntheticQFX(64 * 1024);
+    const size_t start = qfx.find("<BANKMSGSRSV1>");
+    const size_t end = qfx.find("</OFX>");
+    const std::string bank = qfx.substr(start, end - start);
+    const std::string statement = bank.substr(
+        bank.find("<STMTTRNRS>"),
+        bank.find("</BANKMSGSRSV1>") - bank.find("<STMTTRNRS>"));
+
+    std::string creditCard = bank;
+    const struct { const char* from; const char* to; } RENAMES[] = {
+        { "BANKMSGSRSV1", "CREDITCARDMSGSRSV1" },
+        { "STMTTRNRS", "CCSTMTTRNRS" }, { "STMTRS", "CCSTMTRS" },
+        { "BANKACCTFROM", "CCACCTFROM" }, { "000111222", "999888777" } };
+    for (const auto& rename : RENAMES) {
+        for (size_t found = creditCard.find(rename.from);
+            found != std::string::npos;
+            found = creditCard.find(rename.from, found + strlen(rename.to))) {
+            creditCard.replace(found, strlen(rename.from), rename.to);
+        }
+    }
+
+    std::string multi = qfx.substr(0, start);
+    multi += bank.substr(0, bank.find("</BANKMSGSRSV1>"));
+    multi += statement + "</BANKMSGSRSV1>\r\n" + creditCard + "</OFX>\r\n";
+    return multi;
+}
+
+// What one conversion produced, apart from the timings in the report
+struct Converted {
+    bool converted;
+    std::string output;
+    std::string messages;
+};
+
+Converted Convert(const std::string& input, const ConversionOptions& options,
+    ConversionBuffers& buffers) {
+    ConversionContext context(options);
+    Converted result;
+    result.converted = ConvertQFXToOFX(input, context, buffers,
+        result.output);
+    for (const ConversionMessage& message : context.diagnostics.messages) {
+        result.messages += std::to_string(message.severity) + " " +
+            message.title + ": " + message.text + "\n";
+    }
+    buffers.Reset();
+    return result;
+}
+
+// Every combination of the Config menu options. The payee rules are
+// compiled once and shared, the way the UI shares them.
+std::vector<ConversionOptions> AllOptions() {
+    std::shared_ptr<PayeeRules> rules = std::make_shared<PayeeRules>();
+    std::istringstream in(DEFAULT_PAYEE_RULES);
+    std::string error;
+    Check(rules->Compile(in, error), "the default payee rules compile");
+
+    std::vector<ConversionOptions> all;
+    for (unsigned bits = 0; bits < 32; ++bits) {
+        ConversionOptions options;
+        options.dedupeMemoField = (bits & 1) != 0;
+        options.trimLines = (bits & 2) != 0;
+        options.normalizeAmountsAndDates = (bits & 4) != 0;
+        options.sortAndDedupeTransactions = (bits & 8) != 0;
+        if (bits & 16) {
+            options.payeeRules = rules;
+        }
+        all.push_back(options);
+    }
+    return all;
+}
+
+struct Job {
+    const std::string* input;
+    const ConversionOptions* options;
+    Converted expected;
+};
+
+void TestConcurrentConversions() {
+    // Big enough that FixXMLInParallel() splits it
+    const std::string big = MakeSyntheticQFX(520 * 1024);
+    const std::string multi = MakeMultiStatementQFX();
+    const std::vector<ConversionOptions> options = AllOptions();
+
+    std::vector<Job> jobs;
+    ConversionBuffers buffers;
+    for (const std::string* input : { &big, &multi }) {
+        for (const ConversionOptions& option : options) {
+            Job job = { input, &option, Convert(*input, option, buffers) };
+            Check(job.expected.converted, "the input converts on its own");
+            jobs.push_back(job);
+        }
+    }
+
+    std::atomic<unsigned> mismatches(0);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < THREADS; ++t) {
+        threads.push_back(std::thread([&jobs, &mismatches, t]() {
+            ConversionBuffers buffers;
+            // Each thread starts somewhere else in the jobs, so different
+            // options and inputs run side by side
+            for (size_t i = 0; i < JOBS_PER_THREAD; ++i) {
+                const Job& job = jobs[(i + t * jobs.size() / THREADS) %
+                    jobs.size()];
+                Converted converted = Convert(*job.input, *job.options,
+                    buffers);
+                if (converted.converted != job.expected.converted ||
+                    converted.output != job.expected.output ||
+                    converted.messages != job.expected.messages) {
+                    ++mismatches;
+                }
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    printf("%u threads ran %u conversions each, %u differed\n", THREADS,
+        JOBS_PER_THREAD, mismatches.load());
+    Check(mismatches == 0,
+        "conversions on several threads match converting alone");
+}
+
+// The bounded-memory converter and FixXML() on several threads at once
+void TestConcurrentStreaming() {
+    const std::string input = MakeMultiStatementQFX();
+    const ConversionOptions options;
+    std::string expectedFixed = FixXML(input);
+    std::ostringstream expectedOut;
+    std::istringstream expectedIn(input);
+    BoundedConverter expectedConverter(expectedOut, 64 * 1024 * 1024,
+        options, NULL, NULL);
+    Check(expectedConverter.Run(expectedIn).success,
+        "the bounded-memory converter converts the input");
+
+    std::atomic<unsigned> mismatches(0);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < THREADS; ++t) {
+        threads.push_back(std::thread([&]() {
+            for (int i = 0; i < 2; ++i) {
+                std::ostringstream out;
+                std::istringstream in(input);
+                BoundedConverter converter(out, 64 * 1024 * 1024, options,
+                    NULL, NULL);
+                if (!converter.Run(in).success ||
+                    out.str() != expectedOut.str() ||
+                    FixXMLInParallel(input) != expectedFixed) {
+                    ++mismatches;
+                }
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    Check(mismatches == 0,
+        "bounded conversions on several threads match converting alone");
+}
+
+}  // namespace
+
+int main() {
+    TestConcurrentConversions();
+    TestConcurrentStreaming();
+    return TestResult();
+}
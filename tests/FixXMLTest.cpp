@@ -0,0 +1,133 @@
+// Fuzzes FixXMLInParallel() against FixXML(): random statements with tags
+// left open, stray closing tags and <STMTTRN>s in odd places are fixed both
+// ways, split into 2 to 8 pieces, and have to come out the same, down to
+// the error message when they can't be fixed.
+
+#include "OFXConversion.h"
+#include "TestCheck.h"
+
+#include <random>
+
+namespace {
+
+const char* const CONTAINERS[] = { "STMTTRN", "STMTTRN", "STMTTRN",
+    "PAYEE", "BANKACCTTO", "CURRENCY" };
+const char* const FIELDS[] = { "TRNTYPE", "DTPOSTED", "TRNAMT", "FITID",
+    "NAME", "MEMO", "SIC", "ADDR1" };
+
+template <size_t N>
+const char* Pick(std::mt19937& random, const char* const (&names)[N]) {
+    return names[random() % N];
+}
+
+// Some white space between tokens, like the line ends banks use
+void AppendSpace(std::mt19937& random, std::string& xml) {
+    const char* const SPACES[] = { "", "", "\r\n", "\n", " ", "\r\n  " };
+    xml += Pick(random, SPACES);
+}
+
+// A container with fields and more containers in it. Fields are left open
+// the SGML way about half the time, and now and then a container is too, or
+// something is closed that was never opened.
+void AppendContainer(std::mt19937& random, int depth, std::string& xml) {
+    const std::string name = Pick(random, CONTAINERS);
+    xml += "<" + name + ">";
+    AppendSpace(random, xml);
+    const unsigned children = random() % 8;
+    for (unsigned i = 0; i < children; ++i) {
+        const unsigned what = random() % 200;
+        if (what < 20 && depth < 3) {
+            AppendContainer(random, depth + 1, xml);
+        }
+        else if (what == 20) {
+            xml += std::string("</") + Pick(random, FIELDS) + ">";
+        }
+        else if (what < 30) {
+            xml += random() % 2 ? "<EMPTY/>" : "<!-- NOTE -->";
+        }
+        else {
+            const std::string field = Pick(random, FIELDS);
+            xml += "<" + field + ">" + std::to_string(random() % 1000);
+            if (random() % 2) {
+                xml += "</" + field + ">";
+            }
+        }
+        AppendSpace(random, xml);
+    }
+    if (random() % 16 != 0) {
+        xml += "</" + name + ">";
+    }
+    AppendSpace(random, xml);
+}
+
+// A statement that FixXML() can mostly fix, and sometimes can't
+std::string RandomStatement(std::mt19937& random) {
+    std::string xml = "<OFX><BANKMSGSRSV1><STMTRS><BANKTRANLIST>";
+    AppendSpace(random, xml);
+    const unsigned transactions = random() % 40;
+    for (unsigned i = 0; i < transactions; ++i) {
+        AppendContainer(random, 0, xml);
+    }
+    if (random() % 4 != 0) {
+        xml += "</BANKTRANLIST>";
+    }
+    xml += "<LEDGERBAL><BALAMT>" + std::to_string(random() % 1000);
+    if (random() % 2) {
+        xml += "</BALAMT>";
+    }
+    xml += "</LEDGERBAL></STMTRS></BANKMSGSRSV1></OFX>";
+    return xml;
+}
+
+void TestRandomStatements() {
+    unsigned compared = 0;
+    unsigned differed = 0;
+    unsigned unfixable = 0;
+    for (uint32_t seed = 1; seed <= 2000; ++seed) {
+        std::mt19937 random(seed);
+        const std::string input = RandomStatement(random);
+        const std::string expected = FixXML(input);
+        unfixable += expected.compare(0, 5, "<OFX>") != 0;
+        for (size_t pieces = 2; pieces <= 8; ++pieces) {
+            ++compared;
+            if (FixXMLInParallel(input, pieces) != expected) {
+                if (differed++ == 0) {
+                    printf("Seed %u in %zu pieces differs. Input:\n%s\n",
+                        seed, pieces, input.c_str());
+                }
+            }
+        }
+    }
+    printf("%u fixes compared (%u inputs could not be fixed), %u differed\n",
+        compared, unfixable, differed);
+    Check(differed == 0,
+        "FixXMLInParallel() fixes random statements like FixXML()");
+    Check(unfixable > 0 && unfixable < 2000,
+        "some random statements can be fixed and some can't");
+}
+
+// Splits that land inside a tag or value, or after the last <STMTTRN>
+void TestOddSplits() {
+    const std::string inputs[] = {
+        "<OFX><STMTTRN><NAME>A<STMTTRN><NAME>B</STMTTRN></OFX>",
+        "<OFX><STMTTRN></STMTTRN><STMTTRN><MEMO>X</STMTTRN></OFX>",
+        "<OFX></NAME><STMTTRN><STMTTRN></OFX>",
+        "<STMTTRN><STMTTRN><STMTTRN><STMTTRN><STMTTRN>",
+        "no tags at all",
+        "",
+    };
+    for (const std::string& input : inputs) {
+        for (size_t pieces = 2; pieces <= 8; ++pieces) {
+            Check(FixXMLInParallel(input, pieces) == FixXML(input),
+                "FixXMLInParallel() splits odd inputs like FixXML()");
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    TestRandomStatements();
+    TestOddSplits();
+    return TestResult();
+}
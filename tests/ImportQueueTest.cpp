@@ -0,0 +1,226 @@
+// Tests for the ImportQueue with a stub launcher instead of mnyimprt.exe, so
+// they run anywhere (see tests/CMakeLists.txt).
+
+#include "ImportQueue.h"
+#include "TestCheck.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <set>
+
+namespace {
+
+// Pretends to be the import handler. Each import takes runMilliseconds, and
+// any import that would take longer than the queue's timeout times out, the
+// way ShellImportLauncher stops a handler that hangs.
+class StubLauncher : public ImportLauncher {
+public:
+    explicit StubLauncher(unsigned long runMilliseconds)
+        : runMilliseconds(runMilliseconds), nextFile(0), runs(0),
+          strayRuns(0) {
+    }
+
+    bool WriteTempFile(const std::string& ofx, std::wstring& path,
+        std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ofx == "unwritable") {
+            error = "Unable to write the Temporary File.";
+            return false;
+        }
+        path = L"ofx" + std::to_wstring(nextFile++) + L".tmp";
+        files.insert(path);
+        return true;
+    }
+
+    ImportStatus Run(const std::wstring& handler, const std::wstring& file,
+        unsigned long timeout, const std::atomic<bool>& cancelled,
+        std::string& detail) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++runs;
+            // The handler must get the temp file that was just written
+            if (files.count(file) == 0) {
+                ++strayRuns;
+            }
+        }
+        if (handler == L"missing.exe") {
+            detail = "Could not locate the MS Money Import Handler";
+            return IMPORT_HANDLER_NOT_FOUND;
+        }
+        unsigned long waited = 0;
+        while (waited < runMilliseconds) {
+            if (cancelled) {
+                return IMPORT_CANCELLED;
+            }
+            if (waited >= timeout) {
+                detail = "The MS Money Import Handler did not finish";
+                return IMPORT_TIMED_OUT;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            ++waited;
+        }
+        return IMPORT_DONE;
+    }
+
+    bool DeleteTempFile(const std::wstring& path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return files.erase(path) == 1;
+    }
+
+    size_t FilesLeft() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return files.size();
+    }
+    size_t Runs() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return runs;
+    }
+    size_t StrayRuns() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return strayRuns;
+    }
+
+private:
+    const unsigned long runMilliseconds;
+    std::mutex mutex;
+    std::set<std::wstring> files;
+    unsigned nextFile;
+    size_t runs;
+    size_t strayRuns;  // Runs with a file that isn't a temp file
+};
+
+// Counts the finished callbacks and lets the test wait for them
+class FinishedImports {
+public:
+    FinishedImports() : count(0) {}
+
+    std::function<void(unsigned)> Callback() {
+        return [this](unsigned id) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ids.push_back(id);
+            ++count;
+            changed.notify_all();
+        };
+    }
+    bool WaitFor(size_t wanted) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return changed.wait_for(lock, std::chrono::seconds(30),
+            [this, wanted]() { return count >= wanted; });
+    }
+    std::vector<unsigned> Ids() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ids;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<unsigned> ids;
+    size_t count;
+};
+
+// Lots of quick imports: every one runs, in order, each temp file is
+// deleted and only the last IMPORT_HISTORY are remembered
+void TestThroughput() {
+    const unsigned IMPORTS = 2000;
+    StubLauncher launcher(0);
+    FinishedImports finished;
+    std::chrono::steady_clock::time_point started =
+        std::chrono::steady_clock::now();
+    {
+        ImportQueue queue(launcher, IMPORT_TIMEOUT_MILLISECONDS,
+            finished.Callback());
+        for (unsigned i = 0; i < IMPORTS; ++i) {
+            Check(queue.Enqueue(L"mnyimprt.exe", "<OFX></OFX>") == i + 1,
+                "ids count up from 1");
+        }
+        Check(finished.WaitFor(IMPORTS), "every import finishes");
+        Check(queue.Pending() == 0, "nothing pending after the last import");
+        for (const ImportJob& job : queue.Jobs()) {
+            Check(job.status == IMPORT_DONE, "each import is done");
+            Check(!job.tempFileLeft, "each temp file is deleted");
+        }
+        // Finished imports are forgotten when the next one is queued
+        queue.Enqueue(L"mnyimprt.exe", "<OFX></OFX>");
+        Check(queue.Jobs().size() <= IMPORT_HISTORY + 1,
+            "only the recent imports are remembered");
+        Check(finished.WaitFor(IMPORTS + 1), "the last import finishes");
+    }
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - started).count();
+    printf("Throughput: %u imports in %.3f s (%.0f imports/s)\n", IMPORTS,
+        seconds, IMPORTS / std::max(seconds, 1e-9));
+
+    std::vector<unsigned> ids = finished.Ids();
+    bool inOrder = ids.size() == IMPORTS + 1;
+    for (size_t i = 0; inOrder && i < ids.size(); ++i) {
+        inOrder = ids[i] == i + 1;
+    }
+    Check(inOrder, "imports finish in the order they were queued");
+    Check(launcher.Runs() == IMPORTS + 1, "the handler runs once per import");
+    Check(launcher.StrayRuns() == 0, "the handler runs on each temp file");
+    Check(launcher.FilesLeft() == 0, "no temp files are left");
+}
+
+// A handler that hangs times out, its temp file is deleted, and the imports
+// behind it still run. Errors before and from the handler are reported.
+void TestTimeout() {
+    StubLauncher launcher(500);
+    FinishedImports finished;
+    ImportQueue queue(launcher, 20, finished.Callback());
+    unsigned hung = queue.Enqueue(L"mnyimprt.exe", "<OFX></OFX>");
+    unsigned unwritable = queue.Enqueue(L"mnyimprt.exe", "unwritable");
+    unsigned missing = queue.Enqueue(L"missing.exe", "<OFX></OFX>");
+    Check(finished.WaitFor(3), "imports after a timeout still run");
+
+    ImportJob job;
+    Check(queue.Find(hung, job) && job.status == IMPORT_TIMED_OUT &&
+        !job.detail.empty(), "a hung handler times out");
+    Check(!job.tempFileLeft, "the timed out import's temp file is deleted");
+    Check(queue.Find(unwritable, job) && job.status == IMPORT_FAILED &&
+        job.detail == "Unable to write the Temporary File.",
+        "a temp file that can't be written fails the import");
+    Check(queue.Find(missing, job) && job.status == IMPORT_HANDLER_NOT_FOUND,
+        "a missing handler is reported");
+    Check(launcher.Runs() == 2, "the handler doesn't run without a file");
+    Check(launcher.StrayRuns() == 0, "the handler runs on each temp file");
+    Check(launcher.FilesLeft() == 0, "no temp files are left");
+}
+
+// Shutting down stops waiting for the running import and cancels the rest.
+// The running import's temp file stays, since the handler may still need it.
+void TestShutdown() {
+    StubLauncher launcher(60 * 1000);
+    FinishedImports finished;
+    ImportQueue queue(launcher, IMPORT_TIMEOUT_MILLISECONDS,
+        finished.Callback());
+    unsigned running = queue.Enqueue(L"mnyimprt.exe", "<OFX></OFX>");
+    unsigned waiting = queue.Enqueue(L"mnyimprt.exe", "<OFX></OFX>");
+    while (launcher.Runs() == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::chrono::steady_clock::time_point started =
+        std::chrono::steady_clock::now();
+    queue.Shutdown();
+    Check(std::chrono::steady_clock::now() - started <
+        std::chrono::seconds(10), "shutting down doesn't wait for the handler");
+
+    ImportJob job;
+    Check(queue.Find(running, job) && job.status == IMPORT_CANCELLED &&
+        job.tempFileLeft, "the running import is cancelled");
+    Check(queue.Find(waiting, job) && job.status == IMPORT_CANCELLED,
+        "the waiting import is cancelled");
+    Check(queue.Enqueue(L"mnyimprt.exe", "<OFX></OFX>") == 0,
+        "nothing is queued after shutting down");
+    Check(launcher.Runs() == 1, "the waiting import never runs");
+}
+
+}  // namespace
+
+int main() {
+    TestThroughput();
+    TestTimeout();
+    TestShutdown();
+    return TestResult();
+}
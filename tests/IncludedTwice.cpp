@@ -0,0 +1,6 @@
+// Linked into every conversion test, so each one has two files that include
+// the headers. If something in them isn't inline, the link fails with
+// "multiple definition" here instead of in the program.
+
+#include "OFXConversion.h"
+#include "TestCheck.h"
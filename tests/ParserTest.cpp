@@ -0,0 +1,202 @@
+// Table tests for the amount, date and time zone parsers, and for writing
+// them back in the canonical form Money accepts.
+
+#include "OFXConversion.h"
+#include "TestCheck.h"
+
+namespace {
+
+// What each amount parses to, if it should parse
+const struct {
+    const char* text;
+    bool parses;
+    long long minorUnits;
+} AMOUNTS[] = {
+    { "-1.00", true, -100 },
+    { "+12", true, 1200 },
+    { "3,5", true, 350 },
+    { "0.5", true, 50 },
+    { ".5", true, 50 },
+    { "5.", true, 500 },
+    { "-0", true, 0 },
+    { "1.230", true, 123 },
+    { "1.2300000", true, 123 },
+    // Up to 16 whole digits, which can't overflow
+    { "9999999999999999", true, 999999999999999900LL },
+    { "-9999999999999999.99", true, -999999999999999999LL },
+    { "10000000000000000", false, 0 },
+    { "99999999999999999999999", false, 0 },
+    // Signs and decimal marks on their own
+    { "", false, 0 },
+    { "-", false, 0 },
+    { "+", false, 0 },
+    { ".", false, 0 },
+    { ",", false, 0 },
+    { "-.", false, 0 },
+    { "+,", false, 0 },
+    { "--1", false, 0 },
+    { "+-1", false, 0 },
+    // More than 2 decimals that aren't zero can't be held exactly
+    { "1.234", false, 0 },
+    { "1.2301", false, 0 },
+    { "0.001", false, 0 },
+    // Anything else after the number
+    { "1.2.3", false, 0 },
+    { "1,234.56", false, 0 },
+    { " 1", false, 0 },
+    { "1 ", false, 0 },
+    { "1e5", false, 0 },
+};
+
+void TestAmounts() {
+    for (const auto& row : AMOUNTS) {
+        long long minorUnits = -1;
+        const bool parses = ParseOFXAmount(row.text, minorUnits);
+        if (parses != row.parses || (parses &&
+            minorUnits != row.minorUnits)) {
+            printf("ParseOFXAmount(\"%s\") is %s, %lld\n", row.text,
+                parses ? "true" : "false", minorUnits);
+            Check(false, "amounts parse as in the table");
+        }
+    }
+    const struct {
+        long long minorUnits;
+        const char* text;
+    } FORMATTED[] = {
+        { 0, "0.00" }, { 5, "0.05" }, { -5, "-0.05" }, { -100, "-1.00" },
+        { 123456, "1234.56" },
+        { LLONG_MIN, "-92233720368547758.08" },
+        { LLONG_MAX, "92233720368547758.07" },
+    };
+    for (const auto& row : FORMATTED) {
+        if (FormatOFXAmount(row.minorUnits) != row.text) {
+            printf("FormatOFXAmount(%lld) is %s\n", row.minorUnits,
+                FormatOFXAmount(row.minorUnits).c_str());
+            Check(false, "amounts are written as in the table");
+        }
+    }
+}
+
+// 2019-01-01 12:00:00 GMT
+const long long NOON = 1546344000;
+
+// What each date parses to, in seconds since 1970 GMT, if it should parse
+const struct {
+    const char* text;
+    bool parses;
+    long long epochSeconds;
+} DATES[] = {
+    { "19700101", true, 0 },
+    { "19691231", true, -86400 },
+    { "20190101120000", true, NOON },
+    { "201901011200", true, NOON },
+    { "20190101120000.000[0:GMT]", true, NOON },
+    { "20190101120000.5", true, NOON },
+    { "20190101120000.123456", true, NOON },
+    // Feb 29 only in leap years
+    { "20200229", true, 1582934400 },
+    { "20000229", true, 951782400 },
+    { "20190229", false, 0 },
+    { "19000229", false, 0 },
+    { "20190230", false, 0 },
+    // Other days and months that don't exist
+    { "20190431", false, 0 },
+    { "20190132", false, 0 },
+    { "20190100", false, 0 },
+    { "20191301", false, 0 },
+    { "20190001", false, 0 },
+    // A leap second is let through, and lands on the next second
+    { "20161231235960", true, 1483228800 },
+    { "20161231235961", false, 0 },
+    { "20190101240000", false, 0 },
+    { "20190101126000", false, 0 },
+    // Time zones: hours, hours and minutes, hours and tenths
+    { "20190101120000.000[-5:EST]", true, NOON + 5 * 3600 },
+    { "20190101120000[+5.30:IST]", true, NOON - 5 * 3600 - 30 * 60 },
+    { "20190101120000[-3.5]", true, NOON + 3 * 3600 + 30 * 60 },
+    { "20190101120000[5.3]", true, NOON - 5 * 3600 - 18 * 60 },
+    { "20190101120000[+14]", true, NOON - 14 * 3600 },
+    { "20190101120000[-14:X]", true, NOON + 14 * 3600 },
+    { "20190101120000[+15:X]", false, 0 },
+    { "20190101120000[-99]", false, 0 },
+    { "20190101120000[5.60]", false, 0 },
+    { "20190101120000[5.300]", false, 0 },
+    { "20190101120000[5.]", false, 0 },
+    { "20190101120000[:GMT]", false, 0 },
+    { "20190101120000[0:GMT", false, 0 },
+    { "20190101120000[0:GMT]x", false, 0 },
+    { "20190101120000 [0:GMT]", false, 0 },
+    // Milliseconds only come after the seconds, and have digits, or it
+    // could be a date with something else after it
+    { "20190101.000", false, 0 },
+    { "201901011200.000", false, 0 },
+    { "20190101120000.", false, 0 },
+    { "20190101120000.[0:GMT]", false, 0 },
+    // Other lengths
+    { "", false, 0 },
+    { "2019", false, 0 },
+    { "2019010112", false, 0 },
+    { "2019010112000", false, 0 },
+    { "201901011200000", false, 0 },
+    { "2019-01-01", false, 0 },
+};
+
+void TestDates() {
+    for (const auto& row : DATES) {
+        long long epochSeconds = -1;
+        const bool parses = ParseOFXDateTime(row.text, epochSeconds);
+        if (parses != row.parses || (parses &&
+            epochSeconds != row.epochSeconds)) {
+            printf("ParseOFXDateTime(\"%s\") is %s, %lld\n", row.text,
+                parses ? "true" : "false", epochSeconds);
+            Check(false, "dates parse as in the table");
+        }
+    }
+}
+
+// Parsing and writing back keeps the time zone, so the date is the same
+// day in Money, even when it is a different day in GMT
+void TestRoundTrips() {
+    const struct {
+        const char* text;
+        const char* canonical;
+    } ROUND_TRIPS[] = {
+        { "20190101", "20190101000000.000[0:GMT]" },
+        { "19691231", "19691231000000.000[0:GMT]" },
+        { "20200229", "20200229000000.000[0:GMT]" },
+        { "201901011200", "20190101120000.000[0:GMT]" },
+        { "20190101120000.999", "20190101120000.000[0:GMT]" },
+        { "20190101[-5:EST]", "20190101000000.000[-5:EST]" },
+        { "20191231220000[-5:EST]", "20191231220000.000[-5:EST]" },
+        { "20190101013000.000[+5.30:IST]",
+            "20190101013000.000[+5.30:IST]" },
+        { "20190101000000[-3.5]", "20190101000000.000[-3.5]" },
+        { "20200229235959[+14]", "20200229235959.000[+14]" },
+    };
+    for (const auto& row : ROUND_TRIPS) {
+        const std::string text = row.text;
+        long long epochSeconds = 0;
+        size_t zoneStart = 0;
+        std::string written;
+        if (ParseOFXDateTime(text, epochSeconds, &zoneStart)) {
+            written = FormatOFXDateTime(epochSeconds,
+                text.substr(zoneStart));
+        }
+        if (written != row.canonical) {
+            printf("\"%s\" is written back as \"%s\"\n", row.text,
+                written.c_str());
+            Check(false, "dates are written back in their own time zone");
+        }
+    }
+    Check(FormatOFXDateTime(0, "[0:GMT") == "",
+        "a time zone that doesn't parse isn't written");
+}
+
+}  // namespace
+
+int main() {
+    TestAmounts();
+    TestDates();
+    TestRoundTrips();
+    return TestResult();
+}
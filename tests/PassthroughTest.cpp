@@ -0,0 +1,129 @@
+// Converts a made-up file, then converts what came out again. The second
+// time it is already as Money wants it, so it should be copied as it is
+// (PassThroughReadyOFX()) and reported like the first time. Then it spoils
+// the converted file in each way PassthroughVerifier has to say no to, and
+// checks that those go the usual way and still convert.
+
+#include "OFXConversion.h"
+#include "TestCheck.h"
+
+namespace {
+
+const char* const PASSED_THROUGH = "The input needed no changes";
+
+struct Converted {
+    bool converted;
+    std::string output;
+    std::string report;
+};
+
+Converted Convert(const std::string& input) {
+    ConversionContext context((ConversionOptions()));
+    Converted result;
+    result.converted = ConvertQFXToOFX(input, context, result.output);
+    result.report = context.diagnostics.report;
+    return result;
+}
+
+// The statements, their transaction counts and their balance checks from a
+// report, without the timings: "BANKMSGSRSV1 account 000111222: 301" and
+// the "Balance check for ..." lines
+std::string Statements(const std::string& report) {
+    std::string statements;
+    size_t lineStart = 0;
+    while (lineStart < report.length()) {
+        size_t lineEnd = report.find("\r\n", lineStart);
+        if (lineEnd == std::string::npos) {
+            lineEnd = report.length();
+        }
+        const std::string line = report.substr(lineStart,
+            lineEnd - lineStart);
+        lineStart = lineEnd + 2;
+        const size_t transactions = line.find(" transactions");
+        if (line.find(" account ") != std::string::npos &&
+            line.find("Balance check") != 0 &&
+            transactions != std::string::npos) {
+            statements += line.substr(0, transactions) + "\n";
+        }
+        else if (line.find("Balance check") == 0) {
+            statements += line + "\n";
+        }
+    }
+    return statements;
+}
+
+// Replace the first from in text with to
+std::string ReplaceFirst(std::string text, const std::string& from,
+    const std::string& to) {
+    const size_t found = text.find(from);
+    if (found == std::string::npos) {
+        printf("The converted file has no \"%s\"\n", from.c_str());
+        return text;
+    }
+    return text.replace(found, from.length(), to);
+}
+
+void TestConvertingAgain(const Converted& first) {
+    const Converted again = Convert(first.output);
+    Check(again.converted, "the converted file converts again");
+    Check(again.report.find(PASSED_THROUGH) != std::string::npos,
+        "the converted file is passed through");
+    Check(again.output == first.output,
+        "passing it through doesn't change it");
+    Check(!Statements(first.report).empty() &&
+        Statements(again.report) == Statements(first.report),
+        "passing it through reports the same statements and balances");
+}
+
+void TestSaysNo(const Converted& first) {
+    // The first transaction's FITID is 0 and the second's is 1 (see
+    // MakeSyntheticQFX())
+    const std::string& ready = first.output;
+    const size_t name = ready.find("<NAME>") + strlen("<NAME>");
+    const struct {
+        const char* what;
+        std::string input;
+    } SPOILED[] = {
+        { "an entity in <NAME>",
+            ready.substr(0, name) + "&#65;" + ready.substr(name) },
+        { "a repeated FITID",
+            ReplaceFirst(ready, "<FITID>1</FITID>", "<FITID>0</FITID>") },
+        { "a field out of order",
+            ReplaceFirst(ReplaceFirst(ready, "<FITID>0</FITID>", ""),
+                "<STMTTRN>", "<STMTTRN><FITID>0</FITID>") },
+        { "mixed content",
+            ReplaceFirst(ready, "</STMTTRN>", "MORE</STMTTRN>") },
+        { "a comment",
+            ReplaceFirst(ready, "<STMTTRN>", "<STMTTRN><!-- A NOTE -->") },
+        { "a value with spaces around it",
+            ready.substr(0, name) + " " + ready.substr(name,
+                ready.find("</NAME>") - name) + " " +
+            ready.substr(ready.find("</NAME>")) },
+    };
+    for (const auto& spoiled : SPOILED) {
+        const Converted converted = Convert(spoiled.input);
+        // None of them change a statement's transactions or amounts
+        const bool ok = converted.converted &&
+            converted.report.find(PASSED_THROUGH) == std::string::npos &&
+            converted.report.find(" statements pruned in ") !=
+            std::string::npos &&
+            Statements(converted.report) == Statements(first.report);
+        if (!ok) {
+            printf("With %s:\n%s\n", spoiled.what, converted.report.c_str());
+        }
+        Check(ok,
+            "a file the passthrough says no to is converted the usual way");
+    }
+}
+
+}  // namespace
+
+int main() {
+    const Converted first = Convert(MakeSyntheticQFX(64 * 1024));
+    Check(first.converted, "the made-up file converts");
+    Check(first.report.find(PASSED_THROUGH) == std::string::npos,
+        "the made-up file isn't passed through");
+    TestConvertingAgain(first);
+    TestSaysNo(first);
+    return TestResult();
+}
@@ -0,0 +1,156 @@
+// Prunes <STMTTRN>s with TinyXML-2, the way ConvertQFXToOFX() does, and with
+// OFXDocument, the way the bounded-memory converter does, and checks that
+// they print the same for every combination of the options that change
+// pruning. Both go through PruneOneSTMTTRN(), but the two DOMs keep text,
+// decode entities and print differently, which is what this would catch.
+// Build it against the real TinyXML-2 (see tests/CMakeLists.txt).
+
+#include "OFXConversion.h"
+#include "TestCheck.h"
+
+namespace {
+
+// Where the bounded-memory converter prints a <STMTTRN>:
+// <OFX><BANKMSGSRSV1><STMTTRNRS><STMTRS><BANKTRANLIST>
+const int DEPTH = 5;
+
+std::string PruneWithTinyXML(const std::string& block,
+    const ConversionOptions& options) {
+    const std::string wrapped = "<BANKTRANLIST>" + block + "</BANKTRANLIST>";
+    tinyxml2::XMLDocument doc;
+    doc.Parse(wrapped.c_str(), wrapped.length());
+    tinyxml2::XMLElement* banktranlist = doc.FirstChildElement();
+    if (doc.ErrorID() != 0 || !banktranlist) {
+        return "TinyXML-2 could not parse it";
+    }
+    PruneSTMTTRN(banktranlist, options);
+    tinyxml2::XMLPrinter printer(NULL, false, DEPTH);
+    banktranlist->FirstChildElement("STMTTRN")->Accept(&printer);
+    return printer.CStr();
+}
+
+std::string PruneWithOFXDocument(const std::string& block,
+    const ConversionOptions& options) {
+    OFXDocument doc;
+    if (!doc.Parse(block)) {
+        return "OFXDocument could not parse it";
+    }
+    uint32_t stmttrn = doc.FirstChild(OFXDocument::DOCUMENT);
+    ChooseBlockPruner(options)(doc, stmttrn, options);
+    std::string printed;
+    doc.Print(stmttrn, DEPTH, printed);
+    return printed;
+}
+
+// Every <STMTTRN> of a synthetic file, before pruning: FixXML() closes the
+// tags like the converters do, from <OFX> on.
+std::vector<std::string> SyntheticBlocks() {
+    const std::string qfx = MakeSyntheticQFX(64 * 1024);
+    const std::string fixed = FixXML(qfx.substr(qfx.find("<OFX>")));
+    std::vector<std::string> blocks;
+    const std::string END = "</STMTTRN>";
+    for (size_t start = fixed.find("<STMTTRN>"); start != std::string::npos;
+        start = fixed.find("<STMTTRN>", start + 1)) {
+        size_t end = fixed.find(END, start);
+        if (end == std::string::npos) {
+            break;
+        }
+        blocks.push_back(fixed.substr(start, end + END.length() - start));
+    }
+    return blocks;
+}
+
+// The special cases of pruning, one <STMTTRN> each
+std::vector<std::string> HandMadeBlocks() {
+    const std::string START = "<STMTTRN><TRNTYPE>DEBIT</TRNTYPE>"
+        "<DTPOSTED>20190105</DTPOSTED><TRNAMT>-1.5</TRNAMT>"
+        "<FITID>1</FITID>";
+    const std::string END = "</STMTTRN>";
+    return {
+        // <NAME> and <PAYEE> both, and only <PAYEE>
+        START + "<NAME>SHOP</NAME><PAYEE><NAME>SHOP</NAME>"
+            "<CITY>X</CITY></PAYEE>" + END,
+        START + "<PAYEE><NAME>SHOP</NAME><CITY>X</CITY></PAYEE>" + END,
+        // <CCACCTTO> and <BANKACCTTO> both, and only <BANKACCTTO>
+        START + "<CCACCTTO><ACCTID>8</ACCTID></CCACCTTO>"
+            "<BANKACCTTO><ACCTID>9</ACCTID></BANKACCTTO>" + END,
+        START + "<BANKACCTTO><ACCTID>9</ACCTID></BANKACCTTO>" + END,
+        // Out of order, extra and repeated fields
+        "<STMTTRN><MEMO>M</MEMO><FITID>2</FITID><SIC>5411</SIC>"
+            "<TRNAMT>+10.00</TRNAMT><CURRENCY><CURRATE>1</CURRATE>"
+            "</CURRENCY><DTPOSTED>20190105120000[-5:EST]</DTPOSTED>"
+            "<TRNTYPE>CREDIT</TRNTYPE><NAME>A</NAME><NAME>B</NAME>" + END,
+        // Empty fields are dropped
+        START + "<NAME></NAME><MEMO></MEMO><CHECKNUM></CHECKNUM>" + END,
+        // <MEMO> the same as <NAME>, with entities, and nearly the same
+        START + "<NAME>A &amp; B</NAME><MEMO>A &amp; B</MEMO>" + END,
+        START + "<NAME>A &amp; B</NAME><MEMO>A &amp; B </MEMO>" + END,
+        START + "<NAME>&lt;HOME&gt;</NAME><MEMO>&lt;HOME&gt;</MEMO>" + END,
+        // Spaces and new lines TinyXML-2 keeps (it turns "\r\n" into
+        // "\n"), character references and entities it doesn't know
+        START + "<NAME>  SHOP </NAME><MEMO>LINE 1\r\nLINE 2\rEND</MEMO>" +
+            END,
+        START + "<NAME>CAF&#233; &#x41;&#X42;</NAME><MEMO>&nbsp;&#;&#xZZ;"
+            "&quot;&apos;</MEMO>" + END,
+        // Text straight under <STMTTRN>
+        "<STMTTRN>junk<TRNTYPE>DEBIT</TRNTYPE>more<DTPOSTED>20190105"
+            "</DTPOSTED><TRNAMT>1</TRNAMT><FITID>3</FITID>end" + END,
+        // Amounts and dates to normalize, and ones that can't be
+        START + "<DTUSER>20190104</DTUSER><NAME>X</NAME>" + END,
+        "<STMTTRN><TRNTYPE>DEBIT</TRNTYPE><DTPOSTED>2019-01-05</DTPOSTED>"
+            "<DTUSER>20190104000000.000[+1:CET]</DTUSER>"
+            "<TRNAMT>1,234.5</TRNAMT><FITID>4</FITID>" + END,
+        // Things for the payee rules to clean up
+        START + "<NAME>POS PURCHASE AMAZON.COM*2K4</NAME>"
+            "<MEMO>POS PURCHASE AMAZON.COM*2K4</MEMO>" + END,
+        START + "<NAME>SHELL OIL 5744</NAME><MEMO>CARD 1234</MEMO>" + END,
+        // No fields at all
+        "<STMTTRN>" + END,
+    };
+}
+
+void TestSamePruning() {
+    std::shared_ptr<PayeeRules> rules = std::make_shared<PayeeRules>();
+    std::istringstream in(DEFAULT_PAYEE_RULES);
+    std::string error;
+    Check(rules->Compile(in, error), "the default payee rules compile");
+
+    std::vector<std::string> blocks = SyntheticBlocks();
+    Check(!blocks.empty(), "the synthetic file has transactions");
+    for (const std::string& block : HandMadeBlocks()) {
+        blocks.push_back(block);
+    }
+
+    size_t compared = 0;
+    size_t differed = 0;
+    for (unsigned bits = 0; bits < 8; ++bits) {
+        ConversionOptions options;
+        options.dedupeMemoField = (bits & 1) != 0;
+        options.normalizeAmountsAndDates = (bits & 2) != 0;
+        if (bits & 4) {
+            options.payeeRules = rules;
+        }
+        for (const std::string& block : blocks) {
+            const std::string tinyxml = PruneWithTinyXML(block, options);
+            const std::string ofxDocument = PruneWithOFXDocument(block,
+                options);
+            ++compared;
+            if (tinyxml != ofxDocument) {
+                if (++differed <= 5) {
+                    printf("Options %u, %s\nTinyXML-2:\n%s\nOFXDocument:\n"
+                        "%s\n", bits, block.c_str(), tinyxml.c_str(),
+                        ofxDocument.c_str());
+                }
+            }
+        }
+    }
+    printf("%zu prunings compared, %zu differed\n", compared, differed);
+    Check(differed == 0, "both DOMs prune every <STMTTRN> the same way");
+}
+
+}  // namespace
+
+int main() {
+    TestSamePruning();
+    return TestResult();
+}
@@ -0,0 +1,217 @@
+// Tests for the QIF input: a Quicken export with an opening balance, a
+// check, a split and an investment account is converted, and so is one
+// with its dates day first.
+
+#include "OFXConversion.h"
+#include "TestCheck.h"
+
+#include <sstream>
+
+namespace {
+
+struct Converted {
+    QIFConversionResult result;
+    std::string ofx;
+};
+
+Converted Convert(const std::string& qif) {
+    std::ostringstream out;
+    Converted converted;
+    converted.result = ConvertQIFToOFX(qif.data(), qif.length(), out);
+    converted.ofx = out.str();
+    return converted;
+}
+
+// The <STMTTRN>s of some OFX
+std::vector<std::string> Transactions(const std::string& ofx) {
+    std::vector<std::string> transactions;
+    const std::string END = "</STMTTRN>";
+    for (size_t start = ofx.find("<STMTTRN>"); start != std::string::npos;
+        start = ofx.find("<STMTTRN>", start + 1)) {
+        size_t end = ofx.find(END, start);
+        transactions.push_back(ofx.substr(start,
+            end + END.length() - start));
+    }
+    return transactions;
+}
+
+// The value of the first <name> in xml, or "none"
+std::string Field(const std::string& xml, const std::string& name) {
+    size_t start = xml.find("<" + name + ">");
+    if (start == std::string::npos) {
+        return "none";
+    }
+    start += name.length() + 2;
+    return xml.substr(start, xml.find("</" + name + ">", start) - start);
+}
+
+// The output is what Money would take
+bool IsValid(const std::string& ofx) {
+    MoneyValidator validator;
+    validator.Feed(ofx);
+    validator.Finish();
+    return validator.DiagnosticCount() == 0;
+}
+
+// Quicken's dates: month first, with ' before years from 2000 on
+const std::string EXPORT = "!Account\r\n"
+    "NChecking 1\r\n"
+    "TBank\r\n"
+    "^\r\n"
+    "!Type:Bank\r\n"
+    "D1/ 1'20\r\n"
+    "T500.00\r\n"
+    "POpening Balance\r\n"
+    "L[Checking 1]\r\n"
+    "^\r\n"
+    "D1/ 2'20\r\n"
+    "T-50.00\r\n"
+    "N101\r\n"
+    "PGROCER\r\n"
+    "^\r\n"
+    "D1/ 3'20\r\n"
+    "T-100.00\r\n"
+    "PSPLIT SHOP\r\n"
+    "MMonthly\r\n"
+    "SFood\r\n"
+    "EStuff\r\n"
+    "$-60.00\r\n"
+    "SHome\r\n"
+    "$-40.00\r\n"
+    "^\r\n"
+    "D1/13'20\r\n"
+    "T1,000.00\r\n"
+    "NDEP\r\n"
+    "PPAY\r\n"
+    "^\r\n"
+    "D1/14'20\r\n"
+    "PNO AMOUNT\r\n"
+    "^\r\n"
+    "!Type:Invst\r\n"
+    "D1/ 5'20\r\n"
+    "NBuy\r\n"
+    "YACME\r\n"
+    "I10.00\r\n"
+    "Q3\r\n"
+    "T30.00\r\n"
+    "^\r\n"
+    "!Type:CCard\r\n"
+    "D1/ 4'20\r\n"
+    "PCARD SHOP\r\n"
+    "SFood\r\n"
+    "$-15.00\r\n"
+    "S\r\n"
+    "$-5.00\r\n"
+    "^\r\n";
+
+void TestExport() {
+    const Converted converted = Convert(EXPORT);
+    const QIFConversionResult& result = converted.result;
+    const std::vector<std::string> transactions =
+        Transactions(converted.ofx);
+    Check(result.success && IsValid(converted.ofx),
+        "a QIF export converts to OFX Money takes");
+    Check(result.accountCount == 2 && result.transactionCount == 4 &&
+        transactions.size() == 4 && result.synthesizedIds == 4,
+        "the bank and credit card accounts are converted");
+    Check(result.investmentSections == 1 &&
+        converted.ofx.find("ACME") == std::string::npos &&
+        converted.ofx.find("INVSTMTMSGSRSV1") == std::string::npos,
+        "the investment account is skipped");
+    Check(result.skippedRecords == 1 && result.firstSkippedLine == 31,
+        "a record without an amount is skipped, and counted");
+    Check(!result.dayFirst && result.decimalSeparator == '.',
+        "the dates are read month first");
+    if (transactions.size() != 4) {
+        return;
+    }
+
+    // The opening balance isn't a transaction, but the balance starts there
+    Check(converted.ofx.find("Opening Balance") == std::string::npos &&
+        Field(converted.ofx, "ACCTID") == "Checking 1" &&
+        Field(converted.ofx, "BALAMT") == "1350.00",
+        "the opening balance is where the ledger balance starts");
+    Check(Field(transactions[0], "DTPOSTED") == "20200102120000.000[0:GMT]" &&
+        Field(transactions[0], "TRNTYPE") == "CHECK" &&
+        Field(transactions[0], "CHECKNUM") == "101" &&
+        Field(transactions[0], "TRNAMT") == "-50.00",
+        "a numbered record is a check");
+    Check(Field(transactions[1], "TRNAMT") == "-100.00" &&
+        Field(transactions[1], "MEMO") ==
+        "Monthly Split: Food -60.00 (Stuff), Home -40.00",
+        "a split stays one transaction, with the splits in the memo");
+    Check(Field(transactions[2], "DTPOSTED") == "20200113120000.000[0:GMT]" &&
+        Field(transactions[2], "TRNTYPE") == "DEP" &&
+        Field(transactions[2], "TRNAMT") == "1000.00",
+        "N can give the transaction type instead of a check number");
+
+    // The credit card comes after the bank, in its own message set, and
+    // without an opening balance its balance isn't known
+    const std::string creditCard = converted.ofx.substr(
+        converted.ofx.find("<CREDITCARDMSGSRSV1>"));
+    Check(converted.ofx.find("</BANKMSGSRSV1>") <
+        converted.ofx.find("<CREDITCARDMSGSRSV1>") &&
+        Field(creditCard, "ACCTID") == "QIF" &&
+        Field(creditCard, "BALAMT") == "0.00" &&
+        result.accountsWithoutBalance == 1,
+        "the credit card is its own statement");
+    Check(Field(transactions[3], "TRNAMT") == "-20.00" &&
+        Field(transactions[3], "MEMO") == "Split: Food -15.00, -5.00",
+        "a split without a total adds up the splits");
+}
+
+// With a day past 12 in the first part, the dates must be day first, and
+// so are the ones that could be either
+void TestDayFirst() {
+    const Converted converted = Convert("!Type:Bank\n"
+        "D2/1/2020\nT-1,50\nPFIRST\n^\n"
+        "D13/1/2020\nT2,00\nPSECOND\n^\n");
+    const std::vector<std::string> transactions =
+        Transactions(converted.ofx);
+    Check(converted.result.success && converted.result.dayFirst &&
+        converted.result.decimalSeparator == ',' &&
+        transactions.size() == 2,
+        "day first dates and decimal commas are recognized");
+    if (transactions.size() == 2) {
+        Check(Field(transactions[0], "DTPOSTED") ==
+            "20200102120000.000[0:GMT]" &&
+            Field(transactions[0], "TRNAMT") == "-1.50" &&
+            Field(transactions[1], "DTPOSTED") ==
+            "20200113120000.000[0:GMT]",
+            "day first dates and decimal commas are read as such");
+    }
+}
+
+// N is a check number only if it is all digits, and anything else is looked
+// up as a type, even with bytes past 127 that must not reach isdigit() as
+// negative chars
+void TestOddNumbers() {
+    const Converted converted = Convert("!Type:Bank\n"
+        "D1/2/2020\nT-1.00\nN\xD6\xDF\nPFIRST\n^\n"
+        "D1/3/2020\nT-2.00\nN12a\nPSECOND\n^\n");
+    const std::vector<std::string> transactions =
+        Transactions(converted.ofx);
+    Check(converted.result.success && transactions.size() == 2 &&
+        converted.ofx.find("<CHECKNUM>") == std::string::npos &&
+        Field(transactions[0], "TRNTYPE") == "DEBIT" &&
+        Field(transactions[1], "TRNTYPE") == "DEBIT",
+        "N that isn't all digits is neither a check number nor a type");
+}
+
+void TestNothingToConvert() {
+    Check(!Convert("!Type:Invst\nD1/ 5'20\nNBuy\nT30.00\n^\n")
+        .result.success, "an export of only investments isn't converted");
+    Check(!Convert("not a QIF file\n").result.success &&
+        !Convert("").result.success,
+        "a file without transactions isn't converted");
+}
+
+}  // namespace
+
+int main() {
+    TestExport();
+    TestDayFirst();
+    TestOddNumbers();
+    TestNothingToConvert();
+    return TestResult();
+}
@@ -0,0 +1,29 @@
+// A tiny check for the tests: it prints what failed and the test's main()
+// returns TestResult() as its exit code, so ctest sees the failure.
+
+#ifndef CONVERTTOOFX_TESTCHECK_H
+#define CONVERTTOOFX_TESTCHECK_H
+
+#include <cstdio>
+
+// How many checks failed, shared by every file of the test
+inline int& TestFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+inline void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        ++TestFailures();
+    }
+}
+
+inline int TestResult() {
+    if (TestFailures() == 0) {
+        printf("PASSED\n");
+    }
+    return TestFailures() == 0 ? 0 : 1;
+}
+
+#endif  // CONVERTTOOFX_TESTCHECK_H
@@ -0,0 +1,166 @@
+// Tests for TextDocument: random edits are made to a document and to a
+// std::string side by side, and after every one the document has to agree
+// with the string on everything it can be asked.
+
+#include "TextDocument.h"
+#include "TestCheck.h"
+
+#include <cstdio>
+#include <random>
+
+namespace {
+
+// What the document should say, worked out the slow way from the string.
+// Returns an empty string if it does, or what it got wrong.
+std::string Compare(const TextDocument& document, const std::string& text) {
+    if (document.Length() != text.length()) {
+        return "Length() is " + std::to_string(document.Length()) +
+            " instead of " + std::to_string(text.length());
+    }
+    std::vector<size_t> lineStarts(1, 0);
+    for (size_t i = 0; i < text.length(); ++i) {
+        if (text[i] == '\n') {
+            lineStarts.push_back(i + 1);
+        }
+    }
+    if (document.LineCount() != lineStarts.size()) {
+        return "LineCount() is " + std::to_string(document.LineCount()) +
+            " instead of " + std::to_string(lineStarts.size());
+    }
+    // Lines past the end start at the end
+    for (size_t line = 0; line < lineStarts.size() + 2; ++line) {
+        size_t expected = line < lineStarts.size() ? lineStarts[line] :
+            text.length();
+        if (document.OffsetOfLine(line) != expected) {
+            return "OffsetOfLine(" + std::to_string(line) + ") is " +
+                std::to_string(document.OffsetOfLine(line)) + " instead of " +
+                std::to_string(expected);
+        }
+    }
+    size_t line = 0;
+    for (size_t offset = 0; offset <= text.length(); ++offset) {
+        if (offset > 0 && text[offset - 1] == '\n') {
+            ++line;
+        }
+        if (document.LineOfOffset(offset) != line) {
+            return "LineOfOffset(" + std::to_string(offset) + ") is " +
+                std::to_string(document.LineOfOffset(offset)) +
+                " instead of " + std::to_string(line);
+        }
+        char expected = offset < text.length() ? text[offset] : '\0';
+        if (document.At(offset) != expected) {
+            return "At(" + std::to_string(offset) + ") is wrong";
+        }
+    }
+    std::string pieces;
+    document.ForEachPiece([&pieces](const char* data, size_t length) {
+        pieces.append(data, length);
+    });
+    if (pieces != text) {
+        return "ForEachPiece() doesn't give the text";
+    }
+    // Contents() joins the pieces and loads the result, so ask a copy, or
+    // the document would always be one piece
+    TextDocument copy = document;
+    if (copy.Contents() != text) {
+        return "Contents() doesn't give the text";
+    }
+    return "";
+}
+
+// Some text to insert: mostly letters, with new lines, sometimes several in
+// a row or one on its own
+std::string RandomText(std::mt19937& random, size_t maxLength) {
+    std::string text(random() % (maxLength + 1), 'a');
+    for (char& c : text) {
+        c = random() % 5 == 0 ? '\n' : static_cast<char>('a' + random() % 26);
+    }
+    return text;
+}
+
+void TestRandomEdits(uint32_t seed, const std::string& loaded) {
+    std::mt19937 random(seed);
+    TextDocument document;
+    document.Load(loaded);
+    std::string text = loaded;
+    std::string problem = Compare(document, text);
+
+    for (int step = 0; step < 1000 && problem.empty(); ++step) {
+        // Offsets go a little past the end, which inserts at the end and
+        // erases nothing
+        const size_t offset = random() % (text.length() + 3);
+        const size_t length = random() % 40;
+        const std::string inserted = RandomText(random, 30);
+        std::string what;
+        switch (random() % 4) {
+        case 0:
+        case 1:
+            document.Insert(offset, inserted.data(), inserted.length());
+            text.insert(std::min(offset, text.length()), inserted);
+            what = "Insert";
+            break;
+        case 2:
+            document.Erase(offset, length);
+            if (offset < text.length()) {
+                text.erase(offset, length);
+            }
+            what = "Erase";
+            break;
+        default:
+            if (offset > text.length()) {
+                continue;  // Replace() is only used inside the text
+            }
+            document.Replace(offset, length, inserted);
+            text.replace(offset, length, inserted);
+            what = "Replace";
+            break;
+        }
+        problem = Compare(document, text);
+        if (problem.empty() && random() % 8 == 0) {
+            // Now and then, read a random part of it
+            size_t start = random() % (text.length() + 1);
+            size_t count = random() % (text.length() - start + 1);
+            std::string read;
+            document.Read(start, count, read);
+            if (read != text.substr(start, count)) {
+                problem = "Read(" + std::to_string(start) + ", " +
+                    std::to_string(count) + ") is wrong";
+            }
+        }
+        if (!problem.empty()) {
+            printf("Seed %u, step %d, %s(%zu, ...): %s\n", seed, step,
+                what.c_str(), offset, problem.c_str());
+        }
+    }
+    Check(problem.empty(),
+        "the document agrees with a string after every random edit");
+}
+
+// Loading starts over, and Contents() of an edited document is the text
+void TestLoadAndContents() {
+    TextDocument document;
+    Check(document.Length() == 0 && document.LineCount() == 1,
+        "an empty document has one empty line");
+    document.Load("one\ntwo\n");
+    document.Insert(4, "and a half\n", 11);
+    Check(document.Contents() == "one\nand a half\ntwo\n",
+        "Contents() has the edit");
+    Check(Compare(document, "one\nand a half\ntwo\n").empty(),
+        "the document still works after Contents()");
+    document.Load("new");
+    Check(Compare(document, "new").empty(), "Load() starts over");
+}
+
+}  // namespace
+
+int main() {
+    TestLoadAndContents();
+    TestRandomEdits(1, "");
+    TestRandomEdits(2, "first line\nsecond line\n\nfourth\n");
+    TestRandomEdits(3, std::string(500, '\n'));
+    for (uint32_t seed = 4; seed < 10; ++seed) {
+        std::mt19937 random(seed);
+        TestRandomEdits(seed, RandomText(random, 1000));
+    }
+    return TestResult();
+}
@@ -0,0 +1,161 @@
+// Tests for MoneyValidator: a statement Money would take gets no
+// diagnostics, and each kind of problem gets exactly one, pointing at the
+// right byte and line, whether the file is fed to it at once or a byte at a
+// time (as the bounded-memory converter does).
+
+#include "OFXConversion.h"
+#include "TestCheck.h"
+
+namespace {
+
+const std::string TRANSACTION = "<STMTTRN>\r\n"
+    "<TRNTYPE>DEBIT</TRNTYPE>\r\n"
+    "<DTPOSTED>20190105120000.000[-5:EST]</DTPOSTED>\r\n"
+    "<TRNAMT>-1.50</TRNAMT>\r\n"
+    "<FITID>1</FITID>\r\n"
+    "<NAME>SHOP</NAME>\r\n"
+    "<MEMO>M</MEMO>\r\n"
+    "</STMTTRN>\r\n";
+
+// A converted statement around some <STMTTRN>s
+std::string Statement(const std::string& transactions) {
+    return XML_HEADER + "\r\n" + XML_OFX_HEADER + "\r\n<OFX>\r\n"
+        "<BANKMSGSRSV1>\r\n<STMTTRNRS>\r\n<STMTRS>\r\n<BANKTRANLIST>\r\n" +
+        transactions + "</BANKTRANLIST>\r\n</STMTRS>\r\n</STMTTRNRS>\r\n"
+        "</BANKMSGSRSV1>\r\n</OFX>\r\n";
+}
+
+// Replace the first from in text with to
+std::string ReplaceFirst(std::string text, const std::string& from,
+    const std::string& to) {
+    const size_t found = text.find(from);
+    return found == std::string::npos ? text :
+        text.replace(found, from.length(), to);
+}
+
+std::vector<ValidationDiagnostic> Validate(const std::string& ofx,
+    bool byteAtATime) {
+    MoneyValidator validator;
+    if (byteAtATime) {
+        for (char c : ofx) {
+            validator.Feed(&c, 1);
+        }
+    }
+    else {
+        validator.Feed(ofx);
+    }
+    validator.Finish();
+    return validator.Diagnostics();
+}
+
+void TestValidStatement() {
+    const std::string ofx = Statement(TRANSACTION +
+        ReplaceFirst(TRANSACTION, "<FITID>1", "<FITID>2"));
+    Check(Validate(ofx, false).empty() && Validate(ofx, true).empty(),
+        "a statement Money would take has no diagnostics");
+}
+
+void TestProblems() {
+    // Each case has one problem, reported at the first at in the file
+    const struct {
+        const char* what;
+        std::string ofx;
+        const char* at;
+        const char* message;
+    } CASES[] = {
+        { "a missing </NAME>",
+            Statement(ReplaceFirst(TRANSACTION, "SHOP</NAME>", "SHOP")),
+            "</STMTTRN>", "</STMTTRN> does not match <NAME>." },
+        { "a stray </MEMO>",
+            Statement(ReplaceFirst(TRANSACTION, "</NAME>",
+                "</NAME></MEMO>")),
+            "</MEMO>", "</MEMO> does not match <STMTTRN>." },
+        { "a close tag outside everything",
+            Statement(TRANSACTION) + "</STRAY>\r\n", "</STRAY>",
+            "</STRAY> does not match any opening tag." },
+        { "an unclosed statement",
+            Statement(TRANSACTION).substr(0, Statement(TRANSACTION).find(
+                "</BANKTRANLIST>")), NULL, "<BANKTRANLIST> is never closed." },
+        { "a repeated FITID",
+            Statement(TRANSACTION + TRANSACTION), "<FITID>1</FITID>\r\n"
+            "<NAME>SHOP</NAME>\r\n<MEMO>M</MEMO>\r\n</STMTTRN>\r\n</BANKT",
+            "<FITID> 1 is used by more than one transaction. Money will "
+            "skip duplicates." },
+        { "a field out of order",
+            Statement(ReplaceFirst(ReplaceFirst(TRANSACTION,
+                "<MEMO>M</MEMO>\r\n", ""), "<NAME>", "<MEMO>M</MEMO>\r\n"
+                "<NAME>")),
+            "<NAME>", "<NAME> is out of order. It must come before <MEMO>." },
+        { "a missing <TRNAMT>",
+            Statement(ReplaceFirst(TRANSACTION, "<TRNAMT>-1.50</TRNAMT>\r\n",
+                "")),
+            "<STMTTRN>", "<STMTTRN> is missing <TRNAMT>." },
+        { "a repeated field",
+            Statement(ReplaceFirst(TRANSACTION, "<MEMO>",
+                "<NAME>SHOP</NAME><MEMO>")),
+            "<NAME>SHOP</NAME><MEMO>",
+            "<NAME> appears more than once in <STMTTRN>." },
+        { "a field Money doesn't want",
+            Statement(ReplaceFirst(TRANSACTION, "<MEMO>",
+                "<SIC>5411</SIC><MEMO>")),
+            "<SIC>", "<SIC> is not allowed in <STMTTRN>." },
+        { "an amount that isn't one",
+            Statement(ReplaceFirst(TRANSACTION, "-1.50", "-1.5.0")),
+            "<TRNAMT>", "<TRNAMT> is not a valid amount: -1.5.0" },
+        { "a date that isn't one",
+            Statement(ReplaceFirst(TRANSACTION, "20190105", "20190229")),
+            "<DTPOSTED>",
+            "<DTPOSTED> is not a valid date: 20190229120000.000[-5:EST]" },
+        { "both <NAME> and <PAYEE>",
+            Statement(ReplaceFirst(TRANSACTION, "<MEMO>",
+                "<PAYEE><NAME>SHOP</NAME></PAYEE><MEMO>")),
+            "<STMTTRN>", "<STMTTRN> has both <NAME> and <PAYEE>." },
+    };
+    for (const auto& problem : CASES) {
+        // NULL means at the end
+        const size_t offset = problem.at ? problem.ofx.find(problem.at) :
+            problem.ofx.length();
+        const unsigned long long line = 1 + std::count(problem.ofx.begin(),
+            problem.ofx.begin() + offset, '\n');
+        for (bool byteAtATime : { false, true }) {
+            const std::vector<ValidationDiagnostic> diagnostics =
+                Validate(problem.ofx, byteAtATime);
+            const bool ok = diagnostics.size() == 1 &&
+                diagnostics[0].offset == offset &&
+                diagnostics[0].line == line &&
+                diagnostics[0].message == problem.message;
+            if (!ok) {
+                printf("With %s, expected line %llu (byte %zu): %s\n"
+                    "but got:\n%s", problem.what, line, offset,
+                    problem.message, FormatValidationDiagnostics(diagnostics,
+                        diagnostics.size(), diagnostics.size()).c_str());
+            }
+            Check(ok, "each problem gets one diagnostic in the right place");
+        }
+    }
+}
+
+// Past MAX_DIAGNOSTICS, problems are counted but not kept
+void TestManyProblems() {
+    std::string transactions;
+    for (int i = 0; i < 1500; ++i) {
+        transactions += ReplaceFirst(TRANSACTION, "<MEMO>",
+            "<SIC>5411</SIC><MEMO>");
+    }
+    MoneyValidator validator;
+    validator.Feed(Statement(transactions));
+    validator.Finish();
+    // Each transaction also repeats FITID 1, apart from the first
+    Check(validator.DiagnosticCount() == 2999 &&
+        validator.Diagnostics().size() == MoneyValidator::MAX_DIAGNOSTICS,
+        "diagnostics past the limit are only counted");
+}
+
+}  // namespace
+
+int main() {
+    TestValidStatement();
+    TestProblems();
+    TestManyProblems();
+    return TestResult();
+}